@@ -0,0 +1,85 @@
+#include "arena.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+bool arena_init(Arena* a, size_t cap) {
+  *a = (Arena){};
+  a->data = malloc(cap);
+  if (!a->data) {
+    perror("malloc");
+    return false;
+  }
+  a->cap = cap;
+  return true;
+}
+
+void arena_free(Arena* a) {
+  free(a->data);
+  *a = (Arena){};
+}
+
+void* arena_alloc(Arena* a, size_t size, size_t align) {
+  assert(align && (align & (align - 1)) == 0);
+  size_t off = (a->used + align - 1) & ~(align - 1);
+  if (off > a->cap || size > a->cap - off) {
+    return nullptr;
+  }
+  a->used = off + size;
+  if (a->used > a->high_water) {
+    a->high_water = a->used;
+  }
+  return a->data + off;
+}
+
+struct PoolSlab {
+  PoolSlab* next;
+  max_align_t blocks[];
+};
+
+void pool_init(Pool* p, size_t block_size, int blocks_per_slab) {
+  assert(blocks_per_slab > 0);
+  // blocks hold the free list link while free and stay max aligned inside the slab
+  size_t align = sizeof(max_align_t);
+  if (block_size < sizeof(void*)) {
+    block_size = sizeof(void*);
+  }
+  *p = (Pool){.block_size = (block_size + align - 1) & ~(align - 1),
+              .blocks_per_slab = blocks_per_slab};
+}
+
+void pool_free(Pool* p) {
+  PoolSlab* slab = p->slabs;
+  while (slab) {
+    PoolSlab* next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  p->slabs = nullptr;
+  p->free_list = nullptr;
+}
+
+void* pool_alloc(Pool* p) {
+  if (!p->free_list) {
+    PoolSlab* slab = malloc(sizeof(PoolSlab) + p->block_size * p->blocks_per_slab);
+    if (!slab) {
+      perror("malloc");
+      return nullptr;
+    }
+    slab->next = p->slabs;
+    p->slabs = slab;
+    uint8_t* blocks = (uint8_t*)slab->blocks;
+    for (int i = p->blocks_per_slab - 1; i >= 0; i--) {
+      pool_release(p, blocks + p->block_size * i);
+    }
+  }
+  void* block = p->free_list;
+  p->free_list = *(void**)block;
+  return block;
+}
+
+void pool_release(Pool* p, void* block) {
+  *(void**)block = p->free_list;
+  p->free_list = block;
+}
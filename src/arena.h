@@ -0,0 +1,43 @@
+#ifndef PONG_GAME_ARENA_H
+#define PONG_GAME_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Linear allocator for memory that lives for one tick or frame. It never grows: the backing block
+// is allocated once, an exhausted arena returns nullptr and the caller drops whatever it was
+// about to build. Everything is released at once by arena_reset.
+typedef struct Arena {
+  uint8_t* data;
+  size_t cap;
+  size_t used;
+  size_t high_water;  // most bytes ever in use, for sizing cap
+} Arena;
+
+bool arena_init(Arena* a, size_t cap);
+void arena_free(Arena* a);
+
+/** @return size bytes aligned to align (a power of two), or nullptr if the arena is full */
+void* arena_alloc(Arena* a, size_t size, size_t align);
+
+static inline void arena_reset(Arena* a) { a->used = 0; }
+
+// Fixed-size blocks threaded on a free list. Slabs are only allocated when more blocks are live
+// than ever before, so steady state churn never reaches malloc.
+typedef struct PoolSlab PoolSlab;
+
+typedef struct Pool {
+  size_t block_size;
+  int blocks_per_slab;
+  void* free_list;
+  PoolSlab* slabs;
+} Pool;
+
+void pool_init(Pool* p, size_t block_size, int blocks_per_slab);
+void pool_free(Pool* p);
+
+/** @return an uninitialized block, nullptr if out of memory */
+void* pool_alloc(Pool* p);
+void pool_release(Pool* p, void* block);
+
+#endif  // PONG_GAME_ARENA_H
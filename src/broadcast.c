@@ -0,0 +1,173 @@
+#include "broadcast.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+SpectatorFeed* spectator_feed_new(uint32_t match) {
+  SpectatorFeed* f = calloc(1, sizeof(SpectatorFeed));
+  if (!f) {
+    return nullptr;
+  }
+  f->match = match;
+  atomic_init(&f->refs, 1);
+  return f;
+}
+
+void spectator_feed_retain(SpectatorFeed* f) {
+  atomic_fetch_add_explicit(&f->refs, 1, memory_order_relaxed);
+}
+
+void spectator_feed_release(SpectatorFeed* f) {
+  if (atomic_fetch_sub_explicit(&f->refs, 1, memory_order_acq_rel) == 1) {
+    free(f);
+  }
+}
+
+void spectator_feed_publish(SpectatorFeed* f, const Snapshot* snap) {
+  uint32_t gap = snap->tick - f->last.tick;
+  FeedFrame fr = {.snap = *snap,
+                  .base_tick = f->last.tick,
+                  .has_base = f->has_last && gap > 0 && gap <= SNAPSHOT_MAX_GAP};
+  size_t len = snapshot_encode(snap, fr.has_base ? &f->last : nullptr, PONG_TICK_HZ,
+                               fr.data + MSG_HDR_SIZE);
+  msg_hdr_write(fr.data, MSG_SNAPSHOT, (uint32_t)len);
+  fr.len = (uint16_t)(MSG_HDR_SIZE + len);
+  f->last = *snap;
+  f->has_last = true;
+
+  uint64_t words[FEED_FRAME_WORDS] = {};
+  memcpy(words, &fr, sizeof(fr));
+  uint32_t n = atomic_load_explicit(&f->published, memory_order_relaxed);
+  FeedSlot* slot = &f->slots[n % FEED_SLOTS];
+  atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for (size_t i = 0; i < FEED_FRAME_WORDS; i++) {
+    atomic_store_explicit(&slot->words[i], words[i], memory_order_relaxed);
+  }
+  atomic_store_explicit(&slot->seq, n + 1, memory_order_release);
+  atomic_store_explicit(&f->published, n + 1, memory_order_release);
+}
+
+void spectator_feed_end(SpectatorFeed* f) {
+  atomic_store_explicit(&f->ended, true, memory_order_release);
+}
+
+int spectator_feed_read(const SpectatorFeed* f, uint32_t n, FeedFrame* out) {
+  uint32_t published = atomic_load_explicit(&f->published, memory_order_acquire);
+  if ((int32_t)(published - n) <= 0) {
+    return 0;
+  }
+  if (published - n > FEED_SLOTS) {
+    return -1;
+  }
+  const FeedSlot* slot = &f->slots[n % FEED_SLOTS];
+  if (atomic_load_explicit(&slot->seq, memory_order_acquire) != n + 1) {
+    return -1;
+  }
+  uint64_t words[FEED_FRAME_WORDS];
+  for (size_t i = 0; i < FEED_FRAME_WORDS; i++) {
+    words[i] = atomic_load_explicit(&slot->words[i], memory_order_relaxed);
+  }
+  // the copy is only good if the writer didn't start on the slot while it was made
+  atomic_thread_fence(memory_order_acquire);
+  if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != n + 1) {
+    return -1;
+  }
+  memcpy(out, words, sizeof(*out));
+  return 1;
+}
+
+BroadcastFrame* broadcast_frame_new(Pool* frames) {
+  BroadcastFrame* fr = pool_alloc(frames);
+  if (fr) {
+    fr->refs = 1;
+    fr->len = 0;
+  }
+  return fr;
+}
+
+void broadcast_frame_release(Pool* frames, BroadcastFrame* fr) {
+  if (--fr->refs == 0) {
+    pool_release(frames, fr);
+  }
+}
+
+ViewerOffer viewer_offer(Viewer* v, BroadcastFrame* shared, const FeedFrame* f,
+                         const SnapshotHistory* history, Pool* frames) {
+  if (v->count == VIEWER_QUEUE) {
+    return VIEWER_MISSED;
+  }
+  BroadcastFrame* fr;
+  ViewerOffer rc;
+  if (!f->has_base || (v->has_tick && v->tick == f->base_tick)) {
+    fr = shared;
+    fr->refs++;
+    rc = VIEWER_QUEUED;
+  } else {
+    fr = broadcast_frame_new(frames);
+    if (!fr) {
+      return VIEWER_MISSED;
+    }
+    const Snapshot* base = v->has_tick ? snapshot_history_get(history, v->tick) : nullptr;
+    size_t len = snapshot_encode(&f->snap, base, PONG_TICK_HZ, fr->data + MSG_HDR_SIZE);
+    msg_hdr_write(fr->data, MSG_SNAPSHOT, (uint32_t)len);
+    fr->len = (uint16_t)(MSG_HDR_SIZE + len);
+    rc = VIEWER_RESYNCED;
+  }
+  v->queue[(v->head + v->count++) % VIEWER_QUEUE] = fr;
+  v->has_tick = true;
+  v->tick = f->snap.tick;
+  return rc;
+}
+
+int viewer_iov(const Viewer* v, struct iovec* iov) {
+  for (int i = 0; i < v->count; i++) {
+    BroadcastFrame* fr = v->queue[(v->head + i) % VIEWER_QUEUE];
+    size_t off = i == 0 ? v->sent : 0;
+    iov[i] = (struct iovec){fr->data + off, fr->len - off};
+  }
+  return v->count;
+}
+
+void viewer_sent(Viewer* v, size_t n, Pool* frames) {
+  while (n > 0) {
+    BroadcastFrame* fr = v->queue[v->head];
+    size_t rest = fr->len - v->sent;
+    if (n < rest) {
+      v->sent += n;
+      break;
+    }
+    n -= rest;
+    broadcast_frame_release(frames, fr);
+    v->head = (v->head + 1) % VIEWER_QUEUE;
+    v->count--;
+    v->sent = 0;
+  }
+}
+
+ssize_t viewer_flush(Viewer* v, int fd, Pool* frames) {
+  if (v->count == 0) {
+    return 0;
+  }
+  struct iovec iov[VIEWER_QUEUE];
+  int count = viewer_iov(v, iov);
+  ssize_t n;
+  do {
+    n = writev(fd, iov, count);
+  } while (n == -1 && errno == EINTR);
+  if (n == -1) {
+    return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+  }
+  viewer_sent(v, (size_t)n, frames);
+  return n;
+}
+
+void viewer_clear(Viewer* v, Pool* frames) {
+  for (; v->count > 0; v->count--) {
+    broadcast_frame_release(frames, v->queue[v->head]);
+    v->head = (v->head + 1) % VIEWER_QUEUE;
+  }
+  v->sent = 0;
+}
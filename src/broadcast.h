@@ -0,0 +1,130 @@
+#ifndef PONG_GAME_BROADCAST_H
+#define PONG_GAME_BROADCAST_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "networking.h"
+#include "snapshot.h"
+
+// Spectator fan-out. Whoever ticks a match publishes each of its snapshots into the match's feed
+// once, framed and delta-encoded against the previously published one. Every worker with viewers
+// of the match copies a published frame once into a refcounted BroadcastFrame of its own and
+// queues a reference on each of its viewers, which are then written with one writev apiece.
+// Nothing is encoded or copied per viewer, except for one that fell behind: a viewer whose queue
+// is full misses frames, and the next frame it gets is encoded for it alone against the last
+// snapshot it was sent. A slow viewer never holds up the match or the other viewers.
+
+#define FEED_SLOTS 16   // frames a reader may fall behind the feed before it has to resync
+#define VIEWER_QUEUE 8  // frames waiting for a viewer's socket before it misses some
+#define BROADCAST_FRAME_MAX (MSG_HDR_SIZE + SNAPSHOT_MAX_ENCODED)
+
+// One published snapshot.
+typedef struct FeedFrame {
+  Snapshot snap;
+  uint32_t base_tick;  // data is a delta against the snapshot of this tick if has_base
+  bool has_base;
+  uint16_t len;
+  uint8_t data[BROADCAST_FRAME_MAX];  // framed MSG_SNAPSHOT
+} FeedFrame;
+
+#define FEED_FRAME_WORDS ((sizeof(FeedFrame) + 7) / 8)
+
+// Seqlock, seq is 0 while the slot is written and the frame's number + 1 once it is published.
+// The frame is stored as atomic words, so a reader racing the writer reads garbage it then
+// throws away instead of racing on plain memory.
+typedef struct FeedSlot {
+  _Atomic uint32_t seq;
+  _Atomic uint64_t words[FEED_FRAME_WORDS];
+} FeedSlot;
+
+// Single writer, the thread ticking the match, any number of reading workers. The match holds a
+// reference and so does every worker with viewers of it, the last one out frees it.
+typedef struct SpectatorFeed {
+  uint32_t match;
+  atomic_int refs;
+  atomic_int viewers;          // across all workers, nothing is published without any
+  atomic_bool ended;           // set after the last frame is published
+  _Atomic uint32_t published;  // frames ever published, frame n is in slots[n % FEED_SLOTS]
+  FeedSlot slots[FEED_SLOTS];
+  Snapshot last;  // writer only, baseline of the next frame
+  bool has_last;
+  struct SpectatorFeed* prev;  // whoever looks feeds up by match links them, under its own lock
+  struct SpectatorFeed* next;
+} SpectatorFeed;
+
+/** @return a feed with one reference, nullptr if out of memory */
+SpectatorFeed* spectator_feed_new(uint32_t match);
+void spectator_feed_retain(SpectatorFeed* f);
+void spectator_feed_release(SpectatorFeed* f);
+
+void spectator_feed_publish(SpectatorFeed* f, const Snapshot* snap);
+
+/** Marks the feed ended, readers see it once they have read every published frame. */
+void spectator_feed_end(SpectatorFeed* f);
+
+/**
+ * Copies frame n out of the feed.
+ * @return 1 if read, 0 if it isn't published yet, -1 if it was overwritten by a newer one
+ */
+int spectator_feed_read(const SpectatorFeed* f, uint32_t n, FeedFrame* out);
+
+// A frame queued on viewers of one worker, only ever touched by that worker's thread.
+typedef struct BroadcastFrame {
+  int refs;
+  uint16_t len;
+  uint8_t data[BROADCAST_FRAME_MAX];
+} BroadcastFrame;
+
+/**
+ * frames is a pool of BroadcastFrame.
+ * @return a frame with one reference, nullptr if out of memory
+ */
+BroadcastFrame* broadcast_frame_new(Pool* frames);
+void broadcast_frame_release(Pool* frames, BroadcastFrame* fr);
+
+typedef struct Viewer {
+  BroadcastFrame* queue[VIEWER_QUEUE];
+  int head;
+  int count;
+  size_t sent;  // bytes of queue[head] already written
+  bool has_tick;
+  uint32_t tick;  // newest snapshot queued, the client's baseline once the queue drains
+  int watch;      // where the owner keeps track of the viewer
+  int slot;
+} Viewer;
+
+typedef enum ViewerOffer {
+  VIEWER_QUEUED,    // the shared frame
+  VIEWER_RESYNCED,  // a frame encoded for this viewer alone, which just joined or fell behind
+  VIEWER_MISSED,    // the queue is full, or no frame could be allocated
+} ViewerOffer;
+
+/**
+ * Queues a reference to shared, the frame published as f, if v can decode it, otherwise a frame
+ * delta-encoded for v against the snapshot in history it was last sent, or in full if that isn't
+ * there anymore.
+ */
+ViewerOffer viewer_offer(Viewer* v, BroadcastFrame* shared, const FeedFrame* f,
+                         const SnapshotHistory* history, Pool* frames);
+
+struct iovec;
+
+/** @return entries of iov, at most VIEWER_QUEUE, covering the queued bytes in order */
+int viewer_iov(const Viewer* v, struct iovec* iov);
+
+/** Drops n written bytes from the front of the queue, releasing the frames fully written. */
+void viewer_sent(Viewer* v, size_t n, Pool* frames);
+
+/**
+ * Writes the queued frames with a single writev and releases the ones fully written.
+ * @return bytes written, -1 if the connection failed
+ */
+ssize_t viewer_flush(Viewer* v, int fd, Pool* frames);
+
+/** Releases everything still queued. */
+void viewer_clear(Viewer* v, Pool* frames);
+
+#endif  // PONG_GAME_BROADCAST_H
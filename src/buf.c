@@ -4,9 +4,12 @@
 
 #include "buf.h"
 
+#include <errno.h>
+
 void buf_init(Buf* buf, size_t cap) {
   assert(cap > 0);
   buf->data = malloc(cap);
+  buf->head = 0;
   buf->size = 0;
   buf->cap = cap;
 }
@@ -15,6 +18,9 @@ void buf_reserve(Buf* buf, size_t cap) {
   if (cap < 2048) {
     cap = 2048;
   }
+  if (cap > BUF_MAX_CAP) {
+    cap = BUF_MAX_CAP;
+  }
   if (cap > buf->cap) {
     void* new_data = realloc(buf->data, cap);
     if (new_data == nullptr) {
@@ -25,10 +31,27 @@ void buf_reserve(Buf* buf, size_t cap) {
   }
 }
 
+static void buf_compact(Buf* buf) {
+  if (buf->head == 0) {
+    return;
+  }
+  size_t unread = buf_readable(buf);
+  memmove(buf->data, buf->data + buf->head, unread);
+  buf->head = 0;
+  buf->size = unread;
+}
+
 ssize_t buf_recv(Buf* buf, int fd) {
+  if (buf->cap - buf->size < 2048) {
+    buf_compact(buf);
+  }
   if (buf->cap - buf->size < 2048) {
     buf_reserve(buf, buf->size * 2);
   }
+  if (buf->size == buf->cap) {
+    errno = ENOBUFS;
+    return -1;
+  }
   ssize_t n = recv(fd, buf->data + buf->size, buf->cap - buf->size, 0);
   if (n > 0) {
     buf->size += n;
@@ -36,18 +59,35 @@ ssize_t buf_recv(Buf* buf, int fd) {
   return n;
 }
 
+bool buf_append(Buf* buf, const void* data, size_t len) {
+  if (buf->cap - buf->size < len) {
+    buf_compact(buf);
+  }
+  if (buf->cap - buf->size < len) {
+    buf_reserve(buf, (buf->size + len) * 2);
+  }
+  if (buf->cap - buf->size < len) {
+    return false;
+  }
+  memcpy(buf->data + buf->size, data, len);
+  buf->size += len;
+  return true;
+}
+
 void buf_consume(Buf* buf, size_t size) {
   assert(buf->data);
-  if (size >= buf->size) {
+  if (size >= buf_readable(buf)) {
+    buf->head = 0;
     buf->size = 0;
     return;
   }
-  memmove(buf->data, buf->data + size, buf->size - size);
-  buf->size -= size;
+  buf->head += size;
 }
 
 void buf_free(Buf* buf) {
   free(buf->data);
+  buf->data = nullptr;
   buf->cap = 0;
+  buf->head = 0;
   buf->size = 0;
 }
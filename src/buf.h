@@ -12,18 +12,31 @@
 #include <string.h>
 #include <sys/socket.h>
 
+// A Buf never grows past this, reads into a full one fail with ENOBUFS.
+#define BUF_MAX_CAP (64 * 1024)
+
+// Bytes in [head, size) are unread. Consuming only advances head, unread bytes are moved to the
+// front at most once per refill instead of once per frame.
 typedef struct Buf {
   uint8_t* data;
+  size_t head;
   size_t size;
   size_t cap;
 } Buf;
 
+static inline uint8_t* buf_read_ptr(const Buf* buf) { return buf->data + buf->head; }
+static inline size_t buf_readable(const Buf* buf) { return buf->size - buf->head; }
+
 void buf_init(Buf* buf, size_t cap);
 
 void buf_reserve(Buf* buf, size_t cap);
 
+/** recv into the free space, at least 2 KiB of it unless buf is at BUF_MAX_CAP. */
 ssize_t buf_recv(Buf* buf, int fd);
 
+/** @return false if buf can't grow to fit data */
+bool buf_append(Buf* buf, const void* data, size_t len);
+
 void buf_consume(Buf* buf, size_t size);
 
 void buf_free(Buf* buf);
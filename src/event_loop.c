@@ -0,0 +1,181 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define EV_MAX_EVENTS 256
+// bound the catch-up work a stalled timer can trigger in one wakeup
+#define EV_MAX_TIMER_CATCHUP 8
+
+int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1) {
+    return -1;
+  }
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int ev_loop_init(EventLoop* loop) {
+  *loop = (EventLoop){};
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epoll_fd == -1) {
+    perror("epoll_create1");
+    return -1;
+  }
+  return 0;
+}
+
+void ev_loop_free(EventLoop* loop) {
+  for (int fd = 0; fd < loop->handlers_cap; fd++) {
+    if (loop->handlers[fd].timer_fn) {
+      close(fd);
+    }
+  }
+  if (loop->epoll_fd >= 0) {
+    close(loop->epoll_fd);
+  }
+  free(loop->handlers);
+  *loop = (EventLoop){.epoll_fd = -1};
+}
+
+static EvHandler* ev_handler(EventLoop* loop, int fd) {
+  if (fd >= loop->handlers_cap) {
+    int new_cap = loop->handlers_cap ? loop->handlers_cap : 64;
+    while (new_cap <= fd) {
+      new_cap *= 2;
+    }
+    EvHandler* new_handlers = realloc(loop->handlers, sizeof(EvHandler) * new_cap);
+    if (!new_handlers) {
+      perror("realloc");
+      return nullptr;
+    }
+    memset(new_handlers + loop->handlers_cap, 0,
+           sizeof(EvHandler) * (new_cap - loop->handlers_cap));
+    loop->handlers = new_handlers;
+    loop->handlers_cap = new_cap;
+  }
+  return &loop->handlers[fd];
+}
+
+static uint32_t ev_to_epoll(uint32_t events) {
+  uint32_t e = EPOLLET | EPOLLRDHUP;
+  if (events & EV_READ) e |= EPOLLIN;
+  if (events & EV_WRITE) e |= EPOLLOUT;
+  return e;
+}
+
+int ev_add(EventLoop* loop, int fd, uint32_t events, EvIoFn fn, void* user_data) {
+  EvHandler* h = ev_handler(loop, fd);
+  if (!h) {
+    return -1;
+  }
+  struct epoll_event ev = {.events = ev_to_epoll(events), .data.fd = fd};
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    perror("epoll_ctl add");
+    return -1;
+  }
+  *h = (EvHandler){.fn = fn, .user_data = user_data};
+  return 0;
+}
+
+int ev_mod(EventLoop* loop, int fd, uint32_t events) {
+  struct epoll_event ev = {.events = ev_to_epoll(events), .data.fd = fd};
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+    perror("epoll_ctl mod");
+    return -1;
+  }
+  return 0;
+}
+
+void ev_del(EventLoop* loop, int fd) {
+  if (fd < 0 || fd >= loop->handlers_cap) {
+    return;
+  }
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  loop->handlers[fd] = (EvHandler){};
+}
+
+static void ev_on_timerfd(EventLoop* loop, int fd, [[maybe_unused]] uint32_t events,
+                          void* user_data) {
+  uint64_t expirations = 0;
+  if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+    return;
+  }
+  if (expirations > EV_MAX_TIMER_CATCHUP) {
+    expirations = EV_MAX_TIMER_CATCHUP;
+  }
+  EvTimerFn timer_fn = loop->handlers[fd].timer_fn;
+  for (uint64_t i = 0; i < expirations && loop->handlers[fd].timer_fn == timer_fn; i++) {
+    timer_fn(loop, user_data);
+  }
+}
+
+int ev_timer_add(EventLoop* loop, uint64_t interval_ns, EvTimerFn fn, void* user_data) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd == -1) {
+    perror("timerfd_create");
+    return -1;
+  }
+  struct timespec ts = {.tv_sec = (time_t)(interval_ns / 1000000000ull),
+                        .tv_nsec = (long)(interval_ns % 1000000000ull)};
+  struct itimerspec spec = {.it_interval = ts, .it_value = ts};
+  if (timerfd_settime(fd, 0, &spec, nullptr) == -1 ||
+      ev_add(loop, fd, EV_READ, ev_on_timerfd, user_data) == -1) {
+    perror("timerfd_settime");
+    close(fd);
+    return -1;
+  }
+  loop->handlers[fd].timer_fn = fn;
+  return fd;
+}
+
+void ev_timer_del(EventLoop* loop, int timer_id) {
+  if (timer_id < 0) {
+    return;
+  }
+  ev_del(loop, timer_id);
+  close(timer_id);
+}
+
+int ev_run_once(EventLoop* loop, int timeout_ms) {
+  struct epoll_event events[EV_MAX_EVENTS];
+  int n = epoll_wait(loop->epoll_fd, events, EV_MAX_EVENTS, timeout_ms);
+  if (n < 0) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    perror("epoll_wait");
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    int fd = events[i].data.fd;
+    // a previous callback in this batch may have removed the fd
+    if (fd >= loop->handlers_cap || !loop->handlers[fd].fn) {
+      continue;
+    }
+    uint32_t e = 0;
+    if (events[i].events & EPOLLIN) e |= EV_READ;
+    if (events[i].events & EPOLLOUT) e |= EV_WRITE;
+    if (events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) e |= EV_HUP | EV_READ;
+    EvHandler h = loop->handlers[fd];
+    h.fn(loop, fd, e, h.user_data);
+  }
+  return n;
+}
+
+void ev_run(EventLoop* loop) {
+  loop->running = true;
+  while (loop->running) {
+    if (ev_run_once(loop, -1) < 0) {
+      break;
+    }
+  }
+}
+
+void ev_stop(EventLoop* loop) { loop->running = false; }
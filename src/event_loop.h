@@ -0,0 +1,54 @@
+#ifndef PONG_GAME_EVENT_LOOP_H
+#define PONG_GAME_EVENT_LOOP_H
+
+#include <stdint.h>
+
+// Edge-triggered epoll loop. Callbacks must drain their fd (read/accept until EAGAIN), they will
+// not be notified again for data that was already pending.
+
+enum { EV_READ = 1u << 0, EV_WRITE = 1u << 1, EV_HUP = 1u << 2 };
+
+typedef struct EventLoop EventLoop;
+
+typedef void (*EvIoFn)(EventLoop* loop, int fd, uint32_t events, void* user_data);
+typedef void (*EvTimerFn)(EventLoop* loop, void* user_data);
+
+typedef struct EvHandler {
+  EvIoFn fn;
+  EvTimerFn timer_fn;  // set for timers, fn is then the internal timerfd handler
+  void* user_data;
+} EvHandler;
+
+struct EventLoop {
+  int epoll_fd;
+  bool running;
+  EvHandler* handlers;  // indexed by fd
+  int handlers_cap;
+};
+
+int ev_loop_init(EventLoop* loop);
+void ev_loop_free(EventLoop* loop);
+
+// events is a mask of EV_READ | EV_WRITE, EV_HUP is always reported
+int ev_add(EventLoop* loop, int fd, uint32_t events, EvIoFn fn, void* user_data);
+int ev_mod(EventLoop* loop, int fd, uint32_t events);
+void ev_del(EventLoop* loop, int fd);
+
+/**
+ * Repeating timer, fn runs once per elapsed interval.
+ * @return timer id for ev_timer_del, or -1
+ */
+int ev_timer_add(EventLoop* loop, uint64_t interval_ns, EvTimerFn fn, void* user_data);
+void ev_timer_del(EventLoop* loop, int timer_id);
+
+/**
+ * Waits up to timeout_ms (-1 forever, 0 never blocks) and dispatches ready callbacks.
+ * @return number of events dispatched, -1 on error
+ */
+int ev_run_once(EventLoop* loop, int timeout_ms);
+void ev_run(EventLoop* loop);
+void ev_stop(EventLoop* loop);
+
+int set_nonblocking(int fd);
+
+#endif  // PONG_GAME_EVENT_LOOP_H
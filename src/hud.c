@@ -0,0 +1,113 @@
+#include "hud.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int hud_init(Hud* hud, int width, int height, Camera2D camera) {
+  *hud = (Hud){.camera = camera, .dirty = true};
+  hud->layer = LoadRenderTexture(width, height);
+  if (hud->layer.id == 0) {
+    fprintf(stderr, "hud: could not make a %ix%i render texture\n", width, height);
+    return -1;
+  }
+  return 0;
+}
+
+void hud_free(Hud* hud) {
+  if (hud->layer.id) {
+    UnloadRenderTexture(hud->layer);
+  }
+  *hud = (Hud){};
+}
+
+HudStyle hud_style_default(int size, Color color, bool world) {
+  // DrawText spaces glyphs by size over the default font's base size, in whole units
+  return (HudStyle){.font = GetFontDefault(),
+                    .size = (float)size,
+                    .spacing = (float)(size / 10),
+                    .color = color,
+                    .world = world};
+}
+
+void hud_rect(Hud* hud, Rectangle rect, Color color) {
+  assert(hud->rect_count < HUD_MAX_RECTS);
+  hud->rects[hud->rect_count] = rect;
+  hud->rect_colors[hud->rect_count] = color;
+  hud->rect_count++;
+  hud->dirty = true;
+}
+
+bool hud_stale(Hud* hud, int slot, const void* key, size_t key_len) {
+  assert(slot >= 0 && slot < HUD_MAX_TEXTS && key_len <= HUD_KEY_CAP);
+  HudText* t = &hud->texts[slot];
+  if (t->keyed && t->key_len == key_len && memcmp(t->key, key, key_len) == 0) {
+    return false;
+  }
+  memcpy(t->key, key, key_len);
+  t->key_len = key_len;
+  t->keyed = true;
+  return true;
+}
+
+static bool style_eq(const HudStyle* a, const HudStyle* b) {
+  return a->font.texture.id == b->font.texture.id && a->font.glyphs == b->font.glyphs &&
+         a->size == b->size && a->spacing == b->spacing && a->color.r == b->color.r &&
+         a->color.g == b->color.g && a->color.b == b->color.b && a->color.a == b->color.a &&
+         a->world == b->world;
+}
+
+void hud_set_text(Hud* hud, int slot, const char* text, Vector2 pos, HudStyle style) {
+  assert(slot >= 0 && slot < HUD_MAX_TEXTS);
+  HudText* t = &hud->texts[slot];
+  if (strcmp(t->text, text) == 0 && t->pos.x == pos.x && t->pos.y == pos.y &&
+      style_eq(&t->style, &style)) {
+    return;
+  }
+  snprintf(t->text, sizeof(t->text), "%s", text);
+  t->pos = pos;
+  t->style = style;
+  if (hud->shown & (1u << slot)) {
+    hud->dirty = true;
+  }
+}
+
+void hud_show(Hud* hud, uint32_t slots) {
+  if (slots != hud->shown) {
+    hud->shown = slots;
+    hud->dirty = true;
+  }
+}
+
+static void hud_draw_texts(const Hud* hud, bool world) {
+  for (int i = 0; i < HUD_MAX_TEXTS; i++) {
+    const HudText* t = &hud->texts[i];
+    if ((hud->shown & (1u << i)) && t->style.world == world && t->text[0]) {
+      DrawTextEx(t->style.font, t->text, t->pos, t->style.size, t->style.spacing, t->style.color);
+    }
+  }
+}
+
+static void hud_render(Hud* hud) {
+  BeginTextureMode(hud->layer);
+  ClearBackground(BLANK);
+  for (int i = 0; i < hud->rect_count; i++) {
+    DrawRectangleRec(hud->rects[i], hud->rect_colors[i]);
+  }
+  hud_draw_texts(hud, false);
+  BeginMode2D(hud->camera);
+  hud_draw_texts(hud, true);
+  EndMode2D();
+  EndTextureMode();
+  hud->dirty = false;
+  hud->renders++;
+}
+
+void hud_draw(Hud* hud) {
+  if (hud->dirty) {
+    hud_render(hud);
+  }
+  // render textures are stored bottom up
+  Rectangle src = {0, 0, (float)hud->layer.texture.width, -(float)hud->layer.texture.height};
+  DrawTextureRec(hud->layer.texture, src, (Vector2){0, 0}, WHITE);
+}
@@ -0,0 +1,73 @@
+#ifndef PONG_GAME_HUD_H
+#define PONG_GAME_HUD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pong.h"  // before raylib.h, for Vector2
+#include "raylib.h"
+
+// Text and flat shapes that rarely change, kept rendered in one texture the size of the window and
+// drawn each frame as a single quad. Texts live in numbered slots and are laid out and rasterized
+// only when the layer is re-rendered, which happens on the next hud_draw after a slot's text,
+// position or style changed or a different set of slots was shown. Setting a slot to what it
+// already holds costs a compare.
+
+enum { HUD_MAX_TEXTS = 16, HUD_MAX_RECTS = 8, HUD_TEXT_CAP = 256, HUD_KEY_CAP = 32 };
+
+typedef struct HudStyle {
+  Font font;
+  float size;
+  float spacing;
+  Color color;
+  bool world;  // positioned in world units through the layer's camera, otherwise in pixels
+} HudStyle;
+
+typedef struct HudText {
+  char text[HUD_TEXT_CAP];
+  Vector2 pos;
+  HudStyle style;
+  uint8_t key[HUD_KEY_CAP];  // what the text was last formatted from, see hud_stale
+  size_t key_len;
+  bool keyed;
+} HudText;
+
+typedef struct Hud {
+  RenderTexture2D layer;
+  Camera2D camera;
+  HudText texts[HUD_MAX_TEXTS];
+  Rectangle rects[HUD_MAX_RECTS];  // drawn under the texts, always shown
+  Color rect_colors[HUD_MAX_RECTS];
+  int rect_count;
+  uint32_t shown;  // bit per text slot
+  bool dirty;
+  uint64_t renders;
+} Hud;
+
+/**
+ * Needs the window open. camera places the texts positioned in world units.
+ * @return 0, -1 if the texture can't be made
+ */
+int hud_init(Hud* hud, int width, int height, Camera2D camera);
+void hud_free(Hud* hud);
+
+/** What DrawText draws with, the default font at size pixels or world units. */
+HudStyle hud_style_default(int size, Color color, bool world);
+
+void hud_rect(Hud* hud, Rectangle rect, Color color);
+
+/**
+ * Whether slot was last formatted from something other than key, remembering key. Lets callers
+ * skip formatting a text whose inputs are unchanged.
+ */
+bool hud_stale(Hud* hud, int slot, const void* key, size_t key_len);
+
+void hud_set_text(Hud* hud, int slot, const char* text, Vector2 pos, HudStyle style);
+
+/** slots has bit 1 << slot set for every slot to draw, the rest are hidden. */
+void hud_show(Hud* hud, uint32_t slots);
+
+/** Re-renders the layer if anything in it changed, then draws it over the whole window. */
+void hud_draw(Hud* hud);
+
+#endif  // PONG_GAME_HUD_H
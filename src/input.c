@@ -0,0 +1,108 @@
+#include "input.h"
+
+uint32_t input_ring_push(InputRing* r, int8_t dir) {
+  if (r->next_seq - r->acked_seq >= INPUT_RING_SIZE) {
+    // no acks for a long time, the oldest command can't be replayed anymore
+    r->acked_seq++;
+  }
+  r->dirs[r->next_seq % INPUT_RING_SIZE] = dir;
+  return r->next_seq++;
+}
+
+int input_ring_write(const InputRing* r, uint32_t from_seq, MsgInput* msg) {
+  if ((int32_t)(from_seq - r->acked_seq) < 0) {
+    from_seq = r->acked_seq;
+  }
+  uint32_t end = r->next_seq;
+  if (end - from_seq > MSG_INPUT_MAX_CMDS) {
+    end = from_seq + MSG_INPUT_MAX_CMDS;
+  }
+  msg->first_seq = from_seq;
+  msg->count = (uint8_t)(end - from_seq);
+  for (uint32_t seq = from_seq; seq != end; seq++) {
+    msg->dirs[seq - from_seq] = r->dirs[seq % INPUT_RING_SIZE];
+  }
+  return msg->count;
+}
+
+bool input_ring_reconcile(InputRing* r, const MsgInputAck* ack, PongSim* s, int player) {
+  uint32_t acked = ack->seq + 1;
+  if ((int32_t)(acked - r->acked_seq) < 0 || (int32_t)(acked - r->next_seq) > 0) {
+    return false;
+  }
+  r->acked_seq = acked;
+  PlayerData* p = &s->players[player];
+  float vel = p->paddle_vert_velocity;
+  p->pos = ack->pos;
+  for (uint32_t seq = r->acked_seq; seq != r->next_seq; seq++) {
+    pong_move_paddle(s, player, r->dirs[seq % INPUT_RING_SIZE]);
+  }
+  // velocity reflects the newest local input, not the replay
+  p->paddle_vert_velocity = vel;
+  return true;
+}
+
+void input_queue_on_msg(InputQueue* q, const MsgInput* msg) {
+  int count = msg->count > MSG_INPUT_MAX_CMDS ? MSG_INPUT_MAX_CMDS : msg->count;
+  for (int i = 0; i < count; i++) {
+    uint32_t seq = msg->first_seq + (uint32_t)i;
+    if ((int32_t)(seq - q->next_seq) < 0 || seq - q->next_seq >= INPUT_MAX_AHEAD) {
+      continue;
+    }
+    q->dirs[seq % INPUT_RING_SIZE] = msg->dirs[i] > 0 ? 1 : msg->dirs[i] < 0 ? -1 : 0;
+    if (q->slot_seq[seq % INPUT_RING_SIZE] != seq + 1) {
+      q->slot_seq[seq % INPUT_RING_SIZE] = seq + 1;
+      q->received++;
+    }
+    if ((int32_t)(seq + 1 - q->recv_end) > 0) {
+      q->recv_end = seq + 1;
+    }
+  }
+}
+
+static bool input_queue_pop(InputQueue* q, int8_t* dir) {
+  if (q->next_seq == q->recv_end) {
+    return false;
+  }
+  uint32_t slot = q->next_seq % INPUT_RING_SIZE;
+  if (q->slot_seq[slot] == q->next_seq + 1) {
+    *dir = q->dirs[slot];
+    q->received--;
+  } else {
+    // newer commands arrived without this one, every later message would have repeated it
+    *dir = q->last_dir;
+  }
+  q->slot_seq[slot] = 0;
+  q->last_dir = *dir;
+  q->next_seq++;
+  return true;
+}
+
+int input_queue_take_backlog(InputQueue* q, int8_t* dirs) {
+  if (q->catchup_credit < INPUT_MAX_CATCHUP_BANK * INPUT_CATCHUP_TICKS) {
+    q->catchup_credit++;
+  }
+  int n = 0;
+  while (n < INPUT_MAX_CATCHUP && q->received > INPUT_MAX_BACKLOG &&
+         q->catchup_credit >= INPUT_CATCHUP_TICKS &&
+         q->slot_seq[q->next_seq % INPUT_RING_SIZE] == q->next_seq + 1 &&
+         input_queue_pop(q, &dirs[n])) {
+    q->catchup_credit -= INPUT_CATCHUP_TICKS;
+    n++;
+  }
+  return n;
+}
+
+int8_t input_queue_take(InputQueue* q) {
+  int8_t dir;
+  return input_queue_pop(q, &dir) ? dir : 0;
+}
+
+int8_t input_queue_next_dir(InputQueue* q, PongSim* s, int player) {
+  int8_t backlog[INPUT_MAX_CATCHUP];
+  int n = input_queue_take_backlog(q, backlog);
+  for (int i = 0; i < n; i++) {
+    pong_move_paddle(s, player, backlog[i]);
+  }
+  return input_queue_take(q);
+}
@@ -0,0 +1,89 @@
+#ifndef PONG_GAME_INPUT_H
+#define PONG_GAME_INPUT_H
+
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Paddle input as a stream of per-tick commands. The owning client predicts its paddle from the
+// commands it sends and keeps the unacked ones in an InputRing. The authority applies them in
+// order from an InputQueue and acks the last one together with the resulting paddle position,
+// the client then rebases onto that position and replays whatever is still pending.
+
+#define INPUT_RING_SIZE 256
+// received commands queued beyond this are applied early so a client running ahead of the
+// authority doesn't build up latency. Each early command costs INPUT_CATCHUP_TICKS ticks of credit
+// and a tick earns one, banked up to INPUT_MAX_CATCHUP_BANK early commands, with at most
+// INPUT_MAX_CATCHUP per tick. Sending commands faster than the tick rate therefore buys a paddle
+// at most PONG_TICK_HZ / INPUT_CATCHUP_TICKS extra moves a second, a couple of percent.
+#define INPUT_MAX_BACKLOG 8
+#define INPUT_MAX_CATCHUP 2
+#define INPUT_CATCHUP_TICKS 40
+// commands this far or further past the next one to apply are dropped, a client can't claim more
+// than that many commands are on their way
+#define INPUT_MAX_AHEAD (INPUT_MAX_BACKLOG + MSG_INPUT_MAX_CMDS)
+#define INPUT_MAX_CATCHUP_BANK (INPUT_MAX_AHEAD - INPUT_MAX_BACKLOG)
+
+typedef struct InputRing {
+  int8_t dirs[INPUT_RING_SIZE];
+  uint32_t next_seq;   // seq of the next pushed command
+  uint32_t acked_seq;  // first command the authority hasn't acked
+} InputRing;
+
+typedef struct InputQueue {
+  int8_t dirs[INPUT_RING_SIZE];
+  uint32_t slot_seq[INPUT_RING_SIZE];  // seq + 1 stored in the slot, 0 if empty
+  uint32_t next_seq;                   // next command to apply
+  uint32_t recv_end;                   // one past the newest received command
+  uint32_t received;                   // commands actually received in [next_seq, recv_end)
+  uint32_t catchup_credit;             // in ticks, see INPUT_CATCHUP_TICKS
+  int8_t last_dir;
+} InputQueue;
+
+/** @return seq of the pushed command */
+uint32_t input_ring_push(InputRing* r, int8_t dir);
+
+/**
+ * Fills msg with up to MSG_INPUT_MAX_CMDS commands starting at from_seq, clamped to the unacked
+ * range.
+ * @return number of commands written
+ */
+int input_ring_write(const InputRing* r, uint32_t from_seq, MsgInput* msg);
+
+/**
+ * Rebases player's paddle onto the authoritative position in ack and replays the commands the
+ * authority hasn't seen yet. Stale and duplicate acks are ignored.
+ * @return true if the ack was applied
+ */
+bool input_ring_reconcile(InputRing* r, const MsgInputAck* ack, PongSim* s, int player);
+
+void input_queue_on_msg(InputQueue* q, const MsgInput* msg);
+
+/** @return true if any command was received, acks before that are meaningless */
+static inline bool input_queue_started(const InputQueue* q) { return q->recv_end != 0; }
+
+/** @return seq of the last applied command, only valid once input_queue_started() */
+static inline uint32_t input_queue_ack_seq(const InputQueue* q) { return q->next_seq - 1; }
+
+/**
+ * Called once per tick. Takes up to INPUT_MAX_CATCHUP received commands if more than
+ * INPUT_MAX_BACKLOG are queued and there is credit for them, which the caller applies to the
+ * paddle right away. Gaps left by lost commands don't count and aren't taken early.
+ * @return number of commands written to dirs, which must hold INPUT_MAX_CATCHUP
+ */
+int input_queue_take_backlog(InputQueue* q, int8_t* dirs);
+
+/**
+ * Takes the command for this tick. A command that was lost for good is replaced by the previous
+ * direction, a command that simply hasn't arrived yet leaves the paddle still.
+ * @return paddle direction for this tick
+ */
+int8_t input_queue_take(InputQueue* q);
+
+/**
+ * Applies the backlog to player's paddle directly and takes the command for this tick.
+ * @return paddle direction for this tick
+ */
+int8_t input_queue_next_dir(InputQueue* q, PongSim* s, int player);
+
+#endif  // PONG_GAME_INPUT_H
@@ -0,0 +1,114 @@
+#include "interp.h"
+
+#include <math.h>
+#include <string.h>
+
+static double tick_time(uint32_t tick) { return (double)tick / PONG_TICK_HZ; }
+
+void interp_push(InterpBuffer* b, const PongSim* s, double now) {
+  double sample = now - tick_time(s->tick);
+  if (b->count == 0) {
+    b->offset = sample;
+    b->interval = 1.0 / PONG_TICK_HZ;
+    b->delay = b->interval;
+  } else {
+    const PongSim* newest = &b->states[b->count - 1];
+    if ((int32_t)(s->tick - newest->tick) > 0) {
+      b->interval += (tick_time(s->tick - newest->tick) - b->interval) / 16.0;
+    }
+    // RFC 3550 style running estimates
+    double d = sample - b->offset;
+    b->offset += d / 16.0;
+    b->jitter += (fabs(d) - b->jitter) / 16.0;
+  }
+  // ease into the new target so the render time never jumps
+  double target = fmin(b->interval + 2.0 * b->jitter, INTERP_MAX_DELAY);
+  b->delay += (target - b->delay) / 32.0;
+
+  int i = b->count;
+  while (i > 0 && (int32_t)(b->states[i - 1].tick - s->tick) >= 0) {
+    if (b->states[i - 1].tick == s->tick) {
+      return;
+    }
+    i--;
+  }
+  if (b->count == INTERP_BUFFER_SIZE) {
+    if (i == 0) {
+      return;  // older than everything we keep
+    }
+    memmove(&b->states[0], &b->states[1], sizeof(b->states[0]) * (size_t)(b->count - 1));
+    b->count--;
+    i--;
+  }
+  memmove(&b->states[i + 1], &b->states[i], sizeof(b->states[0]) * (size_t)(b->count - i));
+  b->states[i] = *s;
+  b->count++;
+}
+
+static float lerp(float a, float b, float t) { return a + (b - a) * t; }
+
+static void interp_copy(const PongSim* s, PongSim* out) {
+  out->ball_pos = s->ball_pos;
+  out->ball_velocity = s->ball_velocity;
+  for (int i = 0; i < 2; i++) {
+    out->players[i].pos = s->players[i].pos;
+    out->players[i].paddle_vert_velocity = s->players[i].paddle_vert_velocity;
+  }
+}
+
+bool interp_sample(InterpBuffer* b, double now, PongSim* out) {
+  if (b->count == 0) {
+    return false;
+  }
+  double t = now - b->offset - b->delay;
+  const PongSim* newest = &b->states[b->count - 1];
+  if (t >= tick_time(newest->tick)) {
+    interp_copy(newest, out);
+    float dt = (float)fmin(t - tick_time(newest->tick), INTERP_MAX_EXTRAPOLATE);
+    if (dt > 0.f) {
+      b->extrapolated_frames++;
+    }
+    out->ball_pos.x += newest->ball_velocity.x * dt;
+    out->ball_pos.y += newest->ball_velocity.y * dt;
+    out->ball_pos.y = fmaxf(fminf(out->ball_pos.y, world_dims.y - ball_radius), ball_radius);
+    for (int i = 0; i < 2; i++) {
+      out->players[i].pos += newest->players[i].paddle_vert_velocity * dt;
+    }
+    return true;
+  }
+  // drop states nothing will be drawn from anymore, keeping one before t
+  int first = 0;
+  while (first + 1 < b->count && tick_time(b->states[first + 1].tick) <= t) {
+    first++;
+  }
+  if (first > 0) {
+    memmove(&b->states[0], &b->states[first], sizeof(b->states[0]) * (size_t)(b->count - first));
+    b->count -= first;
+  }
+  const PongSim* from = &b->states[0];
+  if (b->count == 1 || t <= tick_time(from->tick)) {
+    interp_copy(from, out);
+    return true;
+  }
+  const PongSim* to = &b->states[1];
+  float alpha = (float)((t - tick_time(from->tick)) / tick_time(to->tick - from->tick));
+  interp_copy(to, out);
+  // a score resets the ball, blending across that would sweep it over the field
+  if (from->players[0].score == to->players[0].score &&
+      from->players[1].score == to->players[1].score) {
+    out->ball_pos.x = lerp(from->ball_pos.x, to->ball_pos.x, alpha);
+    out->ball_pos.y = lerp(from->ball_pos.y, to->ball_pos.y, alpha);
+  }
+  for (int i = 0; i < 2; i++) {
+    out->players[i].pos = lerp(from->players[i].pos, to->players[i].pos, alpha);
+  }
+  return true;
+}
+
+uint32_t interp_render_tick(const InterpBuffer* b, double now) {
+  if (b->count == 0) {
+    return 0;
+  }
+  double t = now - b->offset - b->delay;
+  return t > 0.0 ? (uint32_t)(t * PONG_TICK_HZ) : 0;
+}
@@ -0,0 +1,40 @@
+#ifndef PONG_GAME_INTERP_H
+#define PONG_GAME_INTERP_H
+
+#include "pong.h"
+
+// Buffer of received authoritative states for entities the client doesn't simulate itself. They
+// are drawn a little in the past, interpolated between the two states around the render time.
+// The delay follows the measured arrival jitter so a late packet rarely leaves the buffer empty,
+// and when it does the newest state is extrapolated along its velocity for a short while.
+
+#define INTERP_BUFFER_SIZE 32
+#define INTERP_MAX_DELAY 0.25
+#define INTERP_MAX_EXTRAPOLATE 0.1
+
+typedef struct InterpBuffer {
+  PongSim states[INTERP_BUFFER_SIZE];  // ordered by tick
+  int count;
+  // all in seconds: local arrival time minus sender tick time, its mean deviation, the spacing
+  // of received states and the current render delay behind the mean arrival
+  double offset;
+  double jitter;
+  double interval;
+  double delay;
+  uint64_t extrapolated_frames;
+} InterpBuffer;
+
+/** Adds an authoritative state received at local time now, s->tick is the sender's tick. */
+void interp_push(InterpBuffer* b, const PongSim* s, double now);
+
+/**
+ * Writes the ball and paddles at the render time for now into out, everything else in out is
+ * left alone.
+ * @return false if the buffer is empty
+ */
+bool interp_sample(InterpBuffer* b, double now, PongSim* out);
+
+/** @return the sender tick drawn at now, 0 while the buffer is empty */
+uint32_t interp_render_tick(const InterpBuffer* b, double now);
+
+#endif  // PONG_GAME_INTERP_H
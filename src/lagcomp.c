@@ -0,0 +1,100 @@
+#include "lagcomp.h"
+
+static LagFrame* lag_frame(LagComp* lc, uint32_t tick) {
+  return &lc->frames[tick & (LAG_HISTORY_SIZE - 1)];
+}
+
+static void lag_record(LagComp* lc, const PongSim* s) {
+  *lag_frame(lc, s->tick) = (LagFrame){.tick = s->tick,
+                                       .ball_pos = s->ball_pos,
+                                       .ball_velocity = s->ball_velocity,
+                                       .collision_count = s->collision_count,
+                                       .paddle_pos = {s->players[0].pos, s->players[1].pos}};
+}
+
+void lag_comp_init(LagComp* lc, const PongSim* s, int max_rewind) {
+  if (max_rewind < 0) {
+    max_rewind = 0;
+  } else if (max_rewind > LAG_MAX_REWIND) {
+    max_rewind = LAG_MAX_REWIND;
+  }
+  *lc = (LagComp){.max_rewind = max_rewind, .miss_player = -1};
+  lag_record(lc, s);
+}
+
+void lag_comp_on_input(LagComp* lc, int player, uint32_t view_tick, uint32_t now) {
+  int32_t behind = (int32_t)(now - view_tick);
+  if (behind < 0) {
+    behind = 0;
+  } else if (behind > lc->max_rewind) {
+    behind = lc->max_rewind;
+  }
+  lc->rewind[player] = (int)behind;
+}
+
+// x of the ball's center when it touches player's paddle face
+static float face_x(int player) {
+  return player == 0 ? paddle_dims.x + ball_radius : world_dims.x - paddle_dims.x - ball_radius;
+}
+
+// A deflection leaves the ball on the face moving away, so heading on past it means a miss.
+static int crossed_face(const LagFrame* prev, const PongSim* s) {
+  if (prev->tick + 1 != s->tick) {
+    return -1;
+  }
+  if (s->ball_velocity.x < 0.f && prev->ball_pos.x >= face_x(0) && s->ball_pos.x < face_x(0)) {
+    return 0;
+  }
+  if (s->ball_velocity.x > 0.f && prev->ball_pos.x <= face_x(1) && s->ball_pos.x > face_x(1)) {
+    return 1;
+  }
+  return -1;
+}
+
+// Replays the tick of the held miss with player's paddle where it is now, which is where they had
+// it when they saw that tick. On a hit the ball is carried forward to now against the recorded
+// opponent paddle and written to s.
+static bool lag_try_save(LagComp* lc, PongSim* s, int player) {
+  const LagFrame* from = lag_frame(lc, lc->miss_tick);
+  PongSim r = *s;
+  r.ball_pos = from->ball_pos;
+  r.ball_velocity = from->ball_velocity;
+  r.collision_count = from->collision_count;
+  uint32_t t = lc->miss_tick + 1;
+  r.players[1 - player].pos = lag_frame(lc, t)->paddle_pos[1 - player];
+  pong_sweep_ball(&r, pong_tick_dt);
+  if (player == 0 ? r.ball_velocity.x <= 0.f : r.ball_velocity.x >= 0.f) {
+    return false;
+  }
+  while ((int32_t)(++t - s->tick) <= 0) {
+    r.players[1 - player].pos = lag_frame(lc, t)->paddle_pos[1 - player];
+    pong_sweep_ball(&r, pong_tick_dt);
+  }
+  s->ball_pos = r.ball_pos;
+  s->ball_velocity = r.ball_velocity;
+  s->collision_count = r.collision_count;
+  return true;
+}
+
+int lag_comp_tick(LagComp* lc, PongSim* s, const PongInput* input) {
+  int scorer = pong_tick_hold(s, input, lc->miss_player >= 0);
+  lag_record(lc, s);
+  if (lc->miss_player < 0 && scorer < 0) {
+    int p = crossed_face(lag_frame(lc, s->tick - 1), s);
+    // a player without lag saw the same miss the authority did
+    if (p >= 0 && lc->rewind[p] > 0) {
+      lc->miss_player = p;
+      lc->miss_tick = s->tick - 1;
+    }
+  }
+  // rewind is capped, so every held miss is decided within max_rewind ticks
+  int p = lc->miss_player;
+  if (p >= 0 && (int32_t)(s->tick - (uint32_t)lc->rewind[p] - lc->miss_tick) >= 1) {
+    if (lag_try_save(lc, s, p)) {
+      lc->saves++;
+      lag_record(lc, s);
+    }
+    lc->miss_player = -1;
+  }
+  return scorer;
+}
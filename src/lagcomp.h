@@ -0,0 +1,51 @@
+#ifndef PONG_GAME_LAGCOMP_H
+#define PONG_GAME_LAGCOMP_H
+
+#include <stdint.h>
+
+#include "pong.h"
+
+// Server side lag compensation. A remote player moves their paddle against a ball they see one
+// round trip plus the interpolation delay in the past, so by the time their save reaches the
+// authority the ball has already slipped past. The authority keeps the ball and paddles of every
+// tick, and when the ball crosses a paddle face without a hit it holds the score until that
+// player's input for the tick they saw the crossing at has been applied. If their paddle at that
+// point covers the ball as it was then, the ball is rewound to that tick, deflected and brought
+// forward to the present.
+
+#define LAG_HISTORY_SIZE 64  // ticks, power of two
+// rewinds are capped at this many ticks no matter what the server is configured with
+#define LAG_MAX_REWIND (LAG_HISTORY_SIZE / 2)
+
+typedef struct LagFrame {
+  uint32_t tick;
+  Vector2 ball_pos;
+  Vector2 ball_velocity;
+  int collision_count;
+  float paddle_pos[2];
+} LagFrame;
+
+typedef struct LagComp {
+  LagFrame frames[LAG_HISTORY_SIZE];  // state after each tick
+  int max_rewind;
+  int rewind[2];  // ticks each player's view trails the authority, capped at max_rewind
+  int miss_player;  // -1, or whose miss is held
+  uint32_t miss_tick;  // last tick the ball was still in front of their paddle face
+  uint64_t saves;  // misses the rewind turned into hits
+} LagComp;
+
+void lag_comp_init(LagComp* lc, const PongSim* s, int max_rewind);
+
+/**
+ * Records that player's newest input was sent while they were seeing the authority's view_tick,
+ * now is the authority's current tick.
+ */
+void lag_comp_on_input(LagComp* lc, int player, uint32_t view_tick, uint32_t now);
+
+/**
+ * pong_tick with misses held and re-checked against each player's rewound view.
+ * @return index of the player that scored this tick, or -1
+ */
+int lag_comp_tick(LagComp* lc, PongSim* s, const PongInput* input);
+
+#endif  // PONG_GAME_LAGCOMP_H
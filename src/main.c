@@ -4,122 +4,118 @@
 
 #define RAYGUI_IMPLEMENTATION
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/poll.h>
-#include <sys/uio.h>
 #include <unistd.h>
 
+#include "event_loop.h"
+#include "hud.h"
+#include "input.h"
+#include "interp.h"
+#include "metrics.h"
+#include "netsim.h"
 #include "networking.h"
+#include "protocol.h"
 #include "raygui.h"
 #include "raylib.h"
 #include "raymath.h"
+#include "rollback.h"
+#include "snapshot.h"
+#include "udp.h"
 
 static Vector2 window_dims = {800, 600};
-static Vector2 world_dims = {400, 400};
-static Vector2 paddle_dims = {10, 80};
-static float ball_radius = 8;
-static float ball_base_speed_x = 200.f;
-
-typedef enum GameState {
-  STATE_MENU,
-  STATE_PLAY,
-  STATE_PAUSE_MENU,
-  STATE_WAIT_FOR_PLAYER_TWO_AS_HOST,
-  STATE_COUNT
-} GameState;
-
-typedef enum MsgType {
-  MSG_PLAYER_POS,
-  MSG_SCORE_UPDATE,
-  MSG_BALL_POS_UPDATE,
-  MSG_STATE_UPDATE,
-} MsgType;
-
-typedef struct MsgPlayerPos {
-  float pos;
-  float paddle_vert_velocity;
-  int player;
-} MsgPlayerPos;
-
-typedef struct MsgStateUpdate {
-  GameState state;
-  int player;
-} MsgStateUpdate;
-
-typedef struct MsgScoreUpdate {
-  int score;
-  int player;
-} MsgScoreUpdate;
-
-typedef struct MsgBall {
-  Vector2 pos;
-  Vector2 velocity;
-} MsgBall;
-
-typedef struct MsgPositionUpdate {
-  float p;
-} MsgPositionUpdate;
 
 typedef struct NetworkMultiplayerData {
-  const char* port;
-  const char* ip_addr;
+  char port[8];
+  char ip_addr[64];
   const char* this_machine_ip_addr;
   bool is_host;
   int fd;     // listener fd if host, otherwise fd of the host
   int p2_fd;  // client fd if host, otherwise nothing
+  int player;  // assigned by the dedicated server, otherwise 0 for the host and 1 for the guest
+  bool spectating;  // watching a match on a dedicated server, nothing is sent
   const char* error_msg;
-  MsgBuffer msg_buf;
+  MsgBuffer msg_buf;  // messages of this frame, also applied locally
+  SendRing out;       // what the socket didn't take yet on tcp
+  NetSim netsim;      // what we send goes through it, configured by PONG_NETSIM
+  Buf in;
+  EventLoop loop;
+  Transport transport;  // requested when joining, then whatever the server started the match with
+  int udp_fd;
+  UdpEndpoint udp;
+  bool snap_has_acked;
+  uint32_t snap_acked_tick;
+  SnapshotHistory snap_history;  // sent if host, received otherwise
+  InterpBuffer interp;           // received snapshots, drawn for everything but our own paddle
+  InputRing inputs;              // own paddle commands, unless host
+  uint32_t inputs_sent_seq;
+  InputQueue remote_inputs;  // guest paddle commands if host
+  bool rollback_requested;   // guest asked the host for a rollback session
+  bool rollback;
+  RollbackSession rb;
+  Metrics metrics;
 } NetworkMultiplayerData;
 
-typedef struct PlayerData {
-  float pos;
-  float paddle_vert_velocity;
-  int score;
-} PlayerData;
+// What F3 shows, worked out once a second from the running counters.
+typedef struct MetricsOverlay {
+  bool shown;
+  double sampled_at;
+  Metrics prev;
+  uint64_t hud_renders;
+  char text[256];
+} MetricsOverlay;
+
+// Slots of the HUD layer, what each state shows of them is picked in game_update_hud.
+typedef enum HudSlot {
+  HUD_TITLE,
+  HUD_ERROR,
+  HUD_PORT_LABEL,
+  HUD_HOST_PORT_LABEL,
+  HUD_HOST_IP_LABEL,
+  HUD_SCORE,
+  HUD_BALL_DEBUG,
+  HUD_METRICS,
+  HUD_PAUSED,
+  HUD_WAITING,
+} HudSlot;
 
 typedef struct Game {
-  int collision_count;
-  Vector2 ball_pos;
-  Vector2 ball_velocity;
+  PongSim sim;
+  PongSim prev_sim;   // state one tick before sim, drawn blended with it
+  float accumulator;  // frame time not yet consumed by fixed ticks
+  int8_t input_dir;
   Camera2D camera;
   Rectangle viewport;
   float ppu;
   GameState game_state;
   int curr_pause_player;
-  PlayerData players[2];
   NetworkMultiplayerData net_info;
+  MetricsOverlay overlay;
+  Hud hud;  // text and letterbox, re-rendered only when they change
 } Game;
 
 bool is_online_game(Game* g) { return g->net_info.p2_fd > 0 || g->net_info.fd > 0; }
-int get_curr_player(Game* g) { return g->net_info.is_host ? 0 : 1; }
+int get_curr_player(Game* g) { return g->net_info.player; }
 
-void game_reset_ball(Game* g) {
-  int initial_dir = GetRandomValue(0, 1);
-  float mult = initial_dir > 0 ? 1 : -1;
-  g->ball_velocity = (Vector2){mult * ball_base_speed_x, 0};
-  g->ball_pos = (Vector2){world_dims.x / 2.f, world_dims.x / 2.f};
-  g->collision_count = 0;
-}
 int get_other_player_fd(Game* g) {
   return g->net_info.is_host ? g->net_info.p2_fd : g->net_info.fd;
 }
 
 void game_start_new_game(Game* g) {
   for (int i = 0; i < 2; i++) {
-    msg_buf_push(&g->net_info.msg_buf, MSG_SCORE_UPDATE,
-                 &((MsgScoreUpdate){.score = 0, .player = i}), sizeof(MsgPlayerPos));
-    msg_buf_push(
+    msg_buf_push_msg(&g->net_info.msg_buf, MSG_SCORE_UPDATE,
+                     &((MsgScoreUpdate){.score = 0, .player = i}));
+    msg_buf_push_msg(
         &g->net_info.msg_buf, MSG_PLAYER_POS,
-        &((MsgPlayerPos){.pos = world_dims.x / 2.f, .paddle_vert_velocity = 0, .player = i}),
-        sizeof(MsgPlayerPos));
+        &((MsgPlayerPos){.pos = world_dims.x / 2.f, .paddle_vert_velocity = 0, .player = i}));
   }
-  game_reset_ball(g);
-  msg_buf_push(&g->net_info.msg_buf, MSG_BALL_POS_UPDATE,
-               &((MsgBall){.pos = g->ball_pos, .velocity = g->ball_velocity}),
-               sizeof(MsgPlayerPos));
+  pong_reset_ball(&g->sim);
+  msg_buf_push_msg(&g->net_info.msg_buf, MSG_BALL_POS_UPDATE,
+                   &((MsgBall){.pos = g->sim.ball_pos, .velocity = g->sim.ball_velocity}));
 }
 
 void game_init(Game* g) {
@@ -139,6 +135,39 @@ void game_init(Game* g) {
     g->camera.offset = (Vector2){g->viewport.x + g->viewport.width * 0.5f,
                                  g->viewport.y + g->viewport.height * 0.5f};
     msg_buf_init(&g->net_info.msg_buf, 1024);
+    send_ring_init(&g->net_info.out, 1024);
+    buf_init(&g->net_info.in, 4096);
+    if (ev_loop_init(&g->net_info.loop) == -1) {
+      exit(1);
+    }
+    NetSimProfile netsim;
+    const char* netsim_spec = getenv(NETSIM_ENV);
+    if (netsim_spec && !netsim_profile_parse(&netsim, netsim_spec)) {
+      fprintf(stderr, "%s: expected latency=ms,jitter=ms,loss=%%,dup=%%,reorder=%%,seed=n\n",
+              NETSIM_ENV);
+      exit(1);
+    }
+    if (netsim_init(&g->net_info.netsim, netsim_spec ? &netsim : nullptr,
+                    (uint64_t)(GetTime() * 1e9)) == -1) {
+      exit(1);
+    }
+    pong_sim_init(&g->sim, (uint32_t)GetRandomValue(1, INT_MAX));
+  }
+  {
+    Hud* hud = &g->hud;
+    if (hud_init(hud, (int)window_dims.x, (int)window_dims.y, g->camera) == -1) {
+      exit(1);
+    }
+    // letterbox around the viewport
+    Rectangle v = g->viewport;
+    hud_rect(hud, (Rectangle){0, 0, window_dims.x, v.y}, BLACK);
+    hud_rect(hud, (Rectangle){0, v.y + v.height, window_dims.x, window_dims.y - (v.y + v.height)},
+             BLACK);
+    hud_rect(hud, (Rectangle){0, v.y, v.x, v.height}, BLACK);
+    hud_rect(hud, (Rectangle){v.x + v.width, v.y, window_dims.x - (v.x + v.width), v.height},
+             BLACK);
+    hud_set_text(hud, HUD_TITLE, "Pong lol", (Vector2){0, 0},
+                 hud_style_default(30, (Color){255, 0, 0, 255}, true));
   }
 
   g->curr_pause_player = INT_MAX;
@@ -151,9 +180,7 @@ void on_local_game_start(Game* g) {
 }
 
 void set_port(Game* g, int port) {
-  char buf[10];
-  snprintf(buf, sizeof(buf), "%i", port);
-  g->net_info.port = strdup(buf);
+  snprintf(g->net_info.port, sizeof(g->net_info.port), "%i", port);
 }
 
 /**
@@ -174,53 +201,89 @@ bool connect_to_host(NetworkMultiplayerData* net) {
     close(fd);
     return false;
   }
+  set_nonblocking(fd);
   net->fd = fd;
   return true;
 }
 
-void on_join_online_game(Game* g, int port, const char* ip_addr) {
+void on_peer_event(EventLoop* loop, int fd, uint32_t events, void* user_data);
+
+void on_udp_event(EventLoop* loop, int fd, uint32_t events, void* user_data);
+
+bool open_udp_to_host(Game* g, uint32_t token, uint16_t udp_port) {
+  NetworkMultiplayerData* net = &g->net_info;
+  char port[8];
+  snprintf(port, sizeof(port), "%u", udp_port);
+  struct addrinfo* addr_info = get_addr_info_socktype(port, net->ip_addr, SOCK_DGRAM);
+  int fd = socket(addr_info->ai_family, SOCK_DGRAM, 0);
+  if (fd == -1 || connect(fd, addr_info->ai_addr, addr_info->ai_addrlen) == -1) {
+    perror("udp connect");
+    freeaddrinfo(addr_info);
+    if (fd != -1) close(fd);
+    return false;
+  }
+  freeaddrinfo(addr_info);
+  set_nonblocking(fd);
+  udp_endpoint_init(&net->udp, token);
+  net->udp_fd = fd;
+  ev_add(&net->loop, fd, EV_READ, on_udp_event, g);
+  return true;
+}
+
+// spectate watches the longest running match of a dedicated server instead of joining
+void on_join_online_game(Game* g, int port, const char* ip_addr, Transport transport,
+                         bool rollback, bool spectate) {
   printf("joining game on port %i, addr %s\n", port, ip_addr);
   set_port(g, port);
-  g->net_info.ip_addr = strdup(ip_addr);
+  snprintf(g->net_info.ip_addr, sizeof(g->net_info.ip_addr), "%s", ip_addr);
   g->net_info.is_host = false;
+  g->net_info.player = 1;
   bool success = connect_to_host(&g->net_info);
   if (success) {
-    printf("connected to host");
+    printf("connected to host\n");
+    ev_add(&g->net_info.loop, g->net_info.fd, EV_READ, on_peer_event, g);
+    g->net_info.transport = TRANSPORT_TCP;
+    g->net_info.spectating = spectate;
+    if (spectate) {
+      send_protocol_msg(g->net_info.fd, MSG_SPECTATE,
+                        &(MsgSpectate){.version = PROTOCOL_VERSION, .match = 0});
+    } else {
+      // a dedicated server pairs on this, a player hosting the game ignores it
+      g->net_info.rollback_requested = rollback;
+      send_protocol_msg(
+          g->net_info.fd, MSG_JOIN,
+          &(MsgJoin){.version = PROTOCOL_VERSION, .transport = transport, .rollback = rollback});
+    }
     g->game_state = STATE_PLAY;
   } else {
     g->net_info.error_msg = "Failed to connect to host";
   }
 }
 
-void game_update_wait_for_player_2(Game* g) {
-  struct pollfd fds[1] = {};
-  fds[0].events = POLLIN;
-  fds[0].fd = g->net_info.fd;
-  int res = poll(fds, 1, 4);
-  if (res < 0) {
-    perror("poll");
-    return;
-  }
-  if (res == 0) {
-    return;
-  }
-  if (!(fds[0].revents & (POLLHUP | POLLIN))) {
-    return;
-  }
-  printf("player 2 connected\n");
-
+void on_player_2_connect(EventLoop* loop, int fd, [[maybe_unused]] uint32_t events,
+                         void* user_data) {
+  Game* g = user_data;
   struct sockaddr_storage client_addr;
   unsigned int addr_size = sizeof client_addr;
-  int client_fd = accept(g->net_info.fd, (struct sockaddr*)&client_addr, &addr_size);
+  int client_fd = accept(fd, (struct sockaddr*)&client_addr, &addr_size);
   if (client_fd == -1) {
-    perror("accept");
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      perror("accept");
+    }
     return;
   }
+  printf("player 2 connected\n");
+  // only one guest, stop accepting
+  ev_del(loop, fd);
+  set_nonblocking(client_fd);
+  ev_add(loop, client_fd, EV_READ, on_peer_event, g);
   g->net_info.p2_fd = client_fd;
   g->game_state = STATE_PLAY;
   game_start_new_game(g);
 }
 
+void game_update_wait_for_player_2([[maybe_unused]] Game* g) {}
+
 void setup_host(NetworkMultiplayerData* net) {
   struct addrinfo* addr_info = get_addr_info(net->port, nullptr);
   net->fd = open_and_listen_socket(addr_info);
@@ -229,70 +292,201 @@ void setup_host(NetworkMultiplayerData* net) {
     return;
   }
   freeaddrinfo(addr_info);
+  set_nonblocking(net->fd);
 }
 
 void on_host_online_game(Game* g, int port) {
   printf("hosting game on port %i\n", port);
   set_port(g, port);
   g->net_info.is_host = true;
+  g->net_info.player = 0;
   setup_host(&g->net_info);
+  ev_add(&g->net_info.loop, g->net_info.fd, EV_READ, on_player_2_connect, g);
   g->game_state = STATE_WAIT_FOR_PLAYER_TWO_AS_HOST;
 }
 
 void game_update_menu([[maybe_unused]] Game* g) {}
 
-Rectangle get_p2_paddle_rect(Game* g) {
-  Vector2 paddle_half_dims = Vector2Scale(paddle_dims, 0.5f);
-  return (Rectangle){world_dims.x - paddle_dims.x, g->players[1].pos - paddle_half_dims.y,
-                     paddle_dims.x, paddle_dims.y};
+Rectangle get_paddle_rect(Game* g, int player) {
+  PaddleRect r = pong_paddle_rect(&g->sim, player);
+  return (Rectangle){r.x, r.y, r.width, r.height};
 }
-Rectangle get_p1_paddle_rect(Game* g) {
-  Vector2 paddle_half_dims = Vector2Scale(paddle_dims, 0.5f);
-  return (Rectangle){0, -paddle_half_dims.y + g->players[0].pos, paddle_dims.x, paddle_dims.y};
+
+void game_start_rollback(Game* g, uint32_t seed) {
+  NetworkMultiplayerData* net = &g->net_info;
+  pong_sim_init(&g->sim, seed);
+  g->prev_sim = g->sim;
+  g->accumulator = 0;
+  net->inputs = (InputRing){};
+  net->inputs_sent_seq = 0;
+  rollback_init(&net->rb, &g->sim, get_curr_player(g));
+  net->rollback = true;
 }
 
-ssize_t send_msgs(int fd, MsgHdr* hdrs, void** datas, int count) {
-  // TODO: frame allocator
-  struct iovec iovecs[count * 2];
-  for (int i = 0; i < count; i++) {
-    iovecs[i].iov_base = &hdrs[i];
-    iovecs[i].iov_len = MSG_HDR_SIZE;
-    iovecs[i + 1].iov_base = datas[i];
-    iovecs[i + 1].iov_len = hdrs[i].len;
-  }
-  return writev(fd, iovecs, count * 2);
+void game_on_rejected(Game* g, const MsgReject* u) {
+  NetworkMultiplayerData* net = &g->net_info;
+  fprintf(stderr, "rejected, the other side speaks protocol version %u, we speak %u\n", u->version,
+          PROTOCOL_VERSION);
+  net->error_msg = "Protocol version mismatch";
+  ev_del(&net->loop, net->fd);
+  netsim_forget(&net->netsim, net->fd);
+  close(net->fd);
+  net->fd = 0;
+  g->game_state = STATE_MENU;
 }
 
+// Payloads are decoded into locals, a message that is short or out of range is dropped.
 void game_on_msg(Game* g, Frame* fr) {
   switch (fr->hdr.type) {
     case MSG_PLAYER_POS: {
-      MsgPlayerPos* u = (MsgPlayerPos*)fr->payload;
-      g->players[u->player].pos = u->pos;
-      g->players[u->player].paddle_vert_velocity = u->paddle_vert_velocity;
+      MsgPlayerPos u;
+      if (!msg_player_pos_decode(&u, fr->payload, fr->hdr.len)) {
+        metric_add(&g->net_info.metrics.parse_errors, 1);
+        break;
+      }
+      g->sim.players[u.player].pos = u.pos;
+      g->sim.players[u.player].paddle_vert_velocity = u.paddle_vert_velocity;
       break;
     }
     case MSG_SCORE_UPDATE: {
-      MsgScoreUpdate* u = (MsgScoreUpdate*)fr->payload;
-      g->players[u->player].score = u->score;
+      MsgScoreUpdate u;
+      if (!msg_score_update_decode(&u, fr->payload, fr->hdr.len)) {
+        metric_add(&g->net_info.metrics.parse_errors, 1);
+        break;
+      }
+      g->sim.players[u.player].score = u.score;
       break;
     }
     case MSG_BALL_POS_UPDATE: {
-      MsgBall* u = (MsgBall*)fr->payload;
-      g->ball_pos = u->pos;
-      g->ball_velocity = u->velocity;
+      MsgBall u;
+      if (!msg_ball_decode(&u, fr->payload, fr->hdr.len)) {
+        metric_add(&g->net_info.metrics.parse_errors, 1);
+        break;
+      }
+      g->sim.ball_pos = u.pos;
+      g->sim.ball_velocity = u.velocity;
+      break;
+    }
+    case MSG_MATCH_START: {
+      MsgMatchStart u;
+      if (!msg_match_start_decode(&u, fr->payload, fr->hdr.len)) {
+        metric_add(&g->net_info.metrics.parse_errors, 1);
+        break;
+      }
+      g->net_info.player = u.player;
+      if (u.transport == TRANSPORT_UDP && open_udp_to_host(g, u.udp_token, u.udp_port)) {
+        g->net_info.transport = TRANSPORT_UDP;
+      }
+      break;
+    }
+    case MSG_JOIN: {
+      if (!g->net_info.is_host) {
+        break;
+      }
+      // the version leads MSG_JOIN in every protocol version, check it before trusting the rest
+      MsgJoin u;
+      if (fr->hdr.len < 2 || wire_get_u16(fr->payload) != PROTOCOL_VERSION ||
+          !msg_join_decode(&u, fr->payload, fr->hdr.len)) {
+        msg_buf_push_msg(&g->net_info.msg_buf, MSG_REJECT,
+                         &(MsgReject){.version = PROTOCOL_VERSION});
+        break;
+      }
+      if (u.rollback && !g->net_info.rollback) {
+        uint32_t seed = (uint32_t)GetRandomValue(1, INT_MAX);
+        game_start_rollback(g, seed);
+        msg_buf_push_msg(&g->net_info.msg_buf, MSG_ROLLBACK_START,
+                         &(MsgRollbackStart){.seed = seed});
+      }
+      break;
+    }
+    case MSG_REJECT: {
+      MsgReject u;
+      if (!g->net_info.is_host && msg_reject_decode(&u, fr->payload, fr->hdr.len)) {
+        game_on_rejected(g, &u);
+      }
+      break;
+    }
+    case MSG_ROLLBACK_START: {
+      MsgRollbackStart u;
+      if (!g->net_info.is_host && msg_rollback_start_decode(&u, fr->payload, fr->hdr.len)) {
+        game_start_rollback(g, u.seed);
+      }
+      break;
+    }
+    case MSG_INPUT: {
+      MsgInput u;
+      if (!msg_input_decode(&u, fr->payload, fr->hdr.len)) {
+        metric_add(&g->net_info.metrics.parse_errors, 1);
+        break;
+      }
+      if (u.player == get_curr_player(g)) {
+        break;  // our own, echoed through the local message buffer
+      }
+      if (g->net_info.rollback) {
+        for (int i = 0; i < u.count; i++) {
+          rollback_add_remote(&g->net_info.rb, u.first_seq + (uint32_t)i, u.dirs[i]);
+        }
+      } else if (g->net_info.is_host) {
+        input_queue_on_msg(&g->net_info.remote_inputs, &u);
+      }
+      break;
+    }
+    case MSG_INPUT_ACK: {
+      MsgInputAck u;
+      if (!g->net_info.is_host && msg_input_ack_decode(&u, fr->payload, fr->hdr.len)) {
+        input_ring_reconcile(&g->net_info.inputs, &u, &g->sim, get_curr_player(g));
+      }
+      break;
+    }
+    case MSG_SNAPSHOT: {
+      NetworkMultiplayerData* net = &g->net_info;
+      if (net->is_host) {
+        break;  // our own outgoing snapshot
+      }
+      Snapshot snap;
+      if (snapshot_decode(&snap, fr->payload, fr->hdr.len, &net->snap_history, PONG_TICK_HZ) ==
+          -1) {
+        metric_add(&net->metrics.parse_errors, 1);
+        break;
+      }
+      snapshot_history_put(&net->snap_history, &snap);
+      snapshot_apply(&snap, &g->sim, net->spectating ? -1 : get_curr_player(g));
+      PongSim received = g->sim;
+      snapshot_apply(&snap, &received, -1);
+      received.tick = snap.tick;
+      interp_push(&net->interp, &received, GetTime());
+      if (!net->spectating) {
+        msg_buf_push_msg(&net->msg_buf, MSG_SNAPSHOT_ACK, &(MsgSnapshotAck){.tick = snap.tick});
+      }
+      break;
+    }
+    case MSG_SNAPSHOT_ACK: {
+      NetworkMultiplayerData* net = &g->net_info;
+      MsgSnapshotAck u;
+      if (!net->is_host || !msg_snapshot_ack_decode(&u, fr->payload, fr->hdr.len)) {
+        break;
+      }
+      if (!net->snap_has_acked || (int32_t)(u.tick - net->snap_acked_tick) > 0) {
+        net->snap_acked_tick = u.tick;
+        net->snap_has_acked = true;
+      }
       break;
     }
     case MSG_STATE_UPDATE: {
-      MsgStateUpdate* s = (MsgStateUpdate*)fr->payload;
+      MsgStateUpdate u;
+      if (!msg_state_update_decode(&u, fr->payload, fr->hdr.len)) {
+        metric_add(&g->net_info.metrics.parse_errors, 1);
+        break;
+      }
       if (g->game_state == STATE_PAUSE_MENU) {
-        if (s->player == g->curr_pause_player) {
-          g->game_state = s->state;
+        if (u.player == g->curr_pause_player) {
+          g->game_state = u.state;
           g->curr_pause_player = INT_MAX;
         }
       } else if (g->game_state == STATE_PLAY) {
-        g->game_state = s->state;
-        if (s->state == STATE_PAUSE_MENU) {
-          g->curr_pause_player = s->player;
+        g->game_state = u.state;
+        if (u.state == STATE_PAUSE_MENU) {
+          g->curr_pause_player = u.player;
         }
       } else {
         assert(0 && "invalid");
@@ -300,152 +494,232 @@ void game_on_msg(Game* g, Frame* fr) {
       break;
     }
     default:
-      printf("invalid msg type: %i\n", fr->hdr.type);
+      metric_add(&g->net_info.metrics.parse_errors, 1);
       break;
   }
 }
 
+bool game_on_frame(Frame* fr, void* user_data) {
+  Game* g = user_data;
+  metric_add(&g->net_info.metrics.frames, 1);
+  game_on_msg(g, fr);
+  return true;
+}
+
+// datagrams are counted as a whole when they arrive
+bool game_on_stream_frame(Frame* fr, void* user_data) {
+  Game* g = user_data;
+  metric_add(&g->net_info.metrics.bytes_in, MSG_HDR_SIZE + fr->hdr.len);
+  return game_on_frame(fr, g);
+}
+
 void game_process_msgs(Game* g, void* data_raw, ssize_t size) {
-  ssize_t curr_read_size = 0;
-  uint8_t* data = data_raw;
-  while (curr_read_size < size) {
-    Frame fr = {};
-    memcpy(&fr.hdr.type, data + curr_read_size, sizeof(uint32_t));
-    memcpy(&fr.hdr.len, data + curr_read_size + sizeof(uint32_t), sizeof(uint32_t));
-    curr_read_size += MSG_HDR_SIZE;
-    fr.payload = data + curr_read_size;
-    curr_read_size += fr.hdr.len;
+  size_t off = 0;
+  Frame fr;
+  int frame_size;
+  while ((frame_size = frame_try_parse(&fr, (uint8_t*)data_raw + off, size - off)) > 0) {
     game_on_msg(g, &fr);
+    off += frame_size;
   }
 }
 
-void game_read_from_other(Game* g, int other_fd) {
-  struct pollfd fds[1] = {};
-  fds[0].fd = other_fd;
-  fds[0].events = POLLIN;
-  int res = poll(fds, 1, 4);
-  if (res < 0) {
-    perror("poll");
+void on_udp_event([[maybe_unused]] EventLoop* loop, int fd, [[maybe_unused]] uint32_t events,
+                  void* user_data) {
+  Game* g = user_data;
+  for (;;) {
+    uint8_t pkt[UDP_MAX_PACKET];
+    ssize_t n = recv(fd, pkt, sizeof(pkt), 0);
+    if (n < 0) {
+      return;
+    }
+    Metrics* m = &g->net_info.metrics;
+    metric_add(&m->packets_in, 1);
+    metric_add(&m->bytes_in, (uint64_t)n);
+    if (udp_on_packet(&g->net_info.udp, pkt, n, (uint64_t)(GetTime() * 1e9), game_on_frame, g) ==
+        -1) {
+      metric_add(&m->parse_errors, 1);
+    }
   }
-  if (res == 0) {
+}
+
+void game_send_msgs(Game* g) {
+  NetworkMultiplayerData* net = &g->net_info;
+  if (net->transport != TRANSPORT_UDP) {
+    int fd = get_other_player_fd(g);
+    if (fd > 0) {
+      ssize_t sent = netsim_ring_write(&net->netsim, &net->out, fd, net->msg_buf.data,
+                                       net->msg_buf.size, (uint64_t)(GetTime() * 1e9));
+      if (sent == -1) {
+        perror("send");
+      } else {
+        metric_add(&net->metrics.bytes_out, (uint64_t)sent);
+      }
+      metric_set(&net->metrics.send_queue_bytes, send_ring_pending(&net->out));
+      metric_set(&net->metrics.send_queue_max, send_ring_pending(&net->out));
+    }
+    msg_buf_clear(&net->msg_buf);
     return;
   }
-  char buf[2048];
-  // TODO: handle > mtu
-  ssize_t read_size = read(other_fd, buf, sizeof(buf));
-  if (read_size <= 0) {
-    printf("disconnected or err");
-    return;
+  size_t off = 0;
+  Frame fr;
+  int frame_size;
+  while ((frame_size = frame_try_parse(&fr, (uint8_t*)net->msg_buf.data + off,
+                                       net->msg_buf.size - off)) > 0) {
+    off += frame_size;
+    if (msg_is_unreliable(fr.hdr.type)) {
+      udp_send_unreliable(&net->udp, fr.hdr.type, fr.payload, fr.hdr.len);
+    } else {
+      udp_send_reliable(&net->udp, fr.hdr.type, fr.payload, fr.hdr.len);
+    }
+  }
+  msg_buf_clear(&net->msg_buf);
+  uint64_t now = (uint64_t)(GetTime() * 1e9);
+  ssize_t sent = netsim_udp_flush(&net->netsim, &net->udp, net->udp_fd, now);
+  if (sent > 0) {
+    metric_add(&net->metrics.packets_out, 1);
+    metric_add(&net->metrics.bytes_out, (uint64_t)sent);
+  }
+}
+
+void on_peer_event(EventLoop* loop, int fd, [[maybe_unused]] uint32_t events, void* user_data) {
+  Game* g = user_data;
+  int rc = conn_recv_frames(&g->net_info.in, fd, game_on_stream_frame, g);
+  if (rc < 0) {
+    metric_add(&g->net_info.metrics.parse_errors, rc == -2);
+    printf("disconnected or err\n");
+    ev_del(loop, fd);
   }
-  game_process_msgs(g, buf, read_size);
 }
 
 void game_update_pong_process_input(Game* g) {
-  int player = g->net_info.is_host ? 0 : 1;
-  {  // pos
-    float dt = GetFrameTime();
-    float speed = 300;
-    float* vy = &g->players[player].paddle_vert_velocity;
-    *vy = 0.f;
-    if (IsKeyDown(KEY_J)) {
-      *vy += speed;
-    }
-    if (IsKeyDown(KEY_K)) {
-      *vy += -speed;
-    }
-    g->players[player].pos += (*vy) * dt;
-    if (fabsf(*vy) > 0.f) {
-      msg_buf_push(&g->net_info.msg_buf, MSG_PLAYER_POS,
-                   &(MsgPlayerPos){.pos = g->players[player].pos,
-                                   .paddle_vert_velocity = g->players[player].paddle_vert_velocity,
-                                   .player = player},
-                   sizeof(MsgPlayerPos));
-    }
+  g->input_dir = 0;
+  if (IsKeyDown(KEY_J)) {
+    g->input_dir += 1;
+  }
+  if (IsKeyDown(KEY_K)) {
+    g->input_dir -= 1;
   }
 
   if (IsKeyPressed(KEY_P)) {
     g->game_state = STATE_PAUSE_MENU;
     printf("pausing game\n");
     g->curr_pause_player = get_curr_player(g);
-    msg_buf_push(&g->net_info.msg_buf, MSG_STATE_UPDATE,
-                 &(MsgStateUpdate){.state = g->game_state, .player = get_curr_player(g)},
-                 sizeof(MsgStateUpdate));
+    msg_buf_push_msg(&g->net_info.msg_buf, MSG_STATE_UPDATE,
+                     &(MsgStateUpdate){.state = g->game_state, .player = get_curr_player(g)});
   }
 }
 
-void game_update_pong_game_online(Game* g) {
-  game_update_pong_process_input(g);
-  if (g->net_info.is_host) {
-    float dt = GetFrameTime();
-    bool score_happened = false;
-    if (g->ball_pos.x - ball_radius <= 0) {
-      score_happened = true;
-      msg_buf_push(&g->net_info.msg_buf, MSG_SCORE_UPDATE,
-                   &(MsgScoreUpdate){.score = g->players[0].score + 1, .player = 0},
-                   sizeof(MsgScoreUpdate));
-    }
-    if (g->ball_pos.x + ball_radius >= world_dims.x) {
-      score_happened = true;
-      msg_buf_push(&g->net_info.msg_buf, MSG_SCORE_UPDATE,
-                   &(MsgScoreUpdate){.score = g->players[1].score + 1, .player = 1},
-                   sizeof(MsgScoreUpdate));
-    }
-    if (score_happened) {
-      game_reset_ball(g);
-    }
-
-    Rectangle circle_rect = {g->ball_pos.x - ball_radius, g->ball_pos.y - ball_radius,
-                             ball_radius * 2.f, ball_radius * 2.f};
-    Rectangle p1_rect = get_p1_paddle_rect(g);
-    Rectangle p2_rect = get_p2_paddle_rect(g);
-    float max_deflect = 350.f;
-    float ball_speed_x_collision_mult = ball_base_speed_x / 10.f;
-    float paddle_spin_scale = 0.f;
-    if (CheckCollisionRecs(p1_rect, circle_rect)) {
-      g->ball_velocity.x =
-          ball_base_speed_x + (float)g->collision_count * ball_speed_x_collision_mult;
-
-      g->ball_pos.x = p1_rect.x + p1_rect.width + ball_radius;
-
-      float p1_center = p1_rect.y + p1_rect.height * 0.5f;
-      float rel = (g->ball_pos.y - p1_center) / (paddle_dims.y * 0.5f);
-      rel = fmaxf(fminf(rel, 1.f), -1.f);
+void game_push_snapshot(Game* g) {
+  NetworkMultiplayerData* net = &g->net_info;
+  Snapshot snap;
+  snapshot_from_sim(&snap, &g->sim, g->sim.tick);
+  snapshot_history_put(&net->snap_history, &snap);
+  const Snapshot* base = net->snap_has_acked
+                             ? snapshot_history_get(&net->snap_history, net->snap_acked_tick)
+                             : nullptr;
+  uint8_t buf[SNAPSHOT_MAX_ENCODED];
+  size_t len = snapshot_encode(&snap, base, PONG_TICK_HZ, buf);
+  msg_buf_push(&net->msg_buf, MSG_SNAPSHOT, buf, len);
+  if (input_queue_started(&net->remote_inputs)) {
+    MsgInputAck ack = {.seq = input_queue_ack_seq(&net->remote_inputs),
+                       .pos = g->sim.players[1 - get_curr_player(g)].pos};
+    msg_buf_push_msg(&net->msg_buf, MSG_INPUT_ACK, &ack);
+  }
+}
 
-      g->ball_velocity.y =
-          rel * max_deflect + g->players[0].paddle_vert_velocity * paddle_spin_scale;
-      g->collision_count++;
+void game_push_inputs(Game* g) {
+  NetworkMultiplayerData* net = &g->net_info;
+  MsgInput msg = {.player = (uint8_t)get_curr_player(g),
+                  .view_tick = interp_render_tick(&net->interp, GetTime())};
+  if (net->transport == TRANSPORT_UDP) {
+    // resend the unacked tail every time, the ring clamps this to what's still unacked
+    input_ring_write(&net->inputs, net->inputs.next_seq - MSG_INPUT_MAX_CMDS, &msg);
+    if (msg.count) {
+      msg_buf_push_msg(&net->msg_buf, MSG_INPUT, &msg);
     }
+    return;
+  }
+  while (net->inputs_sent_seq != net->inputs.next_seq &&
+         input_ring_write(&net->inputs, net->inputs_sent_seq, &msg) > 0) {
+    net->inputs_sent_seq = msg.first_seq + msg.count;
+    msg_buf_push_msg(&net->msg_buf, MSG_INPUT, &msg);
+  }
+}
 
-    if (CheckCollisionRecs(p2_rect, circle_rect)) {
-      g->ball_velocity.x =
-          -(ball_base_speed_x + (float)g->collision_count * ball_speed_x_collision_mult);
-
-      // put ball just to the left of the paddle face
-      g->ball_pos.x = p2_rect.x - ball_radius;
-
-      float p2_center = p2_rect.y + p2_rect.height * 0.5f;
-      float rel = (g->ball_pos.y - p2_center) / (paddle_dims.y * 0.5f);
-      rel = fmaxf(fminf(rel, 1.f), -1.f);
+void game_tick_online(Game* g) {
+  int player = get_curr_player(g);
+  if (!g->net_info.is_host) {
+    // the host owns the ball, the guest only predicts its own paddle
+    pong_move_paddle(&g->sim, player, g->input_dir);
+    input_ring_push(&g->net_info.inputs, g->input_dir);
+    g->sim.tick++;
+    return;
+  }
+  PongInput input = {};
+  input.paddle_dir[player] = g->input_dir;
+  input.paddle_dir[1 - player] =
+      input_queue_next_dir(&g->net_info.remote_inputs, &g->sim, 1 - player);
+  int scorer = pong_tick(&g->sim, &input);
+  if (scorer >= 0) {
+    msg_buf_push_msg(&g->net_info.msg_buf, MSG_SCORE_UPDATE,
+                     &(MsgScoreUpdate){.score = g->sim.players[scorer].score, .player = scorer});
+  }
+}
 
-      g->ball_velocity.y =
-          rel * max_deflect + g->players[1].paddle_vert_velocity * paddle_spin_scale;
-      g->collision_count++;
+void game_update_rollback(Game* g) {
+  NetworkMultiplayerData* net = &g->net_info;
+  game_update_pong_process_input(g);
+  rollback_resolve(&net->rb, &g->sim);
+
+  g->accumulator += fminf(GetFrameTime(), 0.25f);
+  int ticks = 0;
+  while (g->accumulator >= pong_tick_dt) {
+    if (!rollback_can_advance(&net->rb)) {
+      // waiting on the remote, don't bank the time for a burst of ticks later
+      g->accumulator = fminf(g->accumulator, pong_tick_dt);
+      break;
     }
+    g->prev_sim = g->sim;
+    input_ring_push(&net->inputs, g->input_dir);
+    rollback_advance(&net->rb, &g->sim, g->input_dir);
+    g->accumulator -= pong_tick_dt;
+    ticks++;
+  }
+  if (ticks > 0) {
+    game_push_inputs(g);
+  }
+}
 
-    g->ball_pos = Vector2Add(g->ball_pos, Vector2Scale(g->ball_velocity, dt));
+void game_update_pong_game_online(Game* g) {
+  if (g->net_info.spectating) {
+    return;  // everything comes from snapshots
+  }
+  if (g->net_info.rollback) {
+    game_update_rollback(g);
+    return;
+  }
+  if (g->net_info.rollback_requested) {
+    return;  // until the host starts the session
+  }
+  game_update_pong_process_input(g);
 
-    // foor/ceiling
-    if (g->ball_pos.y - ball_radius <= 0.f) {
-      g->ball_pos.y = ball_radius;
-      g->ball_velocity.y *= -1.f;
-    }
-    if (g->ball_pos.y + ball_radius >= world_dims.y) {
-      g->ball_pos.y = world_dims.y - ball_radius;
-      g->ball_velocity.y *= -1.f;
-    }
+  // clamp so a long stall doesn't turn into a burst of catch-up ticks
+  g->accumulator += fminf(GetFrameTime(), 0.25f);
+  int ticks = 0;
+  while (g->accumulator >= pong_tick_dt) {
+    g->prev_sim = g->sim;
+    game_tick_online(g);
+    g->accumulator -= pong_tick_dt;
+    ticks++;
+  }
 
-    msg_buf_push(&g->net_info.msg_buf, MSG_BALL_POS_UPDATE,
-                 &(MsgBall){.pos = g->ball_pos, .velocity = g->ball_velocity}, sizeof(MsgBall));
+  if (ticks == 0) {
+    return;
+  }
+  if (g->net_info.is_host) {
+    game_push_snapshot(g);
+  } else {
+    game_push_inputs(g);
   }
 }
 
@@ -459,12 +733,59 @@ void game_update_pong_game(Game* g) {
 void game_update_pause_menu(Game* g) {
   if (g->curr_pause_player == get_curr_player(g) &&
       (IsKeyPressed(KEY_P) || IsKeyPressed(KEY_BACKSLASH))) {
-    msg_buf_push(&g->net_info.msg_buf, MSG_STATE_UPDATE,
-                 &(MsgStateUpdate){.state = g->game_state, .player = get_curr_player(g)},
-                 sizeof(MsgStateUpdate));
+    msg_buf_push_msg(&g->net_info.msg_buf, MSG_STATE_UPDATE,
+                     &(MsgStateUpdate){.state = g->game_state, .player = get_curr_player(g)});
   }
 }
 
+void game_sample_rtt(Game* g) {
+  NetworkMultiplayerData* net = &g->net_info;
+  if (net->transport == TRANSPORT_UDP) {
+    if (net->udp.rtt_ns) {
+      metric_hist_record(&net->metrics.rtt_us, net->udp.rtt_ns / 1000);
+    }
+    return;
+  }
+  int fd = get_other_player_fd(g);
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  if (fd > 0 && getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+    metric_hist_record(&net->metrics.rtt_us, info.tcpi_rtt);
+  }
+}
+
+// Once a second: samples the round trip and turns the counters into what the overlay shows, rates
+// and tick quantiles over the last second.
+void game_sample_metrics(Game* g, double now) {
+  MetricsOverlay* o = &g->overlay;
+  if (now - o->sampled_at < 1.0) {
+    return;
+  }
+  Metrics* m = &g->net_info.metrics;
+  if (is_online_game(g)) {
+    game_sample_rtt(g);
+  }
+  double dt = o->sampled_at > 0 ? now - o->sampled_at : 1.0;
+  static MetricHist ticks;
+  metric_hist_since(&ticks, &m->tick_ns, &o->prev.tick_ns);
+  snprintf(o->text, sizeof(o->text),
+           "tick p50 %.2f ms p99 %.2f ms\nrtt %.1f ms\nin %.1f KB/s %.0f pkt/s\n"
+           "out %.1f KB/s %.0f pkt/s\nsend queue %llu B\nparse errors %llu\nhud %.0f renders/s",
+           (double)metric_hist_quantile(&ticks, 0.5) / 1e6,
+           (double)metric_hist_quantile(&ticks, 0.99) / 1e6,
+           (double)metric_hist_quantile(&m->rtt_us, 0.5) / 1e3,
+           (double)(metric_get(&m->bytes_in) - metric_get(&o->prev.bytes_in)) / 1024.0 / dt,
+           (double)(metric_get(&m->packets_in) - metric_get(&o->prev.packets_in)) / dt,
+           (double)(metric_get(&m->bytes_out) - metric_get(&o->prev.bytes_out)) / 1024.0 / dt,
+           (double)(metric_get(&m->packets_out) - metric_get(&o->prev.packets_out)) / dt,
+           (unsigned long long)metric_get(&m->send_queue_bytes),
+           (unsigned long long)metric_get(&m->parse_errors),
+           (double)(g->hud.renders - o->hud_renders) / dt);
+  o->prev = *m;
+  o->hud_renders = g->hud.renders;
+  o->sampled_at = now;
+}
+
 void game_update(Game* g) {
   void (*update_fns[STATE_COUNT])(Game*) = {
       [STATE_MENU] = game_update_menu,
@@ -473,43 +794,83 @@ void game_update(Game* g) {
       [STATE_WAIT_FOR_PLAYER_TWO_AS_HOST] = game_update_wait_for_player_2};
   assert(g->game_state < STATE_COUNT);
 
-  game_read_from_other(g, get_other_player_fd(g));
+  double start = GetTime();
+  if (IsKeyPressed(KEY_F3)) {
+    g->overlay.shown = !g->overlay.shown;
+  }
+  ev_run_once(&g->net_info.loop, 0);
+  // released once per frame, so simulated delays are only as fine as the frame time
+  netsim_poll(&g->net_info.netsim, (uint64_t)(start * 1e9));
 
   update_fns[g->game_state](g);
 
   game_process_msgs(g, g->net_info.msg_buf.data, g->net_info.msg_buf.size);
-  msg_buf_send_and_clear(&g->net_info.msg_buf, get_other_player_fd(g));
+  game_send_msgs(g);
+  metric_hist_record(&g->net_info.metrics.tick_ns, (uint64_t)((GetTime() - start) * 1e9));
+  game_sample_metrics(g, start);
+}
+
+static float lerpf(float a, float b, float t) { return a + (b - a) * t; }
+
+// sim blended toward prev_sim by how far the accumulator is into the next tick
+PongSim game_render_state(Game* g) {
+  PongSim r = g->sim;
+  if (!is_online_game(g)) {
+    return r;
+  }
+  if (g->prev_sim.tick + 1 == g->sim.tick) {
+    float alpha = g->accumulator / pong_tick_dt;
+    // a teleport (score reset, snapshot correction) would smear across the field
+    if (fabsf(g->sim.ball_pos.x - g->prev_sim.ball_pos.x) < world_dims.x * 0.25f) {
+      r.ball_pos.x = lerpf(g->prev_sim.ball_pos.x, g->sim.ball_pos.x, alpha);
+      r.ball_pos.y = lerpf(g->prev_sim.ball_pos.y, g->sim.ball_pos.y, alpha);
+    }
+    for (int i = 0; i < 2; i++) {
+      r.players[i].pos = lerpf(g->prev_sim.players[i].pos, g->sim.players[i].pos, alpha);
+    }
+  }
+  NetworkMultiplayerData* net = &g->net_info;
+  if (!net->is_host && !net->rollback) {
+    int player = get_curr_player(g);
+    float own_pos = r.players[player].pos;
+    interp_sample(&net->interp, GetTime(), &r);
+    if (!net->spectating) {
+      r.players[player].pos = own_pos;
+    }
+  }
+  return r;
 }
 
 void game_draw_pong(Game* g) {
+  PongSim r = game_render_state(g);
   BeginMode2D(g->camera);
   Color paddle_color = GOLD;
-  char buf[200];
-  snprintf(buf, sizeof(buf), "P1: %i\nP2: %i", g->players[0].score, g->players[1].score);
-  DrawText(buf, 0, 0, 20, ORANGE);
-  snprintf(buf, sizeof(buf), "vel x: %f, y: %f\ncollision_count: %i\nvy0: %f\tvy1: %f",
-           g->ball_velocity.x, g->ball_velocity.y, g->collision_count,
-           g->players[0].paddle_vert_velocity, g->players[1].paddle_vert_velocity);
-  DrawText(buf, 0, 40, 20, ORANGE);
-  Rectangle p1_rect = get_p1_paddle_rect(g);
-  Rectangle p2_rect = get_p2_paddle_rect(g);
-  DrawRectangleRec(p1_rect, paddle_color);
-  DrawRectangleRec(p2_rect, paddle_color);
-  DrawCircleV(g->ball_pos, ball_radius, GREEN);
+  for (int i = 0; i < 2; i++) {
+    PaddleRect p = pong_paddle_rect(&r, i);
+    DrawRectangleRec((Rectangle){p.x, p.y, p.width, p.height}, paddle_color);
+  }
+  DrawCircleV(r.ball_pos, ball_radius, GREEN);
   EndMode2D();
 }
 
 static long override_player = INT_MAX;
 
+typedef enum MenuState { MENU_STATE_MAIN, MENU_STATE_ONLINE_MENU } MenuState;
+static MenuState menu_state = MENU_STATE_MAIN;
+
+static const Vector2 menu_button_dims = {120, 40};
+static const float menu_space_x = 100.f;
+static const float menu_space_y = 30.f;
+
 void game_draw_menu(Game* g) {
-  Vector2 button_dims = {120, 40};
-  float space_y = 30.f;
-  typedef enum MenuState { MENU_STATE_MAIN, MENU_STATE_ONLINE_MENU } MenuState;
-  static MenuState menu_state = MENU_STATE_MAIN;
+  Vector2 button_dims = menu_button_dims;
+  float space_y = menu_space_y;
   switch (menu_state) {
     case MENU_STATE_MAIN: {
       if (override_player == 0) on_host_online_game(g, 8080);
-      if (override_player == 1) on_join_online_game(g, 8080, "127.0.0.1");
+      if (override_player == 1) {
+        on_join_online_game(g, 8080, "127.0.0.1", TRANSPORT_TCP, false, false);
+      }
       if (GuiButton((Rectangle){window_dims.x / 2 - (button_dims.x / 2.f),
                                 window_dims.y / 2 - (button_dims.y / 2.f) - space_y, button_dims.x,
                                 button_dims.y},
@@ -525,11 +886,8 @@ void game_draw_menu(Game* g) {
       break;
     }
     case MENU_STATE_ONLINE_MENU: {
-      if (g->net_info.error_msg) {
-        DrawText(g->net_info.error_msg, 0, (int)window_dims.y / 2, 20, RED);
-      }
       Vector2 half_win_dims = Vector2Scale(window_dims, 0.5f);
-      float space_x = 100;
+      float space_x = menu_space_x;
 
       {
         static int host_port = 0;
@@ -540,11 +898,6 @@ void game_draw_menu(Game* g) {
         if (GuiValueBox(port_button_bounds, nullptr, &host_port, 0, 100000, port_mode)) {
           port_mode = !port_mode;
         }
-        GuiDrawText(
-            "Port",
-            (Rectangle){port_button_bounds.x, port_button_bounds.y - (button_dims.y / 2.f + 5),
-                        port_button_bounds.width, port_button_bounds.height},
-            10, BLACK);
         Rectangle host_game_button_bounds = {half_win_dims.x - (button_dims.x / 2.f) - space_x,
                                              half_win_dims.y - (button_dims.y / 2.f), button_dims.x,
                                              button_dims.y};
@@ -561,77 +914,179 @@ void game_draw_menu(Game* g) {
       if (GuiValueBox(port_button_bounds, nullptr, &port, 0, 100000, port_mode)) {
         port_mode = !port_mode;
       }
-      GuiDrawText(
-          "Host Port",
-          (Rectangle){port_button_bounds.x, port_button_bounds.y - (button_dims.y / 2.f + 5),
-                      port_button_bounds.width, port_button_bounds.height},
-          10, BLACK);
 
       static char ip_addr[50] = {};
       static bool ip_addr_edit_mode = false;
-      GuiDrawText(
-          "Host IP Address",
-          (Rectangle){half_win_dims.x - (button_dims.x / 2.f) + space_x,
-                      half_win_dims.y - (button_dims.y / 2.f) - space_y - (button_dims.y / 2.f + 5),
-                      button_dims.x, button_dims.y},
-          10, BLACK);
       if (GuiTextBox((Rectangle){half_win_dims.x - (button_dims.x / 2.f) + space_x,
                                  half_win_dims.y - (button_dims.y / 2.f) - space_y, button_dims.x,
                                  button_dims.y},
                      ip_addr, sizeof(ip_addr), ip_addr_edit_mode)) {
         ip_addr_edit_mode = !ip_addr_edit_mode;
       }
+      static bool use_udp = false;
+      GuiCheckBox((Rectangle){half_win_dims.x - (button_dims.x / 2.f) + space_x,
+                              half_win_dims.y - (button_dims.y / 2.f) + space_y * 0.75f, 15, 15},
+                  "UDP (dedicated server)", &use_udp);
+      static bool use_rollback = false;
+      GuiCheckBox((Rectangle){half_win_dims.x - (button_dims.x / 2.f) + space_x,
+                              half_win_dims.y - (button_dims.y / 2.f) + space_y * 1.4f, 15, 15},
+                  "Rollback (player host)", &use_rollback);
       if (GuiButton((Rectangle){window_dims.x / 2 - (button_dims.x / 2.f) + space_x,
                                 window_dims.y / 2 - (button_dims.y / 2.f) + space_y * 2.f,
                                 button_dims.x, button_dims.y},
                     "Join Game")) {
-        on_join_online_game(g, port, ip_addr);
+        on_join_online_game(g, port, ip_addr, use_udp ? TRANSPORT_UDP : TRANSPORT_TCP,
+                            use_rollback, false);
+      }
+      if (GuiButton((Rectangle){window_dims.x / 2 - (button_dims.x / 2.f) + space_x,
+                                window_dims.y / 2 - (button_dims.y / 2.f) + space_y * 2.f +
+                                    button_dims.y + 5,
+                                button_dims.x, button_dims.y},
+                    "Spectate")) {
+        on_join_online_game(g, port, ip_addr, TRANSPORT_TCP, false, true);
       }
       break;
     }
   }
-  BeginMode2D(g->camera);
-  DrawText("Pong lol", 0, 0, 30, (Color){255, 0, 0, 255});
-  EndMode2D();
 }
 
-void game_draw_pause_menu(Game* g) {
-  BeginMode2D(g->camera);
-  char buf[50];
-  snprintf(buf, sizeof(buf), "Paused by player %i", g->curr_pause_player + 1);
-  DrawText(buf, 0, 0, 10, (Color){255, 0, 0, 255});
-  game_draw_pong(g);
-  EndMode2D();
+// A raygui label where GuiDrawText would put it, in raygui's font and text size.
+static void game_hud_label(Game* g, int slot, const char* text, Rectangle bounds) {
+  HudStyle style = {.font = GuiGetFont(),
+                    .size = (float)GuiGetStyle(DEFAULT, TEXT_SIZE),
+                    .spacing = (float)GuiGetStyle(DEFAULT, TEXT_SPACING),
+                    .color = BLACK};
+  Vector2 pos = {bounds.x, bounds.y + (bounds.height - style.size) / 2.f};
+  hud_set_text(&g->hud, slot, text, pos, style);
 }
 
-void game_draw_wait_for_player_two_as_host(Game* g) {
+static uint32_t game_hud_menu(Game* g) {
+  uint32_t shown = 1u << HUD_TITLE;
+  if (menu_state != MENU_STATE_ONLINE_MENU) {
+    return shown;
+  }
+  Vector2 half_win_dims = Vector2Scale(window_dims, 0.5f);
+  Vector2 button_dims = menu_button_dims;
+  // labels sit half a button and 5 pixels above what they name
+  float above = button_dims.y / 2.f + 5;
+  game_hud_label(g, HUD_PORT_LABEL, "Port",
+                 (Rectangle){half_win_dims.x - (button_dims.x / 2.f) - menu_space_x,
+                             half_win_dims.y - (button_dims.y / 2.f) - menu_space_y * 2.f - above,
+                             button_dims.x, button_dims.y});
+  game_hud_label(g, HUD_HOST_PORT_LABEL, "Host Port",
+                 (Rectangle){half_win_dims.x - (button_dims.x / 2.f) + menu_space_x,
+                             half_win_dims.y - (button_dims.y / 2.f) - menu_space_y * 4.f - above,
+                             button_dims.x, button_dims.y});
+  game_hud_label(g, HUD_HOST_IP_LABEL, "Host IP Address",
+                 (Rectangle){half_win_dims.x - (button_dims.x / 2.f) + menu_space_x,
+                             half_win_dims.y - (button_dims.y / 2.f) - menu_space_y - above,
+                             button_dims.x, button_dims.y});
+  shown |= 1u << HUD_PORT_LABEL | 1u << HUD_HOST_PORT_LABEL | 1u << HUD_HOST_IP_LABEL;
+  const char* error = g->net_info.error_msg;
+  if (error) {
+    if (hud_stale(&g->hud, HUD_ERROR, &error, sizeof(error))) {
+      hud_set_text(&g->hud, HUD_ERROR, error, (Vector2){0, (float)((int)window_dims.y / 2)},
+                   hud_style_default(20, RED, false));
+    }
+    shown |= 1u << HUD_ERROR;
+  }
+  return shown;
+}
+
+static uint32_t game_hud_pong(Game* g) {
+  Hud* hud = &g->hud;
+  uint32_t shown = 1u << HUD_SCORE;
+  char buf[200];
+  int score[2] = {g->sim.players[0].score, g->sim.players[1].score};
+  if (hud_stale(hud, HUD_SCORE, score, sizeof(score))) {
+    snprintf(buf, sizeof(buf), "P1: %i\nP2: %i", score[0], score[1]);
+    hud_set_text(hud, HUD_SCORE, buf, (Vector2){0, 0}, hud_style_default(20, ORANGE, true));
+  }
+  if (g->overlay.shown) {
+    struct {
+      Vector2 vel;
+      int collision_count;
+      float vy[2];
+    } ball = {g->sim.ball_velocity,
+              g->sim.collision_count,
+              {g->sim.players[0].paddle_vert_velocity, g->sim.players[1].paddle_vert_velocity}};
+    if (hud_stale(hud, HUD_BALL_DEBUG, &ball, sizeof(ball))) {
+      snprintf(buf, sizeof(buf), "vel x: %f, y: %f\ncollision_count: %i\nvy0: %f\tvy1: %f",
+               ball.vel.x, ball.vel.y, ball.collision_count, ball.vy[0], ball.vy[1]);
+      hud_set_text(hud, HUD_BALL_DEBUG, buf, (Vector2){0, 40},
+                   hud_style_default(20, ORANGE, true));
+    }
+    if (hud_stale(hud, HUD_METRICS, &g->overlay.sampled_at, sizeof(g->overlay.sampled_at))) {
+      hud_set_text(hud, HUD_METRICS, g->overlay.text, (Vector2){0, 140},
+                   hud_style_default(20, DARKGRAY, true));
+    }
+    shown |= 1u << HUD_BALL_DEBUG | 1u << HUD_METRICS;
+  }
+  return shown;
+}
+
+// Brings the HUD layer to what the current state shows. Texts are formatted again only when what
+// they are formatted from changed.
+void game_update_hud(Game* g) {
+  Hud* hud = &g->hud;
+  uint32_t shown = 0;
   char buf[100];
-  const char* ip = "ip addr";
-  snprintf(buf, sizeof(buf), "Waiting for player 2 on IP Addr %s, port %s", ip, g->net_info.port);
-  DrawText(buf, 0, 0, 20, RED);
+  switch (g->game_state) {
+    case STATE_MENU:
+      shown = game_hud_menu(g);
+      break;
+    case STATE_PAUSE_MENU:
+      if (hud_stale(hud, HUD_PAUSED, &g->curr_pause_player, sizeof(g->curr_pause_player))) {
+        snprintf(buf, sizeof(buf), "Paused by player %i", g->curr_pause_player + 1);
+        hud_set_text(hud, HUD_PAUSED, buf, (Vector2){0, 0},
+                     hud_style_default(10, (Color){255, 0, 0, 255}, true));
+      }
+      shown = 1u << HUD_PAUSED | game_hud_pong(g);
+      break;
+    case STATE_PLAY:
+      shown = game_hud_pong(g);
+      break;
+    case STATE_WAIT_FOR_PLAYER_TWO_AS_HOST:
+      if (hud_stale(hud, HUD_WAITING, g->net_info.port, sizeof(g->net_info.port))) {
+        const char* ip = "ip addr";
+        snprintf(buf, sizeof(buf), "Waiting for player 2 on IP Addr %s, port %s", ip,
+                 g->net_info.port);
+        hud_set_text(hud, HUD_WAITING, buf, (Vector2){0, 0}, hud_style_default(20, RED, false));
+      }
+      shown = 1u << HUD_WAITING;
+      break;
+    default:
+      break;
+  }
+  hud_show(hud, shown);
 }
 
+// The HUD layer first, then what moves every frame over it.
 void game_draw(Game* g) {
-  DrawRectangle(0, 0, (int)window_dims.x, (int)g->viewport.y, BLACK);
-  DrawRectangle(0, (int)(g->viewport.y + g->viewport.height), (int)window_dims.x,
-                (int)(window_dims.y - (g->viewport.y + g->viewport.height)), BLACK);
-  DrawRectangle(0, (int)g->viewport.y, (int)g->viewport.x, (int)g->viewport.height, BLACK);
-  DrawRectangle((int)(g->viewport.x + g->viewport.width), (int)g->viewport.y,
-                (int)(window_dims.x - (g->viewport.x + g->viewport.width)), (int)g->viewport.height,
-                BLACK);
+  game_update_hud(g);
+  hud_draw(&g->hud);
 
   void (*draw_fns[STATE_COUNT])(Game*) = {
       [STATE_MENU] = game_draw_menu,
-      [STATE_PAUSE_MENU] = game_draw_pause_menu,
-      [STATE_PLAY] = game_draw_pong,
-      [STATE_WAIT_FOR_PLAYER_TWO_AS_HOST] = game_draw_wait_for_player_two_as_host};
+      [STATE_PAUSE_MENU] = game_draw_pong,
+      [STATE_PLAY] = game_draw_pong};
   assert(g->game_state < STATE_COUNT);
-  draw_fns[g->game_state](g);
+  if (draw_fns[g->game_state]) {
+    draw_fns[g->game_state](g);
+  }
 }
 
 void game_shutdown([[maybe_unused]] Game* g) {
-  free((void*)g->net_info.ip_addr);
-  free((void*)g->net_info.port);
+  hud_free(&g->hud);
+  ev_loop_free(&g->net_info.loop);
+  if (g->net_info.transport == TRANSPORT_UDP) {
+    udp_endpoint_free(&g->net_info.udp);
+    close(g->net_info.udp_fd);
+  }
+  buf_free(&g->net_info.in);
+  msg_buf_free(&g->net_info.msg_buf);
+  send_ring_free(&g->net_info.out);
+  netsim_free(&g->net_info.netsim);
 }
 
 int main(int argc, char* argv[]) {
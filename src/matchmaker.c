@@ -0,0 +1,159 @@
+#include "matchmaker.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// upper bounds of the latency classes, in us of round trip, the last class takes the rest
+static const uint32_t latency_class_max[MM_LATENCY_CLASSES - 1] = {20000, 50000, 100000, 200000};
+
+static uint8_t latency_class(uint32_t rtt_us) {
+  uint8_t c = 0;
+  while (c < MM_LATENCY_CLASSES - 1 && rtt_us > latency_class_max[c]) {
+    c++;
+  }
+  return c;
+}
+
+void matchmaker_init(Matchmaker* mm) {
+  *mm = (Matchmaker){};
+  for (int b = 0; b < MM_BUCKETS; b++) {
+    mm->heads[b] = -1;
+    mm->tails[b] = -1;
+  }
+}
+
+void matchmaker_free(Matchmaker* mm) {
+  free(mm->entries);
+  matchmaker_init(mm);
+}
+
+bool matchmaker_add(Matchmaker* mm, int id, Transport transport, uint16_t rating, uint32_t rtt_us,
+                    uint64_t now_ns) {
+  if (id >= mm->entries_cap) {
+    int new_cap = mm->entries_cap ? mm->entries_cap : 64;
+    while (new_cap <= id) {
+      new_cap *= 2;
+    }
+    MatchmakerEntry* new_entries = realloc(mm->entries, sizeof(MatchmakerEntry) * new_cap);
+    if (!new_entries) {
+      return false;
+    }
+    memset(new_entries + mm->entries_cap, 0, sizeof(MatchmakerEntry) * (new_cap - mm->entries_cap));
+    mm->entries = new_entries;
+    mm->entries_cap = new_cap;
+  }
+  int band = rating / MM_RATING_BAND;
+  MatchmakerEntry* e = &mm->entries[id];
+  *e = (MatchmakerEntry){.queued = true,
+                         .transport = transport,
+                         .band = (uint8_t)(band < MM_RATING_BANDS ? band : MM_RATING_BANDS - 1),
+                         .latency_class = latency_class(rtt_us),
+                         .joined_ns = now_ns,
+                         .prev = -1,
+                         .next = -1};
+  e->bucket = ((int)transport * MM_RATING_BANDS + e->band) * MM_LATENCY_CLASSES + e->latency_class;
+  int tail = mm->tails[e->bucket];
+  if (tail >= 0) {
+    mm->entries[tail].next = id;
+    e->prev = tail;
+  } else {
+    mm->heads[e->bucket] = id;
+  }
+  mm->tails[e->bucket] = id;
+  mm->waiting++;
+  return true;
+}
+
+void matchmaker_remove(Matchmaker* mm, int id) {
+  if (!matchmaker_queued(mm, id)) {
+    return;
+  }
+  MatchmakerEntry* e = &mm->entries[id];
+  if (e->prev >= 0) {
+    mm->entries[e->prev].next = e->next;
+  } else {
+    mm->heads[e->bucket] = e->next;
+  }
+  if (e->next >= 0) {
+    mm->entries[e->next].prev = e->prev;
+  } else {
+    mm->tails[e->bucket] = e->prev;
+  }
+  e->queued = false;
+  mm->waiting--;
+}
+
+static void pair_take(Matchmaker* mm, int a, int b, MatchmakerPair* out) {
+  if (mm->entries[b].joined_ns < mm->entries[a].joined_ns) {
+    int t = a;
+    a = b;
+    b = t;
+  }
+  *out = (MatchmakerPair){.ids = {a, b},
+                          .joined_ns = {mm->entries[a].joined_ns, mm->entries[b].joined_ns},
+                          .transport = mm->entries[a].transport};
+  matchmaker_remove(mm, a);
+  matchmaker_remove(mm, b);
+}
+
+typedef struct LoneWaiter {
+  uint64_t joined_ns;
+  int id;
+} LoneWaiter;
+
+static int cmp_lone(const void* a, const void* b) {
+  uint64_t x = ((const LoneWaiter*)a)->joined_ns, y = ((const LoneWaiter*)b)->joined_ns;
+  return (x > y) - (x < y);
+}
+
+int matchmaker_pair(Matchmaker* mm, uint64_t now_ns, MatchmakerPair* out, int cap) {
+  int n = 0;
+  // within buckets, oldest with oldest
+  for (int b = 0; b < MM_BUCKETS && n < cap; b++) {
+    while (n < cap && mm->heads[b] >= 0 && mm->entries[mm->heads[b]].next >= 0) {
+      int a = mm->heads[b];
+      pair_take(mm, a, mm->entries[a].next, &out[n++]);
+    }
+  }
+  if (n == cap || mm->waiting < 2) {
+    return n;
+  }
+
+  // every bucket holds one player at most now, the longest waiting ones get to pick first
+  LoneWaiter lone[MM_BUCKETS];
+  int lone_count = 0;
+  for (int b = 0; b < MM_BUCKETS; b++) {
+    if (mm->heads[b] >= 0) {
+      lone[lone_count++] = (LoneWaiter){mm->entries[mm->heads[b]].joined_ns, mm->heads[b]};
+    }
+  }
+  qsort(lone, lone_count, sizeof(lone[0]), cmp_lone);
+  for (int i = 0; i < lone_count && n < cap; i++) {
+    const MatchmakerEntry* e = &mm->entries[lone[i].id];
+    if (!e->queued) {
+      continue;
+    }
+    uint64_t window = (now_ns - e->joined_ns) / MM_WIDEN_NS;
+    if (window == 0) {
+      break;  // nobody after this one has waited long enough either
+    }
+    int best = -1;
+    uint64_t best_dist = UINT64_MAX;
+    for (int j = i + 1; j < lone_count; j++) {
+      const MatchmakerEntry* o = &mm->entries[lone[j].id];
+      if (!o->queued || o->transport != e->transport) {
+        continue;
+      }
+      uint64_t dr = (uint64_t)abs(o->band - e->band);
+      uint64_t dl = (uint64_t)abs(o->latency_class - e->latency_class);
+      if (dr <= window && dl <= window && dr + dl < best_dist) {
+        best = lone[j].id;
+        best_dist = dr + dl;
+      }
+    }
+    if (best >= 0) {
+      pair_take(mm, lone[i].id, best, &out[n++]);
+    }
+  }
+  return n;
+}
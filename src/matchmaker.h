@@ -0,0 +1,73 @@
+#ifndef PONG_GAME_MATCHMAKER_H
+#define PONG_GAME_MATCHMAKER_H
+
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Pairs waiting players by transport, rating and round trip to the server. Players wait in FIFO
+// buckets, one per transport, rating band and latency class. A batch pass, run once a tick, first
+// pairs the oldest players of every bucket with each other, then lets players who have been
+// waiting pair across buckets: each MM_WIDEN_NS waited widens by one how many rating bands and
+// latency classes away an opponent may be. Players of different transports never meet.
+//
+// Ids are small non-negative ints, the server uses fds. Nothing allocates once the entry table
+// covers the highest id.
+
+#define MM_RATING_BAND 100
+#define MM_RATING_BANDS 32  // ratings past the last band share it
+#define MM_LATENCY_CLASSES 5
+#define MM_BUCKETS (TRANSPORT_COUNT * MM_RATING_BANDS * MM_LATENCY_CLASSES)
+#define MM_WIDEN_NS 1000000000ull
+
+typedef struct MatchmakerEntry {
+  bool queued;
+  Transport transport;
+  uint8_t band;
+  uint8_t latency_class;
+  int bucket;
+  uint64_t joined_ns;
+  int prev;  // ids in the bucket's queue, -1 at either end
+  int next;
+} MatchmakerEntry;
+
+typedef struct MatchmakerPair {
+  int ids[2];  // the one that waited longer first
+  uint64_t joined_ns[2];
+  Transport transport;
+} MatchmakerPair;
+
+typedef struct Matchmaker {
+  MatchmakerEntry* entries;  // indexed by id
+  int entries_cap;
+  int heads[MM_BUCKETS];  // oldest of each bucket, -1 if empty
+  int tails[MM_BUCKETS];
+  int waiting;
+} Matchmaker;
+
+void matchmaker_init(Matchmaker* mm);
+void matchmaker_free(Matchmaker* mm);
+
+/**
+ * Queues id, which must not be queued already. rtt_us is the round trip to the server as far as
+ * it is known, 0 if it isn't.
+ * @return false if out of memory
+ */
+bool matchmaker_add(Matchmaker* mm, int id, Transport transport, uint16_t rating, uint32_t rtt_us,
+                    uint64_t now_ns);
+
+/** Takes id out of the queue, if it is in it. */
+void matchmaker_remove(Matchmaker* mm, int id);
+
+static inline bool matchmaker_queued(const Matchmaker* mm, int id) {
+  return id < mm->entries_cap && mm->entries[id].queued;
+}
+
+/**
+ * The batch pass. Pairs up to cap pairs of waiting players into out and takes them out of the
+ * queue, the rest keep waiting for the next pass.
+ * @return pairs written to out
+ */
+int matchmaker_pair(Matchmaker* mm, uint64_t now_ns, MatchmakerPair* out, int cap);
+
+#endif  // PONG_GAME_MATCHMAKER_H
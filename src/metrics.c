@@ -0,0 +1,125 @@
+#include "metrics.h"
+
+static uint64_t metric_hist_bucket_low(int idx) {
+  if (idx < METRIC_HIST_LINEAR) {
+    return (uint64_t)idx;
+  }
+  int b = (idx - METRIC_HIST_LINEAR) / METRIC_HIST_SUB_BUCKETS + 4;
+  return (uint64_t)(METRIC_HIST_SUB_BUCKETS + (idx - METRIC_HIST_LINEAR) % METRIC_HIST_SUB_BUCKETS)
+         << (b - 3);
+}
+
+uint64_t metric_hist_quantile(const MetricHist* h, double q) {
+  uint64_t rank = (uint64_t)(q * (double)metric_get(&h->total));
+  uint64_t seen = 0;
+  for (int i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    seen += metric_get(&h->counts[i]);
+    if (seen > rank) {
+      return metric_hist_bucket_low(i);
+    }
+  }
+  return metric_get(&h->max);
+}
+
+void metric_hist_merge(MetricHist* into, const MetricHist* h) {
+  for (int i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    metric_add(&into->counts[i], metric_get(&h->counts[i]));
+  }
+  metric_add(&into->total, metric_get(&h->total));
+  metric_add(&into->sum, metric_get(&h->sum));
+  if (metric_get(&h->max) > metric_get(&into->max)) {
+    metric_set(&into->max, metric_get(&h->max));
+  }
+}
+
+void metric_hist_reset(MetricHist* h) {
+  for (int i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    metric_set(&h->counts[i], 0);
+  }
+  metric_set(&h->total, 0);
+  metric_set(&h->sum, 0);
+  metric_set(&h->max, 0);
+}
+
+void metric_hist_since(MetricHist* out, const MetricHist* h, const MetricHist* before) {
+  for (int i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    metric_set(&out->counts[i], metric_get(&h->counts[i]) - metric_get(&before->counts[i]));
+  }
+  metric_set(&out->total, metric_get(&h->total) - metric_get(&before->total));
+  metric_set(&out->sum, metric_get(&h->sum) - metric_get(&before->sum));
+  metric_set(&out->max, metric_get(&h->max));
+}
+
+void metrics_merge(Metrics* into, const Metrics* m) {
+  metric_hist_merge(&into->tick_ns, &m->tick_ns);
+  metric_add(&into->bytes_in, metric_get(&m->bytes_in));
+  metric_add(&into->bytes_out, metric_get(&m->bytes_out));
+  metric_add(&into->packets_in, metric_get(&m->packets_in));
+  metric_add(&into->packets_out, metric_get(&m->packets_out));
+  metric_add(&into->frames, metric_get(&m->frames));
+  metric_add(&into->parse_errors, metric_get(&m->parse_errors));
+  metric_add(&into->send_queue_bytes, metric_get(&m->send_queue_bytes));
+  if (metric_get(&m->send_queue_max) > metric_get(&into->send_queue_max)) {
+    metric_set(&into->send_queue_max, metric_get(&m->send_queue_max));
+  }
+  metric_hist_merge(&into->rtt_us, &m->rtt_us);
+}
+
+static void write_counter(FILE* f, const char* prefix, const char* name, const char* help,
+                          const MetricCounter* c) {
+  fprintf(f, "# HELP %s%s %s\n# TYPE %s%s counter\n%s%s %llu\n", prefix, name, help, prefix, name,
+          prefix, name, (unsigned long long)metric_get(c));
+}
+
+static void write_gauge(FILE* f, const char* prefix, const char* name, const char* help,
+                        const MetricCounter* c) {
+  fprintf(f, "# HELP %s%s %s\n# TYPE %s%s gauge\n%s%s %llu\n", prefix, name, help, prefix, name,
+          prefix, name, (unsigned long long)metric_get(c));
+}
+
+void metric_hist_write_prometheus(FILE* f, const char* prefix, const char* name, const char* help,
+                                  const MetricHist* h, double scale) {
+  fprintf(f, "# HELP %s%s %s\n# TYPE %s%s histogram\n", prefix, name, help, prefix, name);
+  // each count is read once and +Inf and _count are their sum, so the buckets stay consistent
+  // with each other while the owner keeps recording
+  uint64_t max = metric_get(&h->max);
+  uint64_t cumulative = 0;
+  int i = 0;
+  for (int b = 4; b < 48 && (b == 4 || (1ull << (b - 1)) <= max); b++) {
+    // everything below 2^b, samples are whole units so that is everything up to 2^b - 1
+    int end = METRIC_HIST_LINEAR + (b - 4) * METRIC_HIST_SUB_BUCKETS;
+    for (; i < end; i++) {
+      cumulative += metric_get(&h->counts[i]);
+    }
+    fprintf(f, "%s%s_bucket{le=\"%.15g\"} %llu\n", prefix, name, (double)((1ull << b) - 1) * scale,
+            (unsigned long long)cumulative);
+  }
+  for (; i < METRIC_HIST_BUCKETS; i++) {
+    cumulative += metric_get(&h->counts[i]);
+  }
+  fprintf(f, "%s%s_bucket{le=\"+Inf\"} %llu\n%s%s_sum %g\n%s%s_count %llu\n", prefix, name,
+          (unsigned long long)cumulative, prefix, name, (double)metric_get(&h->sum) * scale, prefix,
+          name, (unsigned long long)cumulative);
+}
+
+void metrics_write_prometheus(FILE* f, const char* prefix, const Metrics* m) {
+  metric_hist_write_prometheus(f, prefix, "tick_duration_seconds",
+                               "Time spent per tick, flush included.", &m->tick_ns, 1e-9);
+  write_counter(f, prefix, "received_bytes_total", "Bytes received on both transports.",
+                &m->bytes_in);
+  write_counter(f, prefix, "sent_bytes_total", "Bytes sent on both transports.", &m->bytes_out);
+  write_counter(f, prefix, "received_datagrams_total", "Udp datagrams received.",
+                &m->packets_in);
+  write_counter(f, prefix, "sent_datagrams_total", "Udp datagrams sent.", &m->packets_out);
+  write_counter(f, prefix, "frames_parsed_total", "Messages parsed.", &m->frames);
+  write_counter(f, prefix, "parse_errors_total",
+                "Oversized frames, malformed datagrams and undecodable messages.",
+                &m->parse_errors);
+  write_gauge(f, prefix, "send_queue_bytes", "Stream bytes left queued after the last flush.",
+              &m->send_queue_bytes);
+  write_gauge(f, prefix, "send_queue_max_bytes",
+              "Longest single connection queue after the last flush.", &m->send_queue_max);
+  metric_hist_write_prometheus(f, prefix, "rtt_seconds",
+                               "Connection round trip times, sampled once a second.", &m->rtt_us,
+                               1e-6);
+}
@@ -0,0 +1,93 @@
+#ifndef PONG_GAME_METRICS_H
+#define PONG_GAME_METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Hot path instrumentation. Every thread owns its Metrics and is the only one writing them, so
+// recording is a relaxed load and store: no lock, no read-modify-write, no shared cache line.
+// Other threads read and sum them whenever they like, off the hot path, and may see a value a
+// little late but never torn.
+
+typedef _Atomic uint64_t MetricCounter;
+
+static inline uint64_t metric_get(const MetricCounter* c) {
+  return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static inline void metric_set(MetricCounter* c, uint64_t v) {
+  atomic_store_explicit(c, v, memory_order_relaxed);
+}
+
+/** Only the owning thread may add. */
+static inline void metric_add(MetricCounter* c, uint64_t n) { metric_set(c, metric_get(c) + n); }
+
+// Log-linear histogram in the style of HDR histograms: exact up to 15, then 8 buckets per power of
+// two, so a bucket's lower bound is within 12.5% of everything in it. Covers up to 2^48.
+#define METRIC_HIST_LINEAR 16
+#define METRIC_HIST_SUB_BUCKETS 8
+#define METRIC_HIST_BUCKETS (METRIC_HIST_LINEAR + METRIC_HIST_SUB_BUCKETS * 44)
+
+typedef struct MetricHist {
+  MetricCounter counts[METRIC_HIST_BUCKETS];
+  MetricCounter total;
+  MetricCounter sum;
+  MetricCounter max;
+} MetricHist;
+
+static inline int metric_hist_bucket(uint64_t v) {
+  if (v < METRIC_HIST_LINEAR) {
+    return (int)v;
+  }
+  int b = 63 - __builtin_clzll(v);
+  int idx = METRIC_HIST_LINEAR + (b - 4) * METRIC_HIST_SUB_BUCKETS + (int)((v >> (b - 3)) & 7);
+  return idx < METRIC_HIST_BUCKETS ? idx : METRIC_HIST_BUCKETS - 1;
+}
+
+/** Only the owning thread may record. */
+static inline void metric_hist_record(MetricHist* h, uint64_t v) {
+  metric_add(&h->counts[metric_hist_bucket(v)], 1);
+  metric_add(&h->total, 1);
+  metric_add(&h->sum, v);
+  if (v > metric_get(&h->max)) {
+    metric_set(&h->max, v);
+  }
+}
+
+/** @return lower bound of the bucket holding the q quantile, 0 without samples */
+uint64_t metric_hist_quantile(const MetricHist* h, double q);
+/** Adds h to into, which must be owned by the calling thread. */
+void metric_hist_merge(MetricHist* into, const MetricHist* h);
+void metric_hist_reset(MetricHist* h);
+/** Sets out to what was recorded into h since it looked like before, max stays h's. */
+void metric_hist_since(MetricHist* out, const MetricHist* h, const MetricHist* before);
+
+/**
+ * Writes h as a Prometheus histogram with a bucket up to every power of two minus one up to its
+ * largest sample, scale converts the recorded unit to the exported one.
+ */
+void metric_hist_write_prometheus(FILE* f, const char* prefix, const char* name, const char* help,
+                                  const MetricHist* h, double scale);
+
+// What a server worker or the client records on its tick path.
+typedef struct Metrics {
+  MetricHist tick_ns;  // a whole tick including the flush of what it sent
+  MetricCounter bytes_in;
+  MetricCounter bytes_out;
+  MetricCounter packets_in;  // datagrams
+  MetricCounter packets_out;
+  MetricCounter frames;            // messages parsed, on either transport
+  MetricCounter parse_errors;      // oversized frames, malformed datagrams, undecodable messages
+  MetricCounter send_queue_bytes;  // gauge, stream bytes the sockets didn't take at the last flush
+  MetricCounter send_queue_max;    // gauge, the longest single queue at the last flush
+  MetricHist rtt_us;               // every connection's round trip, sampled about once a second
+} Metrics;
+
+/** Adds m to into, gauges included, into must be owned by the calling thread. */
+void metrics_merge(Metrics* into, const Metrics* m);
+
+/** Writes m in the Prometheus text exposition format, every name prefixed with prefix. */
+void metrics_write_prometheus(FILE* f, const char* prefix, const Metrics* m);
+
+#endif  // PONG_GAME_METRICS_H
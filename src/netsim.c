@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+#include "netsim.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+struct NetSimPacket {
+  NetSimPacket* next;
+  uint64_t due;  // slot
+  int fd;
+  uint32_t gen;
+  bool stream;
+  socklen_t addr_len;  // 0 for a connected socket
+  struct sockaddr_storage addr;
+  size_t len;
+  uint8_t data[NETSIM_PACKET_MAX];
+};
+
+static bool key_is(const char* key, size_t len, const char* name) {
+  return strlen(name) == len && memcmp(key, name, len) == 0;
+}
+
+bool netsim_profile_parse(NetSimProfile* p, const char* spec) {
+  *p = (NetSimProfile){.seed = 1};
+  while (*spec) {
+    const char* eq = strchr(spec, '=');
+    if (!eq) {
+      return false;
+    }
+    size_t key_len = (size_t)(eq - spec);
+    char* end;
+    double v = strtod(eq + 1, &end);
+    if (end == eq + 1 || (*end && *end != ',') || v < 0) {
+      return false;
+    }
+    if (key_is(spec, key_len, "latency") && v <= 10000) {
+      p->latency_ms = (uint32_t)v;
+    } else if (key_is(spec, key_len, "jitter") && v <= 10000) {
+      p->jitter_ms = (uint32_t)v;
+    } else if (key_is(spec, key_len, "loss") && v <= 100) {
+      p->loss = (float)(v / 100);
+    } else if (key_is(spec, key_len, "dup") && v <= 100) {
+      p->duplicate = (float)(v / 100);
+    } else if (key_is(spec, key_len, "reorder") && v <= 100) {
+      p->reorder = (float)(v / 100);
+    } else if (key_is(spec, key_len, "seed") && v <= UINT32_MAX) {
+      p->seed = (uint32_t)v;
+    } else {
+      return false;
+    }
+    spec = *end ? end + 1 : end;
+  }
+  return true;
+}
+
+int netsim_init(NetSim* ns, const NetSimProfile* profile, uint64_t now_ns) {
+  *ns = (NetSim){.batch_fd = -1};
+  if (!profile) {
+    return 0;
+  }
+  ns->enabled = true;
+  ns->profile = *profile;
+  ns->rng = profile->seed;
+  ns->slot = now_ns / NETSIM_SLOT_NS;
+  pool_init(&ns->packets, sizeof(NetSimPacket), 64);
+  ns->batch = calloc(NETSIM_SEND_BATCH, sizeof(struct mmsghdr));
+  ns->batch_iov = calloc(NETSIM_SEND_BATCH, sizeof(struct iovec));
+  ns->batch_packets = calloc(NETSIM_SEND_BATCH, sizeof(NetSimPacket*));
+  return ns->batch && ns->batch_iov && ns->batch_packets ? 0 : -1;
+}
+
+void netsim_free(NetSim* ns) {
+  if (!ns->enabled) {
+    return;
+  }
+  for (int fd = 0; fd < ns->fds_cap; fd++) {
+    send_ring_free(&ns->fds[fd].wire);
+  }
+  free(ns->fds);
+  free(ns->batch);
+  free(ns->batch_iov);
+  free(ns->batch_packets);
+  // every queued packet lives in the pool's slabs
+  pool_free(&ns->packets);
+  *ns = (NetSim){.batch_fd = -1};
+}
+
+// splitmix64, cheap and good enough for coin flips
+static double netsim_uniform(NetSim* ns) {
+  uint64_t z = (ns->rng += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  z ^= z >> 31;
+  return (double)(z >> 11) / (double)(1ull << 53);
+}
+
+static NetSimFd* netsim_fd(NetSim* ns, int fd) {
+  if (fd >= ns->fds_cap) {
+    int cap = ns->fds_cap ? ns->fds_cap : 64;
+    while (cap <= fd) {
+      cap *= 2;
+    }
+    NetSimFd* fds = realloc(ns->fds, sizeof(NetSimFd) * cap);
+    if (!fds) {
+      return nullptr;
+    }
+    memset(fds + ns->fds_cap, 0, sizeof(NetSimFd) * (cap - ns->fds_cap));
+    ns->fds = fds;
+    ns->fds_cap = cap;
+  }
+  return &ns->fds[fd];
+}
+
+// in slots from now, latency with jitter either way
+static uint64_t netsim_delay(NetSim* ns) {
+  double ms = ns->profile.latency_ms + (netsim_uniform(ns) * 2 - 1) * ns->profile.jitter_ms;
+  return ms > 0 ? (uint64_t)(ms * 1e6 / NETSIM_SLOT_NS) : 0;
+}
+
+static void netsim_schedule(NetSim* ns, NetSimPacket* p, uint64_t due) {
+  p->due = due < ns->slot ? ns->slot : due;
+  p->next = nullptr;
+  int idx = (int)(p->due & (NETSIM_WHEEL_SLOTS - 1));
+  if (ns->slot_tails[idx]) {
+    ns->slot_tails[idx]->next = p;
+  } else {
+    ns->slots[idx] = p;
+  }
+  ns->slot_tails[idx] = p;
+}
+
+ssize_t netsim_ring_write(NetSim* ns, SendRing* r, int fd, const void* data, size_t len,
+                          uint64_t now_ns) {
+  if (!ns->enabled) {
+    return send_ring_write(r, fd, data, len);
+  }
+  NetSimFd* f = netsim_fd(ns, fd);
+  if (!f) {
+    return -1;
+  }
+  size_t pending = send_ring_pending(r);
+  size_t total = pending + len;
+  if (!total) {
+    return 0;
+  }
+  uint64_t due = now_ns / NETSIM_SLOT_NS + netsim_delay(ns);
+  if (netsim_uniform(ns) < ns->profile.loss) {
+    due += NETSIM_STREAM_RTO_MS * 1000000ull / NETSIM_SLOT_NS;
+  }
+  if (due < f->last_due) {
+    due = f->last_due;
+  }
+  f->last_due = due;
+  for (size_t off = 0; off < total;) {
+    NetSimPacket* p = pool_alloc(&ns->packets);
+    if (!p) {
+      return -1;
+    }
+    *p = (NetSimPacket){.fd = fd, .gen = f->gen, .stream = true};
+    while (p->len < NETSIM_PACKET_MAX && off < total) {
+      if (off < pending) {
+        size_t idx = (r->head + off) & (r->cap - 1);
+        size_t n = r->cap - idx;
+        n = n < pending - off ? n : pending - off;
+        n = n < NETSIM_PACKET_MAX - p->len ? n : NETSIM_PACKET_MAX - p->len;
+        memcpy(p->data + p->len, r->data + idx, n);
+        p->len += n;
+        off += n;
+      } else {
+        size_t n = total - off;
+        n = n < NETSIM_PACKET_MAX - p->len ? n : NETSIM_PACKET_MAX - p->len;
+        memcpy(p->data + p->len, (const uint8_t*)data + (off - pending), n);
+        p->len += n;
+        off += n;
+      }
+    }
+    netsim_schedule(ns, p, due);
+  }
+  r->head = r->tail;
+  return (ssize_t)total;
+}
+
+static void netsim_queue_datagram(NetSim* ns, const NetSimPacket* src, uint64_t now_slot) {
+  NetSimPacket* p = pool_alloc(&ns->packets);
+  if (!p) {
+    return;
+  }
+  memcpy(p, src, offsetof(NetSimPacket, data) + src->len);
+  // reordered datagrams skip the latency like netem's reorder, so they overtake the ones queued
+  // before them
+  uint64_t delay = netsim_uniform(ns) < ns->profile.reorder ? 0 : netsim_delay(ns);
+  netsim_schedule(ns, p, now_slot + delay);
+}
+
+void netsim_sendmsg(NetSim* ns, int fd, const struct msghdr* msg, uint64_t now_ns) {
+  if (!ns->enabled) {
+    sendmsg(fd, msg, 0);
+    return;
+  }
+  NetSimFd* f = netsim_fd(ns, fd);
+  if (!f || netsim_uniform(ns) < ns->profile.loss) {
+    return;
+  }
+  NetSimPacket pkt = {.fd = fd, .gen = f->gen, .addr_len = msg->msg_namelen};
+  if (pkt.addr_len > sizeof(pkt.addr)) {
+    return;
+  }
+  if (pkt.addr_len) {
+    memcpy(&pkt.addr, msg->msg_name, pkt.addr_len);
+  }
+  for (size_t i = 0; i < msg->msg_iovlen; i++) {
+    const struct iovec* v = &msg->msg_iov[i];
+    if (pkt.len + v->iov_len > NETSIM_PACKET_MAX) {
+      return;
+    }
+    memcpy(pkt.data + pkt.len, v->iov_base, v->iov_len);
+    pkt.len += v->iov_len;
+  }
+  uint64_t now_slot = now_ns / NETSIM_SLOT_NS;
+  netsim_queue_datagram(ns, &pkt, now_slot);
+  if (netsim_uniform(ns) < ns->profile.duplicate) {
+    netsim_queue_datagram(ns, &pkt, now_slot);
+  }
+}
+
+ssize_t netsim_udp_flush(NetSim* ns, UdpEndpoint* ep, int fd, uint64_t now_ns) {
+  if (!ns->enabled) {
+    return udp_flush(ep, fd, now_ns);
+  }
+  UdpPacketOut out;
+  if (!udp_prepare_packet(ep, now_ns, &out)) {
+    return 0;
+  }
+  struct msghdr msg;
+  udp_packet_msghdr(ep, &out, &msg);
+  netsim_sendmsg(ns, fd, &msg, now_ns);
+  udp_packet_sent(ep);
+  return (ssize_t)out.len;
+}
+
+static void netsim_send_batch(NetSim* ns) {
+  int off = 0;
+  while (off < ns->batch_count) {
+    int n = sendmmsg(ns->batch_fd, ns->batch + off, ns->batch_count - off, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;  // dropped like any datagram that doesn't fit the socket buffer
+    }
+    off += n;
+  }
+  for (int i = 0; i < ns->batch_count; i++) {
+    pool_release(&ns->packets, ns->batch_packets[i]);
+  }
+  ns->batch_count = 0;
+}
+
+static void netsim_release_datagram(NetSim* ns, NetSimPacket* p) {
+  if (ns->batch_count == NETSIM_SEND_BATCH || (ns->batch_count && ns->batch_fd != p->fd)) {
+    netsim_send_batch(ns);
+  }
+  int i = ns->batch_count++;
+  ns->batch_fd = p->fd;
+  ns->batch_packets[i] = p;
+  ns->batch_iov[i] = (struct iovec){p->data, p->len};
+  ns->batch[i].msg_hdr = (struct msghdr){.msg_name = p->addr_len ? &p->addr : nullptr,
+                                         .msg_namelen = p->addr_len,
+                                         .msg_iov = &ns->batch_iov[i],
+                                         .msg_iovlen = 1};
+}
+
+// A stream whose socket fails is shut down, its owner then sees it close on the next read.
+static void netsim_stream_write(NetSim* ns, NetSimFd* f, int fd, const void* data, size_t len) {
+  bool was_backed_up = send_ring_pending(&f->wire) > 0;
+  if (send_ring_write(&f->wire, fd, data, len) == -1) {
+    shutdown(fd, SHUT_RDWR);
+    netsim_forget(ns, fd);
+    return;
+  }
+  ns->backed_up += (send_ring_pending(&f->wire) > 0) - was_backed_up;
+}
+
+static void netsim_fire(NetSim* ns, uint64_t slot) {
+  int idx = (int)(slot & (NETSIM_WHEEL_SLOTS - 1));
+  NetSimPacket* p = ns->slots[idx];
+  ns->slots[idx] = ns->slot_tails[idx] = nullptr;
+  while (p) {
+    NetSimPacket* next = p->next;
+    NetSimFd* f = &ns->fds[p->fd];
+    if (p->due > slot) {
+      netsim_schedule(ns, p, p->due);  // a later turn of the wheel
+    } else if (p->gen != f->gen) {
+      pool_release(&ns->packets, p);
+    } else if (p->stream) {
+      netsim_stream_write(ns, f, p->fd, p->data, p->len);
+      pool_release(&ns->packets, p);
+    } else {
+      netsim_release_datagram(ns, p);
+    }
+    p = next;
+  }
+}
+
+void netsim_poll(NetSim* ns, uint64_t now_ns) {
+  if (!ns->enabled) {
+    return;
+  }
+  // streams that filled their socket buffer retry before anything newer goes out behind them
+  for (int fd = 0; ns->backed_up > 0 && fd < ns->fds_cap; fd++) {
+    if (send_ring_pending(&ns->fds[fd].wire)) {
+      netsim_stream_write(ns, &ns->fds[fd], fd, nullptr, 0);
+    }
+  }
+  uint64_t now = now_ns / NETSIM_SLOT_NS;
+  for (; ns->slot <= now; ns->slot++) {
+    netsim_fire(ns, ns->slot);
+  }
+  netsim_send_batch(ns);
+}
+
+void netsim_forget(NetSim* ns, int fd) {
+  if (!ns->enabled || fd >= ns->fds_cap) {
+    return;
+  }
+  NetSimFd* f = &ns->fds[fd];
+  ns->backed_up -= send_ring_pending(&f->wire) > 0;
+  f->wire.head = f->wire.tail;
+  f->last_due = 0;
+  f->gen++;
+}
@@ -0,0 +1,107 @@
+#ifndef PONG_GAME_NETSIM_H
+#define PONG_GAME_NETSIM_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "arena.h"
+#include "networking.h"
+#include "udp.h"
+
+// Network condition simulator underneath the transports. Outgoing datagrams and stream writes are
+// copied into a timer wheel of 1 ms slots instead of being sent, and go out from netsim_poll once
+// their delay passed, so a bad network can be had on loopback without root, tc or netem. Every
+// decision comes from a seeded generator: the same profile and the same traffic give the same
+// network.
+//
+// Datagrams are delayed, jittered, dropped, duplicated and reordered. A stream can't lose or
+// reorder bytes, so its writes keep their order, and a lost write stalls the stream for a
+// retransmission timeout instead.
+
+typedef struct NetSimProfile {
+  uint32_t latency_ms;  // added one way
+  uint32_t jitter_ms;   // the delay varies by up to this much either way
+  float loss;           // chance to drop a datagram, or to stall a stream write
+  float duplicate;      // chance to send a datagram twice
+  float reorder;        // chance to send a datagram without the latency, overtaking earlier ones
+  uint32_t seed;
+} NetSimProfile;
+
+// profile read by the programs that support the simulator, see netsim_profile_parse
+#define NETSIM_ENV "PONG_NETSIM"
+
+/**
+ * Parses a profile like "latency=80,jitter=20,loss=5,dup=1,reorder=2,seed=7", chances in percent.
+ * Keys left out are 0, the seed 1.
+ * @return false on an unknown key or a value out of range
+ */
+bool netsim_profile_parse(NetSimProfile* p, const char* spec);
+
+#define NETSIM_SLOT_NS 1000000ull
+// power of two, a delay longer than a turn of the wheel waits in its slot for more turns
+#define NETSIM_WHEEL_SLOTS 1024
+// stream writes are split into packets this size
+#define NETSIM_PACKET_MAX UDP_MAX_PACKET
+// Linux's minimum retransmission timeout, what a lost stream write costs
+#define NETSIM_STREAM_RTO_MS 200
+// due datagrams go out in sendmmsg batches of this many
+#define NETSIM_SEND_BATCH 64
+
+typedef struct NetSimPacket NetSimPacket;
+
+typedef struct NetSimFd {
+  SendRing wire;      // released stream bytes the socket didn't take yet
+  uint64_t last_due;  // in slots, a stream's writes are released in order
+  uint32_t gen;       // bumped by netsim_forget, packets of an older generation are dropped
+} NetSimFd;
+
+typedef struct NetSim {
+  bool enabled;
+  NetSimProfile profile;
+  uint64_t rng;
+  Pool packets;
+  NetSimPacket* slots[NETSIM_WHEEL_SLOTS];
+  NetSimPacket* slot_tails[NETSIM_WHEEL_SLOTS];
+  uint64_t slot;  // next slot to fire, in NETSIM_SLOT_NS since the clock's epoch
+  NetSimFd* fds;  // indexed by fd
+  int fds_cap;
+  int backed_up;  // streams with bytes in their wire ring
+
+  int batch_fd;
+  int batch_count;
+  struct mmsghdr* batch;  // NETSIM_SEND_BATCH each
+  struct iovec* batch_iov;
+  NetSimPacket** batch_packets;
+} NetSim;
+
+/**
+ * Without a profile ns stays disabled and everything below passes straight through.
+ * @return -1 if out of memory
+ */
+int netsim_init(NetSim* ns, const NetSimProfile* profile, uint64_t now_ns);
+void netsim_free(NetSim* ns);
+
+/**
+ * send_ring_write through the simulator: the bytes queued in r and len bytes at data are taken
+ * as one write and r is left empty.
+ * @return bytes taken, -1 if the connection failed
+ */
+ssize_t netsim_ring_write(NetSim* ns, SendRing* r, int fd, const void* data, size_t len,
+                          uint64_t now_ns);
+
+/** Queues the datagram described by msg, which may be reused as soon as this returns. */
+void netsim_sendmsg(NetSim* ns, int fd, const struct msghdr* msg, uint64_t now_ns);
+
+/** udp_flush through the simulator. */
+ssize_t netsim_udp_flush(NetSim* ns, UdpEndpoint* ep, int fd, uint64_t now_ns);
+
+/**
+ * Sends everything that is due. Call it at least every few ms, its resolution is how often it
+ * runs.
+ */
+void netsim_poll(NetSim* ns, uint64_t now_ns);
+
+/** Drops whatever is still queued for fd, call it before closing fd. */
+void netsim_forget(NetSim* ns, int fd);
+
+#endif  // PONG_GAME_NETSIM_H
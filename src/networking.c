@@ -5,17 +5,23 @@
 #include "networking.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <netdb.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/uio.h>
+#include <unistd.h>
 
 struct addrinfo* get_addr_info(const char* port, const char* host_name) {
+  return get_addr_info_socktype(port, host_name, SOCK_STREAM);
+}
+
+struct addrinfo* get_addr_info_socktype(const char* port, const char* host_name, int socktype) {
   int status;
   struct addrinfo hints = {0};
   struct addrinfo* server_info = nullptr;
   hints.ai_family = AF_UNSPEC;  // don't care ipv4 or 6
-  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_socktype = socktype;
   hints.ai_flags = AI_PASSIVE;  // fill my IP for me
   if ((status = getaddrinfo(host_name, port, &hints, &server_info)) != 0) {
     fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
@@ -38,23 +44,46 @@ int open_and_listen_socket(struct addrinfo* addr_info) {
     return -1;
   }
 
-  if ((status = listen(sock_fd, 20))) {
+  if ((status = listen(sock_fd, SOMAXCONN))) {
     perror("listen");
     return -1;
   }
 
   return sock_fd;
 }
+
+int open_udp_socket(struct addrinfo* addr_info) {
+  int sock_fd = socket(addr_info->ai_family, SOCK_DGRAM, 0);
+  if (sock_fd == -1) {
+    perror("socket");
+    return -1;
+  }
+  int yes = 1;
+  setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes);
+  if (bind(sock_fd, addr_info->ai_addr, addr_info->ai_addrlen)) {
+    perror("bind");
+    close(sock_fd);
+    return -1;
+  }
+  return sock_fd;
+}
+
+void msg_hdr_write(uint8_t* out, uint32_t type, uint32_t len) {
+  wire_put_u32(out, type);
+  wire_put_u32(out + 4, len);
+}
+
 int frame_try_parse(Frame* frame, void* data, size_t size) {
   if (size < MSG_HDR_SIZE) {
     return 0;
   }
 
-  uint32_t type;
-  uint32_t len;
-  memcpy(&type, data, sizeof(uint32_t));
-  memcpy(&len, (uint8_t*)data + sizeof(uint32_t), 4);
+  uint32_t type = wire_get_u32(data);
+  uint32_t len = wire_get_u32((uint8_t*)data + 4);
 
+  if (len > MSG_MAX_PAYLOAD) {
+    return -1;
+  }
   size_t frame_tot_size = len + MSG_HDR_SIZE;
   if (size < frame_tot_size) {
     return 0;
@@ -64,23 +93,79 @@ int frame_try_parse(Frame* frame, void* data, size_t size) {
   frame->hdr.len = len;
   return (int)(frame->hdr.len + MSG_HDR_SIZE);
 }
+
+// Whatever is left after parsing is less than a frame, so with a read on top it still fits.
+static_assert(BUF_MAX_CAP >= MSG_HDR_SIZE + MSG_MAX_PAYLOAD + 2048);
+
+int conn_recv_frames(Buf* buf, int fd, FrameFn on_frame, void* user_data) {
+  for (;;) {
+    ssize_t n = buf_recv(buf, fd);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    bool closed = n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+    // parsed after every read, a peer sending faster than we read can't grow buf
+    Frame fr;
+    int frame_size;
+    while ((frame_size = frame_try_parse(&fr, buf_read_ptr(buf), buf_readable(buf))) > 0) {
+      buf_consume(buf, frame_size);
+      if (!on_frame(&fr, user_data)) {
+        return 0;
+      }
+    }
+    if (frame_size < 0) {
+      return -2;
+    }
+    if (closed) {
+      return -1;
+    }
+    if (n < 0) {
+      return 0;
+    }
+  }
+}
+
+int conn_feed_frames(Buf* buf, uint8_t* data, size_t len, FrameFn on_frame, void* user_data) {
+  bool buffered = buf_readable(buf) > 0;
+  if (buffered) {
+    if (!buf_append(buf, data, len)) {
+      return -1;
+    }
+    data = buf_read_ptr(buf);
+    len = buf_readable(buf);
+  }
+  Frame fr;
+  int frame_size;
+  size_t off = 0;
+  while ((frame_size = frame_try_parse(&fr, data + off, len - off)) > 0) {
+    off += frame_size;
+    if (buffered) {
+      buf_consume(buf, frame_size);
+    }
+    if (!on_frame(&fr, user_data)) {
+      return 0;
+    }
+  }
+  if (frame_size < 0) {
+    return -2;
+  }
+  if (!buffered && off < len && !buf_append(buf, data + off, len - off)) {
+    return -1;
+  }
+  return 0;
+}
 ssize_t send_msg(int fd, int type, void* data, size_t size) {
-  MsgHdr hdr;
-  hdr.type = type;
-  hdr.len = size;
-  // hdr.type = htons(hdr.type);
-  // hdr.len = htons(hdr.len);
-  struct iovec iov[2];
-  iov[0].iov_len = sizeof(hdr);
-  iov[0].iov_base = &hdr;
-  iov[1].iov_len = size;
-  iov[1].iov_base = data;
+  uint8_t hdr[MSG_HDR_SIZE];
+  msg_hdr_write(hdr, type, size);
+  struct iovec iov[2] = {{hdr, MSG_HDR_SIZE}, {data, size}};
+  struct iovec* cur = iov;
+  int count = 2;
   size_t tot_sent = 0;
-  size_t tot_len = iov[0].iov_len + iov[1].iov_len;
-  int iov_i = 0;
-  size_t iov_sent = 0;
-  while (tot_sent < tot_len) {
-    ssize_t sent = writev(fd, &iov[iov_i], 2 - iov_i);
+  while (count > 0) {
+    ssize_t sent = writev(fd, cur, count);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
     if (sent == 0) {  // closed
       return sent;
     }
@@ -89,14 +174,25 @@ ssize_t send_msg(int fd, int type, void* data, size_t size) {
       return sent;
     }
     tot_sent += sent;
-    while (iov_i < 2 && iov_sent < tot_sent) {
-      iov_sent += iov[iov_i].iov_len;
-      iov_i++;
+    // a short write can end inside either iovec
+    while (count > 0 && (size_t)sent >= cur->iov_len) {
+      sent -= (ssize_t)cur->iov_len;
+      cur++;
+      count--;
+    }
+    if (count > 0) {
+      cur->iov_base = (uint8_t*)cur->iov_base + sent;
+      cur->iov_len -= (size_t)sent;
     }
   }
   return (ssize_t)tot_sent;
 }
 
+ssize_t send_protocol_msg(int fd, int type, const void* msg) {
+  uint8_t payload[PROTOCOL_MAX_MSG_SIZE];
+  return send_msg(fd, type, payload, protocol_encode(type, msg, payload));
+}
+
 void msg_buf_init(MsgBuffer* buf, size_t cap) {
   assert(!buf->data);
   assert(!buf->cap);
@@ -107,15 +203,11 @@ void msg_buf_init(MsgBuffer* buf, size_t cap) {
 
 void msg_buf_reserve(MsgBuffer* buf, size_t len) {
   if (len > buf->cap) {
-    void* new_data = malloc(len);
+    void* new_data = realloc(buf->data, len);
     if (!new_data) {
-      perror("malloc");
+      perror("realloc");
       return;
     }
-    if (buf->data) {
-      memcpy(new_data, buf->data, buf->size);
-      free(buf->data);
-    }
     buf->data = new_data;
     buf->cap = len;
   }
@@ -127,13 +219,17 @@ void msg_buf_push(MsgBuffer* buf, int type, void* data, size_t len) {
   if (req_size > buf->cap) {
     msg_buf_reserve(buf, req_size > buf->cap * 2 ? req_size : buf->cap * 2);
   }
-  MsgHdr hdr = {.type = type, .len = len};
-  memcpy((uint8_t*)buf->data + buf->size, &hdr, sizeof(hdr));
-  buf->size += sizeof(hdr);
+  msg_hdr_write((uint8_t*)buf->data + buf->size, type, len);
+  buf->size += MSG_HDR_SIZE;
   memcpy((uint8_t*)buf->data + buf->size, data, len);
   buf->size += len;
 }
 
+void msg_buf_push_msg(MsgBuffer* buf, int type, const void* msg) {
+  uint8_t payload[PROTOCOL_MAX_MSG_SIZE];
+  msg_buf_push(buf, type, payload, protocol_encode(type, msg, payload));
+}
+
 void msg_buf_clear(MsgBuffer* buf) { buf->size = 0; }
 
 void msg_buf_free(MsgBuffer* buf) {
@@ -141,14 +237,113 @@ void msg_buf_free(MsgBuffer* buf) {
   *buf = (MsgBuffer){};
 }
 
-ssize_t msg_buf_send_and_clear(MsgBuffer* buf, int fd) {
-  if (buf->size <= 0) {
+void send_ring_init(SendRing* r, size_t cap) {
+  assert(cap > 0 && (cap & (cap - 1)) == 0);
+  *r = (SendRing){};
+  r->data = malloc(cap);
+  if (r->data) {
+    r->cap = cap;
+  }
+}
+
+void send_ring_free(SendRing* r) {
+  free(r->data);
+  *r = (SendRing){};
+}
+
+static bool send_ring_reserve(SendRing* r, size_t extra) {
+  size_t pending = send_ring_pending(r);
+  if (pending + extra <= r->cap) {
+    return true;
+  }
+  if (pending + extra > SEND_RING_MAX) {
+    return false;
+  }
+  size_t old_cap = r->cap;
+  size_t cap = old_cap ? old_cap : 1024;
+  while (cap < pending + extra) {
+    cap *= 2;
+  }
+  uint8_t* data = realloc(r->data, cap);
+  if (!data) {
+    perror("realloc");
+    return false;
+  }
+  // the wrapped part moves behind the old end, cap at least doubled so it fits without wrapping
+  size_t idx = old_cap ? r->head & (old_cap - 1) : 0;
+  if (idx + pending > old_cap) {
+    memcpy(data + old_cap, data, idx + pending - old_cap);
+  }
+  r->data = data;
+  r->cap = cap;
+  r->head = idx;
+  r->tail = idx + pending;
+  return true;
+}
+
+static void send_ring_copy_in(SendRing* r, const void* src, size_t len) {
+  size_t idx = r->tail & (r->cap - 1);
+  size_t first = len < r->cap - idx ? len : r->cap - idx;
+  memcpy(r->data + idx, src, first);
+  memcpy(r->data, (const uint8_t*)src + first, len - first);
+  r->tail += len;
+}
+
+bool send_ring_push(SendRing* r, int type, const void* data, size_t len) {
+  if (!send_ring_reserve(r, MSG_HDR_SIZE + len)) {
+    return false;
+  }
+  uint8_t hdr[MSG_HDR_SIZE];
+  msg_hdr_write(hdr, type, len);
+  send_ring_copy_in(r, hdr, MSG_HDR_SIZE);
+  send_ring_copy_in(r, data, len);
+  return true;
+}
+
+int send_ring_iov(const SendRing* r, struct iovec* iov) {
+  size_t pending = send_ring_pending(r);
+  if (!pending) {
     return 0;
   }
-  ssize_t sent = send(fd, buf->data, buf->size, 0);
+  size_t idx = r->head & (r->cap - 1);
+  size_t first = pending < r->cap - idx ? pending : r->cap - idx;
+  iov[0] = (struct iovec){r->data + idx, first};
+  if (first == pending) {
+    return 1;
+  }
+  iov[1] = (struct iovec){r->data, pending - first};
+  return 2;
+}
+
+ssize_t send_ring_write(SendRing* r, int fd, const void* data, size_t len) {
+  struct iovec iov[3];
+  size_t pending = send_ring_pending(r);
+  int count = send_ring_iov(r, iov);
+  if (len) {
+    iov[count++] = (struct iovec){(void*)data, len};
+  }
+  if (!count) {
+    return 0;
+  }
+
+  ssize_t sent;
+  do {
+    sent = writev(fd, iov, count);
+  } while (sent < 0 && errno == EINTR);
   if (sent < 0) {
-    perror("send");
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      return -1;
+    }
+    sent = 0;
+  }
+  size_t from_ring = (size_t)sent < pending ? (size_t)sent : pending;
+  r->head += from_ring;
+  size_t from_data = (size_t)sent - from_ring;
+  if (from_data < len) {
+    if (!send_ring_reserve(r, len - from_data)) {
+      return -1;
+    }
+    send_ring_copy_in(r, (const uint8_t*)data + from_data, len - from_data);
   }
-  msg_buf_clear(buf);
   return sent;
 }
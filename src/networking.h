@@ -8,12 +8,21 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "buf.h"
+#include "protocol.h"
+
 typedef struct MsgHdr {
   uint32_t type;
   uint32_t len;
 } MsgHdr;
 
-#define MSG_HDR_SIZE sizeof(MsgHdr)
+// type then len, both little-endian u32
+#define MSG_HDR_SIZE ((size_t)8)
+
+void msg_hdr_write(uint8_t* out, uint32_t type, uint32_t len);
+
+// Frames announcing a larger payload are treated as a protocol error.
+#define MSG_MAX_PAYLOAD 4096
 
 typedef struct Frame {
   MsgHdr hdr;
@@ -21,12 +30,39 @@ typedef struct Frame {
 } Frame;
 
 struct addrinfo* get_addr_info(const char* port, const char* host_name);
+struct addrinfo* get_addr_info_socktype(const char* port, const char* host_name, int socktype);
 
 int open_and_listen_socket(struct addrinfo* addr_info);
+int open_udp_socket(struct addrinfo* addr_info);
 
+/**
+ * @return size of the complete frame at data, 0 if more bytes are needed, -1 if the header is
+ * invalid
+ */
 int frame_try_parse(Frame* frame, void* data, size_t size);
 
+// Return false to stop dispatching, e.g. when the connection was closed by the callback.
+typedef bool (*FrameFn)(Frame* frame, void* user_data);
+
+/**
+ * Reads everything available on a non-blocking fd into buf and dispatches each complete frame,
+ * after every read so buf holds at most a partial frame and one read. Partial frames stay in buf
+ * for the next call, when on_frame stops the dispatch the rest stays unread in the socket.
+ * @return 0 if the connection is still usable, -1 on disconnect or error, -2 on a malformed frame
+ */
+int conn_recv_frames(Buf* buf, int fd, FrameFn on_frame, void* user_data);
+
+/**
+ * Dispatches each complete frame of len bytes received elsewhere, e.g. by io_uring, following
+ * whatever partial frame buf holds. Frames are parsed where they are unless buf holds a partial
+ * one, only a partial frame at the end is copied into buf.
+ * @return 0 if the connection is still usable, -1 if buf can't grow, -2 on a malformed frame
+ */
+int conn_feed_frames(Buf* buf, uint8_t* data, size_t len, FrameFn on_frame, void* user_data);
+
 ssize_t send_msg(int fd, int type, void* data, size_t size);
+// Encodes msg, the struct of message type, per the protocol schema and sends it.
+ssize_t send_protocol_msg(int fd, int type, const void* msg);
 
 typedef struct MsgBuffer {
   void* data;
@@ -37,10 +73,48 @@ typedef struct MsgBuffer {
 void msg_buf_init(MsgBuffer* buf, size_t cap);
 void msg_buf_reserve(MsgBuffer* buf, size_t len);
 void msg_buf_push(MsgBuffer* buf, int type, void* data, size_t len);
+// Pushes msg, the struct of message type, encoded per the protocol schema.
+void msg_buf_push_msg(MsgBuffer* buf, int type, const void* msg);
 void msg_buf_clear(MsgBuffer* buf);
 void msg_buf_free(MsgBuffer* buf);
-ssize_t msg_buf_send_and_clear(MsgBuffer* buf, int fd);
 
-#define MSG_HDR_SIZE ((size_t)sizeof(MsgHdr))
+// Outbound bytes of one stream connection. Head and tail count bytes ever consumed and queued, the
+// ring index is their low bits. Whatever a short write leaves stays queued for the next write.
+typedef struct SendRing {
+  uint8_t* data;
+  size_t cap;  // power of two
+  size_t head;
+  size_t tail;
+} SendRing;
+
+// A peer this far behind is not reading, its connection is dropped instead of buffering more.
+#define SEND_RING_MAX ((size_t)1 << 20)
+
+static inline size_t send_ring_pending(const SendRing* r) { return r->tail - r->head; }
+
+struct iovec;
+
+/** @return entries of iov, at most 2, covering the queued bytes in order */
+int send_ring_iov(const SendRing* r, struct iovec* iov);
+
+/** Drops n written bytes from the front. */
+static inline void send_ring_consume(SendRing* r, size_t n) { r->head += n; }
+
+void send_ring_init(SendRing* r, size_t cap);
+void send_ring_free(SendRing* r);
+
+/** @return false if the ring would grow past SEND_RING_MAX */
+bool send_ring_push(SendRing* r, int type, const void* data, size_t len);
+
+/**
+ * Writes the queued bytes followed by len already framed bytes at data with a single writev,
+ * then queues whatever the socket did not take. data is only copied on a short write.
+ * @return bytes written, -1 if the connection failed or its ring overflowed
+ */
+ssize_t send_ring_write(SendRing* r, int fd, const void* data, size_t len);
+
+static inline ssize_t send_ring_flush(SendRing* r, int fd) {
+  return send_ring_write(r, fd, nullptr, 0);
+}
 
 #endif  // PONG_GAME_NETWORKING_H
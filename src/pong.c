@@ -0,0 +1,177 @@
+#include "pong.h"
+
+#include <math.h>
+
+static uint32_t pong_rand(PongSim* s) {
+  // xorshift32, state must never be 0
+  uint32_t x = s->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  s->rng = x;
+  return x;
+}
+
+void pong_sim_init(PongSim* s, uint32_t seed) {
+  *s = (PongSim){};
+  s->rng = seed ? seed : 0x9E3779B9u;
+  for (int i = 0; i < 2; i++) {
+    s->players[i].pos = world_dims.x / 2.f;
+  }
+  pong_reset_ball(s);
+}
+
+void pong_reset_ball(PongSim* s) {
+  float mult = (pong_rand(s) & 1) ? 1 : -1;
+  s->ball_velocity = (Vector2){mult * ball_base_speed_x, 0};
+  s->ball_pos = (Vector2){world_dims.x / 2.f, world_dims.x / 2.f};
+  s->collision_count = 0;
+}
+
+PaddleRect pong_paddle_rect(const PongSim* s, int player) {
+  float half_y = paddle_dims.y * 0.5f;
+  float x = player == 0 ? 0 : world_dims.x - paddle_dims.x;
+  return (PaddleRect){x, s->players[player].pos - half_y, paddle_dims.x, paddle_dims.y};
+}
+
+void pong_move_paddle(PongSim* s, int player, int dir) {
+  PlayerData* p = &s->players[player];
+  p->paddle_vert_velocity = (float)dir * paddle_speed;
+  p->pos += p->paddle_vert_velocity * pong_tick_dt;
+}
+
+// The ball collides as a square of half size ball_radius, so sweeping it against a paddle is a
+// ray against the paddle grown by ball_radius on every side. Returns whether the ball enters it
+// within max_t, a ball already overlapping enters at 0.
+static bool sweep_paddle(const PongSim* s, int player, float max_t, float* toi) {
+  PaddleRect p = pong_paddle_rect(s, player);
+  float lo[2] = {p.x - ball_radius, p.y - ball_radius};
+  float hi[2] = {p.x + p.width + ball_radius, p.y + p.height + ball_radius};
+  float pos[2] = {s->ball_pos.x, s->ball_pos.y};
+  float vel[2] = {s->ball_velocity.x, s->ball_velocity.y};
+  float t_enter = 0.f;
+  float t_exit = max_t;
+  for (int axis = 0; axis < 2; axis++) {
+    if (vel[axis] == 0.f) {
+      if (pos[axis] <= lo[axis] || pos[axis] >= hi[axis]) {
+        return false;
+      }
+      continue;
+    }
+    float t0 = (lo[axis] - pos[axis]) / vel[axis];
+    float t1 = (hi[axis] - pos[axis]) / vel[axis];
+    t_enter = fmaxf(t_enter, fminf(t0, t1));
+    t_exit = fminf(t_exit, fmaxf(t0, t1));
+    // touching edges is not a hit, same as the overlap test this replaced
+    if (t_enter >= t_exit) {
+      return false;
+    }
+  }
+  *toi = t_enter;
+  return true;
+}
+
+static void deflect_off_paddle(PongSim* s, int player) {
+  float max_deflect = 350.f;
+  float ball_speed_x_collision_mult = ball_base_speed_x / 10.f;
+  float paddle_spin_scale = 0.f;
+  PaddleRect p = pong_paddle_rect(s, player);
+  float speed = ball_base_speed_x + (float)s->collision_count * ball_speed_x_collision_mult;
+  if (player == 0) {
+    s->ball_velocity.x = speed;
+    s->ball_pos.x = p.x + p.width + ball_radius;
+  } else {
+    // put ball just to the left of the paddle face
+    s->ball_velocity.x = -speed;
+    s->ball_pos.x = p.x - ball_radius;
+  }
+
+  float center = p.y + p.height * 0.5f;
+  float rel = (s->ball_pos.y - center) / (paddle_dims.y * 0.5f);
+  rel = fmaxf(fminf(rel, 1.f), -1.f);
+
+  s->ball_velocity.y =
+      rel * max_deflect + s->players[player].paddle_vert_velocity * paddle_spin_scale;
+  s->collision_count++;
+}
+
+enum { HIT_FLOOR = 2, HIT_CEILING = 3, HIT_NONE = -1 };
+
+// Bounces within a tick are bounded (paddle, then floor or ceiling, then rarely the other), past
+// this the rest of the step falls back to clamping.
+#define MAX_BALL_IMPACTS 4
+
+void pong_sweep_ball(PongSim* s, float dt) {
+  float remaining = dt;
+  for (int impact = 0; impact < MAX_BALL_IMPACTS && remaining > 0.f; impact++) {
+    float toi = remaining;
+    int hit = HIT_NONE;
+    for (int i = 0; i < 2; i++) {
+      // an entry is always earlier than toi, the current bound
+      if (sweep_paddle(s, i, toi, &toi)) {
+        hit = i;
+      }
+    }
+    float vy = s->ball_velocity.y;
+    if (vy < 0.f) {
+      float t = fmaxf((ball_radius - s->ball_pos.y) / vy, 0.f);
+      if (t <= toi) {
+        toi = t;
+        hit = HIT_FLOOR;
+      }
+    } else if (vy > 0.f) {
+      float t = fmaxf((world_dims.y - ball_radius - s->ball_pos.y) / vy, 0.f);
+      if (t <= toi) {
+        toi = t;
+        hit = HIT_CEILING;
+      }
+    }
+
+    s->ball_pos.x += s->ball_velocity.x * toi;
+    s->ball_pos.y += s->ball_velocity.y * toi;
+    remaining -= toi;
+    if (hit == HIT_NONE) {
+      return;
+    }
+    if (hit == HIT_FLOOR) {
+      s->ball_pos.y = ball_radius;
+      s->ball_velocity.y *= -1.f;
+    } else if (hit == HIT_CEILING) {
+      s->ball_pos.y = world_dims.y - ball_radius;
+      s->ball_velocity.y *= -1.f;
+    } else {
+      deflect_off_paddle(s, hit);
+    }
+  }
+
+  s->ball_pos.x += s->ball_velocity.x * remaining;
+  s->ball_pos.y += s->ball_velocity.y * remaining;
+  s->ball_pos.y = fmaxf(fminf(s->ball_pos.y, world_dims.y - ball_radius), ball_radius);
+}
+
+static int pong_step_ball(PongSim* s, float dt, bool hold_score) {
+  int scorer = -1;
+  if (hold_score) {
+    // left to fly past the goal line until the caller stops holding
+  } else if (s->ball_pos.x - ball_radius <= 0) {
+    scorer = 0;
+  } else if (s->ball_pos.x + ball_radius >= world_dims.x) {
+    scorer = 1;
+  }
+  if (scorer >= 0) {
+    s->players[scorer].score++;
+    pong_reset_ball(s);
+  }
+  pong_sweep_ball(s, dt);
+  return scorer;
+}
+
+int pong_tick_hold(PongSim* s, const PongInput* input, bool hold_score) {
+  for (int i = 0; i < 2; i++) {
+    pong_move_paddle(s, i, input->paddle_dir[i]);
+  }
+  s->tick++;
+  return pong_step_ball(s, pong_tick_dt, hold_score);
+}
+
+int pong_tick(PongSim* s, const PongInput* input) { return pong_tick_hold(s, input, false); }
@@ -0,0 +1,75 @@
+#ifndef PONG_GAME_PONG_H
+#define PONG_GAME_PONG_H
+
+#include <stdint.h>
+
+// Same layout as raylib's Vector2 so the simulation can be built without raylib. Include this
+// header before raylib.h so raylib picks up the existing definition.
+#ifndef RL_VECTOR2_TYPE
+typedef struct Vector2 {
+  float x;
+  float y;
+} Vector2;
+#define RL_VECTOR2_TYPE
+#endif
+
+static const Vector2 world_dims = {400, 400};
+static const Vector2 paddle_dims = {10, 80};
+static const float ball_radius = 8;
+static const float ball_base_speed_x = 200.f;
+static const float paddle_speed = 300.f;
+
+// The simulation only ever advances in fixed ticks so every machine computes the same result
+// from the same inputs, independent of frame rate.
+#define PONG_TICK_HZ 120
+static const float pong_tick_dt = 1.f / PONG_TICK_HZ;
+
+typedef struct PlayerData {
+  float pos;
+  float paddle_vert_velocity;
+  int score;
+} PlayerData;
+
+typedef struct PongSim {
+  uint32_t tick;
+  int collision_count;
+  Vector2 ball_pos;
+  Vector2 ball_velocity;
+  PlayerData players[2];
+  uint32_t rng;
+} PongSim;
+
+typedef struct PaddleRect {
+  float x, y, width, height;
+} PaddleRect;
+
+// -1 moves the paddle up, 1 down, 0 holds it
+typedef struct PongInput {
+  int8_t paddle_dir[2];
+} PongInput;
+
+void pong_sim_init(PongSim* s, uint32_t seed);
+void pong_reset_ball(PongSim* s);
+PaddleRect pong_paddle_rect(const PongSim* s, int player);
+
+void pong_move_paddle(PongSim* s, int player, int dir);
+
+/**
+ * Moves the ball through dt, bouncing off paddles, floor and ceiling at their time of impact
+ * within the step so a fast ball cannot tunnel through a paddle. Does not score.
+ */
+void pong_sweep_ball(PongSim* s, float dt);
+
+/**
+ * Advances paddles and ball by one tick of pong_tick_dt.
+ * @return index of the player that scored this tick, or -1
+ */
+int pong_tick(PongSim* s, const PongInput* input);
+
+/**
+ * pong_tick, except that while hold_score is set a ball past a goal line keeps flying instead of
+ * scoring, for an authority that has to wait on late input before it calls a miss.
+ */
+int pong_tick_hold(PongSim* s, const PongInput* input, bool hold_score);
+
+#endif  // PONG_GAME_PONG_H
@@ -0,0 +1,208 @@
+// Checks that a running server makes no heap allocations once its matches are under way. The
+// server is server.c itself with its main renamed, forked off with malloc, calloc and realloc
+// wrapped at link time (see CMakeLists.txt) and counted in memory shared with this process. tcp
+// and udp matches and a few spectators are driven by the pong_loadgen next to this program, the
+// count is taken over a window starting once the server's metrics endpoint shows all of them
+// playing and watching. Exits non-zero if the server allocated anything in that window.
+
+// server.c defines _GNU_SOURCE, it goes before any system header
+#define main pong_server_main
+#include "server.c"
+#undef main
+
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct AllocCounts {
+  atomic_uint_fast64_t allocs;
+  atomic_uint_fast64_t bytes;
+} AllocCounts;
+
+static AllocCounts* counts;
+static bool in_server;  // only the forked server counts, not this process
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+static void count_alloc(size_t size) {
+  if (in_server) {
+    atomic_fetch_add_explicit(&counts->allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counts->bytes, size, memory_order_relaxed);
+  }
+}
+
+void* __wrap_malloc(size_t size) {
+  count_alloc(size);
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  count_alloc(count * size);
+  return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+  count_alloc(size);
+  return __real_realloc(p, size);
+}
+
+static void sleep_s(double s) {
+  struct timespec ts = {.tv_sec = (time_t)s, .tv_nsec = (long)((s - (double)(time_t)s) * 1e9)};
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+  }
+}
+
+static pid_t spawn(char* const args[]) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    // the bots' own reports are noise here
+    if (!freopen("/dev/null", "w", stdout)) {
+      _exit(127);
+    }
+    execv(args[0], args);
+    perror(args[0]);
+    _exit(127);
+  }
+  return pid;
+}
+
+// One scrape of the server's metrics endpoint into out.
+static bool scrape(int port, char* out, size_t cap) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons((uint16_t)port),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  const char req[] = "GET /metrics HTTP/1.0\r\n\r\n";
+  if (fd == -1) {
+    return false;
+  }
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      send(fd, req, sizeof(req) - 1, 0) != (ssize_t)(sizeof(req) - 1)) {
+    close(fd);
+    return false;
+  }
+  size_t len = 0;
+  ssize_t n;
+  while (len + 1 < cap && (n = recv(fd, out + len, cap - 1 - len, 0)) > 0) {
+    len += (size_t)n;
+  }
+  out[len] = 0;
+  close(fd);
+  return len > 0;
+}
+
+static long scraped_value(const char* metrics, const char* name) {
+  char line[64];
+  snprintf(line, sizeof(line), "\n%s ", name);
+  const char* at = strstr(metrics, line);
+  return at ? strtol(at + strlen(line), nullptr, 10) : -1;
+}
+
+// Waits until every bot is in a match and every spectator is watching one.
+static bool wait_for_steady(int metrics_port, long matches, long spectators) {
+  static char metrics[1 << 16];
+  for (int i = 0; i < 300; i++) {
+    if (scrape(metrics_port, metrics, sizeof(metrics)) &&
+        scraped_value(metrics, "pong_active_matches") == matches &&
+        scraped_value(metrics, "pong_matchmaking_waiting") == 0 &&
+        scraped_value(metrics, "pong_spectators") == spectators) {
+      return true;
+    }
+    sleep_s(0.05);
+  }
+  return false;
+}
+
+static void stop(pid_t pid, int sig) {
+  if (pid > 0) {
+    kill(pid, sig);
+    waitpid(pid, nullptr, 0);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  long matches = argc > 1 ? strtol(argv[1], nullptr, 0) : 10;
+  double seconds = argc > 2 ? strtod(argv[2], nullptr) : 3.0;
+  const char* port = argc > 3 ? argv[3] : "18431";
+  long spectators = 4;
+  // what a spectator or a late pair allocates is done with shortly after
+  double settle = 0.5;
+  int metrics_port = (int)strtol(port, nullptr, 10) + 1;
+  char metrics_port_arg[16];
+  snprintf(metrics_port_arg, sizeof(metrics_port_arg), "%i", metrics_port);
+  if (matches <= 0 || matches > 1000 || seconds <= 0) {
+    fprintf(stderr, "usage: %s [matches per transport <= 1000] [seconds] [port]\n", argv[0]);
+    return 2;
+  }
+
+  // pong_loadgen is built next to this program
+  char loadgen[PATH_MAX];
+  const char* slash = strrchr(argv[0], '/');
+  int dir_len = slash ? (int)(slash + 1 - argv[0]) : 0;
+  snprintf(loadgen, sizeof(loadgen), "%.*spong_loadgen", dir_len, argv[0]);
+
+  counts = mmap(nullptr, sizeof(AllocCounts), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                -1, 0);
+  if (counts == MAP_FAILED) {
+    perror("mmap");
+    return 2;
+  }
+  fflush(stdout);
+  pid_t server = fork();
+  if (server == 0) {
+    in_server = true;
+    if (!freopen("/dev/null", "w", stdout)) {
+      _exit(127);
+    }
+    char* server_args[] = {argv[0], (char*)port, "60", "2", "150", "-", metrics_port_arg, nullptr};
+    _exit(pong_server_main(7, server_args));
+  }
+  sleep_s(0.3);
+
+  char bots[16];
+  char duration[16];
+  char watchers[16];
+  snprintf(bots, sizeof(bots), "%li", matches * 2);
+  snprintf(duration, sizeof(duration), "%.0f", 15 + settle + seconds + 5);
+  snprintf(watchers, sizeof(watchers), "%li", spectators);
+  char* tcp_args[] = {loadgen, "-p", (char*)port, "-n", bots, "-t", "tcp", "-r", "1000",
+                      "-d", duration, "-c", "0", "-i", duration, "-w", watchers, nullptr};
+  char* udp_args[] = {loadgen, "-p", (char*)port, "-n", bots, "-t", "udp", "-r", "1000",
+                      "-d", duration, "-c", "0", "-i", duration, nullptr};
+  pid_t tcp = spawn(tcp_args);
+  pid_t udp = spawn(udp_args);
+
+  bool steady = wait_for_steady(metrics_port, matches * 2, spectators);
+  sleep_s(settle);
+  uint64_t allocs = atomic_load(&counts->allocs);
+  uint64_t bytes = atomic_load(&counts->bytes);
+  sleep_s(seconds);
+  allocs = atomic_load(&counts->allocs) - allocs;
+  bytes = atomic_load(&counts->bytes) - bytes;
+  bool server_alive = waitpid(server, nullptr, WNOHANG) == 0;
+
+  stop(tcp, SIGTERM);
+  stop(udp, SIGTERM);
+  stop(server_alive ? server : -1, SIGINT);
+  if (!server_alive) {
+    fprintf(stderr, "the server exited early\n");
+    return 2;
+  }
+  if (!steady) {
+    fprintf(stderr, "the matches and spectators never all got going\n");
+    return 2;
+  }
+  printf("%li tcp and %li udp matches, %.1f s: %llu allocations, %llu bytes in the server\n",
+         matches, matches, seconds, (unsigned long long)allocs, (unsigned long long)bytes);
+  return allocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+#include "pong_batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PONG_BATCH_X86 1
+#endif
+
+bool pong_batch_init(PongBatch* b, int cap) {
+  *b = (PongBatch){.cap = cap};
+  float** floats[] = {&b->ball_x,       &b->ball_y,        &b->vel_x,        &b->vel_y,
+                      &b->paddle_y[0],  &b->paddle_y[1],   &b->paddle_vel[0], &b->paddle_vel[1]};
+  for (size_t i = 0; i < sizeof(floats) / sizeof(floats[0]); i++) {
+    *floats[i] = aligned_alloc(32, ((sizeof(float) * cap + 31) / 32) * 32);
+  }
+  b->score[0] = calloc(cap, sizeof(int32_t));
+  b->score[1] = calloc(cap, sizeof(int32_t));
+  b->collision_count = calloc(cap, sizeof(int32_t));
+  b->rng = calloc(cap, sizeof(uint32_t));
+  b->tick = calloc(cap, sizeof(uint32_t));
+  b->input[0] = calloc(cap, 1);
+  b->input[1] = calloc(cap, 1);
+  b->scorer = calloc(cap, 1);
+  for (size_t i = 0; i < sizeof(floats) / sizeof(floats[0]); i++) {
+    if (!*floats[i]) {
+      pong_batch_free(b);
+      return false;
+    }
+  }
+  if (!b->score[0] || !b->score[1] || !b->collision_count || !b->rng || !b->tick ||
+      !b->input[0] || !b->input[1] || !b->scorer) {
+    pong_batch_free(b);
+    return false;
+  }
+  return true;
+}
+
+void pong_batch_free(PongBatch* b) {
+  free(b->ball_x);
+  free(b->ball_y);
+  free(b->vel_x);
+  free(b->vel_y);
+  for (int p = 0; p < 2; p++) {
+    free(b->paddle_y[p]);
+    free(b->paddle_vel[p]);
+    free(b->score[p]);
+    free(b->input[p]);
+  }
+  free(b->collision_count);
+  free(b->rng);
+  free(b->tick);
+  free(b->scorer);
+  *b = (PongBatch){};
+}
+
+void pong_batch_store(PongBatch* b, int i, const PongSim* s) {
+  b->ball_x[i] = s->ball_pos.x;
+  b->ball_y[i] = s->ball_pos.y;
+  b->vel_x[i] = s->ball_velocity.x;
+  b->vel_y[i] = s->ball_velocity.y;
+  for (int p = 0; p < 2; p++) {
+    b->paddle_y[p][i] = s->players[p].pos;
+    b->paddle_vel[p][i] = s->players[p].paddle_vert_velocity;
+    b->score[p][i] = s->players[p].score;
+  }
+  b->collision_count[i] = s->collision_count;
+  b->rng[i] = s->rng;
+  b->tick[i] = s->tick;
+}
+
+void pong_batch_load(const PongBatch* b, int i, PongSim* s) {
+  s->ball_pos = (Vector2){b->ball_x[i], b->ball_y[i]};
+  s->ball_velocity = (Vector2){b->vel_x[i], b->vel_y[i]};
+  for (int p = 0; p < 2; p++) {
+    s->players[p].pos = b->paddle_y[p][i];
+    s->players[p].paddle_vert_velocity = b->paddle_vel[p][i];
+    s->players[p].score = b->score[p][i];
+  }
+  s->collision_count = b->collision_count[i];
+  s->rng = b->rng[i];
+  s->tick = b->tick[i];
+}
+
+// The scalar path is pong_tick itself, so the vector paths have a single reference to match.
+static void tick_scalar(PongBatch* b, int begin, int end) {
+  for (int i = begin; i < end; i++) {
+    PongSim s;
+    pong_batch_load(b, i, &s);
+    PongInput input = {{b->input[0][i], b->input[1][i]}};
+    b->scorer[i] = (int8_t)pong_tick(&s, &input);
+    pong_batch_store(b, i, &s);
+  }
+}
+
+// Scoring is rare, lanes that score reset their ball through the scalar code.
+static void lanes_score(PongBatch* b, int i, int width, int left_mask, int right_mask) {
+  for (int k = 0; k < width; k++) {
+    int scorer = (left_mask >> k) & 1 ? 0 : (right_mask >> k) & 1 ? 1 : -1;
+    b->scorer[i + k] = (int8_t)scorer;
+    if (scorer < 0) {
+      continue;
+    }
+    b->score[scorer][i + k]++;
+    PongSim s = {.rng = b->rng[i + k]};
+    pong_reset_ball(&s);
+    b->rng[i + k] = s.rng;
+    b->ball_x[i + k] = s.ball_pos.x;
+    b->ball_y[i + k] = s.ball_pos.y;
+    b->vel_x[i + k] = s.ball_velocity.x;
+    b->vel_y[i + k] = s.ball_velocity.y;
+    b->collision_count[i + k] = s.collision_count;
+  }
+}
+
+// Lanes whose ball may hit something this tick go through pong_sweep_ball, the rest move in a
+// straight line exactly as pong_sweep_ball moves a ball that hits nothing.
+static void lanes_sweep(PongBatch* b, int i, int width, int event_mask) {
+  for (int k = 0; k < width; k++) {
+    if (!((event_mask >> k) & 1)) {
+      continue;
+    }
+    PongSim s;
+    pong_batch_load(b, i + k, &s);
+    pong_sweep_ball(&s, pong_tick_dt);
+    pong_batch_store(b, i + k, &s);
+  }
+}
+
+// Margin added to the broad phase below so float rounding in the exact sweep can never find a
+// hit the broad phase missed.
+static const float sweep_slack = 1.f;
+
+#ifdef PONG_BATCH_X86
+
+// Paddle movement and straight line ball motion mirror pong_move_paddle and pong_sweep_ball
+// operation for operation so rounding is identical.
+
+static __m128 sse_select(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static void tick_sse(PongBatch* b, int begin, int end) {
+  const __m128 dt = _mm_set1_ps(pong_tick_dt);
+  const __m128 r = _mm_set1_ps(ball_radius);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 slack = _mm_set1_ps(sweep_slack);
+  const __m128 world_x = _mm_set1_ps(world_dims.x);
+  const __m128 world_y = _mm_set1_ps(world_dims.y);
+  int i = begin;
+  for (; i + 4 <= end; i += 4) {
+    for (int p = 0; p < 2; p++) {
+      float dirs[4];
+      for (int k = 0; k < 4; k++) {
+        dirs[k] = (float)b->input[p][i + k];
+      }
+      __m128 vel = _mm_mul_ps(_mm_loadu_ps(dirs), _mm_set1_ps(paddle_speed));
+      __m128 pos = _mm_add_ps(_mm_loadu_ps(&b->paddle_y[p][i]), _mm_mul_ps(vel, dt));
+      _mm_storeu_ps(&b->paddle_vel[p][i], vel);
+      _mm_storeu_ps(&b->paddle_y[p][i], pos);
+    }
+    __m128i tick = _mm_loadu_si128((__m128i*)&b->tick[i]);
+    _mm_storeu_si128((__m128i*)&b->tick[i], _mm_add_epi32(tick, _mm_set1_epi32(1)));
+
+    __m128 bx = _mm_loadu_ps(&b->ball_x[i]);
+    __m128 left = _mm_cmple_ps(_mm_sub_ps(bx, r), zero);
+    __m128 right = _mm_cmpge_ps(_mm_add_ps(bx, r), world_x);
+    lanes_score(b, i, 4, _mm_movemask_ps(left), _mm_movemask_ps(right));
+
+    bx = _mm_loadu_ps(&b->ball_x[i]);
+    __m128 by = _mm_loadu_ps(&b->ball_y[i]);
+    __m128 ex = _mm_add_ps(bx, _mm_mul_ps(_mm_loadu_ps(&b->vel_x[i]), dt));
+    __m128 ey = _mm_add_ps(by, _mm_mul_ps(_mm_loadu_ps(&b->vel_y[i]), dt));
+    // broad phase: the box swept by the ball this tick against walls and paddles
+    __m128 x_lo = _mm_sub_ps(_mm_min_ps(bx, ex), r);
+    __m128 x_hi = _mm_add_ps(_mm_max_ps(bx, ex), r);
+    __m128 y_lo = _mm_sub_ps(_mm_min_ps(by, ey), r);
+    __m128 y_hi = _mm_add_ps(_mm_max_ps(by, ey), r);
+    __m128 event = _mm_or_ps(_mm_cmple_ps(y_lo, slack),
+                             _mm_cmpge_ps(y_hi, _mm_sub_ps(world_y, slack)));
+    for (int p = 0; p < 2; p++) {
+      __m128 px = _mm_set1_ps(p == 0 ? 0 : world_dims.x - paddle_dims.x);
+      __m128 py = _mm_sub_ps(_mm_loadu_ps(&b->paddle_y[p][i]), _mm_set1_ps(paddle_dims.y * 0.5f));
+      __m128 hit = _mm_and_ps(
+          _mm_and_ps(_mm_cmple_ps(_mm_sub_ps(px, slack), x_hi),
+                     _mm_cmple_ps(x_lo, _mm_add_ps(px, _mm_set1_ps(paddle_dims.x + sweep_slack)))),
+          _mm_and_ps(_mm_cmple_ps(_mm_sub_ps(py, slack), y_hi),
+                     _mm_cmple_ps(y_lo, _mm_add_ps(py, _mm_set1_ps(paddle_dims.y + sweep_slack)))));
+      event = _mm_or_ps(event, hit);
+    }
+    _mm_storeu_ps(&b->ball_x[i], sse_select(event, bx, ex));
+    _mm_storeu_ps(&b->ball_y[i], sse_select(event, by, ey));
+    int event_mask = _mm_movemask_ps(event);
+    if (event_mask) {
+      lanes_sweep(b, i, 4, event_mask);
+    }
+  }
+  tick_scalar(b, i, end);
+}
+
+__attribute__((target("avx2"))) static void tick_avx2(PongBatch* b, int begin, int end) {
+  const __m256 dt = _mm256_set1_ps(pong_tick_dt);
+  const __m256 r = _mm256_set1_ps(ball_radius);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 slack = _mm256_set1_ps(sweep_slack);
+  const __m256 world_x = _mm256_set1_ps(world_dims.x);
+  const __m256 world_y = _mm256_set1_ps(world_dims.y);
+  int i = begin;
+  for (; i + 8 <= end; i += 8) {
+    for (int p = 0; p < 2; p++) {
+      __m256 dirs = _mm256_cvtepi32_ps(
+          _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)&b->input[p][i])));
+      __m256 vel = _mm256_mul_ps(dirs, _mm256_set1_ps(paddle_speed));
+      __m256 pos = _mm256_add_ps(_mm256_loadu_ps(&b->paddle_y[p][i]), _mm256_mul_ps(vel, dt));
+      _mm256_storeu_ps(&b->paddle_vel[p][i], vel);
+      _mm256_storeu_ps(&b->paddle_y[p][i], pos);
+    }
+    __m256i tick = _mm256_loadu_si256((__m256i*)&b->tick[i]);
+    _mm256_storeu_si256((__m256i*)&b->tick[i], _mm256_add_epi32(tick, _mm256_set1_epi32(1)));
+
+    __m256 bx = _mm256_loadu_ps(&b->ball_x[i]);
+    __m256 left = _mm256_cmp_ps(_mm256_sub_ps(bx, r), zero, _CMP_LE_OQ);
+    __m256 right = _mm256_cmp_ps(_mm256_add_ps(bx, r), world_x, _CMP_GE_OQ);
+    lanes_score(b, i, 8, _mm256_movemask_ps(left), _mm256_movemask_ps(right));
+
+    bx = _mm256_loadu_ps(&b->ball_x[i]);
+    __m256 by = _mm256_loadu_ps(&b->ball_y[i]);
+    __m256 ex = _mm256_add_ps(bx, _mm256_mul_ps(_mm256_loadu_ps(&b->vel_x[i]), dt));
+    __m256 ey = _mm256_add_ps(by, _mm256_mul_ps(_mm256_loadu_ps(&b->vel_y[i]), dt));
+    __m256 x_lo = _mm256_sub_ps(_mm256_min_ps(bx, ex), r);
+    __m256 x_hi = _mm256_add_ps(_mm256_max_ps(bx, ex), r);
+    __m256 y_lo = _mm256_sub_ps(_mm256_min_ps(by, ey), r);
+    __m256 y_hi = _mm256_add_ps(_mm256_max_ps(by, ey), r);
+    __m256 event =
+        _mm256_or_ps(_mm256_cmp_ps(y_lo, slack, _CMP_LE_OQ),
+                     _mm256_cmp_ps(y_hi, _mm256_sub_ps(world_y, slack), _CMP_GE_OQ));
+    for (int p = 0; p < 2; p++) {
+      __m256 px = _mm256_set1_ps(p == 0 ? 0 : world_dims.x - paddle_dims.x);
+      __m256 py =
+          _mm256_sub_ps(_mm256_loadu_ps(&b->paddle_y[p][i]), _mm256_set1_ps(paddle_dims.y * 0.5f));
+      __m256 x_max = _mm256_add_ps(px, _mm256_set1_ps(paddle_dims.x + sweep_slack));
+      __m256 y_max = _mm256_add_ps(py, _mm256_set1_ps(paddle_dims.y + sweep_slack));
+      __m256 hit = _mm256_and_ps(
+          _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(px, slack), x_hi, _CMP_LE_OQ),
+                        _mm256_cmp_ps(x_lo, x_max, _CMP_LE_OQ)),
+          _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(py, slack), y_hi, _CMP_LE_OQ),
+                        _mm256_cmp_ps(y_lo, y_max, _CMP_LE_OQ)));
+      event = _mm256_or_ps(event, hit);
+    }
+    _mm256_storeu_ps(&b->ball_x[i], _mm256_blendv_ps(ex, bx, event));
+    _mm256_storeu_ps(&b->ball_y[i], _mm256_blendv_ps(ey, by, event));
+    int event_mask = _mm256_movemask_ps(event);
+    if (event_mask) {
+      lanes_sweep(b, i, 8, event_mask);
+    }
+  }
+  tick_sse(b, i, end);
+}
+
+#endif  // PONG_BATCH_X86
+
+void pong_batch_tick_path(PongBatch* b, int path) {
+#ifdef PONG_BATCH_X86
+  if (path >= 2 && __builtin_cpu_supports("avx2")) {
+    tick_avx2(b, 0, b->count);
+    return;
+  }
+  if (path >= 1) {
+    tick_sse(b, 0, b->count);
+    return;
+  }
+#endif
+  (void)path;
+  tick_scalar(b, 0, b->count);
+}
+
+void pong_batch_tick(PongBatch* b) { pong_batch_tick_path(b, 2); }
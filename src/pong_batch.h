@@ -0,0 +1,42 @@
+#ifndef PONG_GAME_PONG_BATCH_H
+#define PONG_GAME_PONG_BATCH_H
+
+#include <stdint.h>
+
+#include "pong.h"
+
+// Many matches in structure-of-arrays layout, stepped together by one call. Each lane computes
+// exactly what pong_tick computes for the same PongSim and inputs, bit for bit, whether it runs
+// through the AVX2, SSE or scalar path. The vector paths move balls in a straight line and only
+// hand lanes that may hit a wall or paddle this tick to pong_sweep_ball.
+
+typedef struct PongBatch {
+  int count;
+  int cap;
+  float* ball_x;
+  float* ball_y;
+  float* vel_x;
+  float* vel_y;
+  float* paddle_y[2];
+  float* paddle_vel[2];
+  int32_t* score[2];
+  int32_t* collision_count;
+  uint32_t* rng;
+  uint32_t* tick;
+  int8_t* input[2];  // paddle directions for the next tick, filled in by the caller
+  int8_t* scorer;    // written by pong_batch_tick, -1 if nobody scored
+} PongBatch;
+
+bool pong_batch_init(PongBatch* b, int cap);
+void pong_batch_free(PongBatch* b);
+
+void pong_batch_store(PongBatch* b, int i, const PongSim* s);
+void pong_batch_load(const PongBatch* b, int i, PongSim* s);
+
+/** Advances every match by one tick, same as pong_tick on each. */
+void pong_batch_tick(PongBatch* b);
+
+// Forces a code path for benchmarks: 0 scalar, 1 SSE, 2 AVX2. Falls back when unsupported.
+void pong_batch_tick_path(PongBatch* b, int path);
+
+#endif  // PONG_GAME_PONG_BATCH_H
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pong_batch.h"
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Paddles chase the ball a quarter of the time so both scoring and deflections get exercised.
+static void fill_inputs(PongBatch* b, uint32_t* rng) {
+  for (int i = 0; i < b->count; i++) {
+    for (int p = 0; p < 2; p++) {
+      uint32_t x = *rng;
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      *rng = x;
+      int chase = b->ball_y[i] < b->paddle_y[p][i] ? -1 : 1;
+      b->input[p][i] = (int8_t)((x & 3) == 0 ? chase : (int)(x >> 2) % 3 - 1);
+    }
+  }
+}
+
+static bool batch_init_matches(PongBatch* b, int count) {
+  if (!pong_batch_init(b, count)) {
+    return false;
+  }
+  b->count = count;
+  for (int i = 0; i < count; i++) {
+    PongSim s;
+    pong_sim_init(&s, (uint32_t)i + 1);
+    pong_batch_store(b, i, &s);
+  }
+  return true;
+}
+
+static bool batch_equal(const PongBatch* a, const PongBatch* b) {
+  for (int i = 0; i < a->count; i++) {
+    PongSim sa, sb;
+    pong_batch_load(a, i, &sa);
+    pong_batch_load(b, i, &sb);
+    if (memcmp(&sa, &sb, sizeof(sa)) || a->scorer[i] != b->scorer[i]) {
+      fprintf(stderr, "match %i diverged at tick %u\n", i, sa.tick);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  int count = argc > 1 ? (int)strtol(argv[1], nullptr, 0) : 4096;
+  int ticks = argc > 2 ? (int)strtol(argv[2], nullptr, 0) : PONG_TICK_HZ * 10;
+  if (count <= 0 || ticks <= 0) {
+    fprintf(stderr, "usage: %s [matches] [ticks]\n", argv[0]);
+    return 1;
+  }
+  static const char* path_names[] = {"scalar", "sse", "avx2"};
+
+  // every path must reproduce pong_tick exactly, check before timing anything
+  PongBatch ref, test;
+  if (!batch_init_matches(&ref, count)) {
+    return 1;
+  }
+  for (int path = 1; path < 3; path++) {
+    if (!batch_init_matches(&test, count)) {
+      return 1;
+    }
+    pong_batch_free(&ref);
+    batch_init_matches(&ref, count);
+    uint32_t rng = 0x2545F491u;
+    for (int t = 0; t < ticks; t++) {
+      fill_inputs(&ref, &rng);
+      memcpy(test.input[0], ref.input[0], (size_t)count);
+      memcpy(test.input[1], ref.input[1], (size_t)count);
+      pong_batch_tick_path(&ref, 0);
+      pong_batch_tick_path(&test, path);
+      if (!batch_equal(&ref, &test)) {
+        fprintf(stderr, "%s path differs from pong_tick\n", path_names[path]);
+        return 1;
+      }
+    }
+    pong_batch_free(&test);
+  }
+  pong_batch_free(&ref);
+
+  for (int path = 0; path < 3; path++) {
+    PongBatch b;
+    if (!batch_init_matches(&b, count)) {
+      return 1;
+    }
+    uint32_t rng = 0x2545F491u;
+    uint64_t elapsed = 0;
+    for (int t = 0; t < ticks; t++) {
+      fill_inputs(&b, &rng);
+      uint64_t start = now_ns();
+      pong_batch_tick_path(&b, path);
+      elapsed += now_ns() - start;
+    }
+    double secs = (double)elapsed / 1e9;
+    printf("%-6s %i matches x %i ticks: %.1f M matches stepped/s\n", path_names[path], count,
+           ticks, (double)count * ticks / secs / 1e6);
+    pong_batch_free(&b);
+  }
+  return 0;
+}
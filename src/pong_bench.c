@@ -0,0 +1,543 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "broadcast.h"
+#include "buf.h"
+#include "event_loop.h"
+#include "matchmaker.h"
+#include "networking.h"
+#include "pong.h"
+#include "protocol.h"
+#include "snapshot.h"
+
+// Microbenchmarks of the hot paths, one TSV line per benchmark so runs can be diffed or checked
+// against a baseline. Every input comes from a fixed seed, two runs on the same build and machine
+// do the same work.
+//
+// Allocations are counted by wrapping malloc, calloc and realloc at link time (see
+// CMakeLists.txt), which covers this program and pong_core but not allocations made inside libc.
+
+static uint64_t bench_allocs;
+static uint64_t bench_alloc_bytes;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+  bench_allocs++;
+  bench_alloc_bytes += size;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  bench_allocs++;
+  bench_alloc_bytes += count * size;
+  return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+  bench_allocs++;
+  bench_alloc_bytes += size;
+  return __real_realloc(p, size);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Makes the compiler assume p's memory is read and written, so benchmarked work isn't dropped.
+static inline void bench_escape(void* p) { __asm__ volatile("" : : "g"(p) : "memory"); }
+
+static uint32_t bench_rng = 0x2545F491u;
+
+static uint32_t bench_rand(void) {
+  uint32_t x = bench_rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return bench_rng = x;
+}
+
+// Payload sizes as a match sends them: mostly inputs, snapshots and acks, now and then something
+// near the frame limit.
+static size_t mixed_payload_len(void) {
+  static const size_t sizes[] = {MSG_INPUT_SIZE,
+                                 MSG_INPUT_SIZE,
+                                 MSG_INPUT_ACK_SIZE,
+                                 MSG_SNAPSHOT_ACK_SIZE,
+                                 SNAPSHOT_MAX_ENCODED / 2,
+                                 SNAPSHOT_MAX_ENCODED,
+                                 MSG_PLAYER_POS_SIZE,
+                                 MSG_BALL_POS_UPDATE_SIZE};
+  uint32_t r = bench_rand();
+  return r % 64 == 0 ? MSG_MAX_PAYLOAD / 2 + r % (MSG_MAX_PAYLOAD / 2) : sizes[r % 8];
+}
+
+// A stream of whole frames, prepared once and reused by the framing and buffer benchmarks.
+#define STREAM_SIZE ((size_t)1 << 18)
+static uint8_t stream[STREAM_SIZE + MSG_HDR_SIZE + MSG_MAX_PAYLOAD];
+static size_t stream_len;
+
+static void stream_init(void) {
+  while (stream_len < STREAM_SIZE) {
+    size_t len = mixed_payload_len();
+    msg_hdr_write(stream + stream_len, bench_rand() % MSG_TYPE_COUNT, (uint32_t)len);
+    for (size_t i = 0; i < len; i++) {
+      stream[stream_len + MSG_HDR_SIZE + i] = (uint8_t)bench_rand();
+    }
+    stream_len += MSG_HDR_SIZE + len;
+  }
+}
+
+// op: one frame parsed out of the stream
+static void bench_frame_try_parse(uint64_t iters) {
+  size_t off = 0;
+  uint64_t sum = 0;
+  for (uint64_t i = 0; i < iters; i++) {
+    Frame fr;
+    int n = frame_try_parse(&fr, stream + off, stream_len - off);
+    if (n <= 0) {
+      off = 0;
+      n = frame_try_parse(&fr, stream, stream_len);
+    }
+    sum += fr.hdr.type;
+    off += (size_t)n;
+  }
+  bench_escape(&sum);
+}
+
+static int sock_pair[2] = {-1, -1};
+
+// op: a chunk of 1 to 4096 stream bytes sent over a unix socket, received with buf_recv and every
+// complete frame in the buffer consumed, partial frames stay for the next op
+static void bench_buf_recv_consume(uint64_t iters) {
+  Buf buf;
+  buf_init(&buf, 4096);
+  size_t sent_off = 0;
+  uint64_t sum = 0;
+  for (uint64_t i = 0; i < iters; i++) {
+    size_t len = 1 + bench_rand() % 4096;
+    if (len > stream_len - sent_off) {
+      len = stream_len - sent_off;
+    }
+    ssize_t sent = send(sock_pair[0], stream + sent_off, len, 0);
+    if (sent > 0) {
+      sent_off = (sent_off + (size_t)sent) % stream_len;
+    }
+    while (buf_recv(&buf, sock_pair[1]) > 0) {
+    }
+    Frame fr;
+    int n;
+    while ((n = frame_try_parse(&fr, buf_read_ptr(&buf), buf_readable(&buf))) > 0) {
+      sum += fr.hdr.len;
+      buf_consume(&buf, (size_t)n);
+    }
+  }
+  bench_escape(&sum);
+  buf_free(&buf);
+}
+
+// op: one frame pushed into a buffer that is cleared every 64 KiB, as a tick's outgoing messages
+static void bench_msg_buf_push(uint64_t iters) {
+  MsgBuffer mb = {};
+  msg_buf_init(&mb, 1 << 17);
+  for (uint64_t i = 0; i < iters; i++) {
+    if (mb.size > (1 << 16)) {
+      msg_buf_clear(&mb);
+    }
+    msg_buf_push(&mb, MSG_INPUT, stream, mixed_payload_len());
+  }
+  bench_escape(mb.data);
+  msg_buf_free(&mb);
+}
+
+// op: a fresh 64 byte buffer grown by 32 mixed frames, then freed
+static void bench_msg_buf_grow(uint64_t iters) {
+  for (uint64_t i = 0; i < iters; i++) {
+    MsgBuffer mb = {};
+    msg_buf_init(&mb, 64);
+    for (int f = 0; f < 32; f++) {
+      msg_buf_push(&mb, MSG_INPUT, stream, mixed_payload_len());
+    }
+    bench_escape(mb.data);
+    msg_buf_free(&mb);
+  }
+}
+
+// op: one message encoded or decoded. The zero message is valid for every schema and the codecs
+// do the same work whatever the values.
+#define BENCH_CODEC(id, type, fn, fields)                     \
+  static void bench_##fn##_encode(uint64_t iters) {           \
+    type msg = {};                                            \
+    uint8_t out[id##_SIZE];                                   \
+    for (uint64_t i = 0; i < iters; i++) {                    \
+      bench_escape(&msg);                                     \
+      fn##_encode(&msg, out);                                 \
+      bench_escape(out);                                      \
+    }                                                         \
+  }                                                           \
+  static void bench_##fn##_decode(uint64_t iters) {           \
+    type msg = {};                                            \
+    uint8_t data[id##_SIZE];                                  \
+    fn##_encode(&msg, data);                                  \
+    for (uint64_t i = 0; i < iters; i++) {                    \
+      bench_escape(data);                                     \
+      if (!fn##_decode(&msg, data, sizeof(data))) {           \
+        abort();                                              \
+      }                                                       \
+      bench_escape(&msg);                                     \
+    }                                                         \
+  }
+PROTOCOL_MESSAGES(BENCH_CODEC)
+
+// Snapshots of a match in play, consecutive ticks so deltas are as small as they get on the wire.
+static Snapshot snaps[2];
+static SnapshotHistory snap_history;
+
+static void snapshots_init(void) {
+  PongSim s;
+  pong_sim_init(&s, 7);
+  PongInput input = {.paddle_dir = {1, -1}};
+  for (int t = 0; t < PONG_TICK_HZ; t++) {
+    pong_tick(&s, &input);
+  }
+  snapshot_from_sim(&snaps[0], &s, s.tick);
+  pong_tick(&s, &input);
+  snapshot_from_sim(&snaps[1], &s, s.tick);
+  snapshot_history_put(&snap_history, &snaps[0]);
+}
+
+// op: one snapshot encoded without a baseline
+static void bench_snapshot_encode_full(uint64_t iters) {
+  uint8_t out[SNAPSHOT_MAX_ENCODED];
+  for (uint64_t i = 0; i < iters; i++) {
+    bench_escape(snaps);
+    snapshot_encode(&snaps[1], nullptr, PONG_TICK_HZ, out);
+    bench_escape(out);
+  }
+}
+
+// op: one snapshot encoded against the previous tick's
+static void bench_snapshot_encode_delta(uint64_t iters) {
+  uint8_t out[SNAPSHOT_MAX_ENCODED];
+  for (uint64_t i = 0; i < iters; i++) {
+    bench_escape(snaps);
+    snapshot_encode(&snaps[1], &snaps[0], PONG_TICK_HZ, out);
+    bench_escape(out);
+  }
+}
+
+// op: one delta snapshot decoded against the history
+static void bench_snapshot_decode_delta(uint64_t iters) {
+  uint8_t data[SNAPSHOT_MAX_ENCODED];
+  size_t len = snapshot_encode(&snaps[1], &snaps[0], PONG_TICK_HZ, data);
+  Snapshot snap;
+  for (uint64_t i = 0; i < iters; i++) {
+    bench_escape(data);
+    if (snapshot_decode(&snap, data, len, &snap_history, PONG_TICK_HZ) == -1) {
+      abort();
+    }
+    bench_escape(&snap);
+  }
+}
+
+// op: one tick of one match, paddles chasing the ball a quarter of the time like the bots do
+static void bench_pong_tick(uint64_t iters) {
+  PongSim s;
+  pong_sim_init(&s, 1);
+  for (uint64_t i = 0; i < iters; i++) {
+    PongInput input;
+    for (int p = 0; p < 2; p++) {
+      uint32_t r = bench_rand();
+      int chase = s.ball_pos.y < s.players[p].pos ? -1 : 1;
+      input.paddle_dir[p] = (int8_t)((r & 3) == 0 ? chase : (int)(r >> 2) % 3 - 1);
+    }
+    pong_tick(&s, &input);
+  }
+  bench_escape(&s);
+}
+
+// op: a player joining with a random rating and round trip, and its share of the pairing passes
+// that run every 256 joins, a burst of arrivals per tick
+static void bench_matchmaker(uint64_t iters) {
+  enum { IDS = 4096, BURST = 256 };
+  Matchmaker mm;
+  matchmaker_init(&mm);
+  static int free_ids[IDS];
+  int free_count = IDS;
+  for (int i = 0; i < IDS; i++) {
+    free_ids[i] = IDS - 1 - i;
+  }
+  MatchmakerPair pairs[BURST];
+  uint64_t now = 0;
+  for (uint64_t i = 0; i < iters; i++) {
+    uint32_t r = bench_rand();
+    uint16_t rating = (uint16_t)(1200 + r % 300 + (r >> 9) % 300);
+    matchmaker_add(&mm, free_ids[--free_count], (Transport)(r >> 31), rating, (r >> 18) % 250000,
+                   now);
+    if (i % BURST == BURST - 1 || free_count == 0) {
+      now += 1000000000ull / PONG_TICK_HZ;
+      int n;
+      while ((n = matchmaker_pair(&mm, now, pairs, BURST)) > 0) {
+        for (int p = 0; p < n; p++) {
+          free_ids[free_count++] = pairs[p].ids[0];
+          free_ids[free_count++] = pairs[p].ids[1];
+        }
+      }
+    }
+  }
+  bench_escape(&mm);
+  matchmaker_free(&mm);
+}
+
+// op: a published snapshot queued on one of 1024 spectators of a worker, with its share of
+// publishing, reading and copying the frame once and draining the queues
+static void bench_broadcast_fanout(uint64_t iters) {
+  enum { VIEWERS = 1024 };
+  static Viewer viewers[VIEWERS];
+  static SnapshotHistory history;
+  memset(viewers, 0, sizeof(viewers));
+  memset(&history, 0, sizeof(history));
+  SpectatorFeed* feed = spectator_feed_new(1);
+  Pool frames;
+  pool_init(&frames, sizeof(BroadcastFrame), 64);
+  Snapshot snap = snaps[1];
+  for (uint32_t n = 0; n < iters / VIEWERS + (iters % VIEWERS != 0); n++) {
+    snap.tick += 2;
+    spectator_feed_publish(feed, &snap);
+    FeedFrame f;
+    if (spectator_feed_read(feed, n, &f) != 1) {
+      abort();
+    }
+    snapshot_history_put(&history, &f.snap);
+    BroadcastFrame* shared = broadcast_frame_new(&frames);
+    memcpy(shared->data, f.data, f.len);
+    shared->len = f.len;
+    uint64_t left = iters - (uint64_t)n * VIEWERS;
+    uint64_t count = left < VIEWERS ? left : VIEWERS;
+    for (uint64_t v = 0; v < count; v++) {
+      viewer_offer(&viewers[v], shared, &f, &history, &frames);
+    }
+    broadcast_frame_release(&frames, shared);
+    for (uint64_t v = 0; v < count; v++) {
+      viewer_clear(&viewers[v], &frames);
+    }
+  }
+  pool_free(&frames);
+  spectator_feed_release(feed);
+}
+
+typedef void (*BenchFn)(uint64_t iters);
+
+typedef struct Bench {
+  const char* name;
+  BenchFn fn;
+} Bench;
+
+#define BENCH_CODEC_ENTRIES(id, type, fn, fields) \
+  {#fn "_encode", bench_##fn##_encode}, {#fn "_decode", bench_##fn##_decode},
+
+static const Bench benches[] = {
+    {"frame_try_parse", bench_frame_try_parse},
+    {"buf_recv_consume", bench_buf_recv_consume},
+    {"msg_buf_push", bench_msg_buf_push},
+    {"msg_buf_grow", bench_msg_buf_grow},
+    PROTOCOL_MESSAGES(BENCH_CODEC_ENTRIES)
+    {"snapshot_encode_full", bench_snapshot_encode_full},
+    {"snapshot_encode_delta", bench_snapshot_encode_delta},
+    {"snapshot_decode_delta", bench_snapshot_decode_delta},
+    {"pong_tick", bench_pong_tick},
+    {"matchmaker", bench_matchmaker},
+    {"broadcast_fanout", bench_broadcast_fanout},
+};
+
+typedef struct BenchResult {
+  uint64_t iters;
+  double ns_per_op;  // median of the runs
+  double ns_per_op_min;
+  double bytes_per_op;  // heap bytes allocated, what Go's -benchmem calls B/op
+  double allocs_per_op;
+} BenchResult;
+
+#define BENCH_RUNS 5
+
+static int cmp_double(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// Every run starts from the same seed, so each one repeats the same work.
+static uint64_t bench_time(BenchFn fn, uint64_t iters) {
+  bench_rng = 0x2545F491u;
+  uint64_t start = now_ns();
+  fn(iters);
+  return now_ns() - start;
+}
+
+// Doubles the iteration count until a run takes a tenth of run_ns, scales it up to run_ns, then
+// times BENCH_RUNS runs of that many. What a run allocates with no iterations at all is setup and
+// not counted against the ops.
+static BenchResult bench_run(BenchFn fn, uint64_t run_ns) {
+  uint64_t allocs = bench_allocs;
+  uint64_t alloc_bytes = bench_alloc_bytes;
+  bench_time(fn, 0);
+  uint64_t setup_allocs = bench_allocs - allocs;
+  uint64_t setup_bytes = bench_alloc_bytes - alloc_bytes;
+
+  uint64_t iters = 1;
+  uint64_t elapsed;
+  while ((elapsed = bench_time(fn, iters)) < run_ns / 10 && iters < (1ull << 40)) {
+    iters *= 2;
+  }
+  iters = (uint64_t)((double)iters * (double)run_ns / (double)(elapsed ? elapsed : 1)) + 1;
+
+  BenchResult r = {.iters = iters};
+  double ns[BENCH_RUNS];
+  allocs = bench_allocs + setup_allocs * BENCH_RUNS;
+  alloc_bytes = bench_alloc_bytes + setup_bytes * BENCH_RUNS;
+  for (int i = 0; i < BENCH_RUNS; i++) {
+    ns[i] = (double)bench_time(fn, iters) / (double)iters;
+  }
+  qsort(ns, BENCH_RUNS, sizeof(ns[0]), cmp_double);
+  r.ns_per_op = ns[BENCH_RUNS / 2];
+  r.ns_per_op_min = ns[0];
+  r.allocs_per_op = (double)(bench_allocs - allocs) / (double)(iters * BENCH_RUNS);
+  r.bytes_per_op = (double)(bench_alloc_bytes - alloc_bytes) / (double)(iters * BENCH_RUNS);
+  return r;
+}
+
+#define BENCH_HEADER "name\titers\tns_per_op\tns_per_op_min\tbytes_per_op\tallocs_per_op"
+
+typedef struct Baseline {
+  char name[64];
+  BenchResult r;
+} Baseline;
+
+// Reads what an earlier run printed, header and unknown lines are skipped.
+static int baseline_load(const char* path, Baseline* out, int cap) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  int count = 0;
+  char line[256];
+  while (count < cap && fgets(line, sizeof(line), f)) {
+    Baseline* b = &out[count];
+    unsigned long long iters;
+    if (sscanf(line, "%63s %llu %lf %lf %lf %lf", b->name, &iters, &b->r.ns_per_op,
+               &b->r.ns_per_op_min, &b->r.bytes_per_op, &b->r.allocs_per_op) == 6) {
+      b->r.iters = iters;
+      count++;
+    }
+  }
+  fclose(f);
+  return count;
+}
+
+// Slower by more than max_pct or allocating more is a regression. Allocations amortized over the
+// ops, like a buffer growing, vary a little with the iteration count.
+static bool baseline_check(const Baseline* base, int count, const char* name,
+                           const BenchResult* r, double max_pct) {
+  for (int i = 0; i < count; i++) {
+    if (strcmp(base[i].name, name) != 0) {
+      continue;
+    }
+    const BenchResult* b = &base[i].r;
+    bool slower = r->ns_per_op > b->ns_per_op * (1.0 + max_pct / 100.0);
+    bool allocs = r->allocs_per_op > b->allocs_per_op + 0.01;
+    if (slower || allocs) {
+      fprintf(stderr, "regression %s: %.2f ns/op (was %.2f), %.3f allocs/op (was %.3f)\n", name,
+              r->ns_per_op, b->ns_per_op, r->allocs_per_op, b->allocs_per_op);
+      return false;
+    }
+    return true;
+  }
+  return true;
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-t ms per run] [-b baseline file] [-x max slowdown %%] [-l] [filter]\n"
+          "prints a tab separated line per benchmark, -l lists them and a filter runs those\n"
+          "whose name contains it. With -b, exits 1 if one got slower or allocates more than\n"
+          "in the baseline, an earlier run's output.\n",
+          name);
+}
+
+int main(int argc, char* argv[]) {
+  uint64_t run_ms = 100;
+  const char* baseline_path = nullptr;
+  double max_pct = 10;
+  bool list = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:b:x:l")) != -1) {
+    switch (opt) {
+      case 't':
+        run_ms = strtoull(optarg, nullptr, 0);
+        break;
+      case 'b':
+        baseline_path = optarg;
+        break;
+      case 'x':
+        max_pct = strtod(optarg, nullptr);
+        break;
+      case 'l':
+        list = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  const char* filter = optind < argc ? argv[optind] : "";
+  if (run_ms == 0 || max_pct < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  int bench_count = (int)(sizeof(benches) / sizeof(benches[0]));
+  if (list) {
+    for (int i = 0; i < bench_count; i++) {
+      printf("%s\n", benches[i].name);
+    }
+    return 0;
+  }
+
+  static Baseline base[128];
+  int base_count = 0;
+  if (baseline_path && (base_count = baseline_load(baseline_path, base, 128)) == -1) {
+    return 1;
+  }
+  stream_init();
+  snapshots_init();
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock_pair) == -1) {
+    perror("socketpair");
+    return 1;
+  }
+  set_nonblocking(sock_pair[0]);
+  set_nonblocking(sock_pair[1]);
+
+  bool ok = true;
+  printf(BENCH_HEADER "\n");
+  for (int i = 0; i < bench_count; i++) {
+    if (!strstr(benches[i].name, filter)) {
+      continue;
+    }
+    BenchResult r = bench_run(benches[i].fn, run_ms * 1000000ull);
+    printf("%s\t%llu\t%.2f\t%.2f\t%.1f\t%.3f\n", benches[i].name, (unsigned long long)r.iters,
+           r.ns_per_op, r.ns_per_op_min, r.bytes_per_op, r.allocs_per_op);
+    fflush(stdout);
+    ok &= baseline_check(base, base_count, benches[i].name, &r, max_pct);
+  }
+  close(sock_pair[0]);
+  close(sock_pair[1]);
+  return ok ? 0 : 1;
+}
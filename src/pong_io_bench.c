@@ -0,0 +1,328 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buf.h"
+#include "event_loop.h"
+#include "networking.h"
+#include "protocol.h"
+#include "snapshot.h"
+#include "uring.h"
+
+// Server side transport cost of a tick at many connections, on epoll and on io_uring: every
+// client sends an input, the server reads and parses it and answers with a snapshot sized frame,
+// the way a worker does. The syscalls the server side makes are counted by wrapping them at link
+// time (see CMakeLists.txt), the clients use read and write, which aren't. io_uring runs the
+// receives of a socket wherever its thread next enters the kernel, here often in a client's
+// write, so its time per tick leaves some of that work out.
+
+static uint64_t calls_epoll_wait;
+static uint64_t calls_recv;
+static uint64_t calls_writev;
+static uint64_t calls_uring_enter;
+
+int __real_epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout);
+ssize_t __real_recv(int fd, void* buf, size_t len, int flags);
+ssize_t __real_writev(int fd, const struct iovec* iov, int iovcnt);
+long __real_syscall(long number, ...);
+
+int __wrap_epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+  calls_epoll_wait++;
+  return __real_epoll_wait(epfd, events, maxevents, timeout);
+}
+
+ssize_t __wrap_recv(int fd, void* buf, size_t len, int flags) {
+  calls_recv++;
+  return __real_recv(fd, buf, len, flags);
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec* iov, int iovcnt) {
+  calls_writev++;
+  return __real_writev(fd, iov, iovcnt);
+}
+
+long __wrap_syscall(long number, ...) {
+  va_list ap;
+  va_start(ap, number);
+  long a[6];
+  for (int i = 0; i < 6; i++) {
+    a[i] = va_arg(ap, long);
+  }
+  va_end(ap);
+  calls_uring_enter += number == __NR_io_uring_enter;
+  return __real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+static uint64_t calls_total(void) {
+  return calls_epoll_wait + calls_recv + calls_writev + calls_uring_enter;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct BenchConn {
+  int fd;  // server side
+  int client_fd;
+  Buf in;
+  SendRing out;
+  bool sending;
+} BenchConn;
+
+typedef struct Bench {
+  BenchConn* conns;
+  int count;
+  int* by_fd;  // index into conns of each server side fd
+  int fd_cap;
+  EventLoop loop;
+  Uring ring;
+  struct msghdr* msgs;
+  struct iovec* iovs;  // 2 per conn
+  uint64_t frames;
+  bool failed;
+} Bench;
+
+// as a server worker has them
+#define BENCH_URING_ENTRIES 8192
+#define BENCH_URING_BUFS 4096
+
+static bool count_frame([[maybe_unused]] Frame* fr, void* user_data) {
+  ((Bench*)user_data)->frames++;
+  return true;
+}
+
+static void on_bench_conn([[maybe_unused]] EventLoop* loop, int fd,
+                          [[maybe_unused]] uint32_t events, void* user_data) {
+  Bench* b = user_data;
+  if (conn_recv_frames(&b->conns[b->by_fd[fd]].in, fd, count_frame, b) < 0) {
+    b->failed = true;
+  }
+}
+
+static void bench_reap(Bench* b) {
+  UringCqe cqe;
+  while (uring_next(&b->ring, &cqe)) {
+    BenchConn* c = &b->conns[cqe.user_data >> 1];
+    bool send = cqe.user_data & 1;
+    if (send) {
+      c->sending = false;
+      if (cqe.res > 0) {
+        send_ring_consume(&c->out, (size_t)cqe.res);
+      } else if (cqe.res != -EAGAIN) {
+        b->failed = true;
+      }
+    } else if (cqe.res > 0) {
+      if (conn_feed_frames(&c->in, uring_buf(&b->ring, cqe.buf), (size_t)cqe.res, count_frame,
+                           b) < 0) {
+        b->failed = true;
+      }
+    } else if (cqe.res != -ENOBUFS) {
+      b->failed = true;
+    }
+    if (!send && !cqe.more) {
+      uring_recv_multishot(&b->ring, c->fd, cqe.user_data);
+    }
+    if (cqe.has_buf) {
+      uring_buf_return(&b->ring, cqe.buf);
+    }
+  }
+}
+
+static void on_bench_ring([[maybe_unused]] EventLoop* loop, [[maybe_unused]] int fd,
+                          [[maybe_unused]] uint32_t events, void* user_data) {
+  bench_reap(user_data);
+}
+
+static bool bench_open(Bench* b, int count, bool uring) {
+  *b = (Bench){.count = count, .ring = {.fd = -1}};
+  b->conns = calloc((size_t)count, sizeof(BenchConn));
+  b->msgs = calloc((size_t)count, sizeof(struct msghdr));
+  b->iovs = calloc((size_t)count * 2, sizeof(struct iovec));
+  if (!b->conns || !b->msgs || !b->iovs || ev_loop_init(&b->loop) == -1) {
+    return false;
+  }
+  if (uring) {
+    if (uring_init(&b->ring, BENCH_URING_ENTRIES, BENCH_URING_BUFS, 2048) == -1 ||
+        ev_add(&b->loop, b->ring.fd, EV_READ, on_bench_ring, b) == -1) {
+      return false;
+    }
+  }
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t addr_len = sizeof(addr);
+  if (listen_fd == -1 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      listen(listen_fd, SOMAXCONN) == -1 ||
+      getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len) == -1) {
+    perror("listen");
+    return false;
+  }
+  int yes = 1;
+  for (int i = 0; i < count; i++) {
+    BenchConn* c = &b->conns[i];
+    c->client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->client_fd == -1 ||
+        connect(c->client_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        (c->fd = accept(listen_fd, nullptr, nullptr)) == -1) {
+      perror("connect");
+      return false;
+    }
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+    setsockopt(c->client_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+    set_nonblocking(c->fd);
+    set_nonblocking(c->client_fd);
+    buf_init(&c->in, 2048);
+    send_ring_init(&c->out, 1024);
+    if (c->fd >= b->fd_cap) {
+      int cap = b->fd_cap ? b->fd_cap * 2 : 1024;
+      while (cap <= c->fd) {
+        cap *= 2;
+      }
+      b->by_fd = realloc(b->by_fd, sizeof(int) * cap);
+      b->fd_cap = cap;
+    }
+    b->by_fd[c->fd] = i;
+    bool armed = uring ? uring_recv_multishot(&b->ring, c->fd, (uint64_t)i << 1)
+                       : ev_add(&b->loop, c->fd, EV_READ, on_bench_conn, b) == 0;
+    if (!armed) {
+      return false;
+    }
+  }
+  close(listen_fd);
+  return !uring || uring_submit(&b->ring) >= 0;
+}
+
+static void bench_close(Bench* b) {
+  for (int i = 0; i < b->count; i++) {
+    BenchConn* c = &b->conns[i];
+    if (c->fd > 0) close(c->fd);
+    if (c->client_fd > 0) close(c->client_fd);
+    buf_free(&c->in);
+    send_ring_free(&c->out);
+  }
+  uring_free(&b->ring);
+  ev_loop_free(&b->loop);
+  free(b->conns);
+  free(b->msgs);
+  free(b->iovs);
+  free(b->by_fd);
+}
+
+static void bench_clients_send(Bench* b) {
+  uint8_t frame[MSG_HDR_SIZE + MSG_INPUT_SIZE] = {};
+  msg_hdr_write(frame, MSG_INPUT, MSG_INPUT_SIZE);
+  for (int i = 0; i < b->count; i++) {
+    if (write(b->conns[i].client_fd, frame, sizeof(frame)) != sizeof(frame)) {
+      b->failed = true;
+    }
+  }
+}
+
+static void bench_clients_drain(Bench* b) {
+  uint8_t scratch[65536];
+  for (int i = 0; i < b->count; i++) {
+    while (read(b->conns[i].client_fd, scratch, sizeof(scratch)) > 0) {
+    }
+  }
+}
+
+// What a worker does with its connections once a tick.
+static void bench_server_tick(Bench* b, bool uring) {
+  static uint8_t snapshot[SNAPSHOT_MAX_ENCODED / 2];
+  // until nothing is left, a wait returns a limited batch of ready fds
+  while (ev_run_once(&b->loop, 0) > 0) {
+  }
+  for (int i = 0; i < b->count; i++) {
+    send_ring_push(&b->conns[i].out, MSG_SNAPSHOT, snapshot, sizeof(snapshot));
+  }
+  for (int i = 0; i < b->count; i++) {
+    BenchConn* c = &b->conns[i];
+    if (!uring) {
+      if (send_ring_flush(&c->out, c->fd) == -1) {
+        b->failed = true;
+      }
+      continue;
+    }
+    if (c->sending) {
+      continue;
+    }
+    struct iovec* iov = &b->iovs[i * 2];
+    b->msgs[i] = (struct msghdr){.msg_iov = iov, .msg_iovlen = (size_t)send_ring_iov(&c->out, iov)};
+    c->sending = uring_sendmsg(&b->ring, c->fd, &b->msgs[i], (uint64_t)i << 1 | 1);
+  }
+  if (uring) {
+    uring_submit(&b->ring);
+    bench_reap(b);
+  }
+}
+
+static bool bench_run(int count, int ticks, bool uring) {
+  Bench b;
+  if (!bench_open(&b, count, uring)) {
+    fprintf(stderr, "%s: setup failed\n", uring ? "io_uring" : "epoll");
+    bench_close(&b);
+    return false;
+  }
+  // a few ticks to settle, then only the server side is counted and timed
+  for (int t = 0; t < 8; t++) {
+    bench_clients_send(&b);
+    bench_server_tick(&b, uring);
+    bench_clients_drain(&b);
+  }
+  b.frames = 0;
+  calls_epoll_wait = calls_recv = calls_writev = calls_uring_enter = 0;
+  uint64_t server_ns = 0;
+  for (int t = 0; t < ticks; t++) {
+    bench_clients_send(&b);
+    uint64_t start = now_ns();
+    bench_server_tick(&b, uring);
+    server_ns += now_ns() - start;
+    bench_clients_drain(&b);
+  }
+  double per_tick = (double)calls_total() / ticks;
+  printf("%-8s  %6i connections  %9.1f syscalls/tick  (epoll_wait %.1f, recv %.1f, writev %.1f, "
+         "io_uring_enter %.1f)  %8.1f us/tick  %.3f frames/conn/tick%s\n",
+         uring ? "io_uring" : "epoll", count, per_tick, (double)calls_epoll_wait / ticks,
+         (double)calls_recv / ticks, (double)calls_writev / ticks,
+         (double)calls_uring_enter / ticks, (double)server_ns / ticks / 1000.0,
+         (double)b.frames / ((double)ticks * count), b.failed ? "  FAILED" : "");
+  bool ok = !b.failed;
+  bench_close(&b);
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  int count = argc > 1 ? (int)strtol(argv[1], nullptr, 0) : 5000;
+  int ticks = argc > 2 ? (int)strtol(argv[2], nullptr, 0) : 200;
+  if (count <= 0 || ticks <= 0) {
+    fprintf(stderr, "usage: %s [connections] [ticks]\n", argv[0]);
+    return 1;
+  }
+  // both ends of every connection
+  struct rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+  bool ok = bench_run(count, ticks, false);
+  Uring probe;
+  if (uring_init(&probe, 8, 8, 64) == -1) {
+    printf("io_uring  not supported by this kernel\n");
+    return ok ? 0 : 1;
+  }
+  uring_free(&probe);
+  ok &= bench_run(count, ticks, true);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,676 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buf.h"
+#include "event_loop.h"
+#include "input.h"
+#include "metrics.h"
+#include "netsim.h"
+#include "networking.h"
+#include "pong.h"
+#include "protocol.h"
+#include "snapshot.h"
+#include "udp.h"
+
+// Headless bots for soak and capacity testing of pong_server. Every bot is a full client as far
+// as the server can tell: it joins, predicts its own paddle from a simple chasing AI, sends its
+// input stream, decodes and acks delta snapshots and reconciles against input acks. All bots run
+// on one event loop at the simulation tick. Spectator bots watch a match instead, some of them
+// stall their reads now and then to make the server resync them.
+
+typedef enum BotState { BOT_IDLE, BOT_CONNECTING, BOT_WAITING, BOT_PLAYING, BOT_WATCHING } BotState;
+
+// a stalling spectator alternates between reading nothing and reading normally for this long
+#define STALL_NS 10000000000ull
+
+struct LoadGen;
+
+typedef struct Bot {
+  struct LoadGen* lg;
+  int id;
+  bool spectator;
+  bool stalls;
+  BotState state;
+  int fd;
+  int udp_fd;  // -1 unless playing over udp
+  Buf in;
+  SendRing out;
+  UdpEndpoint udp;
+  int player;
+  PongSim sim;  // snapshots for everything but our paddle, which is predicted
+  SnapshotHistory snaps;
+  InputRing inputs;
+  uint32_t inputs_sent_seq;
+  uint64_t input_sent_ns[INPUT_RING_SIZE];
+  bool has_snap;
+  uint32_t snap_tick;
+  uint64_t snap_ns;
+  float aim;  // offset from the ball the AI steers to, redrawn every hit
+  float last_vx;
+  uint64_t reconnect_ns;
+  uint64_t session_end_ns;
+} Bot;
+
+typedef struct LoadGen {
+  EventLoop loop;
+  const char* host;
+  const char* port;
+  Transport transport;
+  Bot* bots;  // the players, then the spectators
+  int bot_count;
+  int spectator_count;
+  uint32_t watch;       // match the spectators ask for, 0 for the longest running one
+  double stall_share;   // of the spectators
+  double ramp_per_sec;
+  double target;      // bots allowed to be connected by now, grows with the ramp
+  double churn_secs;  // mean session length, 0 to keep sessions until the server ends them
+  double loss;        // probability of dropping a udp datagram in each direction
+  NetSim netsim;      // what the bots send in a match goes through it
+  int server_pid;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  uint32_t rng;
+
+  MetricHist latency;  // us from input sent to authoritative ack
+  MetricHist jitter;   // us of snapshot arrival against the server's tick spacing
+  MetricHist spectate_jitter;
+  MetricHist total_latency;
+  MetricHist total_jitter;
+  MetricHist total_spectate_jitter;
+  uint64_t snapshots;
+  uint64_t spectator_snapshots;
+  uint64_t decode_errors;
+  uint64_t sessions;
+  uint64_t matches;
+  uint64_t disconnects;
+  uint64_t dropped;
+  uint64_t cpu_ticks;  // server utime + stime at the last report
+  uint64_t report_ns;
+} LoadGen;
+
+static volatile sig_atomic_t running = 1;
+
+static void on_sigint([[maybe_unused]] int sig) { running = 0; }
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t lg_rand(LoadGen* lg) {
+  uint32_t x = lg->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  lg->rng = x;
+  return x;
+}
+
+static double lg_uniform(LoadGen* lg) { return (lg_rand(lg) >> 8) / (double)(1u << 24); }
+
+static void hist_print(const char* name, const MetricHist* h) {
+  if (metric_get(&h->total) == 0) {
+    printf("  %-8s no samples\n", name);
+    return;
+  }
+  printf("  %-8s p50 %6.2f ms  p90 %6.2f ms  p99 %6.2f ms  max %6.2f ms  (%llu samples)\n", name,
+         metric_hist_quantile(h, 0.5) / 1e3, metric_hist_quantile(h, 0.9) / 1e3,
+         metric_hist_quantile(h, 0.99) / 1e3, metric_get(&h->max) / 1e3,
+         (unsigned long long)metric_get(&h->total));
+}
+
+// utime + stime of pid in clock ticks, 0 if it can't be read
+static uint64_t proc_cpu_ticks(int pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%i/stat", pid);
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    return 0;
+  }
+  char buf[1024];
+  size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[n] = '\0';
+  // the command name may contain anything, fields resume after its closing paren
+  char* p = strrchr(buf, ')');
+  unsigned long utime, stime;
+  if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime,
+                   &stime) != 2) {
+    return 0;
+  }
+  return utime + stime;
+}
+
+static bool bot_stalled(LoadGen* lg, Bot* b, uint64_t now) {
+  return b->stalls && (now - lg->start_ns) / STALL_NS % 2 == 0;
+}
+
+static void on_bot_event(EventLoop* loop, int fd, uint32_t events, void* user_data);
+static void on_bot_udp_event(EventLoop* loop, int fd, uint32_t events, void* user_data);
+
+static void bot_close(LoadGen* lg, Bot* b, bool ended_by_server) {
+  if (b->state == BOT_IDLE) {
+    return;
+  }
+  if (ended_by_server) {
+    lg->disconnects++;
+  }
+  ev_del(&lg->loop, b->fd);
+  netsim_forget(&lg->netsim, b->fd);
+  close(b->fd);
+  if (b->udp_fd >= 0) {
+    ev_del(&lg->loop, b->udp_fd);
+    netsim_forget(&lg->netsim, b->udp_fd);
+    close(b->udp_fd);
+    udp_endpoint_free(&b->udp);
+    b->udp_fd = -1;
+  }
+  b->state = BOT_IDLE;
+  // back off a little so a server that drops everyone isn't hammered in lockstep, spectators
+  // longer, they are turned away until there is a match to watch
+  b->reconnect_ns = now_ns() + (uint64_t)(lg_uniform(lg) * (b->spectator ? 1e9 : 100e6));
+}
+
+static void bot_connect(LoadGen* lg, Bot* b, struct addrinfo* ai) {
+  int fd = socket(ai->ai_family, SOCK_STREAM, 0);
+  if (fd == -1) {
+    perror("socket");
+    b->reconnect_ns = now_ns() + 1000000000ull;
+    return;
+  }
+  set_nonblocking(fd);
+  int yes = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+  if (connect(fd, ai->ai_addr, ai->ai_addrlen) == -1 && errno != EINPROGRESS) {
+    perror("connect");
+    close(fd);
+    b->reconnect_ns = now_ns() + 1000000000ull;
+    return;
+  }
+  b->fd = fd;
+  b->in.head = b->in.size = 0;
+  b->out.head = b->out.tail = 0;
+  b->state = BOT_CONNECTING;
+  uint64_t now = now_ns();
+  b->session_end_ns =
+      lg->churn_secs > 0 ? now + (uint64_t)(-log(1.0 - lg_uniform(lg)) * lg->churn_secs * 1e9)
+                         : UINT64_MAX;
+  if (b->stalls) {
+    // as small as the kernel allows, so a stall backs up into the server quickly
+    int rcvbuf = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+  }
+  if (b->spectator) {
+    uint8_t payload[MSG_SPECTATE_SIZE];
+    MsgSpectate spectate = {.version = PROTOCOL_VERSION, .match = lg->watch};
+    send_ring_push(&b->out, MSG_SPECTATE, payload, msg_spectate_encode(&spectate, payload));
+    memset(&b->snaps, 0, sizeof(b->snaps));
+    b->has_snap = false;
+  } else {
+    uint8_t payload[MSG_JOIN_SIZE];
+    // ratings peak around 1500 like a real population, so the server's matchmaking has work to do
+    uint16_t rating = (uint16_t)(1200 + lg_rand(lg) % 300 + lg_rand(lg) % 300);
+    MsgJoin join = {.version = PROTOCOL_VERSION, .transport = lg->transport, .rating = rating};
+    send_ring_push(&b->out, MSG_JOIN, payload, msg_join_encode(&join, payload));
+  }
+  if (ev_add(&lg->loop, fd, EV_READ | EV_WRITE, on_bot_event, b) == -1) {
+    close(fd);
+    b->state = BOT_IDLE;
+    return;
+  }
+  lg->sessions++;
+}
+
+static bool bot_open_udp(LoadGen* lg, Bot* b, uint32_t token, uint16_t udp_port) {
+  char port[8];
+  snprintf(port, sizeof(port), "%u", udp_port);
+  struct addrinfo* ai = get_addr_info_socktype(port, lg->host, SOCK_DGRAM);
+  if (!ai) {
+    return false;
+  }
+  int fd = socket(ai->ai_family, SOCK_DGRAM, 0);
+  if (fd == -1 || connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+    perror("udp connect");
+    freeaddrinfo(ai);
+    if (fd != -1) close(fd);
+    return false;
+  }
+  freeaddrinfo(ai);
+  set_nonblocking(fd);
+  udp_endpoint_init(&b->udp, token);
+  b->udp_fd = fd;
+  return ev_add(&lg->loop, fd, EV_READ, on_bot_udp_event, b) != -1;
+}
+
+// Messages to the server go over udp once the match has it, like the real client.
+static void bot_push(Bot* b, int type, const void* msg) {
+  uint8_t payload[PROTOCOL_MAX_MSG_SIZE];
+  size_t len = protocol_encode(type, msg, payload);
+  if (b->udp_fd < 0) {
+    send_ring_push(&b->out, type, payload, len);
+  } else if (msg_is_unreliable(type)) {
+    udp_send_unreliable(&b->udp, type, payload, len);
+  } else {
+    udp_send_reliable(&b->udp, type, payload, len);
+  }
+}
+
+static void bot_on_snapshot(LoadGen* lg, Bot* b, Frame* fr) {
+  Snapshot snap;
+  if (snapshot_decode(&snap, fr->payload, fr->hdr.len, &b->snaps, PONG_TICK_HZ) == -1) {
+    lg->decode_errors++;
+    return;
+  }
+  snapshot_history_put(&b->snaps, &snap);
+  uint64_t now = now_ns();
+  if (b->spectator) {
+    lg->spectator_snapshots++;
+  } else {
+    snapshot_apply(&snap, &b->sim, b->player);
+    bot_push(b, MSG_SNAPSHOT_ACK, &(MsgSnapshotAck){.tick = snap.tick});
+    lg->snapshots++;
+  }
+  // a stalled spectator reads a burst, that says nothing about the server
+  if (b->has_snap && (int32_t)(snap.tick - b->snap_tick) > 0 && !b->stalls) {
+    double expected = (double)(snap.tick - b->snap_tick) * 1e9 / PONG_TICK_HZ;
+    metric_hist_record(b->spectator ? &lg->spectate_jitter : &lg->jitter,
+                       (uint64_t)(fabs((double)(now - b->snap_ns) - expected) / 1e3));
+  }
+  if (!b->has_snap || (int32_t)(snap.tick - b->snap_tick) > 0) {
+    b->has_snap = true;
+    b->snap_tick = snap.tick;
+    b->snap_ns = now;
+  }
+}
+
+static bool bot_on_frame(Frame* fr, void* user_data) {
+  Bot* b = user_data;
+  LoadGen* lg = b->lg;
+  switch (fr->hdr.type) {
+    case MSG_MATCH_START: {
+      MsgMatchStart u;
+      if (b->state != BOT_WAITING || !msg_match_start_decode(&u, fr->payload, fr->hdr.len)) {
+        break;
+      }
+      b->player = u.player;
+      pong_sim_init(&b->sim, 1);
+      memset(&b->snaps, 0, sizeof(b->snaps));
+      b->inputs = (InputRing){};
+      b->inputs_sent_seq = 0;
+      b->has_snap = false;
+      if (u.transport == TRANSPORT_UDP && !bot_open_udp(lg, b, u.udp_token, u.udp_port)) {
+        bot_close(lg, b, false);
+        return false;
+      }
+      b->state = BOT_PLAYING;
+      lg->matches++;
+      break;
+    }
+    case MSG_SNAPSHOT:
+      bot_on_snapshot(lg, b, fr);
+      break;
+    case MSG_INPUT_ACK: {
+      MsgInputAck u;
+      if (!msg_input_ack_decode(&u, fr->payload, fr->hdr.len)) {
+        break;
+      }
+      uint32_t first_new = b->inputs.acked_seq;
+      if (input_ring_reconcile(&b->inputs, &u, &b->sim, b->player) &&
+          (int32_t)(u.seq + 1 - first_new) > 0) {
+        metric_hist_record(&lg->latency,
+                           (now_ns() - b->input_sent_ns[u.seq % INPUT_RING_SIZE]) / 1000);
+      }
+      break;
+    }
+    case MSG_REJECT:
+      fprintf(stderr, "bot %i: rejected, server speaks another protocol version\n", b->id);
+      running = 0;
+      bot_close(lg, b, false);
+      return false;
+    default:
+      break;
+  }
+  return true;
+}
+
+static void on_bot_event([[maybe_unused]] EventLoop* loop, [[maybe_unused]] int fd,
+                         uint32_t events, void* user_data) {
+  Bot* b = user_data;
+  LoadGen* lg = b->lg;
+  if (b->state == BOT_CONNECTING && (events & (EV_WRITE | EV_HUP))) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(b->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err) {
+      bot_close(lg, b, true);
+      return;
+    }
+    b->state = b->spectator ? BOT_WATCHING : BOT_WAITING;
+  }
+  if ((events & EV_WRITE) && send_ring_pending(&b->out) && send_ring_flush(&b->out, b->fd) == -1) {
+    bot_close(lg, b, true);
+    return;
+  }
+  if (bot_stalled(lg, b, now_ns()) && !(events & EV_HUP)) {
+    return;  // picked up by on_tick once the stall is over
+  }
+  if ((events & (EV_READ | EV_HUP)) && b->state != BOT_IDLE &&
+      conn_recv_frames(&b->in, b->fd, bot_on_frame, b) < 0) {
+    bot_close(lg, b, true);
+  }
+}
+
+static void on_bot_udp_event([[maybe_unused]] EventLoop* loop, int fd,
+                             [[maybe_unused]] uint32_t events, void* user_data) {
+  Bot* b = user_data;
+  LoadGen* lg = b->lg;
+  for (;;) {
+    uint8_t pkt[UDP_MAX_PACKET];
+    ssize_t n = recv(fd, pkt, sizeof(pkt), 0);
+    if (n < 0) {
+      return;
+    }
+    if (lg->loss > 0 && lg_uniform(lg) < lg->loss) {
+      lg->dropped++;
+      continue;
+    }
+    udp_on_packet(&b->udp, pkt, (size_t)n, now_ns(), bot_on_frame, b);
+    if (b->udp_fd != fd) {
+      return;  // closed by a frame
+    }
+  }
+}
+
+static void bot_flush_udp(LoadGen* lg, Bot* b, uint64_t now) {
+  UdpPacketOut out;
+  if (!udp_prepare_packet(&b->udp, now, &out)) {
+    return;
+  }
+  if (lg->loss > 0 && lg_uniform(lg) < lg->loss) {
+    lg->dropped++;
+  } else {
+    struct msghdr msg;
+    udp_packet_msghdr(&b->udp, &out, &msg);
+    netsim_sendmsg(&lg->netsim, b->udp_fd, &msg, now);
+  }
+  udp_packet_sent(&b->udp);
+}
+
+// Chases the ball with an offset that changes every hit, so rallies are long but still end.
+static void bot_tick(LoadGen* lg, Bot* b, uint64_t now) {
+  if ((b->sim.ball_velocity.x > 0) != (b->last_vx > 0)) {
+    b->aim = (float)(lg_uniform(lg) - 0.5) * paddle_dims.y * 1.3f;
+  }
+  b->last_vx = b->sim.ball_velocity.x;
+  float d = b->sim.ball_pos.y + b->aim - b->sim.players[b->player].pos;
+  int8_t dir = d > 4.f ? 1 : d < -4.f ? -1 : 0;
+  pong_move_paddle(&b->sim, b->player, dir);
+  uint32_t seq = input_ring_push(&b->inputs, dir);
+  b->input_sent_ns[seq % INPUT_RING_SIZE] = now;
+
+  MsgInput msg = {.player = (uint8_t)b->player, .view_tick = b->snap_tick};
+  if (b->udp_fd >= 0) {
+    input_ring_write(&b->inputs, b->inputs.next_seq - MSG_INPUT_MAX_CMDS, &msg);
+    bot_push(b, MSG_INPUT, &msg);
+    bot_flush_udp(lg, b, now);
+  } else {
+    while (b->inputs_sent_seq != b->inputs.next_seq &&
+           input_ring_write(&b->inputs, b->inputs_sent_seq, &msg) > 0) {
+      b->inputs_sent_seq = msg.first_seq + msg.count;
+      bot_push(b, MSG_INPUT, &msg);
+    }
+  }
+  if (send_ring_pending(&b->out) &&
+      netsim_ring_write(&lg->netsim, &b->out, b->fd, nullptr, 0, now) == -1) {
+    bot_close(lg, b, true);
+  }
+}
+
+static void on_tick([[maybe_unused]] EventLoop* loop, void* user_data) {
+  LoadGen* lg = user_data;
+  uint64_t now = now_ns();
+  if (now - lg->start_ns >= lg->duration_ns) {
+    running = 0;
+  }
+  int total = lg->bot_count + lg->spectator_count;
+  lg->target = fmin(lg->target + lg->ramp_per_sec / PONG_TICK_HZ, total);
+  struct addrinfo* ai = nullptr;
+  for (int i = 0; i < (int)lg->target; i++) {
+    Bot* b = &lg->bots[i];
+    if (b->state == BOT_IDLE) {
+      // there is nothing to watch before the first match
+      if (now < b->reconnect_ns || (b->spectator && lg->matches == 0 && lg->bot_count > 0)) {
+        continue;
+      }
+      if (!ai && !(ai = get_addr_info(lg->port, lg->host))) {
+        break;
+      }
+      bot_connect(lg, b, ai);
+    } else if (now >= b->session_end_ns) {
+      bot_close(lg, b, false);
+    } else if (b->state == BOT_PLAYING) {
+      bot_tick(lg, b, now);
+    } else if (b->state == BOT_WATCHING && b->stalls && !bot_stalled(lg, b, now)) {
+      // edge triggered, a full socket raises no event of its own once the bot reads again
+      on_bot_event(&lg->loop, b->fd, EV_READ, b);
+    }
+  }
+  if (ai) {
+    freeaddrinfo(ai);
+  }
+}
+
+static void on_netsim_timer([[maybe_unused]] EventLoop* loop, void* user_data) {
+  LoadGen* lg = user_data;
+  netsim_poll(&lg->netsim, now_ns());
+}
+
+static void on_report([[maybe_unused]] EventLoop* loop, void* user_data) {
+  LoadGen* lg = user_data;
+  uint64_t now = now_ns();
+  double secs = (double)(now - lg->report_ns) / 1e9;
+  int connected = 0, playing = 0, watching = 0;
+  for (int i = 0; i < lg->bot_count + lg->spectator_count; i++) {
+    connected += lg->bots[i].state != BOT_IDLE;
+    playing += lg->bots[i].state == BOT_PLAYING;
+    watching += lg->bots[i].state == BOT_WATCHING;
+  }
+  printf("t=%.0fs %i bots connected, %i in matches, %.0f snapshots/s, %llu sessions, %llu "
+         "match starts, %llu disconnects, %llu datagrams dropped\n",
+         (double)(now - lg->start_ns) / 1e9, connected, playing, (double)lg->snapshots / secs,
+         (unsigned long long)lg->sessions, (unsigned long long)lg->matches,
+         (unsigned long long)lg->disconnects, (unsigned long long)lg->dropped);
+  hist_print("latency", &lg->latency);
+  hist_print("jitter", &lg->jitter);
+  if (lg->spectator_count > 0) {
+    printf("  %i spectators watching, %.0f snapshots/s, %llu snapshots failed to decode\n",
+           watching, (double)lg->spectator_snapshots / secs,
+           (unsigned long long)lg->decode_errors);
+    hist_print("spectate", &lg->spectate_jitter);
+  }
+  if (lg->server_pid > 0) {
+    uint64_t cpu = proc_cpu_ticks(lg->server_pid);
+    double cpu_secs = (double)(cpu - lg->cpu_ticks) / (double)sysconf(_SC_CLK_TCK);
+    double matches = playing / 2.0;
+    printf("  server   %.1f%% cpu, %.1f us per match per second\n", cpu_secs / secs * 100.0,
+           matches > 0 ? cpu_secs / secs / matches * 1e6 : 0.0);
+    lg->cpu_ticks = cpu;
+  }
+  fflush(stdout);
+  metric_hist_merge(&lg->total_latency, &lg->latency);
+  metric_hist_merge(&lg->total_jitter, &lg->jitter);
+  metric_hist_merge(&lg->total_spectate_jitter, &lg->spectate_jitter);
+  metric_hist_reset(&lg->latency);
+  metric_hist_reset(&lg->jitter);
+  metric_hist_reset(&lg->spectate_jitter);
+  lg->snapshots = 0;
+  lg->spectator_snapshots = 0;
+  lg->report_ns = now;
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-h host] [-p port] [-n bots] [-t tcp|udp] [-r ramp bots/s] [-d duration s]\n"
+          "          [-c mean session s, 0 for none] [-l udp loss %%] [-s server pid]\n"
+          "          [-i report interval s] [-w spectators] [-m match to watch, 0 for the oldest]\n"
+          "          [-S %% of spectators that stall]\n"
+          "network conditions for what the bots send can be set in %s, see netsim.h\n",
+          name, NETSIM_ENV);
+}
+
+static void raise_fd_limit(void) {
+  struct rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  static LoadGen lg = {.host = "127.0.0.1", .port = "8080", .transport = TRANSPORT_TCP};
+  lg.bot_count = 1000;
+  lg.ramp_per_sec = 200;
+  double duration = 30, interval = 5;
+  int opt;
+  while ((opt = getopt(argc, argv, "h:p:n:t:r:d:c:l:s:i:w:m:S:")) != -1) {
+    switch (opt) {
+      case 'h':
+        lg.host = optarg;
+        break;
+      case 'p':
+        lg.port = optarg;
+        break;
+      case 'n':
+        lg.bot_count = (int)strtol(optarg, nullptr, 0);
+        break;
+      case 't':
+        lg.transport = strcmp(optarg, "udp") == 0 ? TRANSPORT_UDP : TRANSPORT_TCP;
+        break;
+      case 'r':
+        lg.ramp_per_sec = strtod(optarg, nullptr);
+        break;
+      case 'd':
+        duration = strtod(optarg, nullptr);
+        break;
+      case 'c':
+        lg.churn_secs = strtod(optarg, nullptr);
+        break;
+      case 'l':
+        lg.loss = strtod(optarg, nullptr) / 100.0;
+        break;
+      case 's':
+        lg.server_pid = (int)strtol(optarg, nullptr, 0);
+        break;
+      case 'i':
+        interval = strtod(optarg, nullptr);
+        break;
+      case 'w':
+        lg.spectator_count = (int)strtol(optarg, nullptr, 0);
+        break;
+      case 'm':
+        lg.watch = (uint32_t)strtoul(optarg, nullptr, 0);
+        break;
+      case 'S':
+        lg.stall_share = strtod(optarg, nullptr) / 100.0;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (lg.bot_count < 0 || lg.spectator_count < 0 || lg.bot_count + lg.spectator_count == 0 ||
+      lg.ramp_per_sec <= 0 || duration <= 0 || interval <= 0 || lg.churn_secs < 0 || lg.loss < 0 ||
+      lg.loss >= 1 || lg.stall_share < 0 || lg.stall_share > 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (lg.loss > 0 && lg.transport != TRANSPORT_UDP) {
+    fprintf(stderr, "induced loss only applies to udp bots\n");
+  }
+  NetSimProfile netsim;
+  const char* netsim_spec = getenv(NETSIM_ENV);
+  if (netsim_spec && !netsim_profile_parse(&netsim, netsim_spec)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, on_sigint);
+  signal(SIGTERM, on_sigint);
+  raise_fd_limit();
+
+  int total = lg.bot_count + lg.spectator_count;
+  lg.bots = calloc((size_t)total, sizeof(Bot));
+  if (!lg.bots || ev_loop_init(&lg.loop) == -1 ||
+      netsim_init(&lg.netsim, netsim_spec ? &netsim : nullptr, now_ns()) == -1) {
+    return 1;
+  }
+  for (int i = 0; i < total; i++) {
+    Bot* b = &lg.bots[i];
+    int spectator = i - lg.bot_count;
+    *b = (Bot){.lg = &lg,
+               .id = i,
+               .spectator = spectator >= 0,
+               .stalls = spectator >= 0 && spectator < lg.stall_share * lg.spectator_count,
+               .fd = -1,
+               .udp_fd = -1};
+    buf_init(&b->in, 2048);
+    send_ring_init(&b->out, 1024);
+  }
+  lg.rng = (uint32_t)now_ns() | 1;
+  lg.start_ns = lg.report_ns = now_ns();
+  lg.duration_ns = (uint64_t)(duration * 1e9);
+  if (lg.server_pid > 0) {
+    lg.cpu_ticks = proc_cpu_ticks(lg.server_pid);
+  }
+  if (ev_timer_add(&lg.loop, 1000000000ull / PONG_TICK_HZ, on_tick, &lg) == -1 ||
+      ev_timer_add(&lg.loop, (uint64_t)(interval * 1e9), on_report, &lg) == -1 ||
+      (lg.netsim.enabled && ev_timer_add(&lg.loop, NETSIM_SLOT_NS, on_netsim_timer, &lg) == -1)) {
+    return 1;
+  }
+  printf("pong_loadgen: %i %s bots and %i spectators against %s:%s, ramp %.0f/s, churn %.1f s, "
+         "loss %.1f%%\n",
+         lg.bot_count, lg.transport == TRANSPORT_UDP ? "udp" : "tcp", lg.spectator_count, lg.host,
+         lg.port, lg.ramp_per_sec, lg.churn_secs, lg.loss * 100.0);
+
+  while (running) {
+    if (ev_run_once(&lg.loop, -1) < 0 && errno != EINTR) {
+      break;
+    }
+  }
+
+  // the last interval unless the report timer just covered it
+  if (now_ns() - lg.report_ns >= 100000000ull) {
+    on_report(&lg.loop, &lg);
+  } else {
+    metric_hist_merge(&lg.total_latency, &lg.latency);
+    metric_hist_merge(&lg.total_jitter, &lg.jitter);
+    metric_hist_merge(&lg.total_spectate_jitter, &lg.spectate_jitter);
+  }
+  printf("total\n");
+  hist_print("latency", &lg.total_latency);
+  hist_print("jitter", &lg.total_jitter);
+  if (lg.spectator_count > 0) {
+    hist_print("spectate", &lg.total_spectate_jitter);
+  }
+  for (int i = 0; i < total; i++) {
+    bot_close(&lg, &lg.bots[i], false);
+    buf_free(&lg.bots[i].in);
+    send_ring_free(&lg.bots[i].out);
+  }
+  ev_loop_free(&lg.loop);
+  netsim_free(&lg.netsim);
+  free(lg.bots);
+  return 0;
+}
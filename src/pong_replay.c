@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "replay.h"
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint8_t* read_file(const char* path, size_t* len) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return nullptr;
+  }
+  uint8_t* data = nullptr;
+  size_t cap = 0;
+  *len = 0;
+  for (;;) {
+    if (*len == cap) {
+      cap = cap ? cap * 2 : 1 << 16;
+      uint8_t* new_data = realloc(data, cap);
+      if (!new_data) {
+        perror("realloc");
+        free(data);
+        fclose(f);
+        return nullptr;
+      }
+      data = new_data;
+    }
+    size_t n = fread(data + *len, 1, cap - *len, f);
+    if (n == 0) {
+      break;
+    }
+    *len += n;
+  }
+  fclose(f);
+  return data;
+}
+
+// Re-simulates the whole replay from memory as fast as it goes, checking every stored hash.
+static bool replay_verify(const char* path, const uint8_t* data, size_t len) {
+  ReplayReader r;
+  if (replay_reader_init(&r, data, len) == -1) {
+    fprintf(stderr, "%s: not a replay of this build's format and tick rate\n", path);
+    return false;
+  }
+  PongSim s;
+  pong_sim_init(&s, r.seed);
+  LagComp lc;
+  lag_comp_init(&lc, &s, r.max_rewind);
+  uint32_t hash = REPLAY_HASH_SEED;
+  uint32_t verified = 0;
+  ReplayTick t;
+  int rc;
+  uint64_t start = now_ns();
+  while ((rc = replay_read_tick(&r, &t)) == 1) {
+    replay_apply_tick(&t, &s, &lc);
+    hash = replay_hash_step(hash, &s);
+    if (r.has_hash) {
+      if (r.hash != hash) {
+        fprintf(stderr, "%s: diverged between tick %u and %u\n", path, verified, r.ticks);
+        return false;
+      }
+      verified = r.ticks;
+    }
+  }
+  double secs = (double)(now_ns() - start) / 1e9;
+  if (rc == -1) {
+    fprintf(stderr, "%s: malformed or truncated after tick %u, verified up to %u\n", path,
+            r.ticks, verified);
+    return false;
+  }
+  if (r.end_ticks != r.ticks || r.hash != hash) {
+    fprintf(stderr, "%s: diverged after tick %u\n", path, verified);
+    return false;
+  }
+  printf("%s: %u ticks (%.1f s of play), %i:%i, %llu lag compensated saves, verified in %.3f ms, "
+         "%.1f M ticks/s\n",
+         path, r.ticks, (double)r.ticks / PONG_TICK_HZ, s.players[0].score, s.players[1].score,
+         (unsigned long long)lc.saves, secs * 1e3, secs > 0 ? r.ticks / secs / 1e6 : 0.0);
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s replay...\n", argv[0]);
+    return 1;
+  }
+  int failed = 0;
+  for (int i = 1; i < argc; i++) {
+    size_t len;
+    uint8_t* data = read_file(argv[i], &len);
+    if (!data || !replay_verify(argv[i], data, len)) {
+      failed++;
+    }
+    free(data);
+  }
+  return failed ? 1 : 0;
+}
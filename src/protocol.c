@@ -0,0 +1,141 @@
+#include "protocol.h"
+
+#include <string.h>
+
+// Field codecs. Decoders never branch on the data, range checks are folded into ok.
+
+static uint8_t* put_u8(uint8_t* p, uint8_t v) {
+  p[0] = v;
+  return p + 1;
+}
+
+static uint8_t* put_i8(uint8_t* p, int8_t v) { return put_u8(p, (uint8_t)v); }
+
+static uint8_t* put_u16(uint8_t* p, uint16_t v) {
+  wire_put_u16(p, v);
+  return p + 2;
+}
+
+static uint8_t* put_u32(uint8_t* p, uint32_t v) {
+  wire_put_u32(p, v);
+  return p + 4;
+}
+
+static uint8_t* put_i32(uint8_t* p, int32_t v) { return put_u32(p, (uint32_t)v); }
+
+static uint8_t* put_f32(uint8_t* p, float v) {
+  uint32_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return put_u32(p, bits);
+}
+
+static uint8_t* put_vec2(uint8_t* p, Vector2 v) { return put_f32(put_f32(p, v.x), v.y); }
+static uint8_t* put_b8(uint8_t* p, bool v) { return put_u8(p, v); }
+static uint8_t* put_player(uint8_t* p, int v) { return put_u8(p, (uint8_t)v); }
+static uint8_t* put_game_state(uint8_t* p, GameState v) { return put_u8(p, (uint8_t)v); }
+static uint8_t* put_transport(uint8_t* p, Transport v) { return put_u8(p, (uint8_t)v); }
+static uint8_t* put_input_count(uint8_t* p, uint8_t v) { return put_u8(p, v); }
+
+static const uint8_t* get_u8(const uint8_t* p, uint8_t* v, [[maybe_unused]] bool* ok) {
+  *v = p[0];
+  return p + 1;
+}
+
+static const uint8_t* get_i8(const uint8_t* p, int8_t* v, [[maybe_unused]] bool* ok) {
+  *v = (int8_t)p[0];
+  return p + 1;
+}
+
+static const uint8_t* get_u16(const uint8_t* p, uint16_t* v, [[maybe_unused]] bool* ok) {
+  *v = wire_get_u16(p);
+  return p + 2;
+}
+
+static const uint8_t* get_u32(const uint8_t* p, uint32_t* v, [[maybe_unused]] bool* ok) {
+  *v = wire_get_u32(p);
+  return p + 4;
+}
+
+static const uint8_t* get_i32(const uint8_t* p, int32_t* v, [[maybe_unused]] bool* ok) {
+  *v = (int32_t)wire_get_u32(p);
+  return p + 4;
+}
+
+static const uint8_t* get_f32(const uint8_t* p, float* v, [[maybe_unused]] bool* ok) {
+  uint32_t bits = wire_get_u32(p);
+  memcpy(v, &bits, sizeof(bits));
+  return p + 4;
+}
+
+static const uint8_t* get_vec2(const uint8_t* p, Vector2* v, bool* ok) {
+  return get_f32(get_f32(p, &v->x, ok), &v->y, ok);
+}
+
+static const uint8_t* get_b8(const uint8_t* p, bool* v, bool* ok) {
+  *ok &= p[0] <= 1;
+  *v = p[0] != 0;
+  return p + 1;
+}
+
+static const uint8_t* get_player(const uint8_t* p, int* v, bool* ok) {
+  *ok &= p[0] < 2;
+  *v = p[0];
+  return p + 1;
+}
+
+static const uint8_t* get_game_state(const uint8_t* p, GameState* v, bool* ok) {
+  *ok &= p[0] < STATE_COUNT;
+  *v = (GameState)p[0];
+  return p + 1;
+}
+
+static const uint8_t* get_transport(const uint8_t* p, Transport* v, bool* ok) {
+  *ok &= p[0] < TRANSPORT_COUNT;
+  *v = (Transport)p[0];
+  return p + 1;
+}
+
+static const uint8_t* get_input_count(const uint8_t* p, uint8_t* v, bool* ok) {
+  *ok &= p[0] <= MSG_INPUT_MAX_CMDS;
+  *v = p[0];
+  return p + 1;
+}
+
+#define ENCODE_FIELD(kind, name) p = put_##kind(p, msg->name);
+#define ENCODE_ARRAY(kind, name, n)  \
+  for (int i = 0; i < (n); i++) {    \
+    p = put_##kind(p, msg->name[i]); \
+  }
+#define DECODE_FIELD(kind, name) p = get_##kind(p, &msg->name, &ok);
+#define DECODE_ARRAY(kind, name, n)        \
+  for (int i = 0; i < (n); i++) {          \
+    p = get_##kind(p, &msg->name[i], &ok); \
+  }
+
+#define CODEC(id, type, fn, fields)                               \
+  size_t fn##_encode(const type* msg, uint8_t* out) {             \
+    uint8_t* p = out;                                             \
+    fields(ENCODE_FIELD, ENCODE_ARRAY) return (size_t)(p - out);  \
+  }                                                               \
+  bool fn##_decode(type* msg, const uint8_t* data, size_t len) {  \
+    if (len < id##_SIZE) {                                        \
+      return false;                                               \
+    }                                                             \
+    const uint8_t* p = data;                                      \
+    bool ok = true;                                               \
+    fields(DECODE_FIELD, DECODE_ARRAY)(void) p;                   \
+    return ok;                                                    \
+  }
+PROTOCOL_MESSAGES(CODEC)
+
+size_t protocol_encode(uint32_t type, const void* msg, uint8_t* out) {
+#define ENCODE_CASE(id, type, fn, fields) \
+  case id:                                \
+    return fn##_encode(msg, out);
+  switch (type) {
+    PROTOCOL_MESSAGES(ENCODE_CASE)
+    default:
+      return 0;
+  }
+#undef ENCODE_CASE
+}
@@ -0,0 +1,198 @@
+#ifndef PONG_GAME_PROTOCOL_H
+#define PONG_GAME_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pong.h"
+
+// Bumped on any change to the schema below. Clients send it first thing in MSG_JOIN or
+// MSG_SPECTATE, whose version fields must therefore never move.
+#define PROTOCOL_VERSION 5
+
+typedef enum GameState {
+  STATE_MENU,
+  STATE_PLAY,
+  STATE_PAUSE_MENU,
+  STATE_WAIT_FOR_PLAYER_TWO_AS_HOST,
+  STATE_COUNT
+} GameState;
+
+typedef enum MsgType {
+  MSG_PLAYER_POS,
+  MSG_SCORE_UPDATE,
+  MSG_BALL_POS_UPDATE,
+  MSG_STATE_UPDATE,
+  MSG_MATCH_START,
+  MSG_JOIN,
+  MSG_SNAPSHOT,
+  MSG_SNAPSHOT_ACK,
+  MSG_INPUT,
+  MSG_INPUT_ACK,
+  MSG_ROLLBACK_START,
+  MSG_REJECT,
+  MSG_SPECTATE,
+  MSG_TYPE_COUNT
+} MsgType;
+
+typedef enum Transport { TRANSPORT_TCP, TRANSPORT_UDP, TRANSPORT_COUNT } Transport;
+
+// Per-frame state that is superseded every tick, everything else must arrive in order.
+static inline bool msg_is_unreliable(uint32_t type) {
+  return type == MSG_PLAYER_POS || type == MSG_BALL_POS_UPDATE || type == MSG_SNAPSHOT ||
+         type == MSG_SNAPSHOT_ACK || type == MSG_INPUT || type == MSG_INPUT_ACK;
+}
+
+#define MSG_INPUT_MAX_CMDS 16
+
+// Wire schema. Every message is a fixed sequence of little-endian fields, F(kind, name) for a
+// single field and A(kind, name, count) for an array, with no padding. The structs, wire sizes
+// and codecs below are all generated from these lists. Kinds other than the plain integer and
+// float ones are range checked on decode.
+//
+// MSG_SNAPSHOT carries a snapshot_encode()d payload instead, the receiver acks every snapshot it
+// decoded so the sender can delta-encode against it.
+
+#define MSG_PLAYER_POS_FIELDS(F, A) F(f32, pos) F(f32, paddle_vert_velocity) F(player, player)
+
+#define MSG_STATE_UPDATE_FIELDS(F, A) F(game_state, state) F(player, player)
+
+#define MSG_SCORE_UPDATE_FIELDS(F, A) F(i32, score) F(player, player)
+
+#define MSG_BALL_FIELDS(F, A) F(vec2, pos) F(vec2, velocity)
+
+// First message a client sends to a dedicated server, players are only paired with others that
+// asked for the same transport, and preferably with a similar rating, 0 if unrated. rollback asks
+// a player hosting the game for a peer to peer rollback session, dedicated servers ignore it.
+#define MSG_JOIN_FIELDS(F, A) \
+  F(u16, version) F(transport, transport) F(b8, rollback) F(u16, rating)
+
+// Sent by a dedicated server once two players have been paired. For TRANSPORT_UDP the client
+// sends its datagrams to udp_port on the server, tagged with udp_token. match identifies the
+// match to spectators.
+#define MSG_MATCH_START_FIELDS(F, A) \
+  F(player, player) F(transport, transport) F(u32, udp_token) F(u16, udp_port) F(u32, match)
+
+#define MSG_SNAPSHOT_ACK_FIELDS(F, A) F(u32, tick)
+
+// A run of per-tick paddle inputs starting at first_seq. Over UDP every message repeats the
+// still unacked tail of the stream, so a lost packet is covered by the next one. player is
+// informational, a dedicated server goes by the connection. view_tick is the authority tick the
+// sender was drawing when it sampled the newest command, for lag compensated hit checks.
+#define MSG_INPUT_FIELDS(F, A)                                             \
+  F(u32, first_seq) F(u32, view_tick) F(u8, player) F(input_count, count) \
+  A(i8, dirs, MSG_INPUT_MAX_CMDS)
+
+// The authority applied every input up to and including seq, leaving the sender's paddle at pos.
+#define MSG_INPUT_ACK_FIELDS(F, A) F(u32, seq) F(f32, pos)
+
+// Sent by a player hosting the game to start a rollback session, both peers init the simulation
+// from seed and from then on only exchange MSG_INPUT with ticks as sequence numbers.
+#define MSG_ROLLBACK_START_FIELDS(F, A) F(u32, seed)
+
+// Answer to a MSG_JOIN or MSG_SPECTATE with a different version, the connection is closed after
+// it.
+#define MSG_REJECT_FIELDS(F, A) F(u16, version)
+
+// Instead of MSG_JOIN, to watch a match on a dedicated server, 0 for the longest running one. The
+// server answers with nothing but MSG_SNAPSHOT until the match ends and the connection is closed,
+// spectators don't ack them.
+#define MSG_SPECTATE_FIELDS(F, A) F(u16, version) F(u32, match)
+
+// X(type id, struct, function prefix, field list)
+#define PROTOCOL_MESSAGES(X)                                                    \
+  X(MSG_PLAYER_POS, MsgPlayerPos, msg_player_pos, MSG_PLAYER_POS_FIELDS)        \
+  X(MSG_SCORE_UPDATE, MsgScoreUpdate, msg_score_update, MSG_SCORE_UPDATE_FIELDS) \
+  X(MSG_BALL_POS_UPDATE, MsgBall, msg_ball, MSG_BALL_FIELDS)                     \
+  X(MSG_STATE_UPDATE, MsgStateUpdate, msg_state_update, MSG_STATE_UPDATE_FIELDS) \
+  X(MSG_MATCH_START, MsgMatchStart, msg_match_start, MSG_MATCH_START_FIELDS)     \
+  X(MSG_JOIN, MsgJoin, msg_join, MSG_JOIN_FIELDS)                                \
+  X(MSG_SNAPSHOT_ACK, MsgSnapshotAck, msg_snapshot_ack, MSG_SNAPSHOT_ACK_FIELDS) \
+  X(MSG_INPUT, MsgInput, msg_input, MSG_INPUT_FIELDS)                            \
+  X(MSG_INPUT_ACK, MsgInputAck, msg_input_ack, MSG_INPUT_ACK_FIELDS)             \
+  X(MSG_ROLLBACK_START, MsgRollbackStart, msg_rollback_start, MSG_ROLLBACK_START_FIELDS) \
+  X(MSG_REJECT, MsgReject, msg_reject, MSG_REJECT_FIELDS)                        \
+  X(MSG_SPECTATE, MsgSpectate, msg_spectate, MSG_SPECTATE_FIELDS)
+
+// C type and wire size of each field kind
+typedef uint8_t wire_ctype_u8;
+typedef int8_t wire_ctype_i8;
+typedef uint16_t wire_ctype_u16;
+typedef uint32_t wire_ctype_u32;
+typedef int32_t wire_ctype_i32;
+typedef float wire_ctype_f32;
+typedef Vector2 wire_ctype_vec2;
+typedef bool wire_ctype_b8;
+typedef int wire_ctype_player;
+typedef GameState wire_ctype_game_state;
+typedef Transport wire_ctype_transport;
+typedef uint8_t wire_ctype_input_count;
+
+enum {
+  WIRE_SIZE_u8 = 1,
+  WIRE_SIZE_i8 = 1,
+  WIRE_SIZE_u16 = 2,
+  WIRE_SIZE_u32 = 4,
+  WIRE_SIZE_i32 = 4,
+  WIRE_SIZE_f32 = 4,
+  WIRE_SIZE_vec2 = 8,
+  WIRE_SIZE_b8 = 1,
+  WIRE_SIZE_player = 1,
+  WIRE_SIZE_game_state = 1,
+  WIRE_SIZE_transport = 1,
+  WIRE_SIZE_input_count = 1,
+};
+
+#define PROTOCOL_STRUCT_FIELD(kind, name) wire_ctype_##kind name;
+#define PROTOCOL_STRUCT_ARRAY(kind, name, n) wire_ctype_##kind name[n];
+#define PROTOCOL_STRUCT(id, type, fn, fields) \
+  typedef struct type {                       \
+    fields(PROTOCOL_STRUCT_FIELD, PROTOCOL_STRUCT_ARRAY)                        \
+  } type;
+PROTOCOL_MESSAGES(PROTOCOL_STRUCT)
+
+#define PROTOCOL_SIZE_FIELD(kind, name) +WIRE_SIZE_##kind
+#define PROTOCOL_SIZE_ARRAY(kind, name, n) +WIRE_SIZE_##kind * (n)
+#define PROTOCOL_SIZE(id, type, fn, fields) \
+  id##_SIZE = 0 fields(PROTOCOL_SIZE_FIELD, PROTOCOL_SIZE_ARRAY),
+enum { PROTOCOL_MESSAGES(PROTOCOL_SIZE) };
+
+/**
+ * <fn>_encode writes the message to out, which must hold <id>_SIZE bytes, and returns <id>_SIZE.
+ * <fn>_decode reads exactly <id>_SIZE bytes and never touches data past len.
+ * @return false if len is too short or a field is out of range, msg is then unspecified
+ */
+#define PROTOCOL_CODEC_DECL(id, type, fn, fields)         \
+  size_t fn##_encode(const type* msg, uint8_t* out);     \
+  bool fn##_decode(type* msg, const uint8_t* data, size_t len);
+PROTOCOL_MESSAGES(PROTOCOL_CODEC_DECL)
+
+/**
+ * Encodes msg, a pointer to the struct of message type, for code that only has the type id.
+ * @return bytes written to out, which must hold PROTOCOL_MAX_MSG_SIZE, 0 for an unknown type
+ */
+size_t protocol_encode(uint32_t type, const void* msg, uint8_t* out);
+
+#define PROTOCOL_MAX_MEMBER(id, type, fn, fields) uint8_t fn[id##_SIZE];
+#define PROTOCOL_MAX_MSG_SIZE sizeof(union { PROTOCOL_MESSAGES(PROTOCOL_MAX_MEMBER) })
+
+// Little-endian scalar access, shared by the frame and packet headers.
+static inline void wire_put_u16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void wire_put_u32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint16_t wire_get_u16(const uint8_t* p) { return (uint16_t)(p[0] | p[1] << 8); }
+
+static inline uint32_t wire_get_u32(const uint8_t* p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+#endif  // PONG_GAME_PROTOCOL_H
@@ -0,0 +1,346 @@
+#include "replay.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "protocol.h"
+
+struct ReplayChunk {
+  ReplayChunk* next;
+  int fd;
+  bool close;  // last chunk of its file
+  uint32_t len;
+  uint8_t data[REPLAY_CHUNK_SIZE];
+};
+
+// flags, rewinds, two full backlogs and a hash
+#define REPLAY_MAX_TICK_BYTES (1 + 2 + 2 * (1 + INPUT_RING_SIZE / 4) + 4)
+#define REPLAY_END_SIZE 9
+
+static const uint8_t replay_magic[4] = {'P', 'N', 'G', 'R'};
+
+int replay_apply_tick(const ReplayTick* t, PongSim* s, LagComp* lc) {
+  for (int p = 0; p < 2; p++) {
+    for (int i = 0; i < t->backlog_count[p]; i++) {
+      pong_move_paddle(s, p, t->backlog[p][i]);
+    }
+    lag_comp_on_input(lc, p, s->tick - t->rewind[p], s->tick);
+  }
+  return lag_comp_tick(lc, s, &t->input);
+}
+
+static uint32_t fnv1a_u32(uint32_t h, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    h = (h ^ ((v >> (i * 8)) & 0xff)) * 16777619u;
+  }
+  return h;
+}
+
+static uint32_t float_bits(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+uint32_t replay_hash_step(uint32_t prev, const PongSim* s) {
+  uint32_t h = fnv1a_u32(prev, s->tick);
+  h = fnv1a_u32(h, (uint32_t)s->collision_count);
+  h = fnv1a_u32(h, float_bits(s->ball_pos.x));
+  h = fnv1a_u32(h, float_bits(s->ball_pos.y));
+  h = fnv1a_u32(h, float_bits(s->ball_velocity.x));
+  h = fnv1a_u32(h, float_bits(s->ball_velocity.y));
+  for (int i = 0; i < 2; i++) {
+    h = fnv1a_u32(h, float_bits(s->players[i].pos));
+    h = fnv1a_u32(h, float_bits(s->players[i].paddle_vert_velocity));
+    h = fnv1a_u32(h, (uint32_t)s->players[i].score);
+  }
+  return fnv1a_u32(h, s->rng);
+}
+
+static void write_all(int fd, const uint8_t* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("replay write");
+      return;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+}
+
+static void* replay_writer_main(void* arg) {
+  ReplayWriter* w = arg;
+  pthread_mutex_lock(&w->mu);
+  for (;;) {
+    while (!w->head && !w->stop) {
+      pthread_cond_wait(&w->cond, &w->mu);
+    }
+    ReplayChunk* c = w->head;
+    if (!c) {
+      break;  // stopping and drained
+    }
+    w->head = c->next;
+    if (!w->head) {
+      w->tail = nullptr;
+    }
+    pthread_mutex_unlock(&w->mu);
+    write_all(c->fd, c->data, c->len);
+    if (c->close) {
+      close(c->fd);
+    }
+    pthread_mutex_lock(&w->mu);
+    w->queued--;
+    c->next = w->free_chunks;
+    w->free_chunks = c;
+  }
+  pthread_mutex_unlock(&w->mu);
+  return nullptr;
+}
+
+int replay_writer_start(ReplayWriter* w) {
+  *w = (ReplayWriter){};
+  pthread_mutex_init(&w->mu, nullptr);
+  pthread_cond_init(&w->cond, nullptr);
+  if (pthread_create(&w->thread, nullptr, replay_writer_main, w) != 0) {
+    fprintf(stderr, "pthread_create failed\n");
+    return -1;
+  }
+  return 0;
+}
+
+void replay_writer_stop(ReplayWriter* w) {
+  pthread_mutex_lock(&w->mu);
+  w->stop = true;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->mu);
+  pthread_join(w->thread, nullptr);
+  while (w->free_chunks) {
+    ReplayChunk* next = w->free_chunks->next;
+    free(w->free_chunks);
+    w->free_chunks = next;
+  }
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->mu);
+}
+
+// Chunks are recycled through the writer, malloc is only hit while the number of chunks in
+// flight grows.
+static ReplayChunk* replay_chunk_get(ReplayWriter* w) {
+  pthread_mutex_lock(&w->mu);
+  ReplayChunk* c = w->free_chunks;
+  if (c) {
+    w->free_chunks = c->next;
+  }
+  pthread_mutex_unlock(&w->mu);
+  if (!c && !(c = malloc(sizeof(ReplayChunk)))) {
+    perror("malloc");
+    return nullptr;
+  }
+  c->len = 0;
+  return c;
+}
+
+// Hands the current chunk to the writer and continues in a fresh one. A recorder that can't get
+// one, or finds the writer too far behind, ends its replay there rather than wait.
+static void replay_recorder_flush(ReplayRecorder* r, bool last) {
+  ReplayWriter* w = r->writer;
+  ReplayChunk* next = last ? nullptr : replay_chunk_get(w);
+  ReplayChunk* c = r->chunk;
+  c->fd = r->fd;
+  c->next = nullptr;
+  pthread_mutex_lock(&w->mu);
+  c->close = !next || w->queued >= REPLAY_MAX_QUEUED;
+  if (w->tail) {
+    w->tail->next = c;
+  } else {
+    w->head = c;
+  }
+  w->tail = c;
+  w->queued++;
+  if (next && c->close) {
+    next->next = w->free_chunks;
+    w->free_chunks = next;
+  }
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->mu);
+  if (c->close) {
+    if (!last) {
+      fprintf(stderr, "replay writer backed up, truncating a replay after %u ticks\n", r->ticks);
+    }
+    r->chunk = nullptr;
+    r->fd = -1;
+    return;
+  }
+  r->chunk = next;
+}
+
+// @return room for n bytes at the end of the current chunk, nullptr once recording stopped
+static uint8_t* replay_reserve(ReplayRecorder* r, size_t n) {
+  if (replay_recording(r) && r->chunk->len + n > REPLAY_CHUNK_SIZE) {
+    replay_recorder_flush(r, false);
+  }
+  return replay_recording(r) ? r->chunk->data + r->chunk->len : nullptr;
+}
+
+int replay_recorder_open(ReplayRecorder* r, ReplayWriter* w, const char* path, uint32_t seed,
+                         int max_rewind) {
+  *r = (ReplayRecorder){.writer = w, .fd = -1, .hash = REPLAY_HASH_SEED};
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    perror(path);
+    return -1;
+  }
+  r->chunk = replay_chunk_get(w);
+  if (!r->chunk) {
+    close(fd);
+    return -1;
+  }
+  r->fd = fd;
+  uint8_t* p = r->chunk->data;
+  memcpy(p, replay_magic, sizeof(replay_magic));
+  wire_put_u16(p + 4, REPLAY_FORMAT_VERSION);
+  wire_put_u16(p + 6, PONG_TICK_HZ);
+  wire_put_u32(p + 8, seed);
+  p[12] = (uint8_t)max_rewind;
+  p[13] = REPLAY_HASH_INTERVAL;
+  wire_put_u16(p + 14, 0);
+  r->chunk->len = REPLAY_HEADER_SIZE;
+  return 0;
+}
+
+void replay_record_tick(ReplayRecorder* r, const ReplayTick* t, const PongSim* s) {
+  uint8_t* start = replay_reserve(r, REPLAY_MAX_TICK_BYTES);
+  if (!start) {
+    return;
+  }
+  uint8_t* p = start;
+  bool rewound = t->rewind[0] != r->rewind[0] || t->rewind[1] != r->rewind[1];
+  *p++ = (uint8_t)((t->input.paddle_dir[0] + 1) | (t->input.paddle_dir[1] + 1) << 2 |
+                   (t->backlog_count[0] > 0) << 4 | (t->backlog_count[1] > 0) << 5 |
+                   rewound << 6);
+  if (rewound) {
+    *p++ = r->rewind[0] = t->rewind[0];
+    *p++ = r->rewind[1] = t->rewind[1];
+  }
+  for (int pl = 0; pl < 2; pl++) {
+    int count = t->backlog_count[pl];
+    if (count == 0) {
+      continue;
+    }
+    *p++ = (uint8_t)count;
+    memset(p, 0, (size_t)(count + 3) / 4);
+    for (int i = 0; i < count; i++) {
+      p[i / 4] |= (uint8_t)((t->backlog[pl][i] + 1) << (i % 4 * 2));
+    }
+    p += (count + 3) / 4;
+  }
+  r->ticks++;
+  r->hash = replay_hash_step(r->hash, s);
+  if (r->ticks % REPLAY_HASH_INTERVAL == 0) {
+    wire_put_u32(p, r->hash);
+    p += 4;
+  }
+  r->chunk->len += (uint32_t)(p - start);
+}
+
+void replay_recorder_close(ReplayRecorder* r) {
+  uint8_t* p = replay_reserve(r, REPLAY_END_SIZE);
+  if (!p) {
+    return;
+  }
+  p[0] = REPLAY_END_MARKER;
+  wire_put_u32(p + 1, r->ticks);
+  wire_put_u32(p + 5, r->hash);
+  r->chunk->len += REPLAY_END_SIZE;
+  replay_recorder_flush(r, true);
+}
+
+int replay_reader_init(ReplayReader* r, const uint8_t* data, size_t len) {
+  *r = (ReplayReader){.data = data, .len = len, .pos = REPLAY_HEADER_SIZE};
+  if (len < REPLAY_HEADER_SIZE || memcmp(data, replay_magic, sizeof(replay_magic)) != 0 ||
+      wire_get_u16(data + 4) != REPLAY_FORMAT_VERSION || wire_get_u16(data + 6) != PONG_TICK_HZ ||
+      data[12] > LAG_MAX_REWIND || data[13] == 0) {
+    return -1;
+  }
+  r->seed = wire_get_u32(data + 8);
+  r->max_rewind = data[12];
+  r->hash_interval = data[13];
+  return 0;
+}
+
+// a packed dir of 3 is never written
+static bool unpack_dir(uint8_t bits, int8_t* dir) {
+  *dir = (int8_t)(bits - 1);
+  return bits < 3;
+}
+
+int replay_read_tick(ReplayReader* r, ReplayTick* t) {
+  const uint8_t* p = r->data + r->pos;
+  const uint8_t* end = r->data + r->len;
+  r->has_hash = false;
+  if (p == end) {
+    return -1;
+  }
+  uint8_t flags = *p++;
+  if (flags == REPLAY_END_MARKER) {
+    if (end - p < 8) {
+      return -1;
+    }
+    r->end_ticks = wire_get_u32(p);
+    r->hash = wire_get_u32(p + 4);
+    r->pos = r->len;
+    return 0;
+  }
+  if (flags & 0x80 || !unpack_dir(flags & 3, &t->input.paddle_dir[0]) ||
+      !unpack_dir(flags >> 2 & 3, &t->input.paddle_dir[1])) {
+    return -1;
+  }
+  if (flags & 0x40) {
+    if (end - p < 2 || p[0] > r->max_rewind || p[1] > r->max_rewind) {
+      return -1;
+    }
+    r->rewind[0] = *p++;
+    r->rewind[1] = *p++;
+  }
+  t->rewind[0] = r->rewind[0];
+  t->rewind[1] = r->rewind[1];
+  for (int pl = 0; pl < 2; pl++) {
+    t->backlog_count[pl] = 0;
+    if (!(flags & (0x10 << pl))) {
+      continue;
+    }
+    if (p == end) {
+      return -1;
+    }
+    int count = *p++;
+    if (count == 0 || end - p < (count + 3) / 4) {
+      return -1;
+    }
+    for (int i = 0; i < count; i++) {
+      if (!unpack_dir(p[i / 4] >> (i % 4 * 2) & 3, &t->backlog[pl][i])) {
+        return -1;
+      }
+    }
+    t->backlog_count[pl] = count;
+    p += (count + 3) / 4;
+  }
+  r->ticks++;
+  if (r->ticks % (uint32_t)r->hash_interval == 0) {
+    if (end - p < 4) {
+      return -1;
+    }
+    r->hash = wire_get_u32(p);
+    r->has_hash = true;
+    p += 4;
+  }
+  r->pos = (size_t)(p - r->data);
+  return 1;
+}
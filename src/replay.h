@@ -0,0 +1,122 @@
+#ifndef PONG_GAME_REPLAY_H
+#define PONG_GAME_REPLAY_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "input.h"
+#include "lagcomp.h"
+#include "pong.h"
+
+// Match replays. A match is fully determined by its seed and, per tick, every paddle command the
+// authority applied and the rewind lag compensation ran with, so that is all a replay stores:
+//
+//   header   "PNGR", u16 format version, u16 tick rate, u32 seed, u8 max rewind, u8 hash interval,
+//            u16 reserved
+//   tick     u8 flags: bits 0-1 and 2-3 are the tick's dir + 1 of player 0 and 1, bits 4 and 5 mark
+//            a backlog for player 0 and 1, bit 6 a rewind change
+//            [u8 rewind 0, u8 rewind 1] if bit 6
+//            [u8 count, count dirs + 1 packed four to a byte] per marked backlog
+//            [u32 state hash] after every hash interval'th tick
+//   end      u8 0xff, u32 tick count, u32 state hash
+//
+// all little-endian. The state hash chains the state after every tick, so a replay that
+// diverges anywhere fails the next hash check. A quiet tick costs one byte.
+
+#define REPLAY_FORMAT_VERSION 1
+#define REPLAY_HEADER_SIZE 16
+#define REPLAY_HASH_INTERVAL 8
+#define REPLAY_END_MARKER 0xff
+// bytes a recorder buffers before handing them to the writer thread
+#define REPLAY_CHUNK_SIZE 4096
+// chunks queued for the writer past which recorders give up instead of waiting on the disk
+#define REPLAY_MAX_QUEUED 1024
+
+// Everything the authority fed into one tick.
+typedef struct ReplayTick {
+  PongInput input;
+  uint8_t rewind[2];
+  int backlog_count[2];
+  int8_t backlog[2][INPUT_RING_SIZE];  // applied straight to the paddle before the tick
+} ReplayTick;
+
+/**
+ * Runs t on s the way the authority does, the server steps its matches through this too so a
+ * replay takes the exact same path.
+ * @return index of the player that scored this tick, or -1
+ */
+int replay_apply_tick(const ReplayTick* t, PongSim* s, LagComp* lc);
+
+/** @return hash chained from prev with the state of s, byte order independent */
+uint32_t replay_hash_step(uint32_t prev, const PongSim* s);
+
+#define REPLAY_HASH_SEED 2166136261u
+
+typedef struct ReplayChunk ReplayChunk;
+
+// Writes the chunks of every recorder on its own thread so a tick never waits on the disk.
+typedef struct ReplayWriter {
+  pthread_t thread;
+  pthread_mutex_t mu;
+  pthread_cond_t cond;
+  ReplayChunk* head;  // queued for writing
+  ReplayChunk* tail;
+  ReplayChunk* free_chunks;
+  int queued;
+  bool stop;
+} ReplayWriter;
+
+int replay_writer_start(ReplayWriter* w);
+/** Writes out everything queued, then joins the thread. */
+void replay_writer_stop(ReplayWriter* w);
+
+// Recording of one match. May be driven from any thread, one thread at a time.
+typedef struct ReplayRecorder {
+  ReplayWriter* writer;
+  int fd;  // -1 when not recording
+  ReplayChunk* chunk;
+  uint32_t ticks;
+  uint32_t hash;
+  uint8_t rewind[2];
+} ReplayRecorder;
+
+/**
+ * Creates path and starts the replay of a match initialized with seed.
+ * @return -1 if the file can't be created, r is then left not recording
+ */
+int replay_recorder_open(ReplayRecorder* r, ReplayWriter* w, const char* path, uint32_t seed,
+                         int max_rewind);
+
+/** Appends t and the state s it resulted in. */
+void replay_record_tick(ReplayRecorder* r, const ReplayTick* t, const PongSim* s);
+
+/** Ends the replay, the writer closes the file once it's written. */
+void replay_recorder_close(ReplayRecorder* r);
+
+static inline bool replay_recording(const ReplayRecorder* r) { return r->fd >= 0; }
+
+typedef struct ReplayReader {
+  const uint8_t* data;
+  size_t len;
+  size_t pos;
+  uint32_t seed;
+  int max_rewind;
+  int hash_interval;
+  uint32_t ticks;  // read so far
+  uint8_t rewind[2];
+  bool has_hash;  // set by replay_read_tick when the tick just read is followed by a hash
+  uint32_t hash;  // that hash, or the final one once the end was read
+  uint32_t end_ticks;
+} ReplayReader;
+
+/** @return -1 if data doesn't start with a replay header this build understands */
+int replay_reader_init(ReplayReader* r, const uint8_t* data, size_t len);
+
+/**
+ * Reads the next tick into t.
+ * @return 1 for a tick, 0 once the end was read, -1 if the replay is malformed or truncated
+ */
+int replay_read_tick(ReplayReader* r, ReplayTick* t);
+
+#endif  // PONG_GAME_REPLAY_H
@@ -0,0 +1,67 @@
+#include "rollback.h"
+
+void rollback_init(RollbackSession* rb, const PongSim* s, int local_player) {
+  *rb = (RollbackSession){.local_player = local_player, .tick = s->tick, .remote_end = s->tick};
+}
+
+bool rollback_can_advance(const RollbackSession* rb) {
+  return (int32_t)(rb->tick - rb->remote_end) < ROLLBACK_MAX_FRAMES;
+}
+
+static int8_t rollback_remote_dir(const RollbackSession* rb, uint32_t tick) {
+  if ((int32_t)(tick - rb->remote_end) < 0) {
+    return rb->remote_dirs[tick % ROLLBACK_RING];
+  }
+  // the remote most likely still holds whatever it held last
+  return rb->last_remote_dir;
+}
+
+static int rollback_step(RollbackSession* rb, PongSim* s, uint32_t tick) {
+  uint32_t slot = tick % ROLLBACK_RING;
+  rb->states[slot] = *s;
+  rb->remote_dirs[slot] = rollback_remote_dir(rb, tick);
+  PongInput input = {};
+  input.paddle_dir[rb->local_player] = rb->local_dirs[slot];
+  input.paddle_dir[1 - rb->local_player] = rb->remote_dirs[slot];
+  return pong_tick(s, &input);
+}
+
+int rollback_advance(RollbackSession* rb, PongSim* s, int8_t local_dir) {
+  rb->local_dirs[rb->tick % ROLLBACK_RING] = local_dir;
+  return rollback_step(rb, s, rb->tick++);
+}
+
+void rollback_add_remote(RollbackSession* rb, uint32_t tick, int8_t dir) {
+  // contiguous only, and never further ahead than the ring can hold
+  if (tick != rb->remote_end || (int32_t)(tick - rb->tick) >= ROLLBACK_RING - ROLLBACK_MAX_FRAMES) {
+    return;
+  }
+  dir = dir > 0 ? 1 : dir < 0 ? -1 : 0;
+  uint32_t slot = tick % ROLLBACK_RING;
+  if ((int32_t)(tick - rb->tick) < 0 && rb->remote_dirs[slot] != dir &&
+      (!rb->rollback_pending || (int32_t)(tick - rb->rollback_from) < 0)) {
+    rb->rollback_from = tick;
+    rb->rollback_pending = true;
+  }
+  rb->remote_dirs[slot] = dir;
+  rb->last_remote_dir = dir;
+  rb->remote_end++;
+}
+
+int rollback_resolve(RollbackSession* rb, PongSim* s) {
+  if (!rb->rollback_pending) {
+    return 0;
+  }
+  rb->rollback_pending = false;
+  *s = rb->states[rb->rollback_from % ROLLBACK_RING];
+  int count = 0;
+  for (uint32_t tick = rb->rollback_from; tick != rb->tick; tick++, count++) {
+    rollback_step(rb, s, tick);
+  }
+  rb->rollbacks++;
+  rb->resimulated_ticks += (uint64_t)count;
+  if (count > rb->max_resimulated) {
+    rb->max_resimulated = count;
+  }
+  return count;
+}
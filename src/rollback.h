@@ -0,0 +1,53 @@
+#ifndef PONG_GAME_ROLLBACK_H
+#define PONG_GAME_ROLLBACK_H
+
+#include <stdint.h>
+
+#include "pong.h"
+
+// Peer to peer rollback: both peers run the full simulation from the same seed and exchange only
+// their inputs, tick numbers double as input sequence numbers. A tick whose remote input hasn't
+// arrived runs with the remote's last known input. When the real input turns out different the
+// session restores the saved state of that tick and resimulates up to the present.
+
+#define ROLLBACK_RING 32
+// how far the local tick may run ahead of the newest remote input before the session stalls,
+// also the most ticks a single rollback resimulates
+#define ROLLBACK_MAX_FRAMES 16
+
+typedef struct RollbackSession {
+  int local_player;
+  uint32_t tick;        // next tick to simulate
+  uint32_t remote_end;  // one past the newest confirmed remote input
+  uint32_t rollback_from;
+  bool rollback_pending;
+  PongSim states[ROLLBACK_RING];  // state before each tick
+  int8_t local_dirs[ROLLBACK_RING];
+  int8_t remote_dirs[ROLLBACK_RING];  // confirmed, or the prediction a tick was simulated with
+  int8_t last_remote_dir;
+  uint64_t rollbacks;
+  uint64_t resimulated_ticks;
+  int max_resimulated;
+} RollbackSession;
+
+void rollback_init(RollbackSession* rb, const PongSim* s, int local_player);
+
+/** @return false while the remote is ROLLBACK_MAX_FRAMES behind, the caller should stall */
+bool rollback_can_advance(const RollbackSession* rb);
+
+/**
+ * Simulates the next tick with local_dir for the local paddle.
+ * @return index of the player that scored, or -1
+ */
+int rollback_advance(RollbackSession* rb, PongSim* s, int8_t local_dir);
+
+/** Records the remote input for tick, out of order and duplicate ticks are ignored. */
+void rollback_add_remote(RollbackSession* rb, uint32_t tick, int8_t dir);
+
+/**
+ * Rolls s back to the first mispredicted tick and resimulates to the present.
+ * @return number of ticks resimulated
+ */
+int rollback_resolve(RollbackSession* rb, PongSim* s);
+
+#endif  // PONG_GAME_ROLLBACK_H
@@ -0,0 +1,1877 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "broadcast.h"
+#include "buf.h"
+#include "event_loop.h"
+#include "input.h"
+#include "lagcomp.h"
+#include "matchmaker.h"
+#include "metrics.h"
+#include "netsim.h"
+#include "networking.h"
+#include "pong.h"
+#include "protocol.h"
+#include "replay.h"
+#include "snapshot.h"
+#include "udp.h"
+#include "uring.h"
+
+typedef struct Conn {
+  bool active;
+  int match;  // -1 while waiting for an opponent
+  int player;
+  Transport transport;
+  Buf in;
+  SendRing out;
+  UdpEndpoint* udp;  // set for TRANSPORT_UDP matches
+  Viewer* viewer;    // set for spectators, which are never in a match
+  SpectatorFeed* spectating;  // lobby only, a spectator waiting for a free handoff slot
+  bool has_acked;
+  bool lost_msg;  // a message couldn't be queued, worker_flush closes the connection
+  uint32_t acked_tick;  // newest snapshot the client decoded, baseline for the next delta
+  uint32_t io_gen;      // io_uring only, tells its completions from those of an earlier fd owner
+  bool sending;         // io_uring only, a send is queued or its completion not yet reaped
+} Conn;
+
+// udp tokens carry the owning fd in the low bits so datagrams are routed without a lookup table,
+// the bits above are random so a token can't be guessed from the ones handed out before it
+#define UDP_TOKEN_FD_BITS 20
+#define UDP_TOKEN_FD_MASK ((1u << UDP_TOKEN_FD_BITS) - 1)
+
+typedef struct Match {
+  bool active;
+  uint32_t id;  // unique across workers, what spectators ask for
+  SpectatorFeed* feed;
+  GameState state;
+  int curr_pause_player;
+  int fds[2];
+  PongSim sim;
+  SnapshotHistory history;
+  InputQueue inputs[2];
+  LagComp lag;
+  ReplayRecorder replay;
+} Match;
+
+// Two paired connections moving from the lobby to the worker that will own their match, or a
+// spectator moving to a worker that will fan the feed out to it, alone in fds[0].
+typedef struct Handoff {
+  Transport transport;
+  int fds[2];
+  Conn conns[2];
+  SpectatorFeed* feed;  // set for a spectator, the handoff holds a reference
+} Handoff;
+
+// the kernel doubles it and rounds it up to its minimum, a few seconds of snapshots either way
+#define VIEWER_SNDBUF 2048
+
+// Spectators are written 20 times a second, staggered over the ticks, with every snapshot queued
+// since in one writev. They can afford the delay and fan-out costs a syscall per write.
+#define VIEWER_FLUSH_TICKS (PONG_TICK_HZ / 20)
+// Once a match ends its spectators are written every tick until their queue drains, one that
+// still hasn't read it all this many ticks later is closed regardless.
+#define VIEWER_DRAIN_TICKS (PONG_TICK_HZ * 2)
+
+// A match this worker has spectators of, whatever worker owns it.
+typedef struct Watch {
+  SpectatorFeed* feed;      // the watch holds a reference
+  uint32_t next;            // number of the next frame to read
+  SnapshotHistory history;  // of the frames read, baselines of resyncs
+  int* fds;                 // viewers, Viewer.slot indexes this
+  int count;
+  int cap;
+  int drain_ticks;  // ticks since the feed was seen ended
+} Watch;
+
+// A worker's matches are ticked in chunks. The owner and idle workers claim chunks by a CAS on
+// Worker.claim, which packs generation << 32 | next chunk << 16 | chunk count, so a thief
+// working from a stale view of the previous tick can never claim into the current one.
+#define TICK_CHUNK_MATCHES 64
+
+// udp packets of a tick go out in sendmmsg batches of this many
+#define UDP_FLUSH_BATCH 64
+
+// "uring" moves the workers' tcp connections and the lobby's accept onto io_uring, anything else
+// or a kernel without support keeps them on epoll
+#define IO_ENV "PONG_IO"
+
+// Each worker's ring takes this many requests between submits, enough for a tick's sends to go
+// out with one io_uring_enter up to that many connections per worker. Receives land in
+// URING_BUFS provided buffers, each goes back as soon as its frames are dispatched, and a
+// receive that finds none left is re-armed by the next tick.
+#define URING_ENTRIES 8192
+#define URING_BUFS 4096
+#define URING_BUF_SIZE 2048
+
+// io_uring user_data of a worker: what completed, the connection's generation and its fd
+enum { IO_RECV = 1, IO_SEND, IO_CANCEL };
+#define IO_FD_BITS 24
+
+// a queued sendmsg and what it points to, read by the kernel during the submit
+typedef struct UringSend {
+  struct msghdr msg;
+  struct iovec iov[VIEWER_QUEUE];
+} UringSend;
+
+// scratch for everything built during one tick, snapshots and their encodings
+#define WORKER_FRAME_ARENA_SIZE (1024 * 1024)
+
+// pairs waiting to be started by a worker, power of two. A full ring leaves them in the matchmaker
+// for the next pass.
+#define HANDOFF_RING_SIZE 1024
+
+struct Server;
+
+// scrapes answered at once, a new one takes the slot of one stalled for longer than the timeout
+#define METRICS_MAX_SCRAPES 4
+#define METRICS_SCRAPE_TIMEOUT_NS 1000000000ull
+
+// A metrics request being answered on the lobby thread, the response goes out as the socket
+// takes it.
+typedef struct MetricsScrape {
+  struct Server* server;
+  int fd;  // -1 when free
+  uint64_t started_ns;
+  char hdr[160];
+  size_t hdr_len;  // 0 until the request came in
+  char* body;
+  size_t body_len;
+  size_t sent;  // of hdr, then body
+} MetricsScrape;
+
+// Owns the sockets and state of its matches. Nothing here is shared with other threads except
+// the handoff queue, the matches themselves while a tick is being claimed and their feeds.
+typedef struct Worker {
+  struct Server* server;
+  int id;
+  pthread_t thread;
+  EventLoop loop;
+  int udp_fd;
+  uint16_t udp_port;
+  UdpPacketOut* udp_out;  // UDP_FLUSH_BATCH each
+  struct mmsghdr* udp_msgs;
+  UdpEndpoint** udp_eps;
+  Pool udp_pool;        // UdpEndpoint of each udp connection
+  Pool viewer_pool;     // Viewer of each spectator
+  Pool broadcast_pool;  // BroadcastFrame queued on spectators
+  Arena frame;          // reset every tick, only touched by this worker's thread
+  NetSim netsim;        // everything sent goes through it, passes straight through unless enabled
+  Metrics metrics;      // written by this worker's thread only
+  Conn* conns;          // indexed by fd
+  int conns_cap;
+  Match* matches;
+  int match_count;
+  int match_cap;
+  int* free_matches;
+  int free_match_count;
+  Watch* watches;  // Viewer.watch indexes this
+  int watch_count;
+  int watch_cap;
+  uint64_t tick;
+
+  Uring ring;        // tcp reads and writes when its fd is set, otherwise epoll
+  UringSend* sends;  // URING_ENTRIES, of the sends queued since the last submit
+  int send_count;
+  uint32_t io_gen;
+
+  // Single producer single consumer ring: the lobby fills a slot and publishes it by advancing
+  // tail, the worker starts the match and hands the slot back by advancing head.
+  Handoff* handoffs;  // HANDOFF_RING_SIZE
+  _Atomic uint32_t handoff_head;
+  _Atomic uint32_t handoff_tail;
+  int handoff_fd;       // eventfd, signalled by the lobby once per pairing pass
+  bool handoff_signal;  // lobby thread only, pushed to since the last signal
+
+  _Atomic uint64_t claim;
+  atomic_int chunks_done;
+  atomic_int active_matches;  // including handoffs not yet picked up
+  atomic_int viewers;         // likewise
+  _Atomic uint64_t resyncs;   // frames encoded for a single spectator that fell behind
+  _Atomic uint64_t chunks_stolen;
+  _Atomic uint64_t lag_saves;  // of ended matches
+} Worker;
+
+// The lobby on the main thread accepts connections and queues them for matchmaking on MSG_JOIN.
+// Once a tick it pairs whoever it can and hands each pair to the least loaded worker.
+typedef struct Server {
+  EventLoop loop;
+  int listen_fd;
+  int metrics_fd;              // loopback Prometheus endpoint, -1 when off
+  MetricsScrape scrapes[METRICS_MAX_SCRAPES];
+  Matchmaker mm;               // ids are fds
+  int spectators_waiting;      // for a free handoff slot
+  MetricHist pairing_wait_ns;  // from MSG_JOIN to the handoff, lobby thread only
+  Conn* conns;                 // indexed by fd, connections that aren't in a match yet
+  int conns_cap;
+  Worker* workers;
+  int worker_count;
+  int snapshot_interval;        // in ticks
+  int max_rewind;               // in ticks, how far lag compensation looks back
+  const char* replay_dir;       // every match is recorded here when set
+  const NetSimProfile* netsim;  // conditions everything the workers send is put through
+  ReplayWriter replay_writer;
+  long long started;          // unix time, prefixes replay names
+  MetricHist reported_ticks;  // tick durations as of the last report
+  MetricHist reported_waits;  // pairing_wait_ns as of the last report
+  atomic_ullong replay_count;
+  _Atomic uint32_t next_match_id;
+  pthread_mutex_t feeds_mu;  // taken by workers as matches start and end, and by spectators
+  SpectatorFeed* feeds;      // of every active match, oldest first
+  SpectatorFeed* feeds_tail;
+  bool uring;         // the workers use io_uring
+  Uring accept_ring;  // multishot accept of listen_fd when its fd is set
+  bool accept_armed;  // re-armed by the matchmaking tick after an error ended it
+} Server;
+
+static volatile sig_atomic_t running = 1;
+
+static void on_sigint([[maybe_unused]] int sig) { running = 0; }
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void raise_fd_limit(void) {
+  struct rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+}
+
+static Conn* conn_slot(Conn** conns, int* conns_cap, int fd) {
+  if (fd >= *conns_cap) {
+    int new_cap = *conns_cap ? *conns_cap : 64;
+    while (new_cap <= fd) {
+      new_cap *= 2;
+    }
+    Conn* new_conns = realloc(*conns, sizeof(Conn) * new_cap);
+    if (!new_conns) {
+      perror("realloc");
+      return nullptr;
+    }
+    memset(new_conns + *conns_cap, 0, sizeof(Conn) * (new_cap - *conns_cap));
+    *conns = new_conns;
+    *conns_cap = new_cap;
+  }
+  return &(*conns)[fd];
+}
+
+// udp_pool is the owning worker's, lobby connections never have an endpoint
+static void conn_free(Conn* c, Pool* udp_pool) {
+  buf_free(&c->in);
+  send_ring_free(&c->out);
+  if (c->udp) {
+    udp_endpoint_free(c->udp);
+    pool_release(udp_pool, c->udp);
+    c->udp = nullptr;
+  }
+}
+
+static void conn_push(Worker* w, int fd, int type, void* data, size_t len) {
+  if (fd < 0) {
+    return;
+  }
+  Conn* c = &w->conns[fd];
+  // client and server would disagree on score or state for the rest of the match, so a message
+  // that doesn't fit ends it. Closing is left to the owning worker's next flush, this may run on
+  // any worker inside match_tick.
+  if (!c->udp) {
+    c->lost_msg |= !send_ring_push(&c->out, type, data, len);
+  } else if (msg_is_unreliable(type)) {
+    udp_send_unreliable(c->udp, type, data, len);
+  } else if (!udp_send_reliable(c->udp, type, data, len)) {
+    c->lost_msg = true;
+  }
+}
+
+// msg is the struct of message type, encoded per the protocol schema
+static void conn_push_msg(Worker* w, int fd, int type, const void* msg) {
+  uint8_t payload[PROTOCOL_MAX_MSG_SIZE];
+  conn_push(w, fd, type, payload, protocol_encode(type, msg, payload));
+}
+
+static void match_push_all_msg(Worker* w, Match* m, int type, const void* msg) {
+  for (int i = 0; i < 2; i++) {
+    conn_push_msg(w, m->fds[i], type, msg);
+  }
+}
+
+static void on_conn_event(EventLoop* loop, int fd, uint32_t events, void* user_data);
+static void conn_read(Worker* w, int fd);
+
+static void server_feed_add(Server* s, SpectatorFeed* f) {
+  pthread_mutex_lock(&s->feeds_mu);
+  f->prev = s->feeds_tail;
+  f->next = nullptr;
+  if (s->feeds_tail) {
+    s->feeds_tail->next = f;
+  } else {
+    s->feeds = f;
+  }
+  s->feeds_tail = f;
+  pthread_mutex_unlock(&s->feeds_mu);
+}
+
+static void server_feed_remove(Server* s, SpectatorFeed* f) {
+  pthread_mutex_lock(&s->feeds_mu);
+  if (f->prev) {
+    f->prev->next = f->next;
+  } else {
+    s->feeds = f->next;
+  }
+  if (f->next) {
+    f->next->prev = f->prev;
+  } else {
+    s->feeds_tail = f->prev;
+  }
+  pthread_mutex_unlock(&s->feeds_mu);
+}
+
+// The feed of a match with a reference for the caller, nullptr if there is no such match. 0 asks
+// for the longest running one. Linear, spectators join far less often than matches are ticked.
+static SpectatorFeed* server_feed_find(Server* s, uint32_t match) {
+  pthread_mutex_lock(&s->feeds_mu);
+  SpectatorFeed* f = s->feeds;
+  while (f && match && f->match != match) {
+    f = f->next;
+  }
+  if (f) {
+    spectator_feed_retain(f);
+  }
+  pthread_mutex_unlock(&s->feeds_mu);
+  return f;
+}
+
+static uint64_t io_tag(int op, int fd, uint32_t gen) {
+  return (uint64_t)op << 56 | (uint64_t)gen << IO_FD_BITS | (uint64_t)fd;
+}
+
+// Reads of fd start through the worker's ring, or epoll without one.
+static int conn_io_start(Worker* w, int fd) {
+  if (w->ring.fd < 0) {
+    return ev_add(&w->loop, fd, EV_READ | EV_WRITE, on_conn_event, w);
+  }
+  Conn* c = &w->conns[fd];
+  c->io_gen = ++w->io_gen;
+  c->sending = false;
+  return uring_recv_multishot(&w->ring, fd, io_tag(IO_RECV, fd, c->io_gen)) ? 0 : -1;
+}
+
+static void match_end(Worker* w, int idx);
+
+static void match_start(Worker* w, Handoff* h) {
+  int idx;
+  if (w->free_match_count > 0) {
+    idx = w->free_matches[--w->free_match_count];
+  } else {
+    if (w->match_count == w->match_cap) {
+      int new_cap = w->match_cap ? w->match_cap * 2 : 64;
+      Match* new_matches = realloc(w->matches, sizeof(Match) * new_cap);
+      int* new_free = realloc(w->free_matches, sizeof(int) * new_cap);
+      if (!new_matches || !new_free) {
+        perror("realloc");
+        exit(1);
+      }
+      w->matches = new_matches;
+      w->free_matches = new_free;
+      w->match_cap = new_cap;
+    }
+    idx = w->match_count++;
+  }
+  Server* s = w->server;
+  Match* m = &w->matches[idx];
+  *m = (Match){.active = true,
+               .id = atomic_fetch_add_explicit(&s->next_match_id, 1, memory_order_relaxed),
+               .state = STATE_PLAY,
+               .curr_pause_player = -1,
+               .fds = {h->fds[0], h->fds[1]},
+               .replay = {.fd = -1}};
+  memset(&m->history, 0, sizeof(m->history));
+  memset(m->inputs, 0, sizeof(m->inputs));
+  uint32_t seed = (uint32_t)now_ns() ^ (uint32_t)idx;
+  pong_sim_init(&m->sim, seed);
+  m->feed = spectator_feed_new(m->id);
+  if (!m->feed) {
+    exit(1);
+  }
+  server_feed_add(s, m->feed);
+  lag_comp_init(&m->lag, &m->sim, s->max_rewind);
+  if (s->replay_dir) {
+    char path[512];
+    unsigned long long n = atomic_fetch_add_explicit(&s->replay_count, 1, memory_order_relaxed);
+    snprintf(path, sizeof(path), "%s/%lld-%llu.pongreplay", s->replay_dir, s->started, n);
+    replay_recorder_open(&m->replay, &s->replay_writer, path, seed, s->max_rewind);
+  }
+
+  bool io_failed = false;
+  for (int i = 0; i < 2; i++) {
+    int fd = m->fds[i];
+    Conn* c = conn_slot(&w->conns, &w->conns_cap, fd);
+    if (!c) {
+      exit(1);
+    }
+    *c = h->conns[i];
+    c->match = idx;
+    c->player = i;
+    c->has_acked = false;
+    MsgMatchStart start = {.player = i, .transport = h->transport, .match = m->id};
+    if (h->transport == TRANSPORT_UDP) {
+      c->udp = pool_alloc(&w->udp_pool);
+      if (!c->udp) {
+        exit(1);
+      }
+      uint32_t salt;
+      if (getrandom(&salt, sizeof(salt), 0) != sizeof(salt)) {
+        exit(1);
+      }
+      start.udp_token = (uint32_t)fd | (salt & ~UDP_TOKEN_FD_MASK);
+      start.udp_port = w->udp_port;
+      udp_endpoint_init(c->udp, start.udp_token);
+    }
+    // always over tcp, the client can't reach the udp channel before it knows its token
+    uint8_t payload[MSG_MATCH_START_SIZE];
+    send_ring_push(&c->out, MSG_MATCH_START, payload, msg_match_start_encode(&start, payload));
+    io_failed |= conn_io_start(w, fd) == -1;
+  }
+  if (io_failed) {
+    // closes both connections, the player left would wait for a match that never ticks
+    match_end(w, idx);
+  }
+  // the first snapshot has no baseline and carries the full state
+}
+
+static void conn_close(Worker* w, int fd);
+
+static void match_end(Worker* w, int idx) {
+  Match* m = &w->matches[idx];
+  if (!m->active) {
+    return;
+  }
+  m->active = false;
+  atomic_fetch_sub_explicit(&w->active_matches, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&w->lag_saves, m->lag.saves, memory_order_relaxed);
+  replay_recorder_close(&m->replay);
+  // spectators on other workers see the end once they have read the last frame
+  spectator_feed_end(m->feed);
+  server_feed_remove(w->server, m->feed);
+  spectator_feed_release(m->feed);
+  m->feed = nullptr;
+  w->free_matches[w->free_match_count++] = idx;
+  for (int i = 0; i < 2; i++) {
+    int fd = m->fds[i];
+    m->fds[i] = -1;
+    if (fd >= 0 && w->conns[fd].active) {
+      w->conns[fd].match = -1;
+      conn_close(w, fd);
+    }
+  }
+}
+
+// Finds the watch of feed or adds one, taking over the caller's reference to feed either way.
+static int worker_watch(Worker* w, SpectatorFeed* feed) {
+  for (int i = 0; i < w->watch_count; i++) {
+    if (w->watches[i].feed == feed) {
+      spectator_feed_release(feed);
+      return i;
+    }
+  }
+  if (w->watch_count == w->watch_cap) {
+    int new_cap = w->watch_cap ? w->watch_cap * 2 : 16;
+    Watch* new_watches = realloc(w->watches, sizeof(Watch) * new_cap);
+    if (!new_watches) {
+      perror("realloc");
+      exit(1);
+    }
+    w->watches = new_watches;
+    w->watch_cap = new_cap;
+  }
+  // only what is published from now on, the first frame a new viewer gets is a full one anyway
+  w->watches[w->watch_count] =
+      (Watch){.feed = feed, .next = atomic_load_explicit(&feed->published, memory_order_acquire)};
+  return w->watch_count++;
+}
+
+// A watch left without viewers stays until the next broadcast, which drops it.
+static void watch_remove(Worker* w, int idx) {
+  Watch* wt = &w->watches[idx];
+  spectator_feed_release(wt->feed);
+  free(wt->fds);
+  *wt = w->watches[--w->watch_count];
+  for (int i = 0; i < wt->count; i++) {
+    w->conns[wt->fds[i]].viewer->watch = idx;
+  }
+}
+
+static void viewer_start(Worker* w, Handoff* h) {
+  int fd = h->fds[0];
+  Conn* c = conn_slot(&w->conns, &w->conns_cap, fd);
+  if (!c) {
+    exit(1);
+  }
+  *c = h->conns[0];
+  c->match = -1;
+  c->viewer = pool_alloc(&w->viewer_pool);
+  if (!c->viewer) {
+    exit(1);
+  }
+  atomic_fetch_add_explicit(&h->feed->viewers, 1, memory_order_relaxed);
+  int idx = worker_watch(w, h->feed);
+  Watch* wt = &w->watches[idx];
+  if (wt->count == wt->cap) {
+    int new_cap = wt->cap ? wt->cap * 2 : 64;
+    int* new_fds = realloc(wt->fds, sizeof(int) * new_cap);
+    if (!new_fds) {
+      perror("realloc");
+      exit(1);
+    }
+    wt->fds = new_fds;
+    wt->cap = new_cap;
+  }
+  *c->viewer = (Viewer){.watch = idx, .slot = wt->count};
+  wt->fds[wt->count++] = fd;
+  // a viewer that stops reading fills this within seconds and gets resynced, instead of being
+  // fed a backlog of stale snapshots once it reads again
+  int sndbuf = VIEWER_SNDBUF;
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof sndbuf);
+  if (conn_io_start(w, fd) == -1) {
+    conn_close(w, fd);
+  }
+}
+
+static void viewer_stop(Worker* w, Conn* c) {
+  Viewer* v = c->viewer;
+  Watch* wt = &w->watches[v->watch];
+  int last = wt->fds[--wt->count];
+  wt->fds[v->slot] = last;
+  w->conns[last].viewer->slot = v->slot;
+  atomic_fetch_sub_explicit(&wt->feed->viewers, 1, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&w->viewers, 1, memory_order_relaxed);
+  viewer_clear(v, &w->broadcast_pool);
+  pool_release(&w->viewer_pool, v);
+  c->viewer = nullptr;
+}
+
+static void conn_close(Worker* w, int fd) {
+  Conn* c = &w->conns[fd];
+  if (!c->active) {
+    return;
+  }
+  c->active = false;
+  if (c->viewer) {
+    viewer_stop(w, c);
+  }
+  if (c->match >= 0) {
+    int idx = c->match;
+    c->match = -1;
+    match_end(w, idx);
+  }
+  if (w->ring.fd >= 0) {
+    // the receive keeps the socket open until the cancel goes out with the next submit
+    uring_cancel(&w->ring, io_tag(IO_RECV, fd, c->io_gen), io_tag(IO_CANCEL, fd, 0));
+  } else {
+    ev_del(&w->loop, fd);
+  }
+  conn_free(c, &w->udp_pool);
+  netsim_forget(&w->netsim, fd);
+  close(fd);
+}
+
+// Queues a send of everything fd has queued, a spectator's frames or a player's ring, unless
+// one is in flight already. What the submit doesn't get into the socket waits for the next tick.
+static void conn_queue_send(Worker* w, int fd) {
+  Conn* c = &w->conns[fd];
+  if (c->sending) {
+    return;
+  }
+  if (w->send_count == URING_ENTRIES) {
+    if (uring_submit(&w->ring) < 0) {
+      return;
+    }
+    w->send_count = 0;
+  }
+  UringSend* send = &w->sends[w->send_count];
+  int count = c->viewer ? viewer_iov(c->viewer, send->iov) : send_ring_iov(&c->out, send->iov);
+  send->msg = (struct msghdr){.msg_iov = send->iov, .msg_iovlen = (size_t)count};
+  if (count > 0 && uring_sendmsg(&w->ring, fd, &send->msg, io_tag(IO_SEND, fd, c->io_gen))) {
+    w->send_count++;
+    c->sending = true;
+  }
+}
+
+static void match_on_msg(Worker* w, Conn* c, Frame* fr) {
+  if (c->match < 0) {
+    return;
+  }
+  Match* m = &w->matches[c->match];
+  int other_fd = m->fds[1 - c->player];
+  switch (fr->hdr.type) {
+    case MSG_JOIN:
+      break;
+    case MSG_INPUT: {
+      MsgInput u;
+      if (!msg_input_decode(&u, fr->payload, fr->hdr.len)) {
+        metric_add(&w->metrics.parse_errors, 1);
+        break;
+      }
+      // resends over udp carry a stale view, only a message with new commands says where the
+      // player is looking now
+      if ((int32_t)(u.first_seq + u.count - m->inputs[c->player].recv_end) > 0) {
+        lag_comp_on_input(&m->lag, c->player, u.view_tick, m->sim.tick);
+      }
+      // a client only ever controls its own paddle, the opponent sees it in the next snapshot
+      input_queue_on_msg(&m->inputs[c->player], &u);
+      break;
+    }
+    case MSG_SNAPSHOT_ACK: {
+      MsgSnapshotAck u;
+      if (!msg_snapshot_ack_decode(&u, fr->payload, fr->hdr.len)) {
+        metric_add(&w->metrics.parse_errors, 1);
+        break;
+      }
+      if ((!c->has_acked || (int32_t)(u.tick - c->acked_tick) > 0) &&
+          (int32_t)(m->sim.tick - u.tick) >= 0) {
+        c->acked_tick = u.tick;
+        c->has_acked = true;
+      }
+      break;
+    }
+    case MSG_STATE_UPDATE: {
+      MsgStateUpdate u;
+      if (!msg_state_update_decode(&u, fr->payload, fr->hdr.len)) {
+        metric_add(&w->metrics.parse_errors, 1);
+        break;
+      }
+      u.player = c->player;
+      if (m->state == STATE_PAUSE_MENU) {
+        if (u.player == m->curr_pause_player) {
+          m->state = u.state;
+          m->curr_pause_player = -1;
+        }
+      } else if (m->state == STATE_PLAY) {
+        m->state = u.state;
+        if (u.state == STATE_PAUSE_MENU) {
+          m->curr_pause_player = u.player;
+        }
+      }
+      conn_push_msg(w, other_fd, MSG_STATE_UPDATE, &u);
+      break;
+    }
+    default:
+      metric_add(&w->metrics.parse_errors, 1);
+      break;
+  }
+}
+
+typedef struct ConnFrameCtx {
+  Worker* w;
+  int fd;
+  bool stream;  // datagrams are counted as a whole
+} ConnFrameCtx;
+
+static bool conn_on_frame(Frame* fr, void* user_data) {
+  ConnFrameCtx* ctx = user_data;
+  Conn* c = &ctx->w->conns[ctx->fd];
+  metric_add(&ctx->w->metrics.frames, 1);
+  if (ctx->stream) {
+    metric_add(&ctx->w->metrics.bytes_in, MSG_HDR_SIZE + fr->hdr.len);
+  }
+  match_on_msg(ctx->w, c, fr);
+  return c->active;
+}
+
+static void conn_read(Worker* w, int fd) {
+  ConnFrameCtx ctx = {.w = w, .fd = fd, .stream = true};
+  int rc = conn_recv_frames(&w->conns[fd].in, fd, conn_on_frame, &ctx);
+  if (rc < 0) {
+    metric_add(&w->metrics.parse_errors, rc == -2);
+    conn_close(w, fd);
+  }
+}
+
+// May run on any worker while the owner is inside worker_tick, it must only touch m, the
+// connections of m and the frame arena of the worker running it.
+static void match_tick(Worker* w, Match* m, Arena* frame) {
+  if (!m->active || m->state != STATE_PLAY) {
+    return;
+  }
+  // everything fed into the tick goes through a ReplayTick, so a replay runs the exact same path
+  ReplayTick t;
+  for (int p = 0; p < 2; p++) {
+    t.backlog_count[p] = input_queue_take_backlog(&m->inputs[p], t.backlog[p]);
+    t.input.paddle_dir[p] = input_queue_take(&m->inputs[p]);
+    t.rewind[p] = (uint8_t)m->lag.rewind[p];
+  }
+  int scorer = replay_apply_tick(&t, &m->sim, &m->lag);
+  replay_record_tick(&m->replay, &t, &m->sim);
+  if (scorer >= 0) {
+    match_push_all_msg(w, m, MSG_SCORE_UPDATE,
+                       &(MsgScoreUpdate){.score = m->sim.players[scorer].score, .player = scorer});
+  }
+  if (m->sim.tick % w->server->snapshot_interval) {
+    return;
+  }
+
+  Snapshot* snap = arena_alloc(frame, sizeof(Snapshot), alignof(Snapshot));
+  uint8_t* buf = arena_alloc(frame, SNAPSHOT_MAX_ENCODED, 1);
+  if (!snap || !buf) {
+    return;  // arena too small for this many matches, clients extrapolate until the next one
+  }
+  snapshot_from_sim(snap, &m->sim, m->sim.tick);
+  snapshot_history_put(&m->history, snap);
+  if (atomic_load_explicit(&m->feed->viewers, memory_order_relaxed) > 0) {
+    spectator_feed_publish(m->feed, snap);
+  }
+  for (int p = 0; p < 2; p++) {
+    Conn* c = &w->conns[m->fds[p]];
+    const Snapshot* base =
+        c->has_acked ? snapshot_history_get(&m->history, c->acked_tick) : nullptr;
+    size_t len = snapshot_encode(snap, base, PONG_TICK_HZ, buf);
+    conn_push(w, m->fds[p], MSG_SNAPSHOT, buf, len);
+    if (input_queue_started(&m->inputs[p])) {
+      MsgInputAck ack = {.seq = input_queue_ack_seq(&m->inputs[p]), .pos = m->sim.players[p].pos};
+      conn_push_msg(w, m->fds[p], MSG_INPUT_ACK, &ack);
+    }
+  }
+}
+
+static bool worker_claim(Worker* w, int* chunk) {
+  uint64_t c = atomic_load_explicit(&w->claim, memory_order_acquire);
+  for (;;) {
+    uint32_t next = (uint32_t)(c >> 16) & 0xFFFF;
+    uint32_t count = (uint32_t)c & 0xFFFF;
+    if (next >= count) {
+      return false;
+    }
+    if (atomic_compare_exchange_weak_explicit(&w->claim, &c, c + (1ull << 16),
+                                              memory_order_acq_rel, memory_order_acquire)) {
+      *chunk = (int)next;
+      return true;
+    }
+  }
+}
+
+static void worker_run_chunk(Worker* runner, Worker* owner, int chunk) {
+  int end = (chunk + 1) * TICK_CHUNK_MATCHES;
+  if (end > owner->match_count) {
+    end = owner->match_count;
+  }
+  for (int i = chunk * TICK_CHUNK_MATCHES; i < end; i++) {
+    match_tick(owner, &owner->matches[i], &runner->frame);
+  }
+  atomic_fetch_add_explicit(&owner->chunks_done, 1, memory_order_release);
+}
+
+static void worker_tick(Worker* w) {
+  int chunks = (w->match_count + TICK_CHUNK_MATCHES - 1) / TICK_CHUNK_MATCHES;
+  uint64_t gen = (atomic_load_explicit(&w->claim, memory_order_relaxed) >> 32) + 1;
+  atomic_store_explicit(&w->chunks_done, 0, memory_order_relaxed);
+  atomic_store_explicit(&w->claim, gen << 32 | (uint64_t)chunks, memory_order_release);
+
+  int chunk;
+  while (worker_claim(w, &chunk)) {
+    worker_run_chunk(w, w, chunk);
+  }
+  // out of own work, help whoever is still ticking instead of idling
+  Server* s = w->server;
+  for (int i = 1; i < s->worker_count; i++) {
+    Worker* victim = &s->workers[(w->id + i) % s->worker_count];
+    while (worker_claim(victim, &chunk)) {
+      worker_run_chunk(w, victim, chunk);
+      atomic_fetch_add_explicit(&w->chunks_stolen, 1, memory_order_relaxed);
+    }
+  }
+  // chunks a thief took must be done before the connections are flushed or touched again
+  while (atomic_load_explicit(&w->chunks_done, memory_order_acquire) < chunks) {
+    sched_yield();
+  }
+  w->tick++;
+}
+
+static void worker_read_udp(Worker* w) {
+  uint64_t now = now_ns();
+  for (;;) {
+    uint8_t pkt[UDP_MAX_PACKET];
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    ssize_t n = recvfrom(w->udp_fd, pkt, sizeof(pkt), 0, (struct sockaddr*)&addr, &addr_len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    uint32_t token = udp_packet_token(pkt, n);
+    int fd = (int)(token & UDP_TOKEN_FD_MASK);
+    if (fd >= w->conns_cap || !w->conns[fd].active || !w->conns[fd].udp ||
+        w->conns[fd].udp->token != token) {
+      continue;
+    }
+    UdpEndpoint* ep = w->conns[fd].udp;
+    metric_add(&w->metrics.packets_in, 1);
+    metric_add(&w->metrics.bytes_in, (uint64_t)n);
+    ConnFrameCtx ctx = {.w = w, .fd = fd};
+    int rc = udp_on_packet(ep, pkt, n, now, conn_on_frame, &ctx);
+    if (rc == -1) {
+      metric_add(&w->metrics.parse_errors, 1);
+    } else if (rc == 1 && w->conns[fd].active && w->conns[fd].udp == ep) {
+      // follow the client across NAT rebinding, but only to where its newest packet came from, a
+      // replayed or stale one can't redirect the snapshots
+      memcpy(&ep->addr, &addr, addr_len);
+      ep->addr_len = addr_len;
+    }
+  }
+}
+
+static void worker_send_udp(Worker* w, int count, uint64_t now) {
+  for (int i = 0; w->netsim.enabled && i < count; i++) {
+    netsim_sendmsg(&w->netsim, w->udp_fd, &w->udp_msgs[i].msg_hdr, now);
+  }
+  int off = w->netsim.enabled ? count : 0;
+  while (off < count) {
+    int n = sendmmsg(w->udp_fd, w->udp_msgs + off, count - off, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // the socket buffer is full, these are dropped like any lost datagram
+      break;
+    }
+    off += n;
+  }
+  uint64_t bytes = 0;
+  for (int i = 0; i < count; i++) {
+    bytes += i < off ? w->udp_out[i].len : 0;
+    udp_packet_sent(w->udp_eps[i]);
+  }
+  metric_add(&w->metrics.packets_out, (uint64_t)off);
+  metric_add(&w->metrics.bytes_out, bytes);
+}
+
+// The kernel's smoothed estimate on tcp, the endpoint's ack timed one on udp.
+static void conn_sample_rtt(Worker* w, Conn* c, int fd) {
+  if (c->udp) {
+    if (c->udp->rtt_ns) {
+      metric_hist_record(&w->metrics.rtt_us, c->udp->rtt_ns / 1000);
+    }
+    return;
+  }
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+    metric_hist_record(&w->metrics.rtt_us, info.tcpi_rtt);
+  }
+}
+
+// One writev per tcp connection with queued bytes, or a queued send with a ring, one sendmmsg per
+// UDP_FLUSH_BATCH packets. Tcp goes first, a failed connection closes its whole match before any
+// of its endpoints is batched.
+static void worker_flush(Worker* w) {
+  uint64_t now = now_ns();
+  uint64_t queued = 0;
+  uint64_t queue_max = 0;
+  for (int fd = 0; fd < w->conns_cap; fd++) {
+    Conn* c = &w->conns[fd];
+    if (!c->active) {
+      continue;
+    }
+    if (c->lost_msg) {
+      fprintf(stderr, "fd %i: %s send window full, ending its match\n", fd,
+              c->udp ? "reliable udp" : "tcp");
+      conn_close(w, fd);
+      continue;
+    }
+    // every connection once a second, spread over the ticks
+    if ((fd + w->tick) % PONG_TICK_HZ == 0) {
+      conn_sample_rtt(w, c, fd);
+    }
+    if (!send_ring_pending(&c->out)) {
+      continue;
+    }
+    if (w->ring.fd >= 0) {
+      conn_queue_send(w, fd);
+    } else {
+      ssize_t sent = netsim_ring_write(&w->netsim, &c->out, fd, nullptr, 0, now);
+      if (sent == -1) {
+        conn_close(w, fd);
+        continue;
+      }
+      metric_add(&w->metrics.bytes_out, (uint64_t)sent);
+    }
+    uint64_t pending = send_ring_pending(&c->out);
+    queued += pending;
+    queue_max = pending > queue_max ? pending : queue_max;
+  }
+  metric_set(&w->metrics.send_queue_bytes, queued);
+  metric_set(&w->metrics.send_queue_max, queue_max);
+  int udp_count = 0;
+  for (int fd = 0; fd < w->conns_cap; fd++) {
+    Conn* c = &w->conns[fd];
+    if (!c->active || !c->udp || !c->udp->addr_len ||
+        !udp_prepare_packet(c->udp, now, &w->udp_out[udp_count])) {
+      continue;
+    }
+    udp_packet_msghdr(c->udp, &w->udp_out[udp_count], &w->udp_msgs[udp_count].msg_hdr);
+    w->udp_eps[udp_count++] = c->udp;
+    if (udp_count == UDP_FLUSH_BATCH) {
+      worker_send_udp(w, udp_count, now);
+      udp_count = 0;
+    }
+  }
+  worker_send_udp(w, udp_count, now);
+}
+
+// Reads what the watched matches published since the last tick and fans every frame out to the
+// spectators, then writes the queues of the spectators whose turn it is. Spectators of a match
+// that ended are closed once everything queued for them is written, see VIEWER_DRAIN_TICKS.
+static void worker_broadcast(Worker* w) {
+  uint64_t sent = 0;
+  uint64_t resyncs = 0;
+  // backwards, dropping a watch moves the last one into its place
+  for (int i = w->watch_count - 1; i >= 0; i--) {
+    Watch* wt = &w->watches[i];
+    // before reading, the frames of an ended feed are all published by the time ended is set
+    bool ended = atomic_load_explicit(&wt->feed->ended, memory_order_acquire);
+    FeedFrame f;
+    int rc;
+    while ((rc = spectator_feed_read(wt->feed, wt->next, &f)) != 0) {
+      if (rc < 0) {
+        // lapped by the writer, skip to the newest frame and resync everyone from it
+        wt->next = atomic_load_explicit(&wt->feed->published, memory_order_acquire) - 1;
+        continue;
+      }
+      wt->next++;
+      snapshot_history_put(&wt->history, &f.snap);
+      BroadcastFrame* shared = broadcast_frame_new(&w->broadcast_pool);
+      if (!shared) {
+        continue;
+      }
+      memcpy(shared->data, f.data, f.len);
+      shared->len = f.len;
+      for (int j = 0; j < wt->count; j++) {
+        Viewer* v = w->conns[wt->fds[j]].viewer;
+        bool joined = !v->has_tick;
+        ViewerOffer rc = viewer_offer(v, shared, &f, &wt->history, &w->broadcast_pool);
+        resyncs += rc == VIEWER_RESYNCED && !joined;
+      }
+      broadcast_frame_release(&w->broadcast_pool, shared);
+    }
+    bool stalled = ended && ++wt->drain_ticks > VIEWER_DRAIN_TICKS;
+    // backwards, closing a viewer moves the last one into its slot
+    for (int j = wt->count - 1; j >= 0; j--) {
+      int fd = wt->fds[j];
+      Conn* c = &w->conns[fd];
+      if ((fd + w->tick) % VIEWER_FLUSH_TICKS != 0 && !ended) {
+        continue;
+      }
+      if (w->ring.fd >= 0) {
+        // a send in flight completes within this tick's submit, the next broadcast sees it
+        if (ended && ((!c->viewer->count && !c->sending) || stalled)) {
+          conn_close(w, fd);
+        } else {
+          conn_queue_send(w, fd);
+        }
+        continue;
+      }
+      ssize_t n = viewer_flush(c->viewer, fd, &w->broadcast_pool);
+      if (n == -1 || (ended && (!c->viewer->count || stalled))) {
+        conn_close(w, fd);
+      }
+      sent += n > 0 ? (uint64_t)n : 0;
+    }
+    if (wt->count == 0) {
+      watch_remove(w, i);
+    }
+  }
+  metric_add(&w->metrics.bytes_out, sent);
+  atomic_fetch_add_explicit(&w->resyncs, resyncs, memory_order_relaxed);
+}
+
+static void on_udp_event([[maybe_unused]] EventLoop* loop, [[maybe_unused]] int fd,
+                         [[maybe_unused]] uint32_t events, void* user_data) {
+  worker_read_udp(user_data);
+}
+
+static void on_conn_event([[maybe_unused]] EventLoop* loop, int fd, uint32_t events,
+                          void* user_data) {
+  Worker* w = user_data;
+  if (events & EV_READ) {
+    conn_read(w, fd);
+  }
+  // the socket drained after a short write, send the rest without waiting for the next tick
+  Conn* c = &w->conns[fd];
+  if ((events & EV_WRITE) && c->active && c->viewer) {
+    ssize_t sent = viewer_flush(c->viewer, fd, &w->broadcast_pool);
+    if (sent == -1) {
+      conn_close(w, fd);
+    } else {
+      metric_add(&w->metrics.bytes_out, (uint64_t)sent);
+    }
+  } else if ((events & EV_WRITE) && c->active && send_ring_pending(&c->out)) {
+    ssize_t sent = netsim_ring_write(&w->netsim, &c->out, fd, nullptr, 0, now_ns());
+    if (sent == -1) {
+      conn_close(w, fd);
+    } else {
+      metric_add(&w->metrics.bytes_out, (uint64_t)sent);
+    }
+  }
+}
+
+static void conn_on_sent(Worker* w, int fd, const UringCqe* cqe) {
+  Conn* c = &w->conns[fd];
+  c->sending = false;
+  if (cqe->res < 0 && cqe->res != -EAGAIN) {
+    conn_close(w, fd);
+    return;
+  }
+  size_t sent = cqe->res > 0 ? (size_t)cqe->res : 0;
+  if (c->viewer) {
+    viewer_sent(c->viewer, sent, &w->broadcast_pool);
+  } else {
+    send_ring_consume(&c->out, sent);
+  }
+  metric_add(&w->metrics.bytes_out, sent);
+}
+
+// Frames are dispatched straight out of the provided buffer, which goes back to the kernel after.
+static void conn_on_recv(Worker* w, int fd, const UringCqe* cqe) {
+  Conn* c = &w->conns[fd];
+  if (cqe->res > 0) {
+    ConnFrameCtx ctx = {.w = w, .fd = fd, .stream = true};
+    int rc = conn_feed_frames(&c->in, uring_buf(&w->ring, cqe->buf), (size_t)cqe->res,
+                              conn_on_frame, &ctx);
+    if (rc < 0) {
+      metric_add(&w->metrics.parse_errors, rc == -2);
+      conn_close(w, fd);
+    }
+  } else if (cqe->res != -ENOBUFS) {
+    conn_close(w, fd);  // closed by the peer or failed
+  }
+  // out of buffers, or ended by the kernel for its own reasons
+  if (c->active && !cqe->more) {
+    uring_recv_multishot(&w->ring, fd, io_tag(IO_RECV, fd, c->io_gen));
+  }
+}
+
+static void worker_reap(Worker* w) {
+  UringCqe cqe;
+  while (uring_next(&w->ring, &cqe)) {
+    int op = (int)(cqe.user_data >> 56);
+    int fd = (int)(cqe.user_data & ((1u << IO_FD_BITS) - 1));
+    uint32_t gen = (uint32_t)(cqe.user_data >> IO_FD_BITS);
+    // completions of a connection closed since, maybe with its fd reused, are only cleaned up
+    bool current = op != IO_CANCEL && fd < w->conns_cap && w->conns[fd].active &&
+                   w->conns[fd].io_gen == gen;
+    if (current && op == IO_RECV) {
+      conn_on_recv(w, fd, &cqe);
+    } else if (current && op == IO_SEND) {
+      conn_on_sent(w, fd, &cqe);
+    }
+    if (cqe.has_buf) {
+      uring_buf_return(&w->ring, cqe.buf);
+    }
+  }
+}
+
+static void on_uring_event([[maybe_unused]] EventLoop* loop, [[maybe_unused]] int fd,
+                           [[maybe_unused]] uint32_t events, void* user_data) {
+  worker_reap(user_data);
+}
+
+static void on_handoff_event([[maybe_unused]] EventLoop* loop, int fd,
+                             [[maybe_unused]] uint32_t events, void* user_data) {
+  Worker* w = user_data;
+  uint64_t count;
+  while (read(fd, &count, sizeof(count)) > 0) {
+  }
+  uint32_t head = atomic_load_explicit(&w->handoff_head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&w->handoff_tail, memory_order_acquire);
+  for (; head != tail; head++) {
+    Handoff* h = &w->handoffs[head & (HANDOFF_RING_SIZE - 1)];
+    int fds[2] = {h->fds[0], h->fds[1]};
+    if (h->feed) {
+      viewer_start(w, h);
+    } else {
+      match_start(w, h);
+    }
+    atomic_store_explicit(&w->handoff_head, head + 1, memory_order_release);
+    // frames that arrived before the handoff are already buffered
+    for (int p = 0; p < 2; p++) {
+      if (w->ring.fd < 0 && fds[p] >= 0 && w->conns[fds[p]].active) {
+        conn_read(w, fds[p]);
+      }
+    }
+  }
+  // the receives just queued pick those up as soon as they are armed
+  if (w->ring.fd >= 0) {
+    uring_submit(&w->ring);
+  }
+}
+
+static void on_tick([[maybe_unused]] EventLoop* loop, void* user_data) {
+  Worker* w = user_data;
+  uint64_t start = now_ns();
+  arena_reset(&w->frame);
+  worker_tick(w);
+  worker_flush(w);
+  worker_broadcast(w);
+  if (w->ring.fd >= 0) {
+    // one io_uring_enter for every send of the tick, they are done by the time it returns
+    if (uring_submit(&w->ring) < 0) {
+      perror("io_uring_enter");
+    }
+    w->send_count = 0;
+    worker_reap(w);
+  }
+  metric_hist_record(&w->metrics.tick_ns, now_ns() - start);
+}
+
+static void on_netsim_timer([[maybe_unused]] EventLoop* loop, void* user_data) {
+  Worker* w = user_data;
+  netsim_poll(&w->netsim, now_ns());
+}
+
+static void* worker_main(void* arg) {
+  Worker* w = arg;
+  while (running) {
+    if (ev_run_once(&w->loop, -1) < 0) {
+      break;
+    }
+  }
+  return nullptr;
+}
+
+static int worker_init(Worker* w, Server* s, int id) {
+  *w = (Worker){.server = s, .id = id, .udp_fd = -1, .handoff_fd = -1, .ring = {.fd = -1}};
+  w->handoffs = malloc(sizeof(Handoff) * HANDOFF_RING_SIZE);
+  w->udp_out = malloc(sizeof(UdpPacketOut) * UDP_FLUSH_BATCH);
+  w->udp_msgs = calloc(UDP_FLUSH_BATCH, sizeof(struct mmsghdr));
+  w->udp_eps = malloc(sizeof(UdpEndpoint*) * UDP_FLUSH_BATCH);
+  pool_init(&w->udp_pool, sizeof(UdpEndpoint), 64);
+  pool_init(&w->viewer_pool, sizeof(Viewer), 256);
+  pool_init(&w->broadcast_pool, sizeof(BroadcastFrame), 256);
+  // each worker draws from its own seed, so a run with the same traffic is repeatable
+  NetSimProfile netsim = s->netsim ? *s->netsim : (NetSimProfile){};
+  netsim.seed += (uint32_t)id;
+  if (!w->handoffs || !w->udp_out || !w->udp_msgs || !w->udp_eps ||
+      !arena_init(&w->frame, WORKER_FRAME_ARENA_SIZE) || ev_loop_init(&w->loop) == -1 ||
+      netsim_init(&w->netsim, s->netsim ? &netsim : nullptr, now_ns()) == -1) {
+    return -1;
+  }
+  // every worker gets its own udp port, clients learn theirs from MSG_MATCH_START
+  struct addrinfo* addr_info = get_addr_info_socktype("0", nullptr, SOCK_DGRAM);
+  w->udp_fd = open_udp_socket(addr_info);
+  freeaddrinfo(addr_info);
+  struct sockaddr_storage addr;
+  socklen_t addr_len = sizeof(addr);
+  if (w->udp_fd < 0 || getsockname(w->udp_fd, (struct sockaddr*)&addr, &addr_len) == -1) {
+    return -1;
+  }
+  w->udp_port = ntohs(addr.ss_family == AF_INET6 ? ((struct sockaddr_in6*)&addr)->sin6_port
+                                                 : ((struct sockaddr_in*)&addr)->sin_port);
+  w->handoff_fd = eventfd(0, EFD_NONBLOCK);
+  if (w->handoff_fd == -1 || set_nonblocking(w->udp_fd) == -1 ||
+      ev_add(&w->loop, w->udp_fd, EV_READ, on_udp_event, w) == -1 ||
+      ev_add(&w->loop, w->handoff_fd, EV_READ, on_handoff_event, w) == -1 ||
+      ev_timer_add(&w->loop, 1000000000ull / PONG_TICK_HZ, on_tick, w) == -1 ||
+      (w->netsim.enabled && ev_timer_add(&w->loop, NETSIM_SLOT_NS, on_netsim_timer, w) == -1)) {
+    return -1;
+  }
+  // without a ring the worker stays on epoll
+  if (s->uring) {
+    w->sends = malloc(sizeof(UringSend) * URING_ENTRIES);
+    if (!w->sends || uring_init(&w->ring, URING_ENTRIES, URING_BUFS, URING_BUF_SIZE) == -1 ||
+        ev_add(&w->loop, w->ring.fd, EV_READ, on_uring_event, w) == -1) {
+      uring_free(&w->ring);
+      free(w->sends);
+      w->sends = nullptr;
+    }
+  }
+  return 0;
+}
+
+static void worker_free(Worker* w) {
+  for (int fd = 0; fd < w->conns_cap; fd++) {
+    conn_close(w, fd);
+  }
+  uint32_t tail = atomic_load_explicit(&w->handoff_tail, memory_order_acquire);
+  for (uint32_t i = w->handoff_head; i != tail; i++) {
+    Handoff* h = &w->handoffs[i & (HANDOFF_RING_SIZE - 1)];
+    for (int p = 0; p < 2; p++) {
+      if (h->fds[p] >= 0) {
+        conn_free(&h->conns[p], &w->udp_pool);
+        close(h->fds[p]);
+      }
+    }
+    if (h->feed) {
+      spectator_feed_release(h->feed);
+    }
+  }
+  // every viewer is closed, only the watches themselves are left
+  while (w->watch_count > 0) {
+    watch_remove(w, w->watch_count - 1);
+  }
+  // after the connections, closing the ring cancels their receives
+  uring_free(&w->ring);
+  free(w->sends);
+  if (w->udp_fd >= 0) close(w->udp_fd);
+  if (w->handoff_fd >= 0) close(w->handoff_fd);
+  ev_loop_free(&w->loop);
+  netsim_free(&w->netsim);
+  free(w->conns);
+  free(w->matches);
+  free(w->free_matches);
+  free(w->handoffs);
+  free(w->watches);
+  pool_free(&w->udp_pool);
+  pool_free(&w->viewer_pool);
+  pool_free(&w->broadcast_pool);
+  arena_free(&w->frame);
+  free(w->udp_out);
+  free(w->udp_msgs);
+  free(w->udp_eps);
+}
+
+// free handoff slots of w, only exact on the lobby thread
+static uint32_t worker_handoff_space(Worker* w) {
+  return HANDOFF_RING_SIZE - (atomic_load_explicit(&w->handoff_tail, memory_order_relaxed) -
+                              atomic_load_explicit(&w->handoff_head, memory_order_acquire));
+}
+
+// Moves a pair's connections into a handoff slot of the least loaded worker with one free, the
+// pass never pairs more than there are free slots. The worker is signalled by
+// server_handoff_signal after the pass.
+static void server_handoff(Server* s, const MatchmakerPair* pair) {
+  Worker* w = nullptr;
+  for (int i = 0; i < s->worker_count; i++) {
+    Worker* o = &s->workers[i];
+    if (worker_handoff_space(o) > 0 &&
+        (!w || atomic_load_explicit(&o->active_matches, memory_order_relaxed) <
+                   atomic_load_explicit(&w->active_matches, memory_order_relaxed))) {
+      w = o;
+    }
+  }
+  uint32_t tail = atomic_load_explicit(&w->handoff_tail, memory_order_relaxed);
+  Handoff* h = &w->handoffs[tail & (HANDOFF_RING_SIZE - 1)];
+  *h = (Handoff){.transport = pair->transport, .fds = {pair->ids[0], pair->ids[1]}};
+  for (int i = 0; i < 2; i++) {
+    ev_del(&s->loop, h->fds[i]);
+    h->conns[i] = s->conns[h->fds[i]];
+    s->conns[h->fds[i]] = (Conn){};
+  }
+  atomic_fetch_add_explicit(&w->active_matches, 1, memory_order_relaxed);
+  atomic_store_explicit(&w->handoff_tail, tail + 1, memory_order_release);
+  w->handoff_signal = true;
+}
+
+static void server_handoff_signal(Server* s) {
+  for (int i = 0; i < s->worker_count; i++) {
+    Worker* w = &s->workers[i];
+    if (!w->handoff_signal) {
+      continue;
+    }
+    w->handoff_signal = false;
+    uint64_t one = 1;
+    if (write(w->handoff_fd, &one, sizeof(one)) == -1) {
+      perror("eventfd write");
+    }
+  }
+}
+
+static void lobby_close(Server* s, int fd);
+
+// Moves a spectator's connection and its reference to the feed in Conn.spectating to the worker
+// with the fewest spectators. A worker already watching the match would take on another viewer
+// without reading the feed another time, but spreading them is what lets every core write to
+// some of them. The worker is signalled by server_handoff_signal.
+// @return false if every handoff ring is full, the spectator stays in the lobby
+static bool server_spectate(Server* s, int fd) {
+  Worker* w = nullptr;
+  for (int i = 0; i < s->worker_count; i++) {
+    Worker* o = &s->workers[i];
+    if (worker_handoff_space(o) > 0 &&
+        (!w || atomic_load_explicit(&o->viewers, memory_order_relaxed) <
+                   atomic_load_explicit(&w->viewers, memory_order_relaxed))) {
+      w = o;
+    }
+  }
+  if (!w) {
+    return false;
+  }
+  uint32_t tail = atomic_load_explicit(&w->handoff_tail, memory_order_relaxed);
+  Handoff* h = &w->handoffs[tail & (HANDOFF_RING_SIZE - 1)];
+  *h = (Handoff){.fds = {fd, -1}, .feed = s->conns[fd].spectating};
+  ev_del(&s->loop, fd);
+  h->conns[0] = s->conns[fd];
+  h->conns[0].spectating = nullptr;
+  s->conns[fd] = (Conn){};
+  atomic_fetch_add_explicit(&w->viewers, 1, memory_order_relaxed);
+  atomic_store_explicit(&w->handoff_tail, tail + 1, memory_order_release);
+  w->handoff_signal = true;
+  return true;
+}
+
+static void lobby_close(Server* s, int fd) {
+  Conn* c = &s->conns[fd];
+  if (!c->active) {
+    return;
+  }
+  c->active = false;
+  matchmaker_remove(&s->mm, fd);
+  if (c->spectating) {
+    spectator_feed_release(c->spectating);
+    c->spectating = nullptr;
+    s->spectators_waiting--;
+  }
+  ev_del(&s->loop, fd);
+  conn_free(c, nullptr);
+  close(fd);
+}
+
+static void on_lobby_conn_event(EventLoop* loop, int fd, uint32_t events, void* user_data);
+
+static void lobby_add(Server* s, int fd) {
+  int yes = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+  Conn* c = conn_slot(&s->conns, &s->conns_cap, fd);
+  if (!c || set_nonblocking(fd) == -1 ||
+      ev_add(&s->loop, fd, EV_READ, on_lobby_conn_event, s) == -1) {
+    close(fd);
+    return;
+  }
+  *c = (Conn){.active = true, .match = -1};
+  buf_init(&c->in, 2048);
+  send_ring_init(&c->out, 1024);
+}
+
+static void server_accept(Server* s) {
+  for (;;) {
+    struct sockaddr_storage client_addr;
+    socklen_t addr_size = sizeof client_addr;
+    int fd = accept(s->listen_fd, (struct sockaddr*)&client_addr, &addr_size);
+    if (fd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        perror("accept");
+      }
+      return;
+    }
+    lobby_add(s, fd);
+  }
+}
+
+// One multishot accept completes with every connection until an error, e.g. out of fds, ends it.
+static void server_accept_arm(Server* s) {
+  s->accept_armed = uring_accept_multishot(&s->accept_ring, s->listen_fd, 0) &&
+                    uring_submit(&s->accept_ring) == 1;
+}
+
+typedef struct LobbyFrameCtx {
+  Server* s;
+  int fd;
+} LobbyFrameCtx;
+
+// Queues the connection for matchmaking on MSG_JOIN and hands it to a worker on MSG_SPECTATE,
+// anything else is dropped until it is paired.
+static bool lobby_on_frame(Frame* fr, void* user_data) {
+  LobbyFrameCtx* ctx = user_data;
+  Server* s = ctx->s;
+  int fd = ctx->fd;
+  Conn* c = &s->conns[fd];
+  if (fr->hdr.type != MSG_JOIN && fr->hdr.type != MSG_SPECTATE) {
+    return true;
+  }
+  // the version leads both in every protocol version, check it before trusting the rest
+  uint16_t version = fr->hdr.len >= 2 ? wire_get_u16(fr->payload) : 0;
+  MsgJoin join;
+  MsgSpectate spectate;
+  if (version != PROTOCOL_VERSION ||
+      !(fr->hdr.type == MSG_JOIN ? msg_join_decode(&join, fr->payload, fr->hdr.len)
+                                 : msg_spectate_decode(&spectate, fr->payload, fr->hdr.len))) {
+    uint8_t payload[MSG_REJECT_SIZE];
+    send_ring_push(&c->out, MSG_REJECT, payload,
+                   msg_reject_encode(&(MsgReject){.version = PROTOCOL_VERSION}, payload));
+    send_ring_flush(&c->out, fd);
+    fprintf(stderr, "fd %i: rejected protocol version %u\n", fd, version);
+    lobby_close(s, fd);
+    return false;
+  }
+  if (c->spectating) {
+    return true;
+  }
+  if (fr->hdr.type == MSG_SPECTATE) {
+    c->spectating = server_feed_find(s, spectate.match);
+    if (!c->spectating) {
+      lobby_close(s, fd);  // nothing to watch
+      return false;
+    }
+    matchmaker_remove(&s->mm, fd);
+    if (!server_spectate(s, fd)) {
+      s->spectators_waiting++;
+      return true;
+    }
+    server_handoff_signal(s);
+    // the worker dispatches whatever else is buffered
+    return false;
+  }
+  if (matchmaker_queued(&s->mm, fd)) {
+    return true;
+  }
+  c->transport = join.transport;
+  // the handshake's round trip, good enough to tell a neighbour from another continent
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  uint32_t rtt_us = getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 ? info.tcpi_rtt : 0;
+  if (!matchmaker_add(&s->mm, fd, join.transport, join.rating, rtt_us, now_ns())) {
+    lobby_close(s, fd);
+    return false;
+  }
+  return true;
+}
+
+static void on_lobby_conn_event([[maybe_unused]] EventLoop* loop, int fd, uint32_t events,
+                                void* user_data) {
+  Server* s = user_data;
+  if (!(events & EV_READ)) {
+    return;
+  }
+  LobbyFrameCtx ctx = {.s = s, .fd = fd};
+  if (conn_recv_frames(&s->conns[fd].in, fd, lobby_on_frame, &ctx) < 0) {
+    lobby_close(s, fd);
+  }
+}
+
+// The batch pairing pass, once a tick so a pair waits at most one tick once both have joined.
+static void on_matchmaking_tick([[maybe_unused]] EventLoop* loop, void* user_data) {
+  Server* s = user_data;
+  // a tick later instead of right away, the error that ended it is likely still there
+  if (s->accept_ring.fd >= 0 && !s->accept_armed) {
+    server_accept_arm(s);
+  }
+  // spectators turned away by full rings last time go first, there are only any under a burst
+  for (int fd = 0; s->spectators_waiting > 0 && fd < s->conns_cap; fd++) {
+    if (s->conns[fd].active && s->conns[fd].spectating) {
+      if (!server_spectate(s, fd)) {
+        break;
+      }
+      s->spectators_waiting--;
+    }
+  }
+  if (s->mm.waiting < 2) {
+    server_handoff_signal(s);
+    return;
+  }
+  uint64_t now = now_ns();
+  uint32_t space = 0;
+  for (int i = 0; i < s->worker_count; i++) {
+    space += worker_handoff_space(&s->workers[i]);
+  }
+  MatchmakerPair pairs[64];
+  int n;
+  do {
+    n = matchmaker_pair(&s->mm, now, pairs, space < 64 ? (int)space : 64);
+    for (int i = 0; i < n; i++) {
+      server_handoff(s, &pairs[i]);
+      metric_hist_record(&s->pairing_wait_ns, now - pairs[i].joined_ns[0]);
+      metric_hist_record(&s->pairing_wait_ns, now - pairs[i].joined_ns[1]);
+    }
+    space -= (uint32_t)n;
+  } while (n == 64);
+  server_handoff_signal(s);
+}
+
+static void on_listen_event([[maybe_unused]] EventLoop* loop, [[maybe_unused]] int fd,
+                            [[maybe_unused]] uint32_t events, void* user_data) {
+  server_accept(user_data);
+}
+
+static void on_accept_ring_event([[maybe_unused]] EventLoop* loop, [[maybe_unused]] int fd,
+                                 [[maybe_unused]] uint32_t events, void* user_data) {
+  Server* s = user_data;
+  UringCqe cqe;
+  while (uring_next(&s->accept_ring, &cqe)) {
+    if (cqe.res >= 0) {
+      lobby_add(s, cqe.res);
+    } else {
+      fprintf(stderr, "accept: %s\n", strerror(-cqe.res));
+    }
+    if (!cqe.more) {
+      s->accept_armed = false;
+    }
+  }
+}
+
+static int server_active_matches(Server* s) {
+  int active = 0;
+  for (int i = 0; i < s->worker_count; i++) {
+    active += atomic_load_explicit(&s->workers[i].active_matches, memory_order_relaxed);
+  }
+  return active;
+}
+
+static int server_spectators(Server* s) {
+  int viewers = 0;
+  for (int i = 0; i < s->worker_count; i++) {
+    viewers += atomic_load_explicit(&s->workers[i].viewers, memory_order_relaxed);
+  }
+  return viewers;
+}
+
+static uint64_t server_resyncs(Server* s) {
+  uint64_t resyncs = 0;
+  for (int i = 0; i < s->worker_count; i++) {
+    resyncs += atomic_load_explicit(&s->workers[i].resyncs, memory_order_relaxed);
+  }
+  return resyncs;
+}
+
+// Sums up what the workers recorded while they keep running.
+static void server_metrics(Server* s, Metrics* m) {
+  *m = (Metrics){};
+  for (int i = 0; i < s->worker_count; i++) {
+    metrics_merge(m, &s->workers[i].metrics);
+  }
+}
+
+static void on_report([[maybe_unused]] EventLoop* loop, void* user_data) {
+  Server* s = user_data;
+  uint64_t stolen = 0;
+  uint64_t saves = 0;
+  for (int i = 0; i < s->worker_count; i++) {
+    stolen += atomic_load_explicit(&s->workers[i].chunks_stolen, memory_order_relaxed);
+    saves += atomic_load_explicit(&s->workers[i].lag_saves, memory_order_relaxed);
+  }
+  Metrics m;
+  server_metrics(s, &m);
+  MetricHist ticks;
+  metric_hist_since(&ticks, &m.tick_ns, &s->reported_ticks);
+  s->reported_ticks = m.tick_ns;
+  MetricHist waits;
+  metric_hist_since(&waits, &s->pairing_wait_ns, &s->reported_waits);
+  s->reported_waits = s->pairing_wait_ns;
+  printf("%i active matches on %i workers, %llu tick chunks stolen, %llu lag compensated saves, "
+         "tick p50 %.0f us p99 %.0f us, %i waiting, pairing wait p50 %.1f ms p99 %.1f ms, "
+         "%i spectators, %llu spectator resyncs\n",
+         server_active_matches(s), s->worker_count, (unsigned long long)stolen,
+         (unsigned long long)saves, metric_hist_quantile(&ticks, 0.5) / 1e3,
+         metric_hist_quantile(&ticks, 0.99) / 1e3, s->mm.waiting,
+         metric_hist_quantile(&waits, 0.5) / 1e6, metric_hist_quantile(&waits, 0.99) / 1e6,
+         server_spectators(s), (unsigned long long)server_resyncs(s));
+}
+
+static void metrics_scrape_end(EventLoop* loop, MetricsScrape* sc) {
+  ev_del(loop, sc->fd);
+  close(sc->fd);
+  free(sc->body);
+  *sc = (MetricsScrape){.server = sc->server, .fd = -1};
+}
+
+// Builds the whole response up front, the allocation happens once per scrape.
+static bool metrics_scrape_respond(MetricsScrape* sc) {
+  Server* s = sc->server;
+  FILE* f = open_memstream(&sc->body, &sc->body_len);
+  if (!f) {
+    sc->body = nullptr;
+    return false;
+  }
+  Metrics m;
+  server_metrics(s, &m);
+  metrics_write_prometheus(f, "pong_", &m);
+  fprintf(f,
+          "# HELP pong_active_matches Matches being played.\n"
+          "# TYPE pong_active_matches gauge\npong_active_matches %i\n"
+          "# HELP pong_matchmaking_waiting Players waiting for an opponent.\n"
+          "# TYPE pong_matchmaking_waiting gauge\npong_matchmaking_waiting %i\n"
+          "# HELP pong_spectators Spectators being streamed a match.\n"
+          "# TYPE pong_spectators gauge\npong_spectators %i\n"
+          "# HELP pong_spectator_resyncs_total Snapshots encoded for a single spectator that "
+          "fell behind.\n"
+          "# TYPE pong_spectator_resyncs_total counter\npong_spectator_resyncs_total %llu\n",
+          server_active_matches(s), s->mm.waiting, server_spectators(s),
+          (unsigned long long)server_resyncs(s));
+  metric_hist_write_prometheus(f, "pong_", "matchmaking_wait_seconds",
+                               "Time from joining to being paired.", &s->pairing_wait_ns, 1e-9);
+  if (fclose(f) != 0) {
+    return false;
+  }
+  sc->hdr_len = (size_t)snprintf(sc->hdr, sizeof(sc->hdr),
+                                 "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                 sc->body_len);
+  return true;
+}
+
+// @return true while there is more to send once the socket has room again
+static bool metrics_scrape_send(MetricsScrape* sc) {
+  size_t total = sc->hdr_len + sc->body_len;
+  while (sc->sent < total) {
+    struct iovec iov[2];
+    int count = 0;
+    if (sc->sent < sc->hdr_len) {
+      iov[count++] = (struct iovec){sc->hdr + sc->sent, sc->hdr_len - sc->sent};
+    }
+    size_t body_off = sc->sent > sc->hdr_len ? sc->sent - sc->hdr_len : 0;
+    iov[count++] = (struct iovec){sc->body + body_off, sc->body_len - body_off};
+    ssize_t n = writev(sc->fd, iov, count);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    sc->sent += (size_t)n;
+  }
+  return false;
+}
+
+// Plain HTTP/1.0 for scrapers: the request is read and ignored, whatever it asked for gets the
+// metrics and the connection is closed. Nothing blocks, a slow scraper gets the rest of the
+// response as its socket drains.
+static void on_metrics_conn_event(EventLoop* loop, [[maybe_unused]] int fd, uint32_t events,
+                                  void* user_data) {
+  MetricsScrape* sc = user_data;
+  if (sc->hdr_len == 0) {
+    char req[1024];
+    ssize_t n;
+    bool got_request = false;
+    while ((n = recv(sc->fd, req, sizeof(req), 0)) > 0) {
+      got_request = true;
+    }
+    if (!got_request) {
+      if (n < 0 && errno == EAGAIN && !(events & EV_HUP)) {
+        return;
+      }
+      metrics_scrape_end(loop, sc);
+      return;
+    }
+    if (!metrics_scrape_respond(sc)) {
+      metrics_scrape_end(loop, sc);
+      return;
+    }
+  }
+  if (!metrics_scrape_send(sc)) {
+    metrics_scrape_end(loop, sc);
+  }
+}
+
+static MetricsScrape* metrics_scrape_slot(Server* s) {
+  MetricsScrape* oldest = nullptr;
+  for (int i = 0; i < METRICS_MAX_SCRAPES; i++) {
+    MetricsScrape* sc = &s->scrapes[i];
+    if (sc->fd < 0) {
+      return sc;
+    }
+    if (!oldest || sc->started_ns < oldest->started_ns) {
+      oldest = sc;
+    }
+  }
+  if (now_ns() - oldest->started_ns < METRICS_SCRAPE_TIMEOUT_NS) {
+    return nullptr;
+  }
+  metrics_scrape_end(&s->loop, oldest);
+  return oldest;
+}
+
+static void on_metrics_listen_event(EventLoop* loop, int fd, [[maybe_unused]] uint32_t events,
+                                    void* user_data) {
+  Server* s = user_data;
+  for (;;) {
+    int conn_fd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (conn_fd == -1) {
+      return;
+    }
+    MetricsScrape* sc = metrics_scrape_slot(s);
+    if (!sc) {
+      close(conn_fd);
+      continue;
+    }
+    *sc = (MetricsScrape){.server = s, .fd = conn_fd, .started_ns = now_ns()};
+    // edge triggered, writes are retried as the socket drains
+    if (ev_add(loop, conn_fd, EV_READ | EV_WRITE, on_metrics_conn_event, sc) == -1) {
+      close(conn_fd);
+      sc->fd = -1;
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* port = argc > 1 ? argv[1] : "8080";
+  long snapshot_hz = argc > 2 ? strtol(argv[2], nullptr, 0) : 60;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  long worker_count = argc > 3 ? strtol(argv[3], nullptr, 0) : cpus;
+  long max_rewind_ms = argc > 4 ? strtol(argv[4], nullptr, 0) : 150;
+  long max_rewind = max_rewind_ms * PONG_TICK_HZ / 1000;
+  // "-" records nothing, to get to the metrics port
+  const char* replay_dir = argc > 5 && strcmp(argv[5], "-") != 0 ? argv[5] : nullptr;
+  const char* metrics_port = argc > 6 ? argv[6] : nullptr;
+  if (snapshot_hz <= 0 || snapshot_hz > PONG_TICK_HZ || worker_count <= 0 || max_rewind < 0 ||
+      max_rewind > LAG_MAX_REWIND) {
+    fprintf(stderr,
+            "usage: %s [port] [snapshot_hz <= %i] [workers] [max_rewind_ms <= %i] "
+            "[replay_dir or -] [metrics_port]\n",
+            argv[0], PONG_TICK_HZ, LAG_MAX_REWIND * 1000 / PONG_TICK_HZ);
+    return 1;
+  }
+
+  NetSimProfile netsim;
+  const char* netsim_spec = getenv(NETSIM_ENV);
+  if (netsim_spec && !netsim_profile_parse(&netsim, netsim_spec)) {
+    fprintf(stderr, "%s: expected latency=ms,jitter=ms,loss=%%,dup=%%,reorder=%%,seed=n\n",
+            NETSIM_ENV);
+    return 1;
+  }
+  const char* io = getenv(IO_ENV);
+  bool uring = io && strcmp(io, "uring") == 0;
+  if (uring && netsim_spec) {
+    // the simulator holds writes back itself, sends on the ring would go around it
+    fprintf(stderr, "%s: the network simulator runs on epoll only, not using io_uring\n", IO_ENV);
+    uring = false;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, on_sigint);
+  signal(SIGTERM, on_sigint);
+  raise_fd_limit();
+
+  Server s = {.metrics_fd = -1,
+              .snapshot_interval = PONG_TICK_HZ / (int)snapshot_hz,
+              .max_rewind = (int)max_rewind,
+              .replay_dir = replay_dir,
+              .netsim = netsim_spec ? &netsim : nullptr,
+              .started = (long long)time(nullptr),
+              .worker_count = (int)worker_count,
+              .next_match_id = 1,
+              .uring = uring,
+              .accept_ring = {.fd = -1}};
+  matchmaker_init(&s.mm);
+  pthread_mutex_init(&s.feeds_mu, nullptr);
+  s.workers = calloc(s.worker_count, sizeof(Worker));
+  if (!s.workers || ev_loop_init(&s.loop) == -1 ||
+      (replay_dir && replay_writer_start(&s.replay_writer) == -1)) {
+    return 1;
+  }
+  for (int i = 0; i < s.worker_count; i++) {
+    if (worker_init(&s.workers[i], &s, i) == -1) {
+      return 1;
+    }
+    s.uring &= s.workers[i].ring.fd >= 0;
+  }
+  if (uring && !s.uring) {
+    fprintf(stderr, "%s: io_uring with multishot receive is not supported, using epoll\n",
+            IO_ENV);
+  }
+  struct addrinfo* addr_info = get_addr_info(port, nullptr);
+  s.listen_fd = open_and_listen_socket(addr_info);
+  freeaddrinfo(addr_info);
+  if (s.listen_fd < 0 || set_nonblocking(s.listen_fd) == -1) {
+    return 1;
+  }
+  if (s.uring && uring_init(&s.accept_ring, 8, 0, 0) == 0 &&
+      ev_add(&s.loop, s.accept_ring.fd, EV_READ, on_accept_ring_event, &s) == 0) {
+    server_accept_arm(&s);
+  } else {
+    uring_free(&s.accept_ring);
+    if (ev_add(&s.loop, s.listen_fd, EV_READ, on_listen_event, &s) == -1) {
+      return 1;
+    }
+  }
+  if (ev_timer_add(&s.loop, 1000000000ull / PONG_TICK_HZ, on_matchmaking_tick, &s) == -1 ||
+      ev_timer_add(&s.loop, 5000000000ull, on_report, &s) == -1) {
+    return 1;
+  }
+  // only reachable from this machine
+  for (int i = 0; i < METRICS_MAX_SCRAPES; i++) {
+    s.scrapes[i] = (MetricsScrape){.server = &s, .fd = -1};
+  }
+  if (metrics_port) {
+    addr_info = get_addr_info(metrics_port, "127.0.0.1");
+    s.metrics_fd = open_and_listen_socket(addr_info);
+    freeaddrinfo(addr_info);
+    if (s.metrics_fd < 0 || set_nonblocking(s.metrics_fd) == -1 ||
+        ev_add(&s.loop, s.metrics_fd, EV_READ, on_metrics_listen_event, &s) == -1) {
+      return 1;
+    }
+  }
+
+  // signals go to the lobby thread, workers see running drop on their next tick
+  sigset_t mask, old_mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+  for (int i = 0; i < s.worker_count; i++) {
+    Worker* w = &s.workers[i];
+    if (pthread_create(&w->thread, nullptr, worker_main, w) != 0) {
+      fprintf(stderr, "pthread_create failed\n");
+      return 1;
+    }
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    CPU_SET(i % cpus, &cpu);
+    pthread_setaffinity_np(w->thread, sizeof(cpu), &cpu);
+  }
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  printf("pong_server listening on port %s, %i Hz tick, %li Hz snapshots, %i workers on %s\n",
+         port, PONG_TICK_HZ, snapshot_hz, s.worker_count, s.uring ? "io_uring" : "epoll");
+  if (s.netsim) {
+    printf("simulating %u ms latency, %u ms jitter, %.1f%% loss, %.1f%% duplicates, %.1f%% "
+           "reordered on everything sent\n",
+           netsim.latency_ms, netsim.jitter_ms, netsim.loss * 100.0, netsim.duplicate * 100.0,
+           netsim.reorder * 100.0);
+  }
+
+  while (running) {
+    if (ev_run_once(&s.loop, -1) < 0) {
+      break;
+    }
+  }
+  running = 0;
+
+  for (int i = 0; i < s.worker_count; i++) {
+    pthread_join(s.workers[i].thread, nullptr);
+  }
+  for (int i = 0; i < s.worker_count; i++) {
+    worker_free(&s.workers[i]);
+  }
+  // after the workers, their matches' replays are closed by now
+  if (replay_dir) {
+    replay_writer_stop(&s.replay_writer);
+  }
+  for (int fd = 0; fd < s.conns_cap; fd++) {
+    lobby_close(&s, fd);
+  }
+  uring_free(&s.accept_ring);
+  close(s.listen_fd);
+  if (s.metrics_fd >= 0) {
+    close(s.metrics_fd);
+  }
+  for (int i = 0; i < METRICS_MAX_SCRAPES; i++) {
+    if (s.scrapes[i].fd >= 0) {
+      metrics_scrape_end(&s.loop, &s.scrapes[i]);
+    }
+  }
+  ev_loop_free(&s.loop);
+  matchmaker_free(&s.mm);
+  pthread_mutex_destroy(&s.feeds_mu);
+  free(s.conns);
+  free(s.workers);
+  return 0;
+}
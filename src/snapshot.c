@@ -0,0 +1,215 @@
+#include "snapshot.h"
+
+#include <math.h>
+#include <string.h>
+
+typedef struct BitWriter {
+  uint8_t* data;
+  size_t bit;
+} BitWriter;
+
+typedef struct BitReader {
+  const uint8_t* data;
+  size_t bit;
+  size_t bit_len;
+  bool overflow;
+} BitReader;
+
+static void bw_write(BitWriter* w, uint32_t value, int bits) {
+  for (int i = 0; i < bits; i++) {
+    size_t byte = w->bit >> 3;
+    if ((w->bit & 7) == 0) {
+      w->data[byte] = 0;
+    }
+    w->data[byte] |= (uint8_t)(((value >> i) & 1u) << (w->bit & 7));
+    w->bit++;
+  }
+}
+
+static uint32_t br_read(BitReader* r, int bits) {
+  if (r->bit + bits > r->bit_len) {
+    r->overflow = true;
+    return 0;
+  }
+  uint32_t value = 0;
+  for (int i = 0; i < bits; i++) {
+    value |= (uint32_t)((r->data[r->bit >> 3] >> (r->bit & 7)) & 1u) << i;
+    r->bit++;
+  }
+  return value;
+}
+
+// Field encoding in read order: 0 = unchanged, 10 + sign + 4 bit delta, 110 + sign + 8 bit delta,
+// 111 + raw 16 bit value.
+static void write_field(BitWriter* w, int32_t value, int32_t predicted) {
+  int32_t delta = value - predicted;
+  if (delta == 0) {
+    bw_write(w, 0, 1);
+    return;
+  }
+  uint32_t mag = (uint32_t)(delta < 0 ? -delta : delta);
+  if (mag < 16) {
+    bw_write(w, 0b01, 2);
+    bw_write(w, delta < 0, 1);
+    bw_write(w, mag, 4);
+  } else if (mag < 256) {
+    bw_write(w, 0b011, 3);
+    bw_write(w, delta < 0, 1);
+    bw_write(w, mag, 8);
+  } else {
+    bw_write(w, 0b111, 3);
+    bw_write(w, (uint16_t)value, 16);
+  }
+}
+
+static int32_t read_field(BitReader* r, int32_t predicted, bool is_signed) {
+  if (!br_read(r, 1)) {
+    return predicted;
+  }
+  if (!br_read(r, 1)) {
+    bool neg = br_read(r, 1);
+    int32_t mag = (int32_t)br_read(r, 4);
+    return predicted + (neg ? -mag : mag);
+  }
+  if (!br_read(r, 1)) {
+    bool neg = br_read(r, 1);
+    int32_t mag = (int32_t)br_read(r, 8);
+    return predicted + (neg ? -mag : mag);
+  }
+  uint32_t raw = br_read(r, 16);
+  return is_signed ? (int16_t)raw : (int32_t)raw;
+}
+
+static int16_t quantize(float v, int scale) {
+  float q = roundf(v * (float)scale);
+  return (int16_t)fmaxf(fminf(q, 32767.f), -32768.f);
+}
+
+void snapshot_from_sim(Snapshot* snap, const PongSim* s, uint32_t tick) {
+  *snap = (Snapshot){
+      .tick = tick,
+      .ball_x = quantize(s->ball_pos.x, SNAPSHOT_POS_SCALE),
+      .ball_y = quantize(s->ball_pos.y, SNAPSHOT_POS_SCALE),
+      .ball_vx = quantize(s->ball_velocity.x, SNAPSHOT_VEL_SCALE),
+      .ball_vy = quantize(s->ball_velocity.y, SNAPSHOT_VEL_SCALE),
+      .collision_count = (uint8_t)(s->collision_count > 255 ? 255 : s->collision_count),
+  };
+  for (int i = 0; i < 2; i++) {
+    snap->paddle[i] = quantize(s->players[i].pos, SNAPSHOT_POS_SCALE);
+    snap->paddle_vel[i] = quantize(s->players[i].paddle_vert_velocity, SNAPSHOT_VEL_SCALE);
+    snap->score[i] = (uint16_t)s->players[i].score;
+  }
+}
+
+void snapshot_apply(const Snapshot* snap, PongSim* s, int skip_player) {
+  s->ball_pos = (Vector2){(float)snap->ball_x / SNAPSHOT_POS_SCALE,
+                          (float)snap->ball_y / SNAPSHOT_POS_SCALE};
+  s->ball_velocity = (Vector2){(float)snap->ball_vx / SNAPSHOT_VEL_SCALE,
+                               (float)snap->ball_vy / SNAPSHOT_VEL_SCALE};
+  s->collision_count = snap->collision_count;
+  for (int i = 0; i < 2; i++) {
+    s->players[i].score = snap->score[i];
+    if (i == skip_player) {
+      continue;
+    }
+    s->players[i].pos = (float)snap->paddle[i] / SNAPSHOT_POS_SCALE;
+    s->players[i].paddle_vert_velocity = (float)snap->paddle_vel[i] / SNAPSHOT_VEL_SCALE;
+  }
+}
+
+void snapshot_history_put(SnapshotHistory* h, const Snapshot* snap) {
+  h->snaps[snap->tick % SNAPSHOT_HISTORY] = *snap;
+  h->valid[snap->tick % SNAPSHOT_HISTORY] = true;
+}
+
+const Snapshot* snapshot_history_get(const SnapshotHistory* h, uint32_t tick) {
+  size_t i = tick % SNAPSHOT_HISTORY;
+  return h->valid[i] && h->snaps[i].tick == tick ? &h->snaps[i] : nullptr;
+}
+
+// Integer extrapolation so encoder and decoder agree bit for bit.
+static int32_t extrapolate(int32_t pos, int32_t vel, uint32_t gap, int tick_hz) {
+  if (tick_hz <= 0) {
+    return pos;
+  }
+  int64_t num = (int64_t)vel * gap * SNAPSHOT_POS_SCALE;
+  return pos + (int32_t)(num / ((int64_t)SNAPSHOT_VEL_SCALE * tick_hz));
+}
+
+typedef struct Prediction {
+  int32_t ball_x, ball_y;
+  int32_t paddle[2];
+} Prediction;
+
+static Prediction predict(const Snapshot* base, uint32_t gap, int tick_hz) {
+  Prediction p = {
+      .ball_x = extrapolate(base->ball_x, base->ball_vx, gap, tick_hz),
+      .ball_y = extrapolate(base->ball_y, base->ball_vy, gap, tick_hz),
+  };
+  for (int i = 0; i < 2; i++) {
+    p.paddle[i] = extrapolate(base->paddle[i], base->paddle_vel[i], gap, tick_hz);
+  }
+  return p;
+}
+
+size_t snapshot_encode(const Snapshot* snap, const Snapshot* baseline, int tick_hz, uint8_t* out) {
+  BitWriter w = {.data = out};
+  Snapshot zero = {};
+  uint32_t gap = baseline ? snap->tick - baseline->tick : 0;
+  if (baseline && gap > 0 && gap <= SNAPSHOT_MAX_GAP) {
+    bw_write(&w, 1, 1);
+    bw_write(&w, baseline->tick & 0xFFFF, 16);
+    bw_write(&w, gap, 6);
+  } else {
+    baseline = &zero;
+    gap = 0;
+    bw_write(&w, 0, 1);
+    bw_write(&w, snap->tick, 32);
+  }
+  Prediction p = predict(baseline, gap, tick_hz);
+  write_field(&w, snap->ball_x, p.ball_x);
+  write_field(&w, snap->ball_y, p.ball_y);
+  write_field(&w, snap->ball_vx, baseline->ball_vx);
+  write_field(&w, snap->ball_vy, baseline->ball_vy);
+  for (int i = 0; i < 2; i++) {
+    write_field(&w, snap->paddle[i], p.paddle[i]);
+    write_field(&w, snap->paddle_vel[i], baseline->paddle_vel[i]);
+    write_field(&w, snap->score[i], baseline->score[i]);
+  }
+  write_field(&w, snap->collision_count, baseline->collision_count);
+  return (w.bit + 7) / 8;
+}
+
+int snapshot_decode(Snapshot* snap, const uint8_t* data, size_t len, const SnapshotHistory* history,
+                    int tick_hz) {
+  BitReader r = {.data = data, .bit_len = len * 8};
+  Snapshot zero = {};
+  const Snapshot* baseline = &zero;
+  uint32_t gap = 0;
+  if (br_read(&r, 1)) {
+    uint32_t base_tick_lo = br_read(&r, 16);
+    gap = br_read(&r, 6);
+    size_t slot = base_tick_lo % SNAPSHOT_HISTORY;
+    // the slot may have been reused by a newer snapshot since the sender picked its baseline
+    if (r.overflow || gap == 0 || !history || !history->valid[slot] ||
+        (history->snaps[slot].tick & 0xFFFF) != base_tick_lo) {
+      return -1;
+    }
+    baseline = &history->snaps[slot];
+    snap->tick = baseline->tick + gap;
+  } else {
+    snap->tick = br_read(&r, 32);
+  }
+  Prediction p = predict(baseline, gap, tick_hz);
+  snap->ball_x = (int16_t)read_field(&r, p.ball_x, true);
+  snap->ball_y = (int16_t)read_field(&r, p.ball_y, true);
+  snap->ball_vx = (int16_t)read_field(&r, baseline->ball_vx, true);
+  snap->ball_vy = (int16_t)read_field(&r, baseline->ball_vy, true);
+  for (int i = 0; i < 2; i++) {
+    snap->paddle[i] = (int16_t)read_field(&r, p.paddle[i], true);
+    snap->paddle_vel[i] = (int16_t)read_field(&r, baseline->paddle_vel[i], true);
+    snap->score[i] = (uint16_t)read_field(&r, baseline->score[i], false);
+  }
+  snap->collision_count = (uint8_t)read_field(&r, baseline->collision_count, false);
+  return r.overflow ? -1 : 0;
+}
@@ -0,0 +1,58 @@
+#ifndef PONG_GAME_SNAPSHOT_H
+#define PONG_GAME_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pong.h"
+
+// Quantized match state. Positions are stored in 1/SNAPSHOT_POS_SCALE world units, velocities
+// in 1/SNAPSHOT_VEL_SCALE units per second.
+#define SNAPSHOT_POS_SCALE 16
+#define SNAPSHOT_VEL_SCALE 8
+#define SNAPSHOT_HISTORY 64
+// baselines older than this are never referenced, the receiver may have reused their slot
+#define SNAPSHOT_MAX_GAP (SNAPSHOT_HISTORY - 1)
+#define SNAPSHOT_MAX_ENCODED 40
+
+typedef struct Snapshot {
+  uint32_t tick;
+  int16_t ball_x;
+  int16_t ball_y;
+  int16_t ball_vx;
+  int16_t ball_vy;
+  int16_t paddle[2];
+  int16_t paddle_vel[2];
+  uint16_t score[2];
+  uint8_t collision_count;
+} Snapshot;
+
+// Ring of snapshots by tick, a sender keeps what it sent and a receiver what it decoded.
+typedef struct SnapshotHistory {
+  Snapshot snaps[SNAPSHOT_HISTORY];
+  bool valid[SNAPSHOT_HISTORY];
+} SnapshotHistory;
+
+void snapshot_from_sim(Snapshot* snap, const PongSim* s, uint32_t tick);
+
+// Overwrites s with the snapshot, except the paddle of skip_player (-1 to apply everything).
+void snapshot_apply(const Snapshot* snap, PongSim* s, int skip_player);
+
+void snapshot_history_put(SnapshotHistory* h, const Snapshot* snap);
+const Snapshot* snapshot_history_get(const SnapshotHistory* h, uint32_t tick);
+
+/**
+ * Bit-packs snap as a delta against baseline, or in full when baseline is null. With a non-zero
+ * tick_hz positions are delta-encoded against the baseline extrapolated by its velocity, so a
+ * ball in flight and an idle paddle cost a few bits.
+ * @return encoded size in bytes, out must hold SNAPSHOT_MAX_ENCODED
+ */
+size_t snapshot_encode(const Snapshot* snap, const Snapshot* baseline, int tick_hz, uint8_t* out);
+
+/**
+ * @return 0 on success, -1 if the data is malformed or references a baseline missing from history
+ */
+int snapshot_decode(Snapshot* snap, const uint8_t* data, size_t len, const SnapshotHistory* history,
+                    int tick_hz);
+
+#endif  // PONG_GAME_SNAPSHOT_H
@@ -0,0 +1,288 @@
+#include "udp.h"
+
+#include <string.h>
+
+static bool seq_greater(uint16_t a, uint16_t b) {
+  return ((a > b) && (a - b <= 32768)) || ((a < b) && (b - a > 32768));
+}
+
+void udp_endpoint_init(UdpEndpoint* ep, uint32_t token) {
+  *ep = (UdpEndpoint){.token = token};
+  msg_buf_init(&ep->unreliable, 256);
+}
+
+void udp_endpoint_free(UdpEndpoint* ep) { msg_buf_free(&ep->unreliable); }
+
+bool udp_send_reliable(UdpEndpoint* ep, int type, const void* data, size_t len) {
+  if (len > UDP_RELIABLE_MAX_PAYLOAD ||
+      (uint16_t)(ep->send_next_id - ep->send_oldest_id) >= UDP_RELIABLE_WINDOW) {
+    return false;
+  }
+  uint16_t id = ep->send_next_id++;
+  UdpReliableMsg* m = &ep->send_q[id % UDP_RELIABLE_WINDOW];
+  *m = (UdpReliableMsg){.used = true, .id = id, .type = type, .len = (uint16_t)len};
+  memcpy(m->data, data, len);
+  return true;
+}
+
+void udp_send_unreliable(UdpEndpoint* ep, int type, const void* data, size_t len) {
+  msg_buf_push(&ep->unreliable, type, (void*)data, len);
+}
+
+static void write_hdr(uint8_t* out, const UdpPacketHdr* hdr) {
+  wire_put_u32(out, hdr->token);
+  wire_put_u16(out + 4, hdr->seq);
+  wire_put_u16(out + 6, hdr->ack);
+  wire_put_u32(out + 8, hdr->ack_bits);
+  out[12] = hdr->has_ack;
+}
+
+static void read_hdr(const uint8_t* in, UdpPacketHdr* hdr) {
+  hdr->token = wire_get_u32(in);
+  hdr->seq = wire_get_u16(in + 4);
+  hdr->ack = wire_get_u16(in + 6);
+  hdr->ack_bits = wire_get_u32(in + 8);
+  hdr->has_ack = in[12];
+}
+
+static const uint8_t unreliable_channel = UDP_CHANNEL_UNRELIABLE;
+
+bool udp_prepare_packet(UdpEndpoint* ep, uint64_t now_ns, UdpPacketOut* out) {
+  out->iov_count = 1;
+  out->len = UDP_PACKET_HDR_SIZE;
+  UdpSentPacket rec = {.valid = true, .seq = ep->local_seq, .sent_ns = now_ns};
+
+  for (uint16_t id = ep->send_oldest_id;
+       id != ep->send_next_id && rec.msg_count < UDP_MAX_RELIABLE_PER_PACKET; id++) {
+    UdpReliableMsg* m = &ep->send_q[id % UDP_RELIABLE_WINDOW];
+    if (!m->used || m->id != id) {
+      continue;
+    }
+    if (m->last_sent_ns && now_ns - m->last_sent_ns < UDP_RESEND_NS) {
+      continue;
+    }
+    size_t need = UDP_RELIABLE_PREFIX_SIZE + m->len;
+    if (out->len + need > UDP_MAX_PACKET) {
+      break;
+    }
+    uint8_t* prefix = out->reliable_prefix[rec.msg_count];
+    prefix[0] = UDP_CHANNEL_RELIABLE;
+    wire_put_u16(prefix + 1, id);
+    msg_hdr_write(prefix + 1 + sizeof(id), m->type, m->len);
+    out->iov[out->iov_count++] = (struct iovec){prefix, UDP_RELIABLE_PREFIX_SIZE};
+    out->iov[out->iov_count++] = (struct iovec){m->data, m->len};
+    out->len += need;
+    m->last_sent_ns = now_ns;
+    rec.msg_ids[rec.msg_count++] = id;
+  }
+
+  // latest-wins: whatever doesn't fit is superseded next tick anyway
+  int unreliable_count = 0;
+  size_t u_off = 0;
+  Frame fr;
+  int frame_size;
+  while ((frame_size = frame_try_parse(&fr, (uint8_t*)ep->unreliable.data + u_off,
+                                       ep->unreliable.size - u_off)) > 0) {
+    uint8_t* frame = (uint8_t*)ep->unreliable.data + u_off;
+    u_off += frame_size;
+    if (out->len + 1 + (size_t)frame_size > UDP_MAX_PACKET || out->iov_count + 2 > UDP_MAX_IOV) {
+      continue;
+    }
+    out->iov[out->iov_count++] = (struct iovec){(void*)&unreliable_channel, 1};
+    out->iov[out->iov_count++] = (struct iovec){frame, (size_t)frame_size};
+    out->len += 1 + frame_size;
+    unreliable_count++;
+  }
+
+  if (!rec.msg_count && !unreliable_count && !ep->ack_pending &&
+      now_ns - ep->last_send_ns < UDP_KEEPALIVE_NS) {
+    msg_buf_clear(&ep->unreliable);
+    return false;
+  }
+
+  UdpPacketHdr hdr = {.token = ep->token,
+                      .seq = ep->local_seq,
+                      .ack = ep->remote_seq,
+                      .ack_bits = ep->remote_ack_bits,
+                      .has_ack = ep->has_remote};
+  write_hdr(out->hdr, &hdr);
+  out->iov[0] = (struct iovec){out->hdr, UDP_PACKET_HDR_SIZE};
+  ep->sent[ep->local_seq % UDP_SENT_WINDOW] = rec;
+  ep->local_seq++;
+  ep->ack_pending = false;
+  ep->last_send_ns = now_ns;
+  return true;
+}
+
+void udp_packet_sent(UdpEndpoint* ep) { msg_buf_clear(&ep->unreliable); }
+
+void udp_packet_msghdr(UdpEndpoint* ep, UdpPacketOut* out, struct msghdr* msg) {
+  *msg = (struct msghdr){.msg_name = ep->addr_len ? &ep->addr : nullptr,
+                         .msg_namelen = ep->addr_len,
+                         .msg_iov = out->iov,
+                         .msg_iovlen = (size_t)out->iov_count};
+}
+
+ssize_t udp_flush(UdpEndpoint* ep, int fd, uint64_t now_ns) {
+  UdpPacketOut out;
+  if (!udp_prepare_packet(ep, now_ns, &out)) {
+    return 0;
+  }
+  struct msghdr msg;
+  udp_packet_msghdr(ep, &out, &msg);
+  ssize_t sent = sendmsg(fd, &msg, 0);
+  udp_packet_sent(ep);
+  return sent;
+}
+
+// @return false if seq was acked before or is too old to track
+static bool udp_ack_packet(UdpEndpoint* ep, uint16_t seq) {
+  UdpSentPacket* p = &ep->sent[seq % UDP_SENT_WINDOW];
+  if (!p->valid || p->seq != seq) {
+    return false;
+  }
+  p->valid = false;
+  for (int i = 0; i < p->msg_count; i++) {
+    UdpReliableMsg* m = &ep->send_q[p->msg_ids[i] % UDP_RELIABLE_WINDOW];
+    if (m->used && m->id == p->msg_ids[i]) {
+      m->used = false;
+    }
+  }
+  while (ep->send_oldest_id != ep->send_next_id &&
+         !ep->send_q[ep->send_oldest_id % UDP_RELIABLE_WINDOW].used) {
+    ep->send_oldest_id++;
+  }
+  return true;
+}
+
+// Records seq in the ack state. Returns false for duplicates and packets too old to track.
+static bool udp_track_remote_seq(UdpEndpoint* ep, uint16_t seq) {
+  if (!ep->has_remote || seq_greater(seq, ep->remote_seq)) {
+    if (ep->has_remote) {
+      uint16_t diff = seq - ep->remote_seq;
+      if (diff > 32) {
+        ep->remote_ack_bits = 0;
+      } else if (diff == 32) {
+        ep->remote_ack_bits = 1u << 31;
+      } else {
+        ep->remote_ack_bits = (ep->remote_ack_bits << diff) | (1u << (diff - 1));
+      }
+    }
+    ep->remote_seq = seq;
+    ep->has_remote = true;
+    return true;
+  }
+  uint16_t diff = ep->remote_seq - seq;
+  if (diff == 0 || diff > 32) {
+    return false;
+  }
+  uint32_t bit = 1u << (diff - 1);
+  if (ep->remote_ack_bits & bit) {
+    return false;
+  }
+  ep->remote_ack_bits |= bit;
+  return true;
+}
+
+int udp_on_packet(UdpEndpoint* ep, const uint8_t* data, size_t len, uint64_t now_ns,
+                  FrameFn on_frame, void* user_data) {
+  if (len < UDP_PACKET_HDR_SIZE) {
+    return -1;
+  }
+  UdpPacketHdr hdr;
+  read_hdr(data, &hdr);
+  if (hdr.token != ep->token) {
+    return -1;
+  }
+  bool newest = !ep->has_remote || seq_greater(hdr.seq, ep->remote_seq);
+  if (!udp_track_remote_seq(ep, hdr.seq)) {
+    return 0;
+  }
+  ep->ack_pending = true;
+  if (hdr.has_ack) {
+    // only the newest ack is timed, the bits repeat acks that may have been sent long ago. It
+    // includes however long the peer waited for its next packet.
+    uint64_t sent_ns = ep->sent[hdr.ack % UDP_SENT_WINDOW].sent_ns;
+    if (udp_ack_packet(ep, hdr.ack)) {
+      int64_t rtt = (int64_t)(now_ns - sent_ns);
+      ep->rtt_ns = ep->rtt_ns ? (uint64_t)((int64_t)ep->rtt_ns + (rtt - (int64_t)ep->rtt_ns) / 8)
+                              : (uint64_t)rtt;
+    }
+    for (int i = 0; i < 32; i++) {
+      if (hdr.ack_bits & (1u << i)) {
+        udp_ack_packet(ep, (uint16_t)(hdr.ack - 1 - i));
+      }
+    }
+  }
+
+  size_t off = UDP_PACKET_HDR_SIZE;
+  while (off < len) {
+    uint8_t channel = data[off++];
+    uint16_t id = 0;
+    if (channel == UDP_CHANNEL_RELIABLE) {
+      if (len - off < sizeof(id)) {
+        return -1;
+      }
+      id = wire_get_u16(data + off);
+      off += sizeof(id);
+    } else if (channel != UDP_CHANNEL_UNRELIABLE) {
+      return -1;
+    }
+    Frame fr;
+    int frame_size = frame_try_parse(&fr, (void*)(data + off), len - off);
+    if (frame_size <= 0) {
+      return -1;
+    }
+    off += frame_size;
+
+    if (channel == UDP_CHANNEL_RELIABLE) {
+      if (fr.hdr.len > UDP_RELIABLE_MAX_PAYLOAD) {
+        return -1;
+      }
+      if ((uint16_t)(id - ep->recv_next_id) >= UDP_RELIABLE_WINDOW) {
+        continue;  // already delivered
+      }
+      UdpReliableMsg* m = &ep->recv_q[id % UDP_RELIABLE_WINDOW];
+      if (!m->used) {
+        *m = (UdpReliableMsg){.used = true, .id = id, .type = fr.hdr.type, .len = fr.hdr.len};
+        memcpy(m->data, fr.payload, fr.hdr.len);
+      }
+      continue;
+    }
+
+    if (fr.hdr.type >= UDP_MAX_MSG_TYPES) {
+      continue;
+    }
+    uint32_t type_bit = 1u << fr.hdr.type;
+    if ((ep->unreliable_seen & type_bit) &&
+        seq_greater(ep->unreliable_last_seq[fr.hdr.type], hdr.seq)) {
+      continue;  // a newer packet already delivered this type
+    }
+    ep->unreliable_seen |= type_bit;
+    ep->unreliable_last_seq[fr.hdr.type] = hdr.seq;
+    if (!on_frame(&fr, user_data)) {
+      return newest;
+    }
+  }
+
+  for (;;) {
+    UdpReliableMsg* m = &ep->recv_q[ep->recv_next_id % UDP_RELIABLE_WINDOW];
+    if (!m->used || m->id != ep->recv_next_id) {
+      break;
+    }
+    m->used = false;
+    ep->recv_next_id++;
+    Frame fr = {.hdr = {.type = m->type, .len = m->len}, .payload = m->data};
+    if (!on_frame(&fr, user_data)) {
+      return newest;
+    }
+  }
+  return newest;
+}
+
+uint32_t udp_packet_token(const uint8_t* data, size_t len) {
+  if (len < UDP_PACKET_HDR_SIZE) {
+    return 0;
+  }
+  return wire_get_u32(data);
+}
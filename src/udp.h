@@ -0,0 +1,134 @@
+#ifndef PONG_GAME_UDP_H
+#define PONG_GAME_UDP_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "networking.h"
+
+// Datagram transport with two channels on top of one UDP socket:
+//  - reliable ordered: resent until the packet carrying it is acked, delivered in send order
+//  - unreliable latest-wins: sent once, dropped on receive if a newer packet already carried the
+//    same message type
+// Every packet carries the sender's sequence number plus an ack of the newest remote sequence
+// and a bitfield of the 32 before it, so acks ride along with regular traffic.
+
+#define UDP_MAX_PACKET 1200
+#define UDP_SENT_WINDOW 64
+#define UDP_RELIABLE_WINDOW 32
+#define UDP_RELIABLE_MAX_PAYLOAD 48
+#define UDP_MAX_RELIABLE_PER_PACKET 8
+#define UDP_MAX_MSG_TYPES 32
+#define UDP_RESEND_NS 100000000ull
+#define UDP_KEEPALIVE_NS 250000000ull
+
+enum { UDP_CHANNEL_RELIABLE, UDP_CHANNEL_UNRELIABLE };
+
+typedef struct UdpPacketHdr {
+  uint32_t token;  // identifies the connection, assigned by the server
+  uint16_t seq;
+  uint16_t ack;
+  uint32_t ack_bits;
+  uint8_t has_ack;  // false until the sender received anything, ack/ack_bits are then meaningless
+} UdpPacketHdr;
+
+// packed on the wire, no padding
+#define UDP_PACKET_HDR_SIZE 13
+// channel byte, message id, MsgHdr
+#define UDP_RELIABLE_PREFIX_SIZE (1 + 2 + MSG_HDR_SIZE)
+// packet header, prefix and payload per reliable message, then two per unreliable message
+#define UDP_MAX_IOV 48
+
+typedef struct UdpSentPacket {
+  bool valid;
+  uint16_t seq;
+  uint64_t sent_ns;
+  uint8_t msg_count;
+  uint16_t msg_ids[UDP_MAX_RELIABLE_PER_PACKET];
+} UdpSentPacket;
+
+typedef struct UdpReliableMsg {
+  bool used;
+  uint16_t id;
+  uint32_t type;
+  uint16_t len;
+  uint64_t last_sent_ns;
+  uint8_t data[UDP_RELIABLE_MAX_PAYLOAD];
+} UdpReliableMsg;
+
+typedef struct UdpEndpoint {
+  uint32_t token;
+  struct sockaddr_storage addr;
+  socklen_t addr_len;  // 0 until the peer address is known
+
+  uint16_t local_seq;
+  uint16_t remote_seq;
+  uint32_t remote_ack_bits;
+  bool has_remote;
+  bool ack_pending;
+  uint64_t last_send_ns;
+  uint64_t rtt_ns;  // smoothed round trip to the peer's ack, 0 until the first one
+  UdpSentPacket sent[UDP_SENT_WINDOW];
+
+  uint16_t send_next_id;
+  uint16_t send_oldest_id;
+  UdpReliableMsg send_q[UDP_RELIABLE_WINDOW];
+  uint16_t recv_next_id;
+  UdpReliableMsg recv_q[UDP_RELIABLE_WINDOW];
+
+  MsgBuffer unreliable;
+  uint32_t unreliable_seen;  // bit per msg type
+  uint16_t unreliable_last_seq[UDP_MAX_MSG_TYPES];
+} UdpEndpoint;
+
+void udp_endpoint_init(UdpEndpoint* ep, uint32_t token);
+void udp_endpoint_free(UdpEndpoint* ep);
+
+/**
+ * Queues a message on the reliable ordered channel.
+ * @return false if the window is full or the payload is too large
+ */
+bool udp_send_reliable(UdpEndpoint* ep, int type, const void* data, size_t len);
+void udp_send_unreliable(UdpEndpoint* ep, int type, const void* data, size_t len);
+
+// One outgoing packet gathered in place. The iovecs point into the endpoint's queues and into
+// hdr/reliable_prefix, nothing is copied into a packet buffer.
+typedef struct UdpPacketOut {
+  struct iovec iov[UDP_MAX_IOV];
+  int iov_count;
+  size_t len;
+  uint8_t hdr[UDP_PACKET_HDR_SIZE];
+  uint8_t reliable_prefix[UDP_MAX_RELIABLE_PER_PACKET][UDP_RELIABLE_PREFIX_SIZE];
+} UdpPacketOut;
+
+/**
+ * Gathers due reliable messages, queued unreliable messages and acks into out, as if it was sent.
+ * out stays valid until udp_packet_sent, which must follow before anything else is queued.
+ * @return false if there is nothing to send
+ */
+bool udp_prepare_packet(UdpEndpoint* ep, uint64_t now_ns, UdpPacketOut* out);
+void udp_packet_sent(UdpEndpoint* ep);
+
+// Fills msg to send out to ep, for sendmsg or as one entry of a sendmmsg batch.
+void udp_packet_msghdr(UdpEndpoint* ep, UdpPacketOut* out, struct msghdr* msg);
+
+/**
+ * Sends at most one packet with due reliable messages, all queued unreliable messages and acks.
+ * fd must be connected if ep->addr_len is 0.
+ * @return bytes sent, 0 if there was nothing to send, -1 on error
+ */
+ssize_t udp_flush(UdpEndpoint* ep, int fd, uint64_t now_ns);
+
+/**
+ * Processes acks in a received packet at now_ns and dispatches its messages in delivery order.
+ * @return 1 if its seq is the newest received so far, 0 if it's older or a duplicate, -1 if the
+ * packet is malformed
+ */
+int udp_on_packet(UdpEndpoint* ep, const uint8_t* data, size_t len, uint64_t now_ns,
+                  FrameFn on_frame, void* user_data);
+
+// Token of a received packet, used by the server to find the connection. 0 if too short.
+uint32_t udp_packet_token(const uint8_t* data, size_t len);
+
+#endif  // PONG_GAME_UDP_H
@@ -0,0 +1,309 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+// headers from before 6.0 lack multishot receive, such a build has no io_uring at all
+#ifdef IORING_RECV_MULTISHOT
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define URING_BUF_GROUP 0
+
+// head and tail words are shared with the kernel
+static inline unsigned load_acquire(const unsigned* p) {
+  return atomic_load_explicit((_Atomic unsigned*)p, memory_order_acquire);
+}
+
+static inline void store_release(unsigned* p, unsigned v) {
+  atomic_store_explicit((_Atomic unsigned*)p, v, memory_order_release);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  int n;
+  do {
+    n = (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+  } while (n < 0 && errno == EINTR);
+  return n;
+}
+
+static void buf_ring_add(Uring* r, uint16_t buf) {
+  // field by field, the first entry's resv is the ring's tail
+  struct io_uring_buf* b = &r->buf_ring->bufs[r->buf_tail & (r->buf_count - 1)];
+  b->addr = (uintptr_t)uring_buf(r, buf);
+  b->len = r->buf_size;
+  b->bid = buf;
+  r->buf_tail++;
+}
+
+static void buf_ring_publish(Uring* r) {
+  atomic_store_explicit((_Atomic uint16_t*)&r->buf_ring->tail, r->buf_tail,
+                        memory_order_release);
+}
+
+// Multishot receive is what needs 6.0, the registration alone is accepted from 5.19. A byte sent
+// over a socket pair must come back from a receive that stays armed.
+static bool uring_probe_multishot(Uring* r) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) == -1) {
+    return false;
+  }
+  bool ok = false;
+  if (write(sv[1], "", 1) == 1 && uring_recv_multishot(r, sv[0], 1) &&
+      uring_cancel(r, 1, 2) && uring_submit(r) == 2) {
+    bool recv_done = false;
+    bool cancel_done = false;
+    while (!recv_done || !cancel_done) {
+      UringCqe c;
+      if (!uring_next(r, &c)) {
+        if (sys_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+          break;
+        }
+        continue;
+      }
+      if (c.user_data == 2) {
+        cancel_done = true;
+        continue;
+      }
+      ok |= c.res == 1 && c.more;
+      recv_done = !c.more;
+      if (c.has_buf) {
+        uring_buf_return(r, c.buf);
+      }
+    }
+  }
+  close(sv[0]);
+  close(sv[1]);
+  return ok;
+}
+
+int uring_init(Uring* r, unsigned entries, unsigned buf_count, unsigned buf_size) {
+  *r = (Uring){.fd = -1};
+  // a tick's sends and the receives between two ticks must fit without spilling over
+  struct io_uring_params p = {.flags = IORING_SETUP_CQSIZE, .cq_entries = entries * 4};
+  r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0) {
+    return -1;
+  }
+  // mapped one by one, on kernels with IORING_FEAT_SINGLE_MMAP both rings are the same pages
+  r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sq_ring = mmap(nullptr, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    r->fd, IORING_OFF_SQ_RING);
+  r->cq_ring = mmap(nullptr, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    r->fd, IORING_OFF_CQ_RING);
+  r->sqes = mmap(nullptr, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                 IORING_OFF_SQES);
+  if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+    uring_free(r);
+    return -1;
+  }
+  uint8_t* sq = r->sq_ring;
+  uint8_t* cq = r->cq_ring;
+  r->sq_head = (unsigned*)(sq + p.sq_off.head);
+  r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+  r->sq_flags = (unsigned*)(sq + p.sq_off.flags);
+  r->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+  r->sq_entries = p.sq_entries;
+  r->sq_local = *r->sq_tail;
+  // slot i always holds sqe i, queueing only ever advances the tail
+  unsigned* sq_array = (unsigned*)(sq + p.sq_off.array);
+  for (unsigned i = 0; i < p.sq_entries; i++) {
+    sq_array[i] = i;
+  }
+  r->cq_head = (unsigned*)(cq + p.cq_off.head);
+  r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+  r->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+  if (buf_count == 0) {
+    return 0;
+  }
+
+  long page = sysconf(_SC_PAGESIZE);
+  r->buf_ring_size = (buf_count * sizeof(struct io_uring_buf) + page - 1) / page * page;
+  r->buf_ring = mmap(nullptr, r->buf_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  r->bufs = malloc((size_t)buf_count * buf_size);
+  if (r->buf_ring == MAP_FAILED || !r->bufs) {
+    if (r->buf_ring == MAP_FAILED) {
+      r->buf_ring = nullptr;
+    }
+    uring_free(r);
+    return -1;
+  }
+  struct io_uring_buf_reg reg = {
+      .ring_addr = (uintptr_t)r->buf_ring, .ring_entries = buf_count, .bgid = URING_BUF_GROUP};
+  if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    uring_free(r);
+    return -1;
+  }
+  r->buf_count = buf_count;
+  r->buf_size = buf_size;
+  for (unsigned i = 0; i < buf_count; i++) {
+    buf_ring_add(r, (uint16_t)i);
+  }
+  buf_ring_publish(r);
+  if (!uring_probe_multishot(r)) {
+    uring_free(r);
+    return -1;
+  }
+  return 0;
+}
+
+void uring_free(Uring* r) {
+  // closing the ring cancels whatever is still armed and drops the buffer registration
+  if (r->fd >= 0) close(r->fd);
+  if (r->sq_ring && r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_size);
+  if (r->cq_ring && r->cq_ring != MAP_FAILED) munmap(r->cq_ring, r->cq_ring_size);
+  if (r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_size);
+  if (r->buf_ring) munmap(r->buf_ring, r->buf_ring_size);
+  free(r->bufs);
+  *r = (Uring){.fd = -1};
+}
+
+static struct io_uring_sqe* uring_sqe(Uring* r) {
+  if (r->sq_local - load_acquire(r->sq_head) == r->sq_entries) {
+    // full, what is queued goes to the kernel to make room
+    if (uring_submit(r) < 0 || r->sq_local - load_acquire(r->sq_head) == r->sq_entries) {
+      return nullptr;
+    }
+  }
+  struct io_uring_sqe* sqe = &r->sqes[r->sq_local++ & r->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+bool uring_recv_multishot(Uring* r, int fd, uint64_t user_data) {
+  struct io_uring_sqe* sqe = uring_sqe(r);
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUF_GROUP;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool uring_accept_multishot(Uring* r, int fd, uint64_t user_data) {
+  struct io_uring_sqe* sqe = uring_sqe(r);
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool uring_sendmsg(Uring* r, int fd, const struct msghdr* msg, uint64_t user_data) {
+  struct io_uring_sqe* sqe = uring_sqe(r);
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)msg;
+  sqe->len = 1;
+  // completed with -EAGAIN right away instead of parked until the socket drains, so nothing the
+  // send points to is read after the submit
+  sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool uring_cancel(Uring* r, uint64_t target, uint64_t user_data) {
+  struct io_uring_sqe* sqe = uring_sqe(r);
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = user_data;
+  return true;
+}
+
+int uring_submit(Uring* r) {
+  store_release(r->sq_tail, r->sq_local);
+  unsigned pending = r->sq_local - load_acquire(r->sq_head);
+  if (pending == 0) {
+    return 0;
+  }
+  return sys_enter(r->fd, pending, 0, 0);
+}
+
+bool uring_next(Uring* r, UringCqe* out) {
+  unsigned head = *r->cq_head;
+  if (head == load_acquire(r->cq_tail)) {
+    // completions that didn't fit wait in the kernel until the ring is entered
+    if (!(load_acquire(r->sq_flags) & IORING_SQ_CQ_OVERFLOW) ||
+        sys_enter(r->fd, 0, 0, IORING_ENTER_GETEVENTS) < 0 || head == load_acquire(r->cq_tail)) {
+      return false;
+    }
+  }
+  const struct io_uring_cqe* c = &r->cqes[head & r->cq_mask];
+  *out = (UringCqe){.user_data = c->user_data,
+                    .res = c->res,
+                    .more = c->flags & IORING_CQE_F_MORE,
+                    .has_buf = c->flags & IORING_CQE_F_BUFFER,
+                    .buf = (uint16_t)(c->flags >> IORING_CQE_BUFFER_SHIFT)};
+  store_release(r->cq_head, head + 1);
+  return true;
+}
+
+void uring_buf_return(Uring* r, uint16_t buf) {
+  buf_ring_add(r, buf);
+  buf_ring_publish(r);
+}
+
+#else
+
+int uring_init(Uring* r, [[maybe_unused]] unsigned entries, [[maybe_unused]] unsigned buf_count,
+               [[maybe_unused]] unsigned buf_size) {
+  *r = (Uring){.fd = -1};
+  errno = ENOSYS;
+  return -1;
+}
+
+void uring_free(Uring* r) { *r = (Uring){.fd = -1}; }
+
+bool uring_recv_multishot([[maybe_unused]] Uring* r, [[maybe_unused]] int fd,
+                          [[maybe_unused]] uint64_t user_data) {
+  return false;
+}
+
+bool uring_accept_multishot([[maybe_unused]] Uring* r, [[maybe_unused]] int fd,
+                            [[maybe_unused]] uint64_t user_data) {
+  return false;
+}
+
+bool uring_sendmsg([[maybe_unused]] Uring* r, [[maybe_unused]] int fd,
+                   [[maybe_unused]] const struct msghdr* msg, [[maybe_unused]] uint64_t user_data) {
+  return false;
+}
+
+bool uring_cancel([[maybe_unused]] Uring* r, [[maybe_unused]] uint64_t target,
+                  [[maybe_unused]] uint64_t user_data) {
+  return false;
+}
+
+int uring_submit([[maybe_unused]] Uring* r) { return -1; }
+
+bool uring_next([[maybe_unused]] Uring* r, [[maybe_unused]] UringCqe* out) { return false; }
+
+void uring_buf_return([[maybe_unused]] Uring* r, [[maybe_unused]] uint16_t buf) {}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef PONG_GAME_URING_H
+#define PONG_GAME_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// io_uring on the raw syscalls, just what the server's transport needs. Requests are queued into
+// the submission ring with plain stores and go to the kernel together on uring_submit, one
+// io_uring_enter for however many there are. Completions are read straight out of the mapped
+// completion ring without a syscall.
+//
+// Receives are multishot: one request keeps completing for as long as the connection is open,
+// each time into a buffer the kernel picks from a ring of buffers registered up front. The
+// buffer is handed back with uring_buf_return once its bytes are parsed.
+//
+// Kernels without io_uring, provided buffer rings or multishot receive (before 6.0) fail
+// uring_init, and callers stay on epoll.
+
+typedef struct UringCqe {
+  uint64_t user_data;
+  int32_t res;   // bytes, a new fd, or -errno
+  bool more;     // the request stays armed and completes again
+  bool has_buf;  // res bytes were received into buffer buf
+  uint16_t buf;
+} UringCqe;
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+typedef struct Uring {
+  int fd;  // -1 when not set up, the ring is readable in epoll while completions are waiting
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_flags;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_local;  // sq_tail with the requests queued since the last submit
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+  struct io_uring_buf_ring* buf_ring;
+  size_t buf_ring_size;
+  uint8_t* bufs;
+  unsigned buf_count;
+  unsigned buf_size;
+  uint16_t buf_tail;
+} Uring;
+
+/**
+ * entries requests may be queued between submits, buf_count buffers of buf_size bytes are
+ * provided to multishot receives, 0 for none. entries and buf_count are powers of two.
+ * @return 0, -1 if the kernel lacks support or on error
+ */
+int uring_init(Uring* r, unsigned entries, unsigned buf_count, unsigned buf_size);
+void uring_free(Uring* r);
+
+// Each queues one request, submitting whatever is already queued first if the ring is full.
+// They return false if nothing could be queued.
+
+/** Completes with every read on fd into a provided buffer, until EOF, an error or a cancel. */
+bool uring_recv_multishot(Uring* r, int fd, uint64_t user_data);
+
+/** Completes with every accepted connection, non-blocking and close-on-exec. */
+bool uring_accept_multishot(Uring* r, int fd, uint64_t user_data);
+
+/**
+ * Never waits for socket space, a full socket completes with -EAGAIN. msg and what it points to
+ * are read by the submit, they may go once it returns.
+ */
+bool uring_sendmsg(Uring* r, int fd, const struct msghdr* msg, uint64_t user_data);
+
+/** Cancels the requests queued with user_data target. */
+bool uring_cancel(Uring* r, uint64_t target, uint64_t user_data);
+
+/**
+ * Hands everything queued to the kernel with one io_uring_enter. Sends complete before it
+ * returns.
+ * @return requests submitted, -1 on error
+ */
+int uring_submit(Uring* r);
+
+/** Takes the next completion, false if there is none. */
+bool uring_next(Uring* r, UringCqe* out);
+
+static inline uint8_t* uring_buf(const Uring* r, uint16_t buf) {
+  return r->bufs + (size_t)buf * r->buf_size;
+}
+
+/** Provides buffer buf to receives again, its bytes must not be used anymore. */
+void uring_buf_return(Uring* r, uint16_t buf);
+
+#endif  // PONG_GAME_URING_H